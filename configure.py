@@ -3,9 +3,10 @@
 import argparse
 import os
 import shutil
+import subprocess
 import sys
 from pathlib import Path
-from typing import Dict, List, Set, Union
+from typing import Dict, List, Optional, Set, Union
 
 import ninja_syntax
 import requests
@@ -16,13 +17,27 @@ from splat.segtypes.linker_entry import LinkerEntry
 ROOT = Path(__file__).parent.relative_to(os.getcwd())
 TOOLS_DIR = ROOT / "tools"
 
+sys.path.append(str(TOOLS_DIR))
+import build_trace
+import objcache
+import segment_link
+import split_incremental
+import sprite_format
+
 YAML_FILE = "splat.yaml"
+EXTRACT_MANIFEST = ".splat_extract.json"
 BASENAME = "pokemonsnap"
 LD_PATH = f"{BASENAME}.ld"
+SEGMENT_LD_PATH = f"build/{BASENAME}.seg.ld"
+SEGMENTS_DIR = "build/segments"
 MAP_PATH = f"build/{BASENAME}.map"
 ELF_PATH = f"build/{BASENAME}.elf"
 Z64_PATH = f"build/{BASENAME}.z64"
 OK_PATH = f"build/{BASENAME}.ok"
+ROM_MANIFEST_PATH = f"build/{BASENAME}.manifest.json"
+SYMDB_PATH = f"build/{BASENAME}.symdb"
+SYMBOL_ADDRS_PATH = "tools/symbol_addrs.txt"
+BASEROM_PATH = f"{BASENAME}.z64"
 
 COMMON_INCLUDES = "-I include -I ultralib/include -I ultralib/include/ido -I ultralib/include/PR -I ultralib/src"
 IDO_DEFS = "-DF3DEX_GBI_2 -D_LANGUAGE_C -DNDEBUG -D_FINALROM"
@@ -39,16 +54,34 @@ IDO_53_CC = TOOLS_DIR / "ido5.3" / "cc"
 
 O32_TOOL = ROOT / "ultralib/tools/set_o32abi_bit.py"
 
-GAME_CC_CMD = f"python3 tools/asm_processor/build.py {IDO_72_CC} -- {CROSS_AS} {AS_FLAGS} -- -G 0 -non_shared -fullwarn -verbose -Xcpluscomm -nostdinc -Wab,-r4300_mul -O2 -mips2 {COMMON_INCLUDES} {IDO_DEFS} -DBUILD_VERSION=VERSION_I -c -o $out $in"
+ASM_PROCESSOR = "python3 tools/asm_processor/build.py"
+ASM_PROCESSOR_SERVER = "python3 tools/asm_processor/compile_server.py"
+
+ASM_CACHE_DIR = "build/asm_cache"
+
+SPRITE_PACK = TOOLS_DIR / "sprite_pack.py"
+SPRITE_PACK_SOURCES = [SPRITE_PACK, *sprite_format.CODEC_SOURCES]
+
+GAME_CC_CMD = f"$asm_processor --asm-cache={ASM_CACHE_DIR} --depfile=$out.d $obj_cache_flags $timing_flags {IDO_72_CC} -- {CROSS_AS} {AS_FLAGS} -- -G 0 -non_shared -fullwarn -verbose -Xcpluscomm -nostdinc -Wab,-r4300_mul -O2 -mips2 {COMMON_INCLUDES} {IDO_DEFS} -DBUILD_VERSION=VERSION_I -c -o $out $in"
 
-LIBULTRA_CC_CMD = f"$ido -G 0 -non_shared -fullwarn -verbose -Wab,-r4300_mul -woff 513,516,649,838,712 -Xcpluscomm -nostdinc $flags {COMMON_INCLUDES} {IDO_DEFS} -DBUILD_VERSION=$libultra -c -o $out $in && {O32_TOOL} $out"
+LIBULTRA_CC_FLAGS = f"-G 0 -non_shared -fullwarn -verbose -Wab,-r4300_mul -woff 513,516,649,838,712 -Xcpluscomm -nostdinc $flags {COMMON_INCLUDES} {IDO_DEFS} -DBUILD_VERSION=$libultra"
+
+LIBULTRA_CC_CMD = f"$ido {LIBULTRA_CC_FLAGS} -MDupdate $out.d -c -o $out $in && {O32_TOOL} $out"
+
+# With --obj-cache, through the cache wrapper, which writes the depfile itself
+LIBULTRA_CC_CACHED_CMD = f"python3 {TOOLS_DIR / 'objcache.py'} --depfile=$out.d $objcache_flags -- $ido {LIBULTRA_CC_FLAGS} -c -o $out $in && {O32_TOOL} $out"
 
 LIBULTRA_AS_CMD = f"{IDO_53_CC} -G 0 -non_shared -fullwarn -verbose -Wab,-r4300_mul -woff 513,516,649,838,712 $flags {COMMON_INCLUDES} -D_FINALROM -DBUILD_VERSION=VERSION_I -c -o $out $in && {O32_TOOL} $out && {CROSS_STRIP} $out -N asdasdasdasd"
 
 
 def clean():
+    # The compile server keeps its socket in build/, stop it before removing that
+    subprocess.run([*ASM_PROCESSOR_SERVER.split(), "--shutdown"])
+
     if os.path.exists(".splache"):
         os.remove(".splache")
+    if os.path.exists(EXTRACT_MANIFEST):
+        os.remove(EXTRACT_MANIFEST)
     shutil.rmtree("asm", ignore_errors=True)
     shutil.rmtree("assets", ignore_errors=True)
     shutil.rmtree("build", ignore_errors=True)
@@ -123,7 +156,14 @@ NULL = "int"
         )
 
 
-def create_build_script(linker_entries: List[LinkerEntry]):
+def create_build_script(
+    linker_entries: List[LinkerEntry],
+    compile_server: bool,
+    obj_cache: Optional[Path],
+    segment_link_mode: bool,
+    sprite_pack: bool,
+    timings: Optional[Path],
+):
     built_objects: Set[Path] = set()
 
     def build(
@@ -151,6 +191,16 @@ def create_build_script(linker_entries: List[LinkerEntry]):
 
     ninja = ninja_syntax.Writer(open(str(ROOT / "build.ninja"), "w"), width=9999)
 
+    ninja.variable(
+        "asm_processor", ASM_PROCESSOR_SERVER if compile_server else ASM_PROCESSOR
+    )
+    if obj_cache is not None:
+        ninja.variable("obj_cache_flags", f"--obj-cache={obj_cache}")
+        ninja.variable("objcache_flags", f"--cache-dir={obj_cache}")
+    if timings is not None:
+        ninja.variable("timing_flags", f"--timings={timings}")
+    ninja.newline()
+
     # Rules
     ninja.rule(
         "bin",
@@ -158,10 +208,21 @@ def create_build_script(linker_entries: List[LinkerEntry]):
         command=f"{CROSS_LD} -r -b binary $in -o $out",
     )
 
+    # With --sprite-pack, sprite PNGs are packed back into their segment's
+    # bytes, then go through the bin rule
+    ninja.rule(
+        "sprite",
+        description="sprite $in",
+        command=f"python3 {SPRITE_PACK} $in $out",
+        restat=True,
+    )
+
     ninja.rule(
         "as",
         description="as $in",
-        command=f"cpp {COMMON_INCLUDES} $in -o - | {CROSS}as -G0 {COMMON_INCLUDES} -EB -mtune=vr4300 -march=vr4300 -o $out",
+        command=f"cpp -MMD -MF $out.d -MT $out {COMMON_INCLUDES} $in -o - | {CROSS}as -G0 {COMMON_INCLUDES} -EB -mtune=vr4300 -march=vr4300 -o $out",
+        depfile="$out.d",
+        deps="gcc",
     )
 
     ninja.rule(
@@ -174,12 +235,16 @@ def create_build_script(linker_entries: List[LinkerEntry]):
         "cc",
         description="cc $in",
         command=f"{GAME_CC_CMD}",
+        depfile="$out.d",
+        deps="gcc",
     )
 
     ninja.rule(
         "cc_libultra",
         description="cc $in",
-        command=f"{LIBULTRA_CC_CMD}",
+        command=f"{LIBULTRA_CC_CACHED_CMD if obj_cache is not None else LIBULTRA_CC_CMD}",
+        depfile="$out.d",
+        deps="gcc",
     )
 
     ninja.rule(
@@ -188,10 +253,32 @@ def create_build_script(linker_entries: List[LinkerEntry]):
         command=f"{CROSS}ld -T undefined_syms.txt -T undefined_syms_auto.txt -T undefined_funcs.txt -T undefined_funcs_auto.txt -Map $mapfile -T $in -o $out",
     )
 
+    # Only replace the output when its contents changed, so restat can prune
+    # the final link when a rebuilt object didn't change its segment.
+    ninja.rule(
+        "ld_partial",
+        description="link $out",
+        command=f"{CROSS_LD} -r $ldflags -T $script -o $out.tmp $in && (cmp -s $out.tmp $out && rm $out.tmp || mv $out.tmp $out)",
+        restat=True,
+    )
+
+    # On a mismatch, narrow it down to the segments and objects that differ
     ninja.rule(
         "sha1sum",
         description="sha1sum $in",
-        command="sha1sum -c $in && touch $out",
+        command=f"sha1sum -c $in && touch $out || (python3 {TOOLS_DIR / 'rom_manifest.py'} verify $mapfile {Z64_PATH} {BASEROM_PATH} --manifest {ROM_MANIFEST_PATH}; false)",
+    )
+
+    ninja.rule(
+        "rom_manifest",
+        description="rom manifest $out",
+        command=f"python3 {TOOLS_DIR / 'rom_manifest.py'} build $mapfile $in $out",
+    )
+
+    ninja.rule(
+        "symdb",
+        description="symbol database $out",
+        command=f"python3 {TOOLS_DIR / 'symdb.py'} build $in -o $out --symbol-addrs {SYMBOL_ADDRS_PATH}",
     )
 
     ninja.rule(
@@ -310,17 +397,64 @@ def create_build_script(linker_entries: List[LinkerEntry]):
             build(entry.object_path, entry.src_paths, "as")
         elif isinstance(seg, splat.segtypes.common.bin.CommonSegBin):
             build(entry.object_path, entry.src_paths, "bin")
+        elif seg.type == "snap_sprite":
+            png_path = entry.src_paths[0]
+            if sprite_pack:
+                packed = entry.object_path.with_suffix(".bin")
+                # Sprites in formats snap_sprite can't decode only have a layout
+                implicit = [str(png_path)] if png_path.exists() else []
+                ninja.build(
+                    str(packed),
+                    "sprite",
+                    str(sprite_format.layout_path(png_path)),
+                    implicit=implicit + [str(p) for p in SPRITE_PACK_SOURCES],
+                )
+                build(entry.object_path, [packed], "bin")
+            else:
+                # The segment's ROM bytes, as the split wrote them
+                build(entry.object_path, [sprite_format.raw_path(png_path)], "bin")
         else:
             print(f"ERROR: Unsupported build segment type {seg.type}")
             sys.exit(1)
 
-    ninja.build(
-        ELF_PATH,
-        "ld",
-        LD_PATH,
-        implicit=[str(obj) for obj in built_objects],
-        variables={"mapfile": MAP_PATH},
-    )
+    if segment_link_mode:
+        # Link each segment into its own relocatable blob first, so editing
+        # one file only relinks that segment before the final stitch.
+        plans = segment_link.plan(Path(LD_PATH), Path(SEGMENT_LD_PATH), Path(SEGMENTS_DIR))
+        grouped: Set[str] = set()
+        blobs = []
+        for name, seg_plan in plans.items():
+            blob = f"{SEGMENTS_DIR}/{name}.o"
+            ninja.build(
+                blob,
+                "ld_partial",
+                seg_plan.objects,
+                implicit=[f"{SEGMENTS_DIR}/{name}.ld"],
+                variables={
+                    "script": f"{SEGMENTS_DIR}/{name}.ld",
+                    "ldflags": "-d" if seg_plan.allocate_common else "",
+                },
+            )
+            grouped.update(seg_plan.objects)
+            blobs.append(blob)
+
+        ninja.build(
+            ELF_PATH,
+            "ld",
+            SEGMENT_LD_PATH,
+            implicit=blobs + [str(obj) for obj in built_objects if str(obj) not in grouped],
+            implicit_outputs=[MAP_PATH],
+            variables={"mapfile": MAP_PATH},
+        )
+    else:
+        ninja.build(
+            ELF_PATH,
+            "ld",
+            LD_PATH,
+            implicit=[str(obj) for obj in built_objects],
+            implicit_outputs=[MAP_PATH],
+            variables={"mapfile": MAP_PATH},
+        )
 
     ninja.build(
         Z64_PATH,
@@ -333,8 +467,32 @@ def create_build_script(linker_entries: List[LinkerEntry]):
         "sha1sum",
         "checksum.sha1",
         implicit=[Z64_PATH],
+        variables={"mapfile": MAP_PATH},
     )
 
+    ninja.build(
+        SYMDB_PATH,
+        "symdb",
+        MAP_PATH,
+        implicit=[SYMBOL_ADDRS_PATH],
+    )
+
+    # Only built by default with --segment-link, which reports the segments
+    # that changed from it: hashing every range reads the whole ROM again on
+    # every link, on top of the sha1sum check
+    ninja.build(
+        ROM_MANIFEST_PATH,
+        "rom_manifest",
+        Z64_PATH,
+        implicit=[MAP_PATH],
+        variables={"mapfile": MAP_PATH},
+    )
+
+    defaults = [OK_PATH, SYMDB_PATH]
+    if segment_link_mode:
+        defaults.append(ROM_MANIFEST_PATH)
+    ninja.default(defaults)
+
 
 def graph_segments():
     import pandas as pd
@@ -385,6 +543,43 @@ if __name__ == "__main__":
         help="Download and extract IDO compiler",
         action="store_true",
     )
+    parser.add_argument(
+        "--no-compile-server",
+        help="Run asm_processor in a fresh process for every C file instead of using the compile server",
+        action="store_true",
+    )
+    parser.add_argument(
+        "-j",
+        "--jobs",
+        help="Number of processes to extract assets with (default: number of CPUs)",
+        type=int,
+    )
+    parser.add_argument(
+        "--segment-link",
+        help="Partially link each segment on its own and only stitch segments together in the final link",
+        action="store_true",
+    )
+    parser.add_argument(
+        "--sprite-pack",
+        help="Build sprites from their PNGs instead of their ROM bytes (check with tools/sprite_pack.py --check first)",
+        action="store_true",
+    )
+    parser.add_argument(
+        "--obj-cache",
+        help="Cache compiled objects, shared between checkouts (default location: %(const)s)",
+        nargs="?",
+        const=objcache.default_cache_dir(),
+        type=Path,
+        metavar="DIR",
+    )
+    parser.add_argument(
+        "--timings",
+        help="Record how long splat and each phase of every C compile take, for tools/build_trace.py (default location: %(const)s)",
+        nargs="?",
+        const=Path(build_trace.DEFAULT_TIMINGS_DIR),
+        type=Path,
+        metavar="DIR",
+    )
     args = parser.parse_args()
 
     if args.clean:
@@ -394,12 +589,29 @@ if __name__ == "__main__":
         setup()
         sys.exit(0)
 
-    split.main([YAML_FILE], modes="all", verbose=False)
+    # Only re-extract asset segments whose ROM bytes or YAML entry changed,
+    # and do those in parallel once splat is done with everything else.
+    timer = build_trace.PhaseTimer()
+    split_incremental.install(Path(EXTRACT_MANIFEST))
+    with timer.phase("splat"):
+        split.main([YAML_FILE], modes="all", verbose=False)
+    with timer.phase("extract assets"):
+        split_incremental.finish(args.jobs)
 
     linker_entries = split.linker_writer.entries
 
     # graph_segments()
 
-    create_build_script(linker_entries)
+    timings = args.timings.resolve() if args.timings else None
+    with timer.phase("build.ninja"):
+        create_build_script(
+            linker_entries,
+            compile_server=not args.no_compile_server and os.name != "nt",
+            obj_cache=args.obj_cache.resolve() if args.obj_cache else None,
+            segment_link_mode=args.segment_link,
+            sprite_pack=args.sprite_pack,
+            timings=timings,
+        )
 
     write_permuter_settings()
+    timer.write(timings, "configure")
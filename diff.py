@@ -69,6 +69,7 @@ if __name__ == "__main__":
 
     start_argument = parser.add_argument(
         "start",
+        nargs="?",
         help="Function name or address to start diffing from.",
     )
 
@@ -285,6 +286,16 @@ if __name__ == "__main__":
         help="""Automatically update when source/object files change.
         Recommended in combination with -m.""",
     )
+    parser.add_argument(
+        "-W",
+        "--watch-incremental",
+        dest="watch_incremental",
+        action="store_true",
+        help="""Like -w -m, but on each change only rebuild the function's object
+        file, and relocate and disassemble it in-process against the last full
+        link's map instead of relinking the ROM. MIPS binary diffs only. Run a
+        full build now and then, e.g. after changing other files.""",
+    )
     parser.add_argument(
         "-y",
         "--yes",
@@ -339,9 +350,11 @@ if __name__ == "__main__":
         "--algorithm",
         dest="algorithm",
         default="levenshtein",
-        choices=["levenshtein", "difflib"],
+        choices=["levenshtein", "difflib", "myers"],
         help="""Diff algorithm to use. Levenshtein gives the minimum diff, while difflib
-        aims for long sections of equal opcodes. Defaults to %(default)s.""",
+        aims for long sections of equal opcodes. Myers gives a minimal diff without
+        substitutions, using a native backend that stays fast on very large
+        functions. Defaults to %(default)s.""",
     )
     parser.add_argument(
         "--max-size",
@@ -383,6 +396,30 @@ if __name__ == "__main__":
         help="""Compress streaks of lines with same instructions (but possibly
         different regalloc), leaving N lines of context around other parts.""",
     )
+    parser.add_argument(
+        "--batch",
+        metavar="LIST",
+        nargs="?",
+        const="",
+        dest="batch",
+        help="""Instead of diffing one function, score every function in the map
+        file (or, if LIST is given, every function in the objects listed in it,
+        one path per line) and write a JSON report. Compares against the base
+        image, or against expected/ objects with -o.""",
+    )
+    parser.add_argument(
+        "--batch-report",
+        metavar="FILE",
+        dest="batch_report",
+        help="Where to write the --batch report. Defaults to diff_report.json in the build directory.",
+    )
+    parser.add_argument(
+        "--batch-jobs",
+        metavar="N",
+        dest="batch_jobs",
+        type=int,
+        help="Number of worker processes for --batch. Defaults to the number of CPUs.",
+    )
 
     # Project-specific flags, e.g. different versions/make arguments.
     add_custom_arguments_fn = getattr(diff_settings, "add_custom_arguments", None)
@@ -400,6 +437,7 @@ import abc
 from collections import Counter, defaultdict
 from dataclasses import asdict, dataclass, field, replace
 import difflib
+import hashlib
 import html
 import itertools
 import json
@@ -409,6 +447,7 @@ import re
 import string
 import struct
 import subprocess
+import tempfile
 import threading
 import time
 import traceback
@@ -1088,6 +1127,14 @@ def eval_line_num(expr: str) -> Optional[int]:
     return int(expr, 16)
 
 
+def import_tool(name: str) -> Any:
+    """Import one of the project's helper modules from tools/."""
+    tools_dir = os.path.join(os.path.dirname(os.path.abspath(__file__)), "tools")
+    if tools_dir not in sys.path:
+        sys.path.insert(0, tools_dir)
+    return __import__(name)
+
+
 def run_make(target: str, project: ProjectSettings) -> None:
     subprocess.check_call(project.build_command + [target])
 
@@ -1137,8 +1184,21 @@ def maybe_get_objdump_source_flags(config: Config) -> List[str]:
 
 def run_objdump(cmd: ObjdumpCommand, config: Config, project: ProjectSettings) -> str:
     flags, target, restrict = cmd
+    out = run_objdump_raw(flags, target, config, project)
+
+    obj_data: Optional[bytes] = None
+    if config.diff_obj:
+        with open(target, "rb") as f:
+            obj_data = f.read()
+
+    return preprocess_objdump_out(restrict, obj_data, out, config)
+
+
+def run_objdump_raw(
+    flags: List[str], target: str, config: Config, project: ProjectSettings
+) -> str:
     try:
-        out = subprocess.run(
+        return subprocess.run(
             [project.objdump_executable]
             + config.arch.arch_flags
             + project.objdump_flags
@@ -1156,13 +1216,6 @@ def run_objdump(cmd: ObjdumpCommand, config: Config, project: ProjectSettings) -
             fail("** Try using --source-old-binutils instead of --source **")
         raise e
 
-    obj_data: Optional[bytes] = None
-    if config.diff_obj:
-        with open(target, "rb") as f:
-            obj_data = f.read()
-
-    return preprocess_objdump_out(restrict, obj_data, out, config)
-
 
 def preprocess_objdump_out(
     restrict: Optional[str], obj_data: Optional[bytes], objdump_out: str, config: Config
@@ -1218,45 +1271,38 @@ def search_map_file(
     if not project.mapfile:
         fail(f"No map file configured; cannot find function {fn_name}.")
 
-    try:
-        with open(
-            project.mapfile,
-            encoding=MAPFILE_ENCODING,
-            errors=MAPFILE_ENCODING_ERROR_HANDLER,
-        ) as f:
-            contents = f.read()
-    except Exception:
-        fail(f"Failed to open map file {project.mapfile} for reading.")
-
+    # GNU maps are read through their symbol database instead
     if project.map_format == "gnu":
-        if for_binary and "load address" not in contents:
-            fail(
-                'Failed to find "load address" in map file. Maybe you need to add\n'
-                '"export LANG := C" to your Makefile to avoid localized output?'
-            )
-
-        lines = contents.split("\n")
+        if not os.path.isfile(project.mapfile):
+            fail(f"Failed to open map file {project.mapfile} for reading.")
+    else:
+        try:
+            with open(
+                project.mapfile,
+                encoding=MAPFILE_ENCODING,
+                errors=MAPFILE_ENCODING_ERROR_HANDLER,
+            ) as f:
+                contents = f.read()
+        except Exception:
+            fail(f"Failed to open map file {project.mapfile} for reading.")
 
+    if project.map_format == "gnu":
+        # One indexed query on the map's symbol database. It's rebuilt first
+        # if the map changed since it was written.
+        symdb = import_tool("symdb")
         try:
-            cur_objfile = None
-            ram_to_rom = None
-            cands = []
-            last_line = ""
-            for line in lines:
-                if line.startswith(" " + config.diff_section):
-                    cur_objfile = line.split()[3]
-                if "load address" in line:
-                    tokens = last_line.split() + line.split()
-                    ram = int(tokens[1], 0)
-                    rom = int(tokens[5], 0)
-                    ram_to_rom = rom - ram
-                if line.endswith(" " + fn_name) or f" {fn_name} = 0x" in line:
-                    ram = int(line.split()[0], 0)
-                    if (for_binary and ram_to_rom is not None) or (
-                        not for_binary and cur_objfile is not None
-                    ):
-                        cands.append((cur_objfile, ram + (ram_to_rom or 0)))
-                last_line = line
+            with symdb.SymbolDB(project.mapfile) as db:
+                if for_binary and db.meta("has_load_addresses") != "1":
+                    fail(
+                        'Failed to find "load address" in map file. Maybe you need to add\n'
+                        '"export LANG := C" to your Makefile to avoid localized output?'
+                    )
+                cands = []
+                for sym in db.lookup(fn_name):
+                    if for_binary and sym.rom is not None:
+                        cands.append((sym.object, sym.rom))
+                    elif not for_binary and sym.object is not None:
+                        cands.append((sym.object, sym.rom if sym.rom is not None else sym.vram))
         except Exception as e:
             traceback.print_exc()
             fail(f"Internal error while parsing map file")
@@ -1540,6 +1586,31 @@ def dump_objfile(
     )
 
 
+def dump_incremental(
+    start: str, end: Optional[str], config: Config, project: ProjectSettings
+) -> Tuple[str, Any]:
+    if config.arch.name not in MIPS_ARCH_NAMES or not config.arch.big_endian:
+        fail("-W only supports big-endian MIPS")
+    if config.base_shift:
+        fail("--base-shift not compatible with -W")
+    if end is not None:
+        fail("end address not supported together with -W")
+    if maybe_eval_int(start) is not None:
+        fail("numerical start address not supported with -W; pass a function name")
+    if not project.baseimg or not project.mapfile or project.map_format != "gnu":
+        fail("-W needs baseimg and a GNU ld mapfile in the config.")
+
+    objfile, _ = search_map_file(start, project, config, for_binary=False)
+    if not objfile:
+        fail("Not able to find .o file for function.")
+    run_make(objfile, project)
+
+    objdisasm = import_tool("objdisasm")
+    return objfile, objdisasm.FunctionTarget(
+        project.mapfile, objfile, start, project.baseimg
+    )
+
+
 def dump_binary(
     start: str, end: Optional[str], config: Config, project: ProjectSettings
 ) -> Tuple[str, ObjdumpCommand, ObjdumpCommand]:
@@ -2826,6 +2897,10 @@ def diff_sequences_difflib(
 def diff_sequences(
     seq1: List[str], seq2: List[str], algorithm: str
 ) -> List[Tuple[str, int, int, int, int]]:
+    if algorithm == "myers":
+        myers = import_tool("myers")
+        ret: List[Tuple[str, int, int, int, int]] = myers.opcodes(seq1, seq2)
+        return ret
     if algorithm != "levenshtein":
         return diff_sequences_difflib(seq1, seq2)
 
@@ -2854,8 +2929,8 @@ def diff_sequences(
 
     import Levenshtein
 
-    ret: List[Tuple[str, int, int, int, int]] = Levenshtein.opcodes(rem1, rem2)
-    return ret
+    lev_ret: List[Tuple[str, int, int, int, int]] = Levenshtein.opcodes(rem1, rem2)
+    return lev_ret
 
 
 def diff_lines(
@@ -3696,8 +3771,307 @@ class Display:
         self.ready_queue.get()
 
 
+# ==== BATCH ====
+
+
+@dataclass
+class BatchTask:
+    objfile: str
+    # Binary mode: the object's ROM range, and (name, start, end) ROM ranges of
+    # its functions. Object mode: just the function names to keep (if any).
+    rom_range: Optional[Tuple[int, int]]
+    functions: List[Tuple[str, int, int]]
+
+
+class ObjdumpCache:
+    """On-disk cache of raw objdump output, with one entry per target (and
+    address range, and flags), which is replaced when the target changes, so
+    the cache never holds more than one dump of anything. Whole files are
+    checked by their size and mtime. Address ranges of an image are checked by
+    the bytes in the range instead, since the image is relinked on every
+    build."""
+
+    def __init__(self, path: str, config: Config, project: ProjectSettings) -> None:
+        self.path = path
+        self.config = config
+        self.project = project
+        os.makedirs(path, exist_ok=True)
+
+    def run(self, flags: List[str], target: str, data_id: str) -> str:
+        h = hashlib.sha256()
+        h.update(
+            json.dumps(
+                [
+                    self.project.objdump_executable,
+                    self.config.arch.arch_flags,
+                    self.project.objdump_flags,
+                    flags,
+                    os.path.abspath(target),
+                ]
+            ).encode()
+        )
+        entry = os.path.join(self.path, h.hexdigest() + ".txt")
+        # The first line says what the dump was made from
+        try:
+            with open(entry) as f:
+                if f.readline() == data_id + "\n":
+                    return f.read()
+        except OSError:
+            pass
+        out = run_objdump_raw(flags, target, self.config, self.project)
+        fd, tmp_name = tempfile.mkstemp(dir=self.path, suffix=".tmp")
+        with os.fdopen(fd, "w") as f:
+            f.write(data_id + "\n")
+            f.write(out)
+        os.replace(tmp_name, entry)
+        return out
+
+    def run_file(self, flags: List[str], target: str) -> str:
+        st = os.stat(target)
+        return self.run(flags, target, f"{st.st_size}:{st.st_mtime_ns}")
+
+    def run_range(self, flags: List[str], target: str, start: int, end: int) -> str:
+        with open(target, "rb") as f:
+            f.seek(start)
+            data_id = hashlib.sha1(f.read(end - start)).hexdigest()
+        flags = flags + [f"--start-address={start}", f"--stop-address={end}"]
+        return self.run(flags, target, data_id)
+
+
+def split_dump_by_address(
+    dump: str, functions: List[Tuple[str, int, int]]
+) -> Dict[str, str]:
+    """Split a binary-mode dump into one dump per (name, start, end) range."""
+    lines: Dict[str, List[str]] = {name: [] for name, _, _ in functions}
+    bounds = sorted((start, end, name) for name, start, end in functions)
+    i = 0
+    cur: Optional[List[str]] = None
+    for row in dump.split("\n"):
+        m = re.match(r"^\s*([0-9a-f]+):", row)
+        if m:
+            addr = int(m.group(1), 16)
+            while i < len(bounds) and bounds[i][1] <= addr:
+                i += 1
+            if i < len(bounds) and bounds[i][0] <= addr:
+                cur = lines[bounds[i][2]]
+            else:
+                cur = None
+        if cur is not None:
+            cur.append(row)
+    return {name: "\n".join(rows) for name, rows in lines.items()}
+
+
+def split_dump_by_symbol(dump: str, prefix: str) -> Dict[str, str]:
+    """Split an object dump at its `<symbol>:` headers, keeping what follows
+    each header, like restrict_to_function does."""
+    ret: Dict[str, List[str]] = {}
+    cur: Optional[List[str]] = None
+    for row in dump.split("\n"):
+        m = re.match(r"^[0-9a-f]+ <(.*)>:$", row)
+        if m:
+            cur = ret.setdefault(m.group(1), [])
+        elif cur is not None:
+            cur.append(row)
+    return {name: prefix + "\n".join(rows) for name, rows in ret.items()}
+
+
+def batch_dumps(
+    task: BatchTask, cache: ObjdumpCache, config: Config, project: ProjectSettings
+) -> Tuple[Dict[str, str], Dict[str, str]]:
+    disassemble_flag = "-D" if project.disassemble_all else "-d"
+    if task.rom_range is not None:
+        assert project.baseimg and project.myimg
+        start, end = task.rom_range
+        flags = ["-Dz", "-bbinary", "-EB" if config.arch.big_endian else "-EL"]
+        dumps = []
+        for image in (project.baseimg, project.myimg):
+            out = cache.run_range(flags, image, start, end)
+            out = preprocess_objdump_out(None, None, out, config)
+            dumps.append(split_dump_by_address(out, task.functions))
+        return dumps[0], dumps[1]
+
+    flags = [disassemble_flag, "-rz", "-j", config.diff_section]
+    refobjfile = os.path.join(project.expected_dir, task.objfile)
+    dumps = []
+    for objfile in (refobjfile, task.objfile):
+        if not os.path.isfile(objfile):
+            dumps.append({})
+            continue
+        prefix = ""
+        if config.show_rodata_refs:
+            with open(objfile, "rb") as f:
+                prefix = serialize_rodata_references(
+                    parse_elf_rodata_references(f.read(), config)
+                )
+        dumps.append(split_dump_by_symbol(cache.run_file(flags, objfile), prefix))
+    return dumps[0], dumps[1]
+
+
+def batch_score_task(
+    task: BatchTask, cache: ObjdumpCache, config: Config, project: ProjectSettings
+) -> List[Dict[str, Any]]:
+    basedumps, mydumps = batch_dumps(task, cache, config, project)
+    if task.rom_range is not None:
+        names = [name for name, _, _ in task.functions]
+        addresses = {name: start for name, start, _ in task.functions}
+    else:
+        keep = {name for name, _, _ in task.functions}
+        names = [name for name in mydumps if not keep or name in keep]
+        addresses = {}
+
+    results = []
+    for name in names:
+        result: Dict[str, Any] = {
+            "name": name,
+            "object": task.objfile,
+            "address": addresses.get(name),
+        }
+        if name not in basedumps:
+            result["error"] = "missing from base"
+        else:
+            base_lines = process(basedumps[name], config)
+            my_lines = process(mydumps.get(name, ""), config)
+            diff = do_diff(base_lines, my_lines, config)
+            result["score"] = diff.score
+            result["max_score"] = diff.max_score
+            result["instructions"] = len(base_lines)
+        results.append(result)
+    return results
+
+
+_batch_state: Optional[Tuple[List[BatchTask], ObjdumpCache, Config, ProjectSettings]]
+_batch_state = None
+
+
+def _batch_worker(index: int) -> List[Dict[str, Any]]:
+    assert _batch_state is not None
+    tasks, cache, config, project = _batch_state
+    return batch_score_task(tasks[index], cache, config, project)
+
+
+def batch_tasks(
+    objects: Optional[List[str]], config: Config, project: ProjectSettings
+) -> List[BatchTask]:
+    if config.diff_obj and objects is not None:
+        return [BatchTask(obj, None, []) for obj in objects]
+
+    if not project.mapfile:
+        fail("No map file configured; cannot list functions.")
+    if project.map_format != "gnu":
+        fail("--batch needs a GNU ld map file, or -o with an object list.")
+    symdb = import_tool("symdb")
+    objdisasm = import_tool("objdisasm")
+
+    # Inputs come from the map's symbol database, but function boundaries come
+    # from each object's own symbol table: the map only lists globals, so
+    # static functions would be scored as part of the function before them.
+    with symdb.SymbolDB(project.mapfile) as db:
+        inputs = db.inputs(config.diff_section)
+    tasks: List[BatchTask] = []
+    wanted = set(objects) if objects is not None else None
+    for inp in inputs:
+        if inp.size == 0 or (wanted is not None and inp.object not in wanted):
+            continue
+        if config.diff_obj:
+            tasks.append(BatchTask(inp.object, None, []))
+            continue
+        if inp.rom is None:
+            continue
+        try:
+            ranges = objdisasm.function_ranges(inp.object, config.diff_section)
+        except (OSError, objdisasm.RelocationError) as e:
+            print(f"Skipping {inp.object}: {e}", file=sys.stderr)
+            continue
+        rom_start = inp.rom + project.map_address_offset
+        functions = [
+            (name, rom_start + start, rom_start + min(end, inp.size))
+            for name, start, end in ranges
+            if start < inp.size
+        ]
+        if functions:
+            tasks.append(
+                BatchTask(inp.object, (rom_start, rom_start + inp.size), functions)
+            )
+    return tasks
+
+
+def run_batch(args: argparse.Namespace, config: Config, project: ProjectSettings) -> None:
+    """Score every function at once. Each worker disassembles a whole object
+    (or an object's ROM range) per objdump call, and the raw output is cached
+    under the build directory, so repeat runs only disassemble what changed."""
+    global _batch_state
+    import multiprocessing
+
+    if config.base_shift:
+        fail("--base-shift not compatible with --batch")
+    if not config.diff_obj and (not project.baseimg or not project.myimg):
+        fail("Missing myimg/baseimg in config.")
+
+    objects = None
+    if args.batch:
+        with open(args.batch) as f:
+            objects = [line.strip() for line in f if line.strip()]
+
+    tasks = batch_tasks(objects, config, project)
+    cache = ObjdumpCache(
+        os.path.join(project.build_dir, ".diff_objdump_cache"), config, project
+    )
+
+    results: List[Dict[str, Any]] = []
+    jobs = args.batch_jobs or os.cpu_count() or 1
+    if jobs > 1 and "fork" in multiprocessing.get_all_start_methods():
+        # Forked workers inherit the tasks and config, so only indices need to
+        # be sent over.
+        _batch_state = (tasks, cache, config, project)
+        with multiprocessing.get_context("fork").Pool(jobs) as pool:
+            for task_results in pool.imap(_batch_worker, range(len(tasks))):
+                results.extend(task_results)
+        _batch_state = None
+    else:
+        for task in tasks:
+            results.extend(batch_score_task(task, cache, config, project))
+
+    # Closest non-matching functions first, matching ones last
+    def sort_key(result: Dict[str, Any]) -> Tuple[int, float]:
+        if "score" not in result:
+            return (2, 0.0)
+        if result["score"] == 0:
+            return (1, 0.0)
+        return (0, result["score"] / max(result["max_score"], 1))
+
+    results.sort(key=sort_key)
+    scored = [r for r in results if "score" in r]
+    report = {
+        "mode": "object" if config.diff_obj else "binary",
+        "functions": results,
+        "summary": {
+            "functions": len(results),
+            "matching": sum(1 for r in scored if r["score"] == 0),
+            "errors": len(results) - len(scored),
+            "total_score": sum(r["score"] for r in scored),
+            "total_max_score": sum(r["max_score"] for r in scored),
+        },
+    }
+    report_path = args.batch_report or os.path.join(
+        project.build_dir, "diff_report.json"
+    )
+    with open(report_path, "w") as f:
+        json.dump(report, f, indent=1)
+        f.write("\n")
+
+    summary = report["summary"]
+    print(
+        f"Scored {summary['functions']} functions in {len(tasks)} objects: "
+        f"{summary['matching']} matching, {summary['errors']} errors. "
+        f"Report written to {report_path}"
+    )
+
+
 def main() -> None:
     args = parser.parse_args()
+    if args.watch_incremental:
+        args.watch = True
+        args.make = True
 
     # Apply project-specific configuration.
     settings: Dict[str, Any] = {}
@@ -3721,13 +4095,29 @@ def main() -> None:
         except ModuleNotFoundError as e:
             fail(MISSING_PREREQUISITES.format(e.name))
 
+    if args.batch is not None:
+        run_batch(args, config, project)
+        return
+
+    if args.start is None:
+        fail("Missing function name or address to diff.")
+
     if (
         config.diff_mode in (DiffMode.THREEWAY_BASE, DiffMode.THREEWAY_PREV)
         and not args.watch
     ):
         fail("Threeway diffing requires -w.")
 
-    if args.diff_elf_symbol:
+    get_basedump: Callable[[], str]
+    get_mydump: Callable[[], str]
+    dump_errors: Tuple[type, ...] = ()
+    if args.watch_incremental:
+        make_target, target = dump_incremental(args.start, args.end, config, project)
+        # The base dump is decoded once and kept for the session
+        get_basedump = target.base_dump
+        get_mydump = target.my_dump
+        dump_errors = (import_tool("objdisasm").RelocationError,)
+    elif args.diff_elf_symbol:
         make_target, basecmd, mycmd = dump_elf(
             args.start, args.end, args.diff_elf_symbol, config, project
         )
@@ -3737,27 +4127,33 @@ def main() -> None:
         )
     else:
         make_target, basecmd, mycmd = dump_binary(args.start, args.end, config, project)
+    if not args.watch_incremental:
+        get_basedump = lambda: run_objdump(basecmd, config, project)
+        get_mydump = lambda: run_objdump(mycmd, config, project)
 
     map_build_target_fn = getattr(diff_settings, "map_build_target", None)
     if map_build_target_fn:
         make_target = map_build_target_fn(make_target=make_target)
 
     if args.write_asm is not None:
-        mydump = run_objdump(mycmd, config, project)
+        mydump = get_mydump()
         with open(args.write_asm, "w") as f:
             f.write(mydump)
         print(f"Wrote assembly to {args.write_asm}.")
         sys.exit(0)
 
-    if args.base_asm is not None:
-        with open(args.base_asm) as f:
-            basedump = f.read()
-    elif config.diff_mode != DiffMode.SINGLE:
-        basedump = run_objdump(basecmd, config, project)
-    else:
-        basedump = ""
+    try:
+        if args.base_asm is not None:
+            with open(args.base_asm) as f:
+                basedump = f.read()
+        elif config.diff_mode != DiffMode.SINGLE:
+            basedump = get_basedump()
+        else:
+            basedump = ""
 
-    mydump = run_objdump(mycmd, config, project)
+        mydump = get_mydump()
+    except dump_errors as e:
+        fail(str(e))
 
     display = Display(basedump, mydump, config)
 
@@ -3807,7 +4203,11 @@ def main() -> None:
                             error=True,
                         )
                         continue
-                mydump = run_objdump(mycmd, config, project)
+                try:
+                    mydump = get_mydump()
+                except dump_errors as e:
+                    display.update(str(e), error=True)
+                    continue
                 display.update(mydump, error=False)
         except KeyboardInterrupt:
             display.terminate()
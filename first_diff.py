@@ -2,8 +2,12 @@
 
 import os.path
 import argparse
+import sys
 from subprocess import check_call
 
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "tools"))
+from symdb import SymbolDB
+
 parser = argparse.ArgumentParser(
     description="Find the first difference(s) between the built ROM and the base ROM."
 )
@@ -59,118 +63,30 @@ if mybin == basebin:
     exit(0)
 
 
+mydb = SymbolDB(mymap)
+
+
 def search_rom_address(target_addr):
-    ram_offset = None
-    prev_ram = 0
-    prev_rom = 0
-    prev_sym = "<start of rom>"
-    cur_file = "<no file>"
-    prev_file = cur_file
-    prev_line = ""
-    with open(mymap) as f:
-        for line in f:
-            if "load address" in line:
-                # Ignore .bss sections since we're looking for a ROM address
-                if ".bss" in line or ".bss" in prev_line:
-                    ram_offset = None
-                    continue
-                ram = int(line[16 : 16 + 18], 0)
-                rom = int(line[59 : 59 + 18], 0)
-                ram_offset = ram - rom
-                continue
-
-            prev_line = line
-
-            if (
-                ram_offset is None
-                or "=" in line
-                or "*fill*" in line
-                or " 0x" not in line
-            ):
-                continue
-
-            ram = int(line[16 : 16 + 18], 0)
-            rom = ram - ram_offset
-            sym = line.split()[-1]
-
-            if "0x" in sym:
-                ram_offset = None
-                continue
-            if "/" in sym:
-                cur_file = sym
-                continue
-
-            if rom > target_addr:
-                return f"{prev_sym} (RAM 0x{prev_ram:X}, ROM 0x{prev_rom:X}, {prev_file})"
-
-            prev_ram = ram
-            prev_rom = rom
-            prev_sym = sym
-            prev_file = cur_file
-
-    return "at end of rom?"
-
-
-def parse_map(map_fname):
-    ram_offset = None
-    cur_file = "<no file>"
-    syms = {}
-    prev_sym = None
-    prev_line = ""
-    with open(map_fname) as f:
-        for line in f:
-            if "load address" in line:
-                ram = int(line[16 : 16 + 18], 0)
-                rom = int(line[59 : 59 + 18], 0)
-                ram_offset = ram - rom
-                continue
-
-            prev_line = line
-
-            if (
-                ram_offset is None
-                or "=" in line
-                or "*fill*" in line
-                or " 0x" not in line
-            ):
-                continue
-
-            ram = int(line[16 : 16 + 18], 0)
-            rom = ram - ram_offset
-            sym = line.split()[-1]
-
-            if "0x" in sym:
-                ram_offset = None
-                continue
-            elif "/" in sym:
-                cur_file = sym
-                continue
-
-            syms[sym] = (rom, cur_file, prev_sym, ram)
-            prev_sym = sym
-
-    return syms
+    rom_end = mydb.rom_end()
+    if rom_end is None or target_addr >= rom_end:
+        return "at end of rom?"
+    sym = mydb.at_rom(target_addr)
+    if sym is None:
+        return "<start of rom> (RAM 0x0, ROM 0x0, <no file>)"
+    return f"{sym.name} (RAM 0x{sym.vram:X}, ROM 0x{sym.rom:X}, {sym.object})"
 
 
 def map_diff():
-    map1 = parse_map(mymap)
-    map2 = parse_map(basemap)
-    min_ram = None
-    found = None
-    for sym, addr in map1.items():
-        if sym not in map2:
-            continue
-        if addr[0] != map2[sym][0]:
-            if min_ram is None or addr[0] < min_ram:
-                min_ram = addr[0]
-                found = (sym, addr[1], addr[2])
-    if min_ram is None:
+    basedb = SymbolDB(basemap)
+    moved = mydb.first_moved(basedb)
+    if moved is None:
         return False
     else:
+        sym, prev_sym = moved
         print(
-            f"Map appears to have shifted just before {found[0]} ({found[1]}) -- in {found[2]}?"
+            f"Map appears to have shifted just before {sym.name} ({sym.object}) -- in {prev_sym}?"
         )
-        if found[2] is not None and found[2] not in map2:
+        if prev_sym is not None and not basedb.lookup(prev_sym):
             print(
                 f"(Base map file {basemap} out of date due to new or renamed symbols, so result may be imprecise.)"
             )
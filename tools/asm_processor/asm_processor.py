@@ -1,13 +1,21 @@
 #!/usr/bin/env python3
 import argparse
+import hashlib
 import tempfile
 import struct
 import sys
 import re
 import os
+import time
 from collections import namedtuple
 from io import StringIO
 
+try:
+    import fcntl
+except ImportError:
+    # No locking on Windows; the stats may then lose a count now and then
+    fcntl = None
+
 MAX_FN_SIZE = 100
 SLOW_CHECKS = False
 
@@ -328,6 +336,8 @@ class Section:
 
         self.data = bytes(new_data)
 
+# Not ultralib's libelf: this one writes objects back out with new sections,
+# symbols and relocations, and only ever sees the single object it rewrites.
 class ElfFile:
     def __init__(self, data):
         self.data = data
@@ -442,6 +452,159 @@ class Failure(Exception):
         return self.message
 
 
+class AsmCache:
+    """Content-addressed cache of assembled GLOBAL_ASM objects.
+
+    There is one entry per C file, not per block: it is keyed by the whole
+    assembler input fixup_objfile generates for the file (every block, the
+    padding between them and the prelude) and the assembler command line, and
+    holds the object file the assembler produced, i.e. all the section
+    contents, symbols and relocations fixup_objfile splices into the IDO
+    output. Editing C code around the blocks keeps hitting; adding, removing
+    or changing any block misses for the whole file.
+
+    Least recently used entries are evicted once the cache grows past
+    max_size bytes, down to TRIM_RATIO of it. The stats file keeps a running
+    total of the size alongside the hit and miss counts, so the directory is
+    only scanned when that total crosses the limit."""
+
+    TRIM_RATIO = 0.8
+
+    def __init__(self, path, max_size):
+        self.path = path
+        self.objects_path = os.path.join(path, 'objects')
+        self.stats_path = os.path.join(path, 'stats')
+        self.max_size = max_size
+        self.hits = 0
+        self.misses = 0
+
+    @staticmethod
+    def cacheable(asm_source):
+        # Anything pulling in other files could change behind our back.
+        return b'.incbin' not in asm_source and b'.include' not in asm_source
+
+    def key(self, asm_source, assembler):
+        h = hashlib.sha256()
+        h.update(assembler.encode('utf-8') + b'\0')
+        h.update(asm_source)
+        return h.hexdigest()
+
+    def get(self, key):
+        entry = os.path.join(self.objects_path, key + '.o')
+        try:
+            with open(entry, 'rb') as f:
+                data = f.read()
+        except OSError:
+            self.misses += 1
+            return None
+        try:
+            os.utime(entry)
+        except OSError:
+            pass
+        self.hits += 1
+        return data
+
+    def put(self, key, data):
+        os.makedirs(self.objects_path, exist_ok=True)
+        fd, tmp_name = tempfile.mkstemp(dir=self.objects_path, suffix='.tmp')
+        with os.fdopen(fd, 'wb') as f:
+            f.write(data)
+        os.replace(tmp_name, os.path.join(self.objects_path, key + '.o'))
+        _, _, size = self._update_stats(added=len(data))
+        if size is None or size > self.max_size:
+            self.trim()
+
+    def trim(self):
+        try:
+            entries = [e for e in os.scandir(self.objects_path) if e.name.endswith('.o')]
+        except OSError:
+            return
+        stats = [(e.stat(), e.path) for e in entries]
+        total = sum(st.st_size for st, _ in stats)
+        if total > self.max_size:
+            target = self.max_size * self.TRIM_RATIO
+            stats.sort(key=lambda x: x[0].st_mtime)
+            for st, entry_path in stats:
+                if total <= target:
+                    break
+                try:
+                    os.remove(entry_path)
+                except OSError:
+                    continue
+                total -= st.st_size
+        self._update_stats(size=total)
+
+    @staticmethod
+    def _parse_stats(text):
+        # One 'hits misses size' line, with a size of -1 until it's known.
+        # Older caches have a 'hits misses' line per compile instead.
+        hits = misses = 0
+        size = None
+        for line in text.splitlines():
+            fields = line.split()
+            if len(fields) == 3:
+                size = int(fields[2])
+                return int(fields[0]), int(fields[1]), size if size >= 0 else None
+            if len(fields) == 2:
+                hits += int(fields[0])
+                misses += int(fields[1])
+        return hits, misses, size
+
+    def _update_stats(self, hits=0, misses=0, added=0, size=None):
+        """Add to the counts in the stats file, or set its size, and return
+        (hits, misses, size). The size is None if it isn't known yet. The file
+        is rewritten in place under a lock, so concurrent compiles don't lose
+        each other's counts and it never grows."""
+        os.makedirs(self.path, exist_ok=True)
+        fd = os.open(self.stats_path, os.O_RDWR | os.O_CREAT, 0o644)
+        try:
+            if fcntl is not None:
+                fcntl.lockf(fd, fcntl.LOCK_EX)
+            text = b''
+            while True:
+                chunk = os.read(fd, 65536)
+                if not chunk:
+                    break
+                text += chunk
+            old_hits, old_misses, old_size = self._parse_stats(text.decode('utf-8', 'replace'))
+            hits += old_hits
+            misses += old_misses
+            if size is None and old_size is not None:
+                size = old_size + added
+            os.lseek(fd, 0, os.SEEK_SET)
+            os.ftruncate(fd, 0)
+            os.write(fd, '{} {} {}\n'.format(hits, misses, -1 if size is None else size).encode('utf-8'))
+        finally:
+            os.close(fd)
+        return hits, misses, size
+
+    def record_stats(self):
+        if not self.hits and not self.misses:
+            return
+        self._update_stats(hits=self.hits, misses=self.misses)
+
+    def report(self):
+        hits = misses = 0
+        try:
+            with open(self.stats_path) as f:
+                hits, misses, _ = self._parse_stats(f.read())
+        except OSError:
+            pass
+        count = size = 0
+        try:
+            for e in os.scandir(self.objects_path):
+                if e.name.endswith('.o'):
+                    count += 1
+                    size += e.stat().st_size
+        except OSError:
+            pass
+        total = hits + misses
+        rate = 100.0 * hits / total if total else 0.0
+        print('asm cache: {}'.format(self.path))
+        print('  lookups:  {} ({} hits, {} misses, {:.1f}% hit rate)'.format(total, hits, misses, rate))
+        print('  entries:  {} ({:.1f} / {:.1f} MiB)'.format(count, size / 2**20, self.max_size / 2**20))
+
+
 class GlobalState:
     def __init__(self, min_instr_count, skip_instr_count, use_jtbl_for_rodata, prelude_if_late_rodata, mips1, pascal):
         # A value that hopefully never appears as a 32-bit rodata constant (or we
@@ -1027,7 +1190,7 @@ def parse_source(f, opts, out_dependencies, print_source=None):
 
     return asm_functions
 
-def fixup_objfile(objfile_name, functions, asm_prelude, assembler, output_enc, drop_mdebug_gptab, convert_statics):
+def fixup_objfile(objfile_name, functions, asm_prelude, assembler, output_enc, drop_mdebug_gptab, convert_statics, asm_cache=None, timer=None):
     SECTIONS = ['.data', '.text', '.rodata', '.bss']
 
     with open(objfile_name, 'rb') as f:
@@ -1122,15 +1285,27 @@ def fixup_objfile(objfile_name, functions, asm_prelude, assembler, output_enc, d
     s_file = tempfile.NamedTemporaryFile(prefix='asm-processor', suffix='.s', delete=False)
     s_name = s_file.name
     try:
-        s_file.write(asm_prelude + b'\n')
-        for line in asm:
-            s_file.write(line.encode(output_enc) + b'\n')
-        s_file.close()
-        ret = os.system(assembler + " " + s_name + " -o " + o_name)
-        if ret != 0:
-            raise Failure("failed to assemble")
-        with open(o_name, 'rb') as f:
-            asm_objfile = ElfFile(f.read())
+        asm_source = asm_prelude + b'\n' + b''.join(line.encode(output_enc) + b'\n' for line in asm)
+        cache_key = None
+        asm_data = None
+        assemble_start = time.time()
+        if asm_cache is not None and AsmCache.cacheable(asm_source):
+            cache_key = asm_cache.key(asm_source, assembler)
+            asm_data = asm_cache.get(cache_key)
+        if asm_data is None:
+            s_file.write(asm_source)
+            s_file.close()
+            ret = os.system(assembler + " " + s_name + " -o " + o_name)
+            if ret != 0:
+                raise Failure("failed to assemble")
+            with open(o_name, 'rb') as f:
+                asm_data = f.read()
+            if cache_key is not None:
+                asm_cache.put(cache_key, asm_data)
+        fixup_start = time.time()
+        if timer is not None:
+            timer.add("assemble", assemble_start, fixup_start)
+        asm_objfile = ElfFile(asm_data)
 
         # Remove clutter from objdump output for tests, and make the tests
         # portable by avoiding absolute paths. Outside of tests .mdebug is
@@ -1439,6 +1614,8 @@ def fixup_objfile(objfile_name, functions, asm_prelude, assembler, output_enc, d
                     target_reltaba.data += new_data
 
         objfile.write(objfile_name)
+        if timer is not None:
+            timer.add("fixup", fixup_start, time.time())
     finally:
         s_file.close()
         os.remove(s_name)
@@ -1447,9 +1624,9 @@ def fixup_objfile(objfile_name, functions, asm_prelude, assembler, output_enc, d
         except:
             pass
 
-def run_wrapped(argv, outfile, functions):
+def run_wrapped(argv, outfile, functions, timer=None):
     parser = argparse.ArgumentParser(description="Pre-process .c files and post-process .o files to enable embedding assembly into C.")
-    parser.add_argument('filename', help="path to .c code")
+    parser.add_argument('filename', nargs='?', help="path to .c code")
     parser.add_argument('--post-process', dest='objfile', help="path to .o file to post-process")
     parser.add_argument('--assembler', dest='assembler', help="assembler command (e.g. \"mips-linux-gnu-as -march=vr4300 -mabi=32\")")
     parser.add_argument('--asm-prelude', dest='asm_prelude', help="path to a file containing a prelude to the assembly file (with .set and .macro directives, e.g.)")
@@ -1459,16 +1636,31 @@ def run_wrapped(argv, outfile, functions):
     parser.add_argument('--convert-statics', dest='convert_statics', choices=["no", "local", "global", "global-with-filename"], default="local", help="change static symbol visibility (default: %(default)s)")
     parser.add_argument('--force', dest='force', action='store_true', help="force processing of files without GLOBAL_ASM blocks")
     parser.add_argument('--encode-cutscene-data-floats', dest='enable_cutscene_data_float_encoding', action='store_true', default=False, help="Replace floats with their encoded hexadecimal representation in CutsceneData data")
+    parser.add_argument('--asm-cache', dest='asm_cache', help="directory to cache assembled GLOBAL_ASM blocks in")
+    parser.add_argument('--asm-cache-max-size', dest='asm_cache_max_size', type=int, default=256, help="asm cache size limit in MiB (default: %(default)s)")
+    parser.add_argument('--asm-cache-stats', dest='asm_cache_stats', action='store_true', help="print asm cache hit rate and size, then exit")
     parser.add_argument('-framepointer', dest='framepointer', action='store_true')
     parser.add_argument('-mips1', dest='mips1', action='store_true')
     parser.add_argument('-g3', dest='g3', action='store_true')
     parser.add_argument('-KPIC', dest='kpic', action='store_true')
-    group = parser.add_mutually_exclusive_group(required=True)
+    group = parser.add_mutually_exclusive_group()
     group.add_argument('-O0', dest='opt', action='store_const', const='O0')
     group.add_argument('-O1', dest='opt', action='store_const', const='O1')
     group.add_argument('-O2', dest='opt', action='store_const', const='O2')
     group.add_argument('-g', dest='opt', action='store_const', const='g')
     args = parser.parse_args(argv)
+    asm_cache = None
+    if args.asm_cache:
+        asm_cache = AsmCache(args.asm_cache, args.asm_cache_max_size * 2**20)
+    if args.asm_cache_stats:
+        if asm_cache is None:
+            parser.error("--asm-cache-stats requires --asm-cache")
+        asm_cache.report()
+        return
+    if args.filename is None:
+        parser.error("the following arguments are required: filename")
+    if args.opt is None:
+        parser.error("one of the arguments -O0 -O1 -O2 -g is required")
     opt = args.opt
     pascal = any(args.filename.endswith(ext) for ext in (".p", ".pas", ".pp"))
     if args.g3:
@@ -1498,11 +1690,15 @@ def run_wrapped(argv, outfile, functions):
         if args.asm_prelude:
             with open(args.asm_prelude, 'rb') as f:
                 asm_prelude = f.read()
-        fixup_objfile(args.objfile, functions, asm_prelude, args.assembler, args.output_enc, args.drop_mdebug_gptab, args.convert_statics)
+        try:
+            fixup_objfile(args.objfile, functions, asm_prelude, args.assembler, args.output_enc, args.drop_mdebug_gptab, args.convert_statics, asm_cache, timer)
+        finally:
+            if asm_cache is not None:
+                asm_cache.record_stats()
 
-def run(argv, outfile=sys.stdout.buffer, functions=None):
+def run(argv, outfile=sys.stdout.buffer, functions=None, timer=None):
     try:
-        return run_wrapped(argv, outfile, functions)
+        return run_wrapped(argv, outfile, functions, timer)
     except Failure as e:
         print("Error:", e, file=sys.stderr)
         sys.exit(1)
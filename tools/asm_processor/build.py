@@ -7,6 +7,11 @@ import tempfile
 import uuid
 import asm_processor
 
+sys.path.insert(0, str(Path(__file__).resolve().parent.parent))
+import build_trace
+import depfile
+import objcache
+
 # Boolean for debugging purposes
 # Preprocessed files are temporary, set to True to keep a copy
 keep_preprocessed_files = False
@@ -14,92 +19,171 @@ keep_preprocessed_files = False
 dir_path = Path(__file__).resolve().parent
 asm_prelude_path = dir_path / "prelude.inc"
 
-all_args = sys.argv[1:]
-sep0 = next(index for index, arg in enumerate(all_args) if not arg.startswith("-"))
-sep1 = all_args.index("--")
-sep2 = all_args.index("--", sep1 + 1)
-
-asmproc_flags = all_args[:sep0]
-compiler = all_args[sep0:sep1]
-
-assembler_args = all_args[sep1 + 1 : sep2]
-assembler_sh = " ".join(shlex.quote(x) for x in assembler_args)
-
-
-compile_args = all_args[sep2 + 1 :]
-
-in_file = Path(compile_args[-1])
-del compile_args[-1]
-
-out_ind = compile_args.index("-o")
-out_file = Path(compile_args[out_ind + 1])
-del compile_args[out_ind + 1]
-del compile_args[out_ind]
-
-
-in_dir = in_file.resolve().parent
-opt_flags = [
-    x for x in compile_args if x in {"-g3", "-g", "-O0", "-O1", "-O2", "-framepointer", "-KPIC"}
-]
-if "-mips2" not in compile_args:
-    opt_flags.append("-mips1")
-
-asmproc_flags += opt_flags + [str(in_file)]
 
-# Drop .mdebug and .gptab sections from resulting binaries. This makes
-# resulting .o files much smaller and speeds up builds, but loses line
-# number debug data.
-# asmproc_flags += ["--drop-mdebug-gptab"]
-
-# Convert encoding before compiling.
-# asmproc_flags += ["--input-enc", "utf-8", "--output-enc", "euc-jp"]
-
-with tempfile.TemporaryDirectory(prefix="asm_processor") as tmpdirname:
-    tmpdir_path = Path(tmpdirname)
-    preprocessed_filename = "preprocessed_" + uuid.uuid4().hex + in_file.suffix
-    preprocessed_path = tmpdir_path / preprocessed_filename
-
-    with preprocessed_path.open("wb") as f:
-        functions, deps = asm_processor.run(asmproc_flags, outfile=f)
-
-    if keep_preprocessed_files:
-        import shutil
-
-        keep_output_dir = Path("./asm_processor_preprocessed")
-        keep_output_dir.mkdir(parents=True, exist_ok=True)
-
-        shutil.copy(
-            preprocessed_path,
-            keep_output_dir / (in_file.stem + "_" + preprocessed_filename),
+def main(all_args):
+    timer = build_trace.PhaseTimer()
+    sep0 = next(index for index, arg in enumerate(all_args) if not arg.startswith("-"))
+    sep1 = all_args.index("--")
+    sep2 = all_args.index("--", sep1 + 1)
+
+    asmproc_flags = all_args[:sep0]
+    compiler = all_args[sep0:sep1]
+
+    # Flags for build.py itself, rather than asm_processor
+    obj_cache = None
+    depfile_path = None
+    timings_dir = None
+    for flag in list(asmproc_flags):
+        if flag.startswith("--obj-cache="):
+            obj_cache = objcache.ObjectCache(Path(flag.split("=", 1)[1]))
+            asmproc_flags.remove(flag)
+        elif flag.startswith("--depfile="):
+            depfile_path = Path(flag.split("=", 1)[1])
+            asmproc_flags.remove(flag)
+        elif flag.startswith("--timings="):
+            timings_dir = Path(flag.split("=", 1)[1])
+            asmproc_flags.remove(flag)
+
+    assembler_args = all_args[sep1 + 1 : sep2]
+    assembler_sh = " ".join(shlex.quote(x) for x in assembler_args)
+
+
+    compile_args = all_args[sep2 + 1 :]
+
+    in_file = Path(compile_args[-1])
+    del compile_args[-1]
+
+    out_ind = compile_args.index("-o")
+    out_file = Path(compile_args[out_ind + 1])
+    del compile_args[out_ind + 1]
+    del compile_args[out_ind]
+
+
+    in_dir = in_file.resolve().parent
+    opt_flags = [
+        x for x in compile_args if x in {"-g3", "-g", "-O0", "-O1", "-O2", "-framepointer", "-KPIC"}
+    ]
+    if "-mips2" not in compile_args:
+        opt_flags.append("-mips1")
+
+    asmproc_flags += opt_flags + [str(in_file)]
+
+    # Drop .mdebug and .gptab sections from resulting binaries. This makes
+    # resulting .o files much smaller and speeds up builds, but loses line
+    # number debug data.
+    # asmproc_flags += ["--drop-mdebug-gptab"]
+
+    # Convert encoding before compiling.
+    # asmproc_flags += ["--input-enc", "utf-8", "--output-enc", "euc-jp"]
+
+    with tempfile.TemporaryDirectory(prefix="asm_processor") as tmpdirname:
+        tmpdir_path = Path(tmpdirname)
+        preprocessed_filename = "preprocessed_" + uuid.uuid4().hex + in_file.suffix
+        preprocessed_path = tmpdir_path / preprocessed_filename
+
+        with timer.phase("preprocess"), preprocessed_path.open("wb") as f:
+            functions, deps = asm_processor.run(asmproc_flags, outfile=f)
+
+        if keep_preprocessed_files:
+            import shutil
+
+            keep_output_dir = Path("./asm_processor_preprocessed")
+            keep_output_dir.mkdir(parents=True, exist_ok=True)
+
+            shutil.copy(
+                preprocessed_path,
+                keep_output_dir / (in_file.stem + "_" + preprocessed_filename),
+            )
+
+        # With the object cache on, run IDO's preprocessor over the rewritten
+        # source: the result keys the cache, and its line markers list the
+        # headers for the depfile. Otherwise the compile writes the depfile.
+        preprocessed = None
+        cache_flags = compile_args + ["-I", str(in_dir)]
+        if obj_cache is not None:
+            try:
+                with timer.phase("cpp"):
+                    preprocessed = objcache.preprocess(compiler, cache_flags, preprocessed_path)
+            except subprocess.CalledProcessError:
+                # Let the real compile report the error
+                pass
+        if preprocessed is not None:
+            preprocessed = preprocessed.replace(
+                str(preprocessed_path).encode(), str(in_file).encode()
+            )
+            deps = depfile.headers_from_preprocessed(preprocessed) + deps
+
+        cache_key = None
+        if obj_cache is not None and preprocessed is not None:
+            # The GLOBAL_ASM contents get spliced in after compiling, so they
+            # (and how they get assembled) are part of the key too.
+            extra = "\n".join(
+                [assembler_sh, asm_prelude_path.read_text(), repr(asmproc_flags), repr(functions)]
+            ).encode()
+            cache_key = obj_cache.key(
+                obj_cache.compiler_id(compiler[0]), cache_flags, preprocessed, extra
+            )
+            with timer.phase("cache lookup"):
+                hit = obj_cache.get(cache_key, out_file)
+            if hit:
+                write_deps(out_file, deps, depfile_path)
+                timer.write(timings_dir, out_file, cached=True)
+                return 0
+
+        mdupdate_path = None
+        if depfile_path is not None and preprocessed is None:
+            mdupdate_path = tmpdir_path / "mdupdate.d"
+
+        compile_cmdline = (
+            compiler
+            + compile_args
+            + (["-MDupdate", str(mdupdate_path)] if mdupdate_path is not None else [])
+            + ["-I", str(in_dir), "-o", str(out_file), str(preprocessed_path)]
         )
 
-    compile_cmdline = (
-        compiler
-        + compile_args
-        + ["-I", str(in_dir), "-o", str(out_file), str(preprocessed_path)]
-    )
-
-    try:
-        subprocess.check_call(compile_cmdline)
-    except subprocess.CalledProcessError as e:
-        print("Failed to compile file " + str(in_file) + ". Command line:")
-        print()
-        print(" ".join(shlex.quote(x) for x in compile_cmdline))
-        print()
-        sys.exit(55)
-
-    asm_processor.run(
-        asmproc_flags
-        + [
-            "--post-process",
-            str(out_file),
-            "--assembler",
-            assembler_sh,
-            "--asm-prelude",
-            str(asm_prelude_path),
-        ],
-        functions=functions,
-    )
+        try:
+            with timer.phase("cc"):
+                subprocess.check_call(compile_cmdline)
+        except subprocess.CalledProcessError as e:
+            print("Failed to compile file " + str(in_file) + ". Command line:")
+            print()
+            print(" ".join(shlex.quote(x) for x in compile_cmdline))
+            print()
+            return 55
+
+        with timer.phase("post-process"):
+            asm_processor.run(
+                asmproc_flags
+                + [
+                    "--post-process",
+                    str(out_file),
+                    "--assembler",
+                    assembler_sh,
+                    "--asm-prelude",
+                    str(asm_prelude_path),
+                ],
+                functions=functions,
+                timer=timer,
+            )
+
+        if mdupdate_path is not None:
+            deps = depfile.read_mdupdate(mdupdate_path, exclude=[str(preprocessed_path)]) + deps
+
+        if cache_key is not None:
+            with timer.phase("cache store"):
+                obj_cache.put(cache_key, out_file)
+
+        write_deps(out_file, deps, depfile_path)
+        timer.write(timings_dir, out_file, cached=False)
+
+    return 0
+
+
+def write_deps(out_file, deps, depfile_path):
+    if depfile_path is not None:
+        # Headers and GLOBAL_ASM .s files together, for ninja's `deps = gcc`
+        depfile.write_depfile(depfile_path, out_file, deps)
+        return
 
     deps_file = out_file.with_suffix(".asmproc.d")
     if deps:
@@ -112,3 +196,7 @@ with tempfile.TemporaryDirectory(prefix="asm_processor") as tmpdirname:
             deps_file.unlink()
         except OSError:
             pass
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
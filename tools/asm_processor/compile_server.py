@@ -0,0 +1,253 @@
+#!/usr/bin/env python3
+# Long-lived compile server for build.py.
+#
+# Running build.py once per translation unit means paying for interpreter
+# start-up and for importing asm_processor on every C file. This script is a
+# drop-in replacement for build.py on the command line: the first invocation
+# starts a server in the background, and every invocation after that hands its
+# arguments (and its stdout/stderr file descriptors) to the server over a unix
+# socket. The server forks a warm copy of itself per request, so many
+# translation units can be compiled concurrently without re-importing anything.
+#
+# If the server can't be reached (or the platform lacks unix sockets), the
+# compile falls back to running build.py in-process.
+#
+# The client path is what ninja runs for every C file, so it sticks to cheap
+# imports; everything else is imported lazily.
+import json
+import os
+import socket
+import struct
+import sys
+
+dir_path = os.path.dirname(os.path.realpath(__file__))
+
+DEFAULT_SOCKET = os.path.join("build", ".asm_processor.sock")
+DEFAULT_IDLE_TIMEOUT = 300
+CONNECT_TIMEOUT = 10
+
+HEADER = struct.Struct("<I")
+STATUS = struct.Struct("<i")
+
+
+def source_mtimes():
+    return {
+        name: os.stat(os.path.join(dir_path, name)).st_mtime_ns
+        for name in ("asm_processor.py", "build.py", "compile_server.py", "prelude.inc", "../objcache.py", "../depfile.py", "../build_trace.py")
+    }
+
+
+def recv_exact(sock, count):
+    buf = b""
+    while len(buf) < count:
+        chunk = sock.recv(count - len(buf))
+        if not chunk:
+            raise ConnectionError("unexpected end of stream")
+        buf += chunk
+    return buf
+
+
+def handle_compile(conn):
+    # Runs in a forked child of the server, one per translation unit.
+    data, fds, _, _ = socket.recv_fds(conn, 65536, 2)
+    (length,) = HEADER.unpack(data[: HEADER.size])
+    data = data[HEADER.size :]
+    data += recv_exact(conn, length - len(data))
+    request = json.loads(data)
+
+    sys.stdout.flush()
+    sys.stderr.flush()
+    os.dup2(fds[0], 1)
+    os.dup2(fds[1], 2)
+    for fd in fds:
+        os.close(fd)
+    os.chdir(request["cwd"])
+    os.environ.clear()
+    os.environ.update(request["env"])
+
+    import build
+
+    try:
+        status = build.main(request["argv"])
+    except SystemExit as e:
+        status = e.code if isinstance(e.code, int) else 1
+    except Exception:
+        import traceback
+
+        traceback.print_exc()
+        status = 1
+
+    sys.stdout.flush()
+    sys.stderr.flush()
+    conn.sendall(STATUS.pack(status))
+
+
+def serve(path, idle_timeout):
+    import signal
+    import socketserver
+
+    # Import everything a compile needs up front, so forked children start warm.
+    import asm_processor
+    import build
+
+    class CompileHandler(socketserver.BaseRequestHandler):
+        def handle(self):
+            handle_compile(self.request)
+
+    class CompileServer(socketserver.ForkingMixIn, socketserver.UnixStreamServer):
+        # Compiles are mostly spent waiting on IDO, so don't cap concurrency
+        # below what ninja asks for.
+        max_children = 256
+
+        def __init__(self):
+            super().__init__(path, CompileHandler)
+            self.timeout = idle_timeout
+            self.mtimes = source_mtimes()
+            self.stale = False
+            self.idle = False
+
+        def verify_request(self, request, client_address):
+            # Runs in the server process before forking. If build.py or
+            # asm_processor changed since start-up, drop the request (the
+            # client falls back to compiling in-process) and exit so the next
+            # compile starts a fresh server.
+            if source_mtimes() != self.mtimes:
+                self.stale = True
+                return False
+            return True
+
+        def handle_timeout(self):
+            super().handle_timeout()
+            if not self.active_children:
+                self.idle = True
+
+    try:
+        os.unlink(path)
+    except FileNotFoundError:
+        pass
+
+    signal.signal(signal.SIGTERM, lambda signum, frame: sys.exit(0))
+
+    with CompileServer() as server:
+        with open(path + ".pid", "w") as f:
+            f.write(str(os.getpid()))
+        try:
+            while not server.idle and not server.stale:
+                server.handle_request()
+        finally:
+            for stale_path in (path, path + ".pid"):
+                try:
+                    os.unlink(stale_path)
+                except FileNotFoundError:
+                    pass
+
+
+def connect(path):
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    try:
+        sock.connect(path)
+    except OSError:
+        sock.close()
+        return None
+    return sock
+
+
+def spawn_server(path, idle_timeout):
+    import fcntl
+    import subprocess
+    import time
+
+    os.makedirs(os.path.dirname(path) or ".", exist_ok=True)
+
+    # Serialize start-up, otherwise every job in the first ninja batch would
+    # start its own server.
+    with open(path + ".lock", "w") as lock:
+        fcntl.flock(lock, fcntl.LOCK_EX)
+        sock = connect(path)
+        if sock is not None:
+            return sock
+
+        subprocess.Popen(
+            [
+                sys.executable,
+                os.path.join(dir_path, "compile_server.py"),
+                "--serve",
+                "--socket",
+                path,
+                "--idle-timeout",
+                str(idle_timeout),
+            ],
+            stdin=subprocess.DEVNULL,
+            stdout=subprocess.DEVNULL,
+            stderr=subprocess.DEVNULL,
+            start_new_session=True,
+        )
+
+        deadline = time.monotonic() + CONNECT_TIMEOUT
+        while time.monotonic() < deadline:
+            sock = connect(path)
+            if sock is not None:
+                return sock
+            time.sleep(0.01)
+    return None
+
+
+def compile_remote(sock, argv):
+    with sock:
+        payload = json.dumps(
+            {"argv": argv, "cwd": os.getcwd(), "env": dict(os.environ)}
+        ).encode("utf-8")
+        sys.stdout.flush()
+        sys.stderr.flush()
+        socket.send_fds(sock, [HEADER.pack(len(payload)) + payload], [1, 2])
+        (status,) = STATUS.unpack(recv_exact(sock, STATUS.size))
+    return status
+
+
+def compile_local(argv):
+    sys.path.insert(0, dir_path)
+    import build
+
+    return build.main(argv)
+
+
+def main():
+    argv = sys.argv[1:]
+    if argv and argv[0] in ("--serve", "--shutdown"):
+        import argparse
+        import signal
+
+        parser = argparse.ArgumentParser(description="asm_processor compile server")
+        parser.add_argument("--serve", action="store_true", help="run the server in the foreground")
+        parser.add_argument("--shutdown", action="store_true", help="stop a running server")
+        parser.add_argument("--socket", default=os.environ.get("ASMP_SERVER_SOCKET", DEFAULT_SOCKET))
+        parser.add_argument("--idle-timeout", type=float, default=DEFAULT_IDLE_TIMEOUT)
+        args = parser.parse_args(argv)
+        if args.shutdown:
+            try:
+                with open(args.socket + ".pid") as f:
+                    os.kill(int(f.read()), signal.SIGTERM)
+            except (OSError, ValueError):
+                pass
+            return 0
+        serve(args.socket, args.idle_timeout)
+        return 0
+
+    path = os.environ.get("ASMP_SERVER_SOCKET", DEFAULT_SOCKET)
+    if not hasattr(socket, "send_fds") or os.environ.get("ASMP_NO_SERVER"):
+        return compile_local(argv)
+
+    sock = connect(path)
+    if sock is None:
+        sock = spawn_server(path, DEFAULT_IDLE_TIMEOUT)
+    if sock is None:
+        return compile_local(argv)
+
+    try:
+        return compile_remote(sock, argv)
+    except (OSError, ConnectionError):
+        return compile_local(argv)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+# Extract the snap_bank and snap_seq segments listed in splat.yaml straight
+# from the ROM, without running splat: the same descriptors, WAVs and MIDI
+# files the splat extensions write. The ROM is read with seeks, only the
+# structs and samples that are needed, never loaded whole.
+#
+#   audio_extract.py [--rom pokemonsnap.z64] [--out assets]
+#   audio_extract.py --bench     time VADPCM decoding on every wavetable
+
+import argparse
+import sys
+import time
+from pathlib import Path
+from typing import List, NamedTuple, Optional
+
+import yaml
+
+import audio_format
+import vadpcm
+from audio_format import AL_ADPCM_WAVE, AudioFormatError, FileReader, SampleCache
+
+
+class AudioSegment(NamedTuple):
+    type: str
+    name: str
+    start: int
+    end: int
+    table: Optional[List[int]]  # [start, end] of a bank's wave table
+
+
+def audio_segments(yaml_path: Path) -> List[AudioSegment]:
+    """The top-level snap_bank and snap_seq segments, each ending where the
+    next segment starts."""
+    with open(yaml_path) as f:
+        config = yaml.safe_load(f)
+    entries = []
+    for seg in config["segments"]:
+        if isinstance(seg, dict):
+            entries.append((seg.get("start"), seg.get("type"), seg.get("name"), seg.get("table")))
+        else:
+            entries.append((seg[0], seg[1] if len(seg) > 1 else None, seg[2] if len(seg) > 2 else None, None))
+    segments = []
+    for (start, kind, name, table), (end, *_) in zip(entries, entries[1:]):
+        if kind in ("snap_bank", "snap_seq"):
+            segments.append(AudioSegment(kind, name or f"{start:X}", start, end, table))
+    return segments
+
+
+def extract(rom, segments: List[AudioSegment], out_dir: Path, cache: SampleCache):
+    for seg in segments:
+        base = out_dir / seg.name
+        base.parent.mkdir(parents=True, exist_ok=True)
+        try:
+            if seg.type == "snap_bank":
+                audio_format.extract_bank(
+                    FileReader(rom, seg.start, seg.end - seg.start),
+                    FileReader(rom, seg.table[0], seg.table[1] - seg.table[0]),
+                    base.with_suffix(".json"),
+                    base,
+                    cache,
+                )
+            else:
+                audio_format.extract_seq(
+                    FileReader(rom, seg.start, seg.end - seg.start).read(0, seg.end - seg.start),
+                    base.with_suffix(".json"),
+                    base.with_suffix(".mid"),
+                )
+        except AudioFormatError as e:
+            print(f"{seg.name}: {e}")
+    print(f"Samples: {cache.hits} cached, {cache.misses} decoded")
+
+
+def bench(rom, segments: List[AudioSegment], repeat: int):
+    waves = []
+    for seg in segments:
+        if seg.type != "snap_bank":
+            continue
+        tbl = FileReader(rom, seg.table[0], seg.table[1] - seg.table[0])
+        try:
+            bank_file = audio_format.parse_bank_file(FileReader(rom, seg.start, seg.end - seg.start))
+        except AudioFormatError as e:
+            print(f"{seg.name}: {e}")
+            continue
+        for wave in bank_file.wavetables.values():
+            if wave.type == AL_ADPCM_WAVE:
+                waves.append((wave, tbl.read(wave.base, wave.len)))
+    if not waves:
+        print("No ADPCM wavetables found")
+        return
+
+    total = sum(len(data) for _, data in waves)
+    samples = sum(audio_format.wave_samples(wave) for wave, _ in waves)
+    print(f"{len(waves)} ADPCM wavetables, {total / 1e6:.2f} MB, {samples} samples, best of {repeat}")
+    results = {}
+    backends = [("native", True)] if vadpcm.native() is not None else []
+    backends.append(("python", False))
+    for name, use_native in backends:
+        best = None
+        for _ in range(repeat):
+            start = time.perf_counter()
+            out = [vadpcm.decode(data, w.book, w.order, w.npredictors, use_native) for w, data in waves]
+            elapsed = time.perf_counter() - start
+            best = elapsed if best is None else min(best, elapsed)
+        results[name] = out
+        print(f"{name:8}{best * 1e3:10.1f} ms{samples / best / 1e6:10.2f} Msamples/s")
+    if len(results) > 1:
+        for a, b in zip(results["native"], results["python"]):
+            assert (a == b).all()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Extract audio banks and sequences from the ROM")
+    parser.add_argument("--rom", type=Path, default=Path("pokemonsnap.z64"))
+    parser.add_argument("--yaml", type=Path, default=Path("splat.yaml"))
+    parser.add_argument("--out", type=Path, default=Path("assets"), help="output directory (default: %(default)s)")
+    parser.add_argument("--cache", type=Path, default=audio_format.SAMPLE_CACHE_DIR, help="decoded sample cache (default: %(default)s)")
+    parser.add_argument("--bench", action="store_true", help="time VADPCM decoding instead of extracting")
+    parser.add_argument("--repeat", type=int, default=3)
+    args = parser.parse_args()
+
+    segments = audio_segments(args.yaml)
+    try:
+        rom = open(args.rom, "rb")
+    except OSError as e:
+        sys.exit(f"audio_extract: {e}")
+    with rom:
+        if args.bench:
+            bench(rom, segments, args.repeat)
+        else:
+            extract(rom, segments, args.out, SampleCache(args.cache))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,673 @@
+# Layout of the N64 audio library's sound banks and compressed sequences,
+# shared by the snap_bank and snap_seq splat extensions and audio_extract.py.
+#
+# A bank file (.ctl) is an ALBankFile whose pointers are offsets from its own
+# start; alBnkfNew() in ultralib/src/audio/bnkf.c patches them in place. Its
+# wavetables point into a separate wave table file (.tbl) that holds the
+# VADPCM or raw 16-bit sample data. A compressed sequence is an ALCMidiHdr
+# (16 track offsets and a division) followed by MIDI-like track data; see
+# alCSeqNew() and __getTrackByte() in ultralib/src/audio/cseq.c.
+#
+# Everything is read through a Reader, so a bank can be parsed straight from
+# the ROM file without loading it: only the structs and the sample data of
+# each wavetable are ever read.
+
+import hashlib
+import os
+import struct
+from dataclasses import dataclass, field
+from pathlib import Path
+from typing import BinaryIO, Dict, List, Optional, Tuple
+
+import numpy as np
+
+import vadpcm
+
+AL_BANK_VERSION = 0x4231  # 'B1'
+AL_ADPCM_WAVE = 0
+AL_RAW16_WAVE = 1
+
+CSEQ_HEADER_SIZE = 0x44
+AL_MIDI_META = 0xFF
+AL_MIDI_META_TEMPO = 0x51
+AL_MIDI_META_EOT = 0x2F
+AL_CMIDI_BLOCK_CODE = 0xFE
+AL_CMIDI_LOOPSTART_CODE = 0x2E
+AL_CMIDI_LOOPEND_CODE = 0x2D
+AL_MIDI_NOTE_ON = 0x90
+AL_MIDI_PROGRAM_CHANGE = 0xC0
+AL_MIDI_CHANNEL_PRESSURE = 0xD0
+
+# Where splitting keeps decoded samples between runs
+SAMPLE_CACHE_DIR = Path("build/audio_cache")
+
+# Microseconds per quarter note until the first tempo event, as in MIDI
+DEFAULT_TEMPO = 500000
+
+
+class AudioFormatError(ValueError):
+    pass
+
+
+class Reader:
+    """Random access to part of a larger buffer or file."""
+
+    def __init__(self, size: int):
+        self.size = size
+
+    def _read(self, offset: int, size: int) -> bytes:
+        raise NotImplementedError
+
+    def read(self, offset: int, size: int) -> bytes:
+        if offset < 0 or size < 0 or offset + size > self.size:
+            raise AudioFormatError(f"read of 0x{size:X} bytes at 0x{offset:X} is outside 0x{self.size:X} bytes")
+        return self._read(offset, size)
+
+    def unpack(self, fmt: str, offset: int) -> tuple:
+        return struct.unpack(fmt, self.read(offset, struct.calcsize(fmt)))
+
+
+class BytesReader(Reader):
+    def __init__(self, data, start: int = 0, size: Optional[int] = None):
+        self.view = memoryview(data)
+        self.start = start
+        super().__init__(len(data) - start if size is None else size)
+
+    def _read(self, offset: int, size: int) -> bytes:
+        return bytes(self.view[self.start + offset : self.start + offset + size])
+
+
+class FileReader(Reader):
+    """Seeks and reads as needed, so the file is never loaded whole."""
+
+    def __init__(self, f: BinaryIO, start: int = 0, size: Optional[int] = None):
+        self.f = f
+        self.start = start
+        if size is None:
+            size = os.fstat(f.fileno()).st_size - start
+        super().__init__(size)
+
+    def _read(self, offset: int, size: int) -> bytes:
+        self.f.seek(self.start + offset)
+        data = self.f.read(size)
+        if len(data) != size:
+            raise AudioFormatError(f"short read at 0x{self.start + offset:X}")
+        return data
+
+
+# Banks
+
+
+@dataclass
+class Envelope:
+    attackTime: int
+    decayTime: int
+    releaseTime: int
+    attackVolume: int
+    decayVolume: int
+
+    STRUCT = ">iiiBB"
+
+
+@dataclass
+class KeyMap:
+    velocityMin: int
+    velocityMax: int
+    keyMin: int
+    keyMax: int
+    keyBase: int
+    detune: int
+
+    STRUCT = ">BBBBBb"
+
+
+@dataclass
+class WaveTable:
+    offset: int
+    base: int
+    len: int
+    type: int
+    # ALADPCMBook
+    order: int = 0
+    npredictors: int = 0
+    book: List[int] = field(default_factory=list)
+    # ALADPCMloop or ALRawLoop: start, end and count, in samples
+    loop: Optional[Tuple[int, int, int]] = None
+    loop_state: List[int] = field(default_factory=list)
+
+    STRUCT = ">IiBBxxII"
+
+    @property
+    def type_name(self) -> str:
+        return {AL_ADPCM_WAVE: "adpcm", AL_RAW16_WAVE: "raw16"}.get(self.type, f"unknown{self.type}")
+
+
+@dataclass
+class Sound:
+    offset: int
+    envelope: Envelope
+    keyMap: KeyMap
+    wavetable: WaveTable
+    samplePan: int
+    sampleVolume: int
+
+    STRUCT = ">IIIBBxx"
+
+
+@dataclass
+class Instrument:
+    offset: int
+    volume: int
+    pan: int
+    priority: int
+    tremType: int
+    tremRate: int
+    tremDepth: int
+    tremDelay: int
+    vibType: int
+    vibRate: int
+    vibDepth: int
+    vibDelay: int
+    bendRange: int
+    sounds: List[Sound]
+
+    STRUCT = ">BBBxBBBBBBBBhh"
+
+
+@dataclass
+class Bank:
+    offset: int
+    sampleRate: int
+    percussion: Optional[Instrument]
+    instruments: List[Optional[Instrument]]
+
+
+@dataclass
+class BankFile:
+    revision: int
+    banks: List[Optional[Bank]]
+    # Every wavetable in the file, by offset, in the order they were found
+    wavetables: Dict[int, WaveTable]
+
+
+class _BankParser:
+    """Follows the offsets the way alBnkfNew() patches them, parsing shared
+    structs once."""
+
+    def __init__(self, ctl: Reader):
+        self.ctl = ctl
+        self.instruments: Dict[int, Instrument] = {}
+        self.sounds: Dict[int, Sound] = {}
+        self.wavetables: Dict[int, WaveTable] = {}
+
+    def wavetable(self, offset: int) -> WaveTable:
+        if offset in self.wavetables:
+            return self.wavetables[offset]
+        base, length, kind, _flags, ptr1, ptr2 = self.ctl.unpack(WaveTable.STRUCT, offset)
+        wave = WaveTable(offset, base, length, kind)
+        if kind == AL_ADPCM_WAVE:
+            loop, book = ptr1, ptr2
+            wave.order, wave.npredictors = self.ctl.unpack(">ii", book)
+            if not (1 <= wave.order <= vadpcm.MAX_ORDER and 1 <= wave.npredictors <= vadpcm.MAX_PREDICTORS):
+                raise AudioFormatError(f"wavetable at 0x{offset:X} has a bad codebook")
+            count = wave.order * wave.npredictors * 8
+            wave.book = list(self.ctl.unpack(f">{count}h", book + 8))
+            if loop:
+                start, end, loop_count, *state = self.ctl.unpack(">III16h", loop)
+                wave.loop = (start, end, loop_count)
+                wave.loop_state = state
+        elif kind == AL_RAW16_WAVE:
+            if ptr1:
+                wave.loop = self.ctl.unpack(">III", ptr1)
+        else:
+            raise AudioFormatError(f"wavetable at 0x{offset:X} has unknown type {kind}")
+        self.wavetables[offset] = wave
+        return wave
+
+    def sound(self, offset: int) -> Sound:
+        if offset not in self.sounds:
+            envelope, keymap, wavetable, pan, volume = self.ctl.unpack(Sound.STRUCT, offset)
+            self.sounds[offset] = Sound(
+                offset,
+                Envelope(*self.ctl.unpack(Envelope.STRUCT, envelope)),
+                KeyMap(*self.ctl.unpack(KeyMap.STRUCT, keymap)),
+                self.wavetable(wavetable),
+                pan,
+                volume,
+            )
+        return self.sounds[offset]
+
+    def instrument(self, offset: int) -> Instrument:
+        if offset not in self.instruments:
+            *fields, sound_count = self.ctl.unpack(Instrument.STRUCT, offset)
+            sounds = self.ctl.unpack(f">{sound_count}I", offset + 0x10) if sound_count > 0 else ()
+            self.instruments[offset] = Instrument(offset, *fields, [self.sound(s) for s in sounds])
+        return self.instruments[offset]
+
+    def bank(self, offset: int) -> Bank:
+        inst_count, _flags, sample_rate, percussion = self.ctl.unpack(">hBxiI", offset)
+        insts = self.ctl.unpack(f">{inst_count}I", offset + 0xC) if inst_count > 0 else ()
+        return Bank(
+            offset,
+            sample_rate,
+            self.instrument(percussion) if percussion else None,
+            [self.instrument(i) if i else None for i in insts],
+        )
+
+
+def parse_bank_file(ctl: Reader) -> BankFile:
+    revision, bank_count = ctl.unpack(">hh", 0)
+    if revision != AL_BANK_VERSION:
+        raise AudioFormatError(f"not a bank file: revision 0x{revision & 0xFFFF:04X}, expected 0x{AL_BANK_VERSION:04X}")
+    parser = _BankParser(ctl)
+    offsets = ctl.unpack(f">{bank_count}I", 4) if bank_count > 0 else ()
+    banks = [parser.bank(o) if o else None for o in offsets]
+    return BankFile(revision, banks, parser.wavetables)
+
+
+def wave_samples(wave: WaveTable) -> int:
+    if wave.type == AL_ADPCM_WAVE:
+        return wave.len // vadpcm.FRAME_BYTES * vadpcm.FRAME_SAMPLES
+    return wave.len // 2
+
+
+def decode_wave(wave: WaveTable, data: bytes) -> np.ndarray:
+    """The wavetable's samples as int16 PCM."""
+    if wave.type == AL_ADPCM_WAVE:
+        return vadpcm.decode(data, wave.book, wave.order, wave.npredictors)
+    return np.frombuffer(data[: len(data) // 2 * 2], dtype=">i2").astype(np.int16)
+
+
+class SampleCache:
+    """Decoded samples, stored under a hash of everything decoding depends
+    on: the wave data, its codebook and the decoder's source. Wavetables
+    shared between banks, or unchanged since the last split, are only decoded
+    once."""
+
+    SOURCES = [Path(__file__), Path(vadpcm.__file__), vadpcm.SOURCE_PATH]
+
+    def __init__(self, directory: Optional[Path]):
+        self.directory = directory
+        self._code_hash: Optional[str] = None
+        self.hits = self.misses = 0
+
+    def key(self, wave: WaveTable, data: bytes) -> str:
+        if self._code_hash is None:
+            h = hashlib.sha1()
+            for path in self.SOURCES:
+                h.update(path.read_bytes())
+            self._code_hash = h.hexdigest()
+        h = hashlib.sha1(self._code_hash.encode())
+        h.update(struct.pack(">iii", wave.type, wave.order, wave.npredictors))
+        h.update(struct.pack(f">{len(wave.book)}h", *wave.book))
+        h.update(data)
+        return h.hexdigest()
+
+    def decode(self, wave: WaveTable, data: bytes) -> np.ndarray:
+        if self.directory is None:
+            return decode_wave(wave, data)
+        key = self.key(wave, data)
+        path = self.directory / key[:2] / f"{key}.pcm"
+        try:
+            samples = np.frombuffer(path.read_bytes(), dtype="<i2").astype(np.int16)
+            if len(samples) == wave_samples(wave):
+                self.hits += 1
+                return samples
+        except OSError:
+            pass
+        self.misses += 1
+        samples = decode_wave(wave, data)
+        path.parent.mkdir(parents=True, exist_ok=True)
+        write_if_changed(path, samples.astype("<i2").tobytes())
+        return samples
+
+
+def wave_name(wave: WaveTable) -> str:
+    return f"{wave.base:06X}.wav"
+
+
+def bank_descriptor(bank_file: BankFile, wav_dir: Optional[str]) -> dict:
+    """The bank file as JSON. Wavetables are listed once and referred to by
+    their offset in the file."""
+
+    def inst(i: Optional[Instrument]):
+        if i is None:
+            return None
+        return {
+            "offset": i.offset,
+            **{k: getattr(i, k) for k in Instrument.__dataclass_fields__ if k not in ("offset", "sounds")},
+            "sounds": [
+                {
+                    "offset": s.offset,
+                    "samplePan": s.samplePan,
+                    "sampleVolume": s.sampleVolume,
+                    "envelope": vars(s.envelope),
+                    "keyMap": vars(s.keyMap),
+                    "wavetable": s.wavetable.offset,
+                }
+                for s in i.sounds
+            ],
+        }
+
+    waves = []
+    for wave in bank_file.wavetables.values():
+        entry = {
+            "offset": wave.offset,
+            "base": wave.base,
+            "len": wave.len,
+            "type": wave.type_name,
+            "samples": wave_samples(wave),
+        }
+        if wave.type == AL_ADPCM_WAVE:
+            entry["book"] = {"order": wave.order, "npredictors": wave.npredictors, "coefs": wave.book}
+        if wave.loop is not None:
+            entry["loop"] = {"start": wave.loop[0], "end": wave.loop[1], "count": wave.loop[2]}
+            if wave.loop_state:
+                entry["loop"]["state"] = wave.loop_state
+        if wav_dir is not None:
+            entry["wav"] = f"{wav_dir}/{wave_name(wave)}"
+        waves.append(entry)
+
+    return {
+        "revision": bank_file.revision,
+        "banks": [
+            None
+            if b is None
+            else {
+                "offset": b.offset,
+                "sampleRate": b.sampleRate,
+                "percussion": inst(b.percussion),
+                "instruments": [inst(i) for i in b.instruments],
+            }
+            for b in bank_file.banks
+        ],
+        "wavetables": waves,
+    }
+
+
+def bank_sample_rate(bank_file: BankFile, wave: WaveTable) -> int:
+    """The rate of the first bank that plays the wavetable, for its WAV."""
+    for bank in bank_file.banks:
+        if bank is None:
+            continue
+        for inst in [bank.percussion] + bank.instruments:
+            if inst is not None and any(s.wavetable is wave for s in inst.sounds):
+                return bank.sampleRate
+    return 22050
+
+
+def extract_bank(ctl: Reader, tbl: Reader, out_json: Path, wav_dir: Path, cache: SampleCache) -> BankFile:
+    """Write the bank file's descriptor and a WAV per wavetable."""
+    import json
+
+    bank_file = parse_bank_file(ctl)
+    wav_dir.mkdir(parents=True, exist_ok=True)
+    for wave in bank_file.wavetables.values():
+        samples = cache.decode(wave, tbl.read(wave.base, wave.len))
+        loop = [wave.loop[0], wave.loop[1]] if wave.loop is not None and wave.loop[1] > wave.loop[0] else None
+        write_if_changed(wav_dir / wave_name(wave), vadpcm.pcm_wav(samples, bank_sample_rate(bank_file, wave), loop))
+    descriptor = bank_descriptor(bank_file, os.path.relpath(wav_dir, out_json.parent))
+    write_if_changed(out_json, (json.dumps(descriptor, indent=1) + "\n").encode())
+    return bank_file
+
+
+# Compressed sequences
+
+
+@dataclass
+class SeqEvent:
+    tick: int
+    # "midi", "tempo", "loopstart", "loopend" or "end"
+    kind: str
+    status: int = 0
+    byte1: int = 0
+    byte2: int = 0
+    # Note length in ticks, for note-ons, which have no matching note-off
+    duration: int = 0
+    # Microseconds per quarter note, for tempo events
+    tempo: int = 0
+    # For loop ends: the loop count and how far back the loop start is
+    loop_count: int = 0
+    loop_offset: int = 0
+
+
+@dataclass
+class SeqTrack:
+    index: int
+    offset: int
+    events: List[SeqEvent]
+
+
+@dataclass
+class CompressedSeq:
+    division: int
+    tracks: List[SeqTrack]
+
+
+class _TrackStream:
+    """A track's bytes with the compression undone: AL_CMIDI_BLOCK_CODE
+    followed by a 16-bit distance and a length repeats earlier bytes, and a
+    doubled block code stands for the byte itself."""
+
+    def __init__(self, data: bytes, pos: int):
+        self.data = data
+        self.pos = pos
+        self.backup_pos = 0
+        self.backup_len = 0
+
+    def _raw(self) -> int:
+        if self.pos >= len(self.data):
+            raise AudioFormatError("track runs past the end of the sequence")
+        b = self.data[self.pos]
+        self.pos += 1
+        return b
+
+    def byte(self) -> int:
+        if self.backup_len:
+            b = self.data[self.backup_pos]
+            self.backup_pos += 1
+            self.backup_len -= 1
+            return b
+        b = self._raw()
+        if b == AL_CMIDI_BLOCK_CODE:
+            hi = self._raw()
+            if hi != AL_CMIDI_BLOCK_CODE:
+                lo = self._raw()
+                length = self._raw()
+                self.backup_pos = self.pos - (((hi << 8) | lo) + 4)
+                if self.backup_pos < 0 or length == 0:
+                    raise AudioFormatError("bad back-reference in track")
+                self.backup_len = length
+                return self.byte()
+        return b
+
+    def var_len(self) -> int:
+        value = self.byte()
+        if value & 0x80:
+            value &= 0x7F
+            while True:
+                c = self.byte()
+                value = (value << 7) + (c & 0x7F)
+                if not c & 0x80:
+                    break
+        return value
+
+
+def is_compressed_seq(data: bytes) -> bool:
+    if len(data) < CSEQ_HEADER_SIZE:
+        return False
+    *offsets, division = struct.unpack(">16II", data[:CSEQ_HEADER_SIZE])
+    return (
+        0 < division < 0x10000
+        and any(offsets)
+        and all(o == 0 or CSEQ_HEADER_SIZE <= o < len(data) for o in offsets)
+    )
+
+
+def parse_compressed_seq(data: bytes) -> CompressedSeq:
+    """Read every track to its end of track event. Loops aren't followed, so
+    each event appears once, at the tick it first plays."""
+    if not is_compressed_seq(data):
+        raise AudioFormatError("not a compressed sequence")
+    *offsets, division = struct.unpack(">16II", data[:CSEQ_HEADER_SIZE])
+    tracks = []
+    for index, offset in enumerate(offsets):
+        if not offset:
+            continue
+        stream = _TrackStream(data, offset)
+        events = []
+        tick = stream.var_len()
+        last_status = 0
+        while True:
+            status = stream.byte()
+            if status == AL_MIDI_META:
+                kind = stream.byte()
+                if kind == AL_MIDI_META_TEMPO:
+                    b1, b2, b3 = stream.byte(), stream.byte(), stream.byte()
+                    events.append(SeqEvent(tick, "tempo", tempo=(b1 << 16) | (b2 << 8) | b3))
+                elif kind == AL_MIDI_META_EOT:
+                    events.append(SeqEvent(tick, "end"))
+                    break
+                elif kind == AL_CMIDI_LOOPSTART_CODE:
+                    stream.byte()
+                    stream.byte()
+                    events.append(SeqEvent(tick, "loopstart"))
+                elif kind == AL_CMIDI_LOOPEND_CODE:
+                    # Read straight from the track, like alCSeqNextEvent()
+                    if stream.pos + 6 > len(data):
+                        raise AudioFormatError("loop end runs past the end of the sequence")
+                    count, _current, back = struct.unpack(">BBI", data[stream.pos : stream.pos + 6])
+                    stream.pos += 6
+                    events.append(SeqEvent(tick, "loopend", loop_count=count, loop_offset=back))
+                last_status = 0
+            else:
+                event = SeqEvent(tick, "midi")
+                if status & 0x80:
+                    event.status, event.byte1 = status, stream.byte()
+                    last_status = status
+                else:
+                    if not last_status:
+                        raise AudioFormatError(f"track {index} uses running status with no status")
+                    event.status, event.byte1 = last_status, status
+                if event.status & 0xF0 not in (AL_MIDI_PROGRAM_CHANGE, AL_MIDI_CHANNEL_PRESSURE):
+                    event.byte2 = stream.byte()
+                    if event.status & 0xF0 == AL_MIDI_NOTE_ON:
+                        event.duration = stream.var_len()
+                events.append(event)
+            tick += stream.var_len()
+        tracks.append(SeqTrack(index, offset, events))
+    return CompressedSeq(division, tracks)
+
+
+def seq_descriptor(seq: CompressedSeq, midi_name: Optional[str]) -> dict:
+    tempos = sorted((e.tick, e.tempo) for t in seq.tracks for e in t.events if e.kind == "tempo")
+    end = max((e.tick + e.duration for t in seq.tracks for e in t.events), default=0)
+
+    # Length in seconds through the tempo map
+    seconds = 0.0
+    tick, tempo = 0, DEFAULT_TEMPO
+    for at, new_tempo in tempos + [(end, 0)]:
+        seconds += (at - tick) * tempo / (seq.division * 1e6)
+        tick, tempo = at, new_tempo
+
+    tracks = []
+    for t in seq.tracks:
+        midi = [e for e in t.events if e.kind == "midi"]
+        tracks.append(
+            {
+                "index": t.index,
+                "offset": t.offset,
+                "events": len(t.events),
+                "notes": sum(e.status & 0xF0 == AL_MIDI_NOTE_ON for e in midi),
+                "channels": sorted({e.status & 0xF for e in midi}),
+                "programs": sorted({e.byte1 for e in midi if e.status & 0xF0 == AL_MIDI_PROGRAM_CHANGE}),
+                "end_tick": t.events[-1].tick if t.events else 0,
+                "loops": [
+                    {"tick": e.tick, "kind": e.kind, **({"count": e.loop_count} if e.kind == "loopend" else {})}
+                    for e in t.events
+                    if e.kind in ("loopstart", "loopend")
+                ],
+            }
+        )
+    descriptor = {
+        "format": "cseq",
+        "division": seq.division,
+        "ticks": end,
+        "seconds": round(seconds, 3),
+        "tempos": [{"tick": at, "usec_per_quarter": t} for at, t in tempos],
+        "tracks": tracks,
+    }
+    if midi_name is not None:
+        descriptor["midi"] = midi_name
+    return descriptor
+
+
+def _var_len_bytes(value: int) -> bytes:
+    out = [value & 0x7F]
+    value >>= 7
+    while value:
+        out.append(0x80 | (value & 0x7F))
+        value >>= 7
+    return bytes(reversed(out))
+
+
+def seq_to_midi(seq: CompressedSeq) -> bytes:
+    """A format 1 standard MIDI file. Note-ons get note-offs after their
+    duration, and loop points become marker events."""
+    chunks = []
+    for track in seq.tracks:
+        timed: List[Tuple[int, int, bytes]] = []
+        for order, e in enumerate(track.events):
+            if e.kind == "midi":
+                size = 2 if e.status & 0xF0 in (AL_MIDI_PROGRAM_CHANGE, AL_MIDI_CHANNEL_PRESSURE) else 3
+                timed.append((e.tick, order * 2 + 1, bytes((e.status, e.byte1, e.byte2))[:size]))
+                if e.status & 0xF0 == AL_MIDI_NOTE_ON:
+                    # Note-offs sort before anything else on the same tick
+                    timed.append((e.tick + e.duration, 0, bytes((0x80 | (e.status & 0xF), e.byte1, 0))))
+            elif e.kind == "tempo":
+                timed.append((e.tick, order * 2 + 1, b"\xFF\x51\x03" + e.tempo.to_bytes(3, "big")))
+            elif e.kind in ("loopstart", "loopend"):
+                text = e.kind if e.kind == "loopstart" else f"loopend {e.loop_count}"
+                timed.append((e.tick, order * 2 + 1, b"\xFF\x06" + _var_len_bytes(len(text)) + text.encode()))
+        timed.sort(key=lambda t: (t[0], t[1]))
+
+        body = bytearray()
+        tick = 0
+        for at, _, message in timed:
+            body += _var_len_bytes(at - tick) + message
+            tick = at
+        end = max(tick, track.events[-1].tick if track.events else 0)
+        body += _var_len_bytes(end - tick) + b"\xFF\x2F\x00"
+        chunks.append(b"MTrk" + struct.pack(">I", len(body)) + bytes(body))
+    header = b"MThd" + struct.pack(">IHHH", 6, 1, len(chunks), seq.division)
+    return header + b"".join(chunks)
+
+
+def extract_seq(data: bytes, out_json: Path, out_midi: Path) -> Optional[CompressedSeq]:
+    """Write the sequence's descriptor and, for compressed sequences, a
+    standard MIDI file. Sequences that are already standard MIDI files are
+    only described by their header; anything else gets no descriptor."""
+    import json
+
+    if data[:4] == b"MThd" and len(data) >= 14:
+        _, fmt, ntracks, division = struct.unpack(">IHHH", data[4:14])
+        descriptor = {"format": "midi", "type": fmt, "tracks": ntracks, "division": division}
+        write_if_changed(out_json, (json.dumps(descriptor, indent=1) + "\n").encode())
+        return None
+    seq = parse_compressed_seq(data)
+    write_if_changed(out_midi, seq_to_midi(seq))
+    descriptor = seq_descriptor(seq, out_midi.name)
+    write_if_changed(out_json, (json.dumps(descriptor, indent=1) + "\n").encode())
+    return seq
+
+
+def write_if_changed(path: Path, data: bytes):
+    """Atomically replace path with data, unless it already holds it."""
+    try:
+        if path.read_bytes() == data:
+            return
+    except OSError:
+        pass
+    tmp_path = path.with_name(f".{path.name}.{os.getpid()}.tmp")
+    tmp_path.write_bytes(data)
+    os.replace(tmp_path, path)
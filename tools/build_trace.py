@@ -0,0 +1,457 @@
+#!/usr/bin/env python3
+# Build timeline: turn the last build in .ninja_log into a Chrome trace
+# (chrome://tracing or https://ui.perfetto.dev) and summarise where the time
+# went.
+#
+# ninja only knows how long each command took. When the project is configured
+# with --timings, tools/asm_processor/build.py also records the phases of
+# every C file (asm_processor preprocessing, IDO cpp, IDO cc, post-processing
+# split into assembling the GLOBAL_ASM blocks and fixing up the ELF, object
+# cache lookups and stores) under build/timings, and configure.py records
+# splat. Those show up nested under the ninja job they belong to.
+#
+# The summary lists the time spent per rule and per compiler phase, the
+# slowest translation units, and the critical path: the chain of jobs, linked
+# through build.ninja, that no amount of parallelism could make any shorter.
+#
+#   ./configure.py --timings && ninja
+#   build_trace.py [-o build/trace.json] [--top N] [--json summary.json]
+
+import argparse
+import json
+import os
+import sys
+import tempfile
+import time
+from collections import defaultdict
+from contextlib import contextmanager
+from pathlib import Path
+from typing import Dict, List, Optional, Tuple
+
+script_dir = os.path.dirname(os.path.realpath(__file__))
+root_dir = os.path.abspath(os.path.join(script_dir, ".."))
+
+DEFAULT_TIMINGS_DIR = os.path.join(root_dir, "build", "timings")
+
+# How far a timings record may be from where its ninja job says it should be
+# before it's taken to be left over from an earlier build, in seconds
+MAX_SKEW = 5.0
+
+# Phases that are recorded within another one
+SUBPHASES = {"assemble": "post-process", "fixup": "post-process"}
+
+
+class PhaseTimer:
+    """Records named phases of one job as wall-clock intervals."""
+
+    def __init__(self):
+        self.start = time.time()
+        self.phases: List[Tuple[str, float, float]] = []
+
+    def add(self, name: str, start: float, end: float):
+        self.phases.append((name, start, end))
+
+    @contextmanager
+    def phase(self, name: str):
+        start = time.time()
+        try:
+            yield
+        finally:
+            self.add(name, start, time.time())
+
+    def write(self, timings_dir: Optional[Path], output, cached: bool = False):
+        """Store the phases of the job that built `output`, if timings are on."""
+        if timings_dir is None:
+            return
+        path = timings_path(timings_dir, str(output))
+        record = {
+            "output": str(output),
+            "start": self.start,
+            "end": time.time(),
+            "cached": cached,
+            "phases": [{"name": name, "start": start, "end": end} for name, start, end in self.phases],
+        }
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        fd, tmp_name = tempfile.mkstemp(dir=os.path.dirname(path), suffix=".tmp")
+        with os.fdopen(fd, "w") as f:
+            json.dump(record, f)
+        os.replace(tmp_name, path)
+
+
+def timings_path(timings_dir, output: str) -> str:
+    return os.path.join(timings_dir, os.path.normpath(output).lstrip(os.sep) + ".json")
+
+
+class Job:
+    """One command ninja ran, and every output it produced."""
+
+    def __init__(self, start: int, end: int, cmd_hash: str):
+        self.start = start  # ms since the build started
+        self.end = end
+        self.cmd_hash = cmd_hash
+        self.outputs: List[str] = []
+        self.rule: Optional[str] = None
+        self.timings: Optional[dict] = None
+
+    @property
+    def duration(self) -> int:
+        return self.end - self.start
+
+    @property
+    def name(self) -> str:
+        return self.outputs[0] + (f" (+{len(self.outputs) - 1})" if len(self.outputs) > 1 else "")
+
+
+def read_ninja_log(path: str) -> List[Job]:
+    """The jobs of the most recent build in a .ninja_log (format v5 or v6).
+
+    ninja appends to the log on every build, with times relative to the start
+    of that build, so a new build starts wherever the end times go backwards."""
+    with open(path) as f:
+        header = f.readline()
+        if not header.startswith("# ninja log v"):
+            raise ValueError(f"{path} is not a ninja log")
+        builds: List[List[Tuple[int, int, str, str]]] = [[]]
+        last_end = 0
+        for line in f:
+            fields = line.rstrip("\n").split("\t")
+            if len(fields) != 5:
+                continue
+            start, end, _, output, cmd_hash = fields
+            entry = (int(start), int(end), output, cmd_hash)
+            if entry[1] < last_end:
+                builds.append([])
+            last_end = entry[1]
+            builds[-1].append(entry)
+
+    # A later entry for the same output (a restarted build) wins
+    latest: Dict[str, Tuple[int, int, str, str]] = {}
+    for entry in builds[-1]:
+        latest[entry[2]] = entry
+
+    jobs: Dict[Tuple[int, int, str], Job] = {}
+    for start, end, output, cmd_hash in latest.values():
+        key = (start, end, cmd_hash)
+        if key not in jobs:
+            jobs[key] = Job(start, end, cmd_hash)
+        jobs[key].outputs.append(output)
+    return sorted(jobs.values(), key=lambda job: (job.start, job.end))
+
+
+def ninja_split(text: str) -> List[str]:
+    """Split a build statement's paths on unescaped spaces, unescaping them."""
+    words = []
+    word = []
+    i = 0
+    while i < len(text):
+        c = text[i]
+        if c == "$" and i + 1 < len(text):
+            word.append(text[i + 1])
+            i += 2
+            continue
+        if c == " ":
+            if word:
+                words.append("".join(word))
+                word = []
+        else:
+            word.append(c)
+        i += 1
+    if word:
+        words.append("".join(word))
+    return words
+
+
+def find_unescaped(text: str, char: str) -> int:
+    i = 0
+    while i < len(text):
+        if text[i] == "$":
+            i += 2
+            continue
+        if text[i] == char:
+            return i
+        i += 1
+    return -1
+
+
+def read_build_graph(path: str) -> Tuple[Dict[str, str], Dict[str, List[str]]]:
+    """The rule and the inputs (explicit, implicit and order-only) of every
+    output in a build.ninja. Variables in paths aren't expanded, which
+    configure.py never needs."""
+    rules: Dict[str, str] = {}
+    inputs: Dict[str, List[str]] = {}
+    with open(path) as f:
+        text = f.read().replace("$\n", "")
+    for line in text.splitlines():
+        if not line.startswith("build "):
+            continue
+        line = line[len("build ") :]
+        colon = find_unescaped(line, ":")
+        if colon < 0:
+            continue
+        outputs = [o for o in ninja_split(line[:colon]) if o != "|"]
+        rule, *ins = ninja_split(line[colon + 1 :])
+        ins = [i for i in ins if i not in ("|", "||", "|@")]
+        for output in outputs:
+            rules[output] = rule
+            inputs[output] = ins
+    return rules, inputs
+
+
+def attach_timings(jobs: List[Job], timings_dir: str) -> Optional[float]:
+    """Give each job the timings record of its outputs, if there's a current
+    one, and work out when (in seconds since the epoch) the build started."""
+    candidates = []
+    for job in jobs:
+        for output in job.outputs:
+            try:
+                with open(timings_path(timings_dir, output)) as f:
+                    record = json.load(f)
+            except (OSError, ValueError):
+                continue
+            # Line the record up with the end of its job: the phases finish
+            # just before the process exits, while interpreter start-up
+            # delays the beginning by a varying amount
+            candidates.append((record["end"] - job.end / 1000, job, record))
+            break
+    if not candidates:
+        return None
+
+    offsets = sorted(c[0] for c in candidates)
+    build_start = offsets[len(offsets) // 2]
+    for offset, job, record in candidates:
+        if abs(offset - build_start) <= MAX_SKEW:
+            job.timings = record
+    return build_start
+
+
+def assign_lanes(jobs: List[Job]) -> Dict[Job, int]:
+    """Spread jobs over as few rows as possible, like ninja's own -j slots."""
+    lane_free: List[int] = []
+    lanes = {}
+    for job in jobs:
+        for i, free in enumerate(lane_free):
+            if free <= job.start:
+                lane_free[i] = job.end
+                lanes[job] = i
+                break
+        else:
+            lanes[job] = len(lane_free)
+            lane_free.append(job.end)
+    return lanes
+
+
+def phase_events(record: dict, shift: float, lo: float, hi: float, pid: int, tid: int) -> List[dict]:
+    """Trace events for the phases in a timings record, in µs from the start
+    of the build and kept within [lo, hi]."""
+    events = []
+    for phase in record["phases"]:
+        start = max(lo, min(hi, (phase["start"] - shift) * 1e6))
+        end = max(start, min(hi, (phase["end"] - shift) * 1e6))
+        events.append(
+            {"name": phase["name"], "cat": "phase", "ph": "X", "ts": round(start, 1), "dur": round(end - start, 1), "pid": pid, "tid": tid}
+        )
+    return events
+
+
+def trace_events(jobs: List[Job], build_start: Optional[float], configure: Optional[dict]) -> List[dict]:
+    events: List[dict] = [
+        {"name": "process_name", "ph": "M", "pid": 0, "args": {"name": "ninja"}},
+    ]
+    lanes = assign_lanes(jobs)
+    for job in jobs:
+        tid = lanes[job]
+        ts = job.start * 1000
+        end = job.end * 1000
+        args = {"outputs": job.outputs}
+        if job.rule is not None:
+            args["rule"] = job.rule
+        if job.timings is not None and job.timings.get("cached"):
+            args["cached"] = True
+        events.append(
+            {"name": job.name, "cat": job.rule or "job", "ph": "X", "ts": ts, "dur": end - ts, "pid": 0, "tid": tid, "args": args}
+        )
+        if job.timings is not None:
+            # The record's end is the job's end
+            shift = job.timings["end"] - job.end / 1000
+            events += phase_events(job.timings, shift, ts, end, 0, tid)
+
+    if configure is not None:
+        # configure.py runs before ninja, so it usually lands at negative times
+        events.append({"name": "process_name", "ph": "M", "pid": 1, "args": {"name": "configure.py"}})
+        shift = build_start if build_start is not None else configure["end"]
+        start = (configure["start"] - shift) * 1e6
+        end = (configure["end"] - shift) * 1e6
+        events.append(
+            {"name": "configure.py", "cat": "configure", "ph": "X", "ts": round(start, 1), "dur": round(end - start, 1), "pid": 1, "tid": 0}
+        )
+        events += phase_events(configure, shift, start, end, 1, 0)
+    return events
+
+
+def critical_path(jobs: List[Job], inputs: Dict[str, List[str]]) -> List[Job]:
+    """The longest chain of jobs where each one needed the previous one's
+    output. A job can't start before everything it depends on has finished, so
+    going through them in order of start time sees dependencies first."""
+    producer = {output: job for job in jobs for output in job.outputs}
+    finish: Dict[Job, int] = {}
+    prev: Dict[Job, Optional[Job]] = {}
+    for job in sorted(jobs, key=lambda j: j.start):
+        best = None
+        for output in job.outputs:
+            for dep in inputs.get(output, []):
+                dep_job = producer.get(dep)
+                # Order-only inputs that were still running don't count
+                if dep_job is None or dep_job is job or dep_job not in finish or dep_job.end > job.start:
+                    continue
+                if best is None or finish[dep_job] > finish[best]:
+                    best = dep_job
+        finish[job] = job.duration + (finish[best] if best is not None else 0)
+        prev[job] = best
+    if not finish:
+        return []
+    job: Optional[Job] = max(finish, key=lambda j: finish[j])
+    path = []
+    while job is not None:
+        path.append(job)
+        job = prev[job]
+    return path[::-1]
+
+
+def phase_totals(records: List[dict]) -> Dict[str, float]:
+    totals: Dict[str, float] = defaultdict(float)
+    for record in records:
+        for phase in record["phases"]:
+            totals[phase["name"]] += phase["end"] - phase["start"]
+    return totals
+
+
+def summarize(jobs: List[Job], path: List[Job], top: int) -> dict:
+    wall = (max(j.end for j in jobs) - min(j.start for j in jobs)) / 1000 if jobs else 0.0
+    busy = sum(j.duration for j in jobs) / 1000
+
+    by_rule: Dict[str, List[float]] = defaultdict(list)
+    for job in jobs:
+        by_rule[job.rule or "?"].append(job.duration / 1000)
+
+    tus = [j for j in jobs if j.timings is not None]
+    slowest = sorted(jobs, key=lambda j: j.duration, reverse=True)
+    if tus:
+        slowest = sorted(tus, key=lambda j: j.duration, reverse=True)
+
+    return {
+        "jobs": len(jobs),
+        "wall": wall,
+        "busy": busy,
+        "parallelism": busy / wall if wall else 0.0,
+        "rules": {
+            rule: {"count": len(times), "total": sum(times), "max": max(times)}
+            for rule, times in sorted(by_rule.items(), key=lambda kv: -sum(kv[1]))
+        },
+        "phases": dict(sorted(phase_totals([j.timings for j in tus]).items(), key=lambda kv: -kv[1])),
+        "cached": sum(1 for j in tus if j.timings.get("cached")),
+        "slowest": [
+            {
+                "output": j.outputs[0],
+                "time": j.duration / 1000,
+                "phases": phase_totals([j.timings]) if j.timings is not None else {},
+            }
+            for j in slowest[:top]
+        ],
+        "critical_path": {
+            "length": sum(j.duration for j in path) / 1000,
+            "jobs": [{"output": j.name, "rule": j.rule, "time": j.duration / 1000} for j in path],
+        },
+    }
+
+
+def print_summary(summary: dict, configure: Optional[dict]):
+    wall = summary["wall"]
+    print(f"{summary['jobs']} jobs in {wall:.2f} s, {summary['busy']:.2f} s of work, {summary['parallelism']:.1f}x parallel")
+    if configure is not None:
+        print(f"configure.py took {configure['end'] - configure['start']:.2f} s before that")
+        for name, total in phase_totals([configure]).items():
+            print(f"  {name:24}{total:9.2f} s")
+
+    print("\nTime per rule:")
+    for rule, stats in summary["rules"].items():
+        print(f"  {rule:24}{stats['count']:6}{stats['total']:9.2f} s  (max {stats['max']:.2f} s)")
+
+    if summary["phases"]:
+        compile_time = summary["rules"].get("cc", {}).get("total") or sum(summary["phases"].values())
+        print(f"\nCompiler phases ({summary['cached']} object cache hits):")
+        for name, total in summary["phases"].items():
+            if name in SUBPHASES:
+                continue
+            print(f"  {name:24}{total:9.2f} s  {100 * total / compile_time:5.1f}%")
+            for sub, sub_total in summary["phases"].items():
+                if SUBPHASES.get(sub) == name:
+                    print(f"    {sub:22}{sub_total:9.2f} s  {100 * sub_total / compile_time:5.1f}%")
+
+    print(f"\nSlowest {'translation units' if summary['phases'] else 'jobs'}:")
+    for tu in summary["slowest"]:
+        top_level = {name: t for name, t in tu["phases"].items() if name not in SUBPHASES}
+        phases = ", ".join(f"{name} {t:.2f}" for name, t in sorted(top_level.items(), key=lambda kv: -kv[1]))
+        print(f"  {tu['time']:7.2f} s  {tu['output']}" + (f"  [{phases}]" if phases else ""))
+
+    cp = summary["critical_path"]
+    share = 100 * cp["length"] / wall if wall else 0.0
+    print(f"\nCritical path: {cp['length']:.2f} s ({share:.0f}% of the build), {len(cp['jobs'])} jobs")
+    for job in cp["jobs"]:
+        print(f"  {job['time']:7.2f} s  {job['rule'] or '?':16}{job['output']}")
+
+
+def read_record(path: str) -> Optional[dict]:
+    try:
+        with open(path) as f:
+            return json.load(f)
+    except (OSError, ValueError):
+        return None
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Make a Chrome trace and a summary of the last ninja build")
+    parser.add_argument("--log", default=os.path.join(root_dir, ".ninja_log"), help="ninja log (default: %(default)s)")
+    parser.add_argument("--ninja", default=os.path.join(root_dir, "build.ninja"), help="build file, for rules and the critical path (default: %(default)s)")
+    parser.add_argument("--timings", default=DEFAULT_TIMINGS_DIR, help="per-job phase timings (default: %(default)s)")
+    parser.add_argument("-o", "--output", default=os.path.join(root_dir, "build", "trace.json"), help="trace to write (default: %(default)s)")
+    parser.add_argument("--top", type=int, default=15, help="slowest translation units to list (default: %(default)s)")
+    parser.add_argument("--json", help="also write the summary here as JSON, - for stdout")
+    args = parser.parse_args()
+
+    try:
+        jobs = read_ninja_log(args.log)
+    except (OSError, ValueError) as e:
+        sys.exit(f"can't read the ninja log: {e}")
+
+    inputs: Dict[str, List[str]] = {}
+    if os.path.exists(args.ninja):
+        rules, inputs = read_build_graph(args.ninja)
+        for job in jobs:
+            job.rule = rules.get(job.outputs[0])
+
+    build_start = attach_timings(jobs, args.timings)
+    configure = read_record(os.path.join(args.timings, "configure.json"))
+    if configure is not None and build_start is not None and configure["end"] > build_start + MAX_SKEW:
+        # Written after this build started, so it's for some later one
+        configure = None
+
+    trace = {"traceEvents": trace_events(jobs, build_start, configure), "displayTimeUnit": "ms"}
+    os.makedirs(os.path.dirname(os.path.abspath(args.output)), exist_ok=True)
+    with open(args.output, "w") as f:
+        json.dump(trace, f)
+
+    summary = summarize(jobs, critical_path(jobs, inputs), args.top)
+    if args.json == "-":
+        json.dump(summary, sys.stdout, indent=1)
+        print()
+    else:
+        print_summary(summary, configure)
+        print(f"\nWrote {args.output}")
+        if args.json:
+            with open(args.json, "w") as f:
+                json.dump(summary, f, indent=1)
+                f.write("\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -1,30 +1,177 @@
 #!/usr/bin/python3
+# Look for code hidden in data: scan every *.bin in the tree for MIPS
+# functions.
+#
+# Each file is memory-mapped and decoded in place as big-endian instruction
+# words, a whole file at a time with numpy, so no disassembler is spawned.
+# Files are spread over a process pool. Besides `jr ra`, functions are found
+# by the IDO prologue and epilogue:
+#
+#   addiu sp, sp, -N     start of a function with an N-byte frame
+#   sw    ra, X(sp)      within the first few instructions: not a leaf
+#   addiu sp, sp, N      just before `jr ra` or in its delay slot
+#
+# Every `jr ra` ends a candidate function. It starts at the first prologue
+# after the previous one ended or, failing that, at the first non-zero word
+# (a leaf function). The confidence of each candidate says how much of the
+# pattern matched.
+#
+#   codescan.py [files...] [-j N] [--json report.json]
 
+import argparse
+import json
+import mmap
+import multiprocessing
 import os
-import re
-import subprocess
+import sys
 from pathlib import Path
+from typing import List, Optional, Tuple
+
+import numpy as np
 
 script_dir = os.path.dirname(os.path.realpath(__file__))
 root_dir = os.path.abspath(os.path.join(script_dir, ".."))
 
-import glob, os
-os.chdir(root_dir)
+SKIP = {"pokemonsnap.bin", "rspboot_font.bin"}
+
+JR_RA = 0x03E00008
+ADDIU_SP_SP = 0x27BD0000  # addiu sp, sp, imm
+SW_RA_SP = 0xAFBF0000  # sw ra, imm(sp)
+NOP = 0
+
+# How far into a function the return address may be saved, and how far
+# before `jr ra` the stack may be restored, in instructions
+SAVE_RA_WINDOW = 16
+EPILOGUE_WINDOW = 8
+
+
+def scan_words(words: np.ndarray) -> dict:
+    """Find returns, prologues and candidate functions in a file's words.
+    Offsets in the result are in bytes."""
+    hi = words & 0xFFFF0000
+    imm = (words & 0xFFFF).astype(np.int32)
+    imm = np.where(imm >= 0x8000, imm - 0x10000, imm)
+
+    returns = np.flatnonzero(words == JR_RA)
+    prologue_mask = (hi == ADDIU_SP_SP) & (imm < 0) & (imm % 8 == 0)
+    prologues = np.flatnonzero(prologue_mask)
+    saves_ra = np.flatnonzero(hi == SW_RA_SP)
+    nonzero = np.flatnonzero(words != NOP)
+
+    functions = []
+    prev_end = 0
+    for ret in returns:
+        end = ret + 2  # past the delay slot
+        frame = 0
+        start = None
+        i = np.searchsorted(prologues, prev_end)
+        if i < len(prologues) and prologues[i] < ret:
+            start = int(prologues[i])
+            frame = -int(imm[start])
+        else:
+            i = np.searchsorted(nonzero, prev_end)
+            if i < len(nonzero) and nonzero[i] <= ret:
+                start = int(nonzero[i])
+        if start is None:
+            start = int(ret)
+
+        saved = False
+        restored = False
+        if frame:
+            i = np.searchsorted(saves_ra, start)
+            saved = bool(i < len(saves_ra) and saves_ra[i] < min(start + SAVE_RA_WINDOW, ret))
+            lo = max(start + 1, ret - EPILOGUE_WINDOW)
+            restored = bool(np.any(words[lo : min(end, len(words))] == ADDIU_SP_SP | frame))
+            confidence = "high" if saved and restored else "medium"
+        else:
+            confidence = "low"
+
+        functions.append(
+            {
+                "start": start * 4,
+                "end": int(end) * 4,
+                "frame": frame,
+                "saves_ra": saved,
+                "restores_sp": restored,
+                "confidence": confidence,
+            }
+        )
+        prev_end = end
 
-for f in Path(root_dir).rglob("*.bin"):
-    if f.name in ["pokemonsnap.bin", "rspboot_font.bin"]:
-        continue
+    return {
+        "returns": [int(r) * 4 for r in returns],
+        "prologues": [{"offset": int(p) * 4, "frame": -int(imm[p])} for p in prologues],
+        "functions": functions,
+    }
 
-    ras = []
-    result = subprocess.run(["mips-linux-gnu-objdump", "-Dz",  "-bbinary", "-mmips", "-EB" , f], stdout=subprocess.PIPE)
-    output = result.stdout.decode().split("\n")
 
-    for line in output:
-        if re.match(r".*jr.*ra.*", line):
-            ras.append(line)
+def scan_file(path: str, name: Optional[str] = None) -> Optional[dict]:
+    size = os.path.getsize(path)
+    if size < 4:
+        return None
+    with open(path, "rb") as f, mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) as mm:
+        words = np.frombuffer(mm, dtype=">u4", count=size // 4)
+        result = scan_words(words)
+        # The mapping can't close while a view of it is alive
+        del words
+    if not result["returns"]:
+        return None
+    return {"path": name or path, "size": size, **result}
 
-    if len(ras) > 0:
-        print(f"{f.name} : {len(ras)}")
-        for line in ras:
-            print(line)
+
+def bin_files() -> List[Tuple[str, str]]:
+    """(path, name to report it by) of every *.bin in the repo."""
+    return [
+        (str(f), os.path.relpath(f, root_dir))
+        for f in sorted(Path(root_dir).rglob("*.bin"))
+        if f.name not in SKIP
+    ]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Find MIPS functions in binary files")
+    parser.add_argument("files", nargs="*", type=Path, help="files to scan (default: every *.bin in the repo)")
+    parser.add_argument("-j", "--jobs", type=int, default=os.cpu_count() or 1, help="worker processes (default: %(default)s)")
+    parser.add_argument("--json", type=Path, help="write a JSON report of every candidate function here")
+    parser.add_argument(
+        "--min-confidence",
+        choices=["low", "medium", "high"],
+        default="low",
+        help="only report functions at least this likely (default: %(default)s)",
+    )
+    args = parser.parse_args()
+
+    files = [(str(f), str(f)) for f in args.files] if args.files else bin_files()
+    if args.jobs > 1 and len(files) > 1:
+        with multiprocessing.Pool(min(args.jobs, len(files))) as pool:
+            results = pool.starmap(scan_file, files, chunksize=max(1, len(files) // (args.jobs * 4)))
+    else:
+        results = [scan_file(*f) for f in files]
+    results = [r for r in results if r is not None]
+
+    levels = ["low", "medium", "high"]
+    keep = levels[levels.index(args.min_confidence) :]
+    for r in results:
+        r["functions"] = [fn for fn in r["functions"] if fn["confidence"] in keep]
+
+    for r in results:
+        if not r["functions"] or str(args.json) == "-":
+            continue
+        print(f"{r['path']} : {len(r['returns'])}")
+        for fn in r["functions"]:
+            frame = f" frame 0x{fn['frame']:X}" if fn["frame"] else ""
+            print(f"  0x{fn['start']:06X}-0x{fn['end']:06X} {fn['confidence']}{frame}")
         print("")
+
+    if args.json is not None:
+        report = {"files": [r for r in results if r["functions"]]}
+        if str(args.json) == "-":
+            json.dump(report, sys.stdout, indent=1)
+        else:
+            with open(args.json, "w") as f:
+                json.dump(report, f, indent=1)
+                f.write("\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,58 @@
+# Helpers for reading and writing Makefile-style depfiles that ninja can read
+# with `deps = gcc`.
+
+import os
+import re
+from pathlib import Path
+from typing import Iterable, List
+
+# Line markers in preprocessor output, e.g. `# 12 "include/common.h" 2`
+# (gcc) or `#line 12 "include/common.h"` / `# 12 "include/common.h"` (IDO).
+LINE_MARKER_RE = re.compile(rb'^#\s*(?:line\s+)?\d+\s+"([^"]+)"', re.MULTILINE)
+
+
+def headers_from_preprocessed(preprocessed: bytes) -> List[str]:
+    """List every file a preprocessed translation unit pulled in, in first-seen
+    order, taken from the line markers the preprocessor leaves behind."""
+    seen = {}
+    for match in LINE_MARKER_RE.finditer(preprocessed):
+        name = match.group(1).decode("latin1")
+        if name not in seen:
+            seen[name] = None
+    return [
+        os.path.normpath(name)
+        for name in seen
+        if not name.startswith("<") and os.path.isfile(name)
+    ]
+
+
+def read_mdupdate(path: Path, exclude: Iterable[str] = ()) -> List[str]:
+    """List the dependencies IDO's `-MDupdate <path>` recorded while compiling,
+    in order, leaving out any in exclude. Missing files give an empty list."""
+    try:
+        text = Path(path).read_text(errors="replace")
+    except OSError:
+        return []
+    excluded = {os.path.normpath(name) for name in exclude}
+    seen = {}
+    for line in text.replace("\\\n", " ").splitlines():
+        if line.startswith("#") or ":" not in line:
+            continue
+        for name in line.split(":", 1)[1].split():
+            name = os.path.normpath(name)
+            if name not in excluded:
+                seen[name] = None
+    return list(seen)
+
+
+def escape(path: str) -> str:
+    return path.replace("\\", "/").replace(" ", "\\ ").replace("$", "$$")
+
+
+def write_depfile(depfile: Path, target: Path, deps: Iterable[str]):
+    deps = list(dict.fromkeys(str(d) for d in deps))
+    with open(depfile, "w") as f:
+        f.write(escape(str(target)) + ":")
+        for dep in deps:
+            f.write(" \\\n    " + escape(dep))
+        f.write("\n")
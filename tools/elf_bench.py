@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+# Time libelf on the linked ELF: how long tools wait before they can use it.
+#
+#   eager    read the whole file into memory, then parse every section,
+#            symbol, relocation and .mdebug file descriptor with parse_all()
+#            (all the work, done up front, through the current code)
+#   open     map the file and parse its headers
+#   lookup   open, then find a symbol by name and the symbols at its address
+#   symbols  open, then parse the whole symbol table
+#   mdebug   open, then parse .mdebug
+#
+#   elf_bench.py [build/pokemonsnap.elf] [--repeat N]
+
+import argparse
+import os
+import sys
+import time
+from pathlib import Path
+
+sys.path.insert(0, str(Path(__file__).parent.parent / "ultralib" / "tools"))
+from libelf import ElfFile, SHT_MIPS_DEBUG  # noqa: E402
+
+script_dir = os.path.dirname(os.path.realpath(__file__))
+root_dir = os.path.abspath(os.path.join(script_dir, ".."))
+
+
+def eager(path: str):
+    with open(path, "rb") as f:
+        elf = ElfFile(bytearray(f.read()))
+    elf.parse_all()
+
+
+def open_only(path: str):
+    with ElfFile.open(path):
+        pass
+
+
+def lookup(path: str):
+    with ElfFile.open(path) as elf:
+        if elf.symtab is None:
+            return
+        global_symbols = elf.symtab.global_symbols()
+        if global_symbols:
+            sym = global_symbols[-1]
+            elf.symtab.find_symbol(sym.name)
+            elf.symtab.lookup_symbol(sym.st_value)
+
+
+def symbols(path: str):
+    with ElfFile.open(path) as elf:
+        if elf.symtab is not None:
+            elf.symtab.symbol_entries
+
+
+def mdebug(path: str):
+    with ElfFile.open(path) as elf:
+        section = elf.find_section_by_type(SHT_MIPS_DEBUG)
+        if section is not None:
+            section.fdrs
+
+
+BENCHMARKS = [("eager", eager), ("open", open_only), ("lookup", lookup), ("symbols", symbols), ("mdebug", mdebug)]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Time parsing an ELF file with libelf")
+    parser.add_argument("elf", nargs="?", default=os.path.join(root_dir, "build", "pokemonsnap.elf"))
+    parser.add_argument("--repeat", type=int, default=5)
+    args = parser.parse_args()
+
+    if not os.path.exists(args.elf):
+        sys.exit(f"{args.elf} doesn't exist, build it first")
+
+    with ElfFile.open(args.elf) as elf:
+        nsyms = len(elf.symtab.symbol_entries) if elf.symtab is not None else 0
+        nrels = sum(len(s.relocations) for s in elf.sections if s.is_rel())
+    print(f"{args.elf}: {os.path.getsize(args.elf) / 1e6:.1f} MB, {len(elf.sections)} sections, {nsyms} symbols, {nrels} relocations, best of {args.repeat}")
+
+    for name, fn in BENCHMARKS:
+        best = None
+        for _ in range(args.repeat):
+            start = time.perf_counter()
+            fn(args.elf)
+            elapsed = time.perf_counter() - start
+            best = elapsed if best is None else min(best, elapsed)
+        print(f"{name:10}{best * 1e3:10.1f} ms")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,162 @@
+# Parser for the GNU ld map file written by the `ld` rule.
+
+import re
+from dataclasses import dataclass, field
+from pathlib import Path
+from typing import Dict, List, Optional
+
+OUTPUT_SECTION_RE = re.compile(
+    r"^(\.\S+|/DISCARD/)?\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)(?:\s+load address\s+0x([0-9a-fA-F]+))?\s*$"
+)
+INPUT_SECTION_RE = re.compile(r"^ (\S+)?\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*?)\s*$")
+SYMBOL_RE = re.compile(r"^\s+0x([0-9a-fA-F]+)\s+([^\s=]+)\s*$")
+NAME_ONLY_RE = re.compile(r"^( ?)(\S+)\s*$")
+ASSIGNMENT_RE = re.compile(r"^\s+0x([0-9a-fA-F]+)\s+(?:PROVIDE \()?([\w.$]+) = ")
+
+SEGMENT_SUFFIXES = (".bss", ".noload")
+
+# Sections that take up RAM but no ROM. ld still prints a load address for
+# splat's NOLOAD sections, so go by name instead.
+NOBITS_SECTIONS = {".bss", ".sbss", "COMMON", ".scommon"}
+
+
+@dataclass
+class MapSymbol:
+    name: str
+    vram: int
+    rom: Optional[int]
+    object: str
+    section: str
+
+
+@dataclass
+class MapInput:
+    """One input section, i.e. one object's contribution to an output section."""
+
+    object: str
+    section: str
+    vram: int
+    size: int
+    rom: Optional[int]
+    symbols: List[MapSymbol] = field(default_factory=list)
+
+
+@dataclass
+class MapSection:
+    """One output section (splat emits one or two per segment)."""
+
+    name: str
+    vram: int
+    size: int
+    rom: Optional[int]
+    inputs: List[MapInput] = field(default_factory=list)
+
+    @property
+    def segment(self) -> str:
+        name = self.name.lstrip(".")
+        for suffix in SEGMENT_SUFFIXES:
+            if name.endswith(suffix):
+                name = name[: -len(suffix)]
+        return name
+
+
+def parse(map_path: Path) -> List[MapSection]:
+    """Parse the memory map part of the map file. ROM addresses are only set
+    for sections that occupy ROM."""
+    sections: List[MapSection] = []
+    section: Optional[MapSection] = None
+    inp: Optional[MapInput] = None
+    pending_output: Optional[str] = None
+    pending_input: Optional[str] = None
+    in_map = False
+
+    with open(map_path) as f:
+        for line in f:
+            line = line.rstrip("\n")
+            if not in_map:
+                in_map = line.startswith("Linker script and memory map")
+                continue
+            if not line.strip():
+                continue
+
+            # Long section names go on their own line, with the addresses on
+            # the next one.
+            m = NAME_ONLY_RE.match(line)
+            if m and "0x" not in line and "(" not in line:
+                if m.group(1):
+                    pending_input = m.group(2)
+                else:
+                    pending_output = m.group(2)
+                    section = None
+                    inp = None
+                continue
+
+            if not line.startswith(" ") or pending_output is not None:
+                m = OUTPUT_SECTION_RE.match(line)
+                if m and (m.group(1) or pending_output):
+                    name = m.group(1) or pending_output
+                    pending_output = None
+                    inp = None
+                    if name == "/DISCARD/":
+                        section = None
+                        continue
+                    vram, size = int(m.group(2), 16), int(m.group(3), 16)
+                    rom = int(m.group(4), 16) if m.group(4) else None
+                    if name.endswith(SEGMENT_SUFFIXES):
+                        rom = None
+                    section = MapSection(name, vram, size, rom)
+                    sections.append(section)
+                    continue
+                pending_output = None
+                if not line.startswith(" "):
+                    section = None
+                    continue
+
+            if section is None:
+                continue
+
+            m = INPUT_SECTION_RE.match(line)
+            if m and (m.group(1) or pending_input) and "=" not in line:
+                name = m.group(1) or pending_input
+                pending_input = None
+                vram, size = int(m.group(2), 16), int(m.group(3), 16)
+                rom = None
+                if section.rom is not None and name not in NOBITS_SECTIONS:
+                    rom = section.rom + (vram - section.vram)
+                inp = MapInput(m.group(4), name, vram, size, rom)
+                section.inputs.append(inp)
+                continue
+            pending_input = None
+
+            m = SYMBOL_RE.match(line)
+            if m and inp is not None and "0x" not in m.group(2):
+                vram = int(m.group(1), 16)
+                rom = None
+                if inp.rom is not None:
+                    rom = inp.rom + (vram - inp.vram)
+                inp.symbols.append(MapSymbol(m.group(2), vram, rom, inp.object, inp.section))
+
+    return sections
+
+
+def parse_assignments(map_path: Path) -> Dict[str, int]:
+    """Symbols assigned in linker scripts (undefined_syms.txt, segment
+    bounds), which belong to no object."""
+    symbols: Dict[str, int] = {}
+    with open(map_path) as f:
+        for line in f:
+            m = ASSIGNMENT_RE.match(line)
+            if m:
+                symbols[m.group(2)] = int(m.group(1), 16)
+    return symbols
+
+
+def parse_symbols(map_path: Path) -> Dict[str, int]:
+    """Addresses of every symbol in the map: the ones defined by objects, and
+    the ones assigned in linker scripts."""
+    symbols = parse_assignments(map_path)
+    for section in parse(map_path):
+        for inp in section.inputs:
+            for sym in inp.symbols:
+                symbols[sym.name] = sym.vram
+    return symbols
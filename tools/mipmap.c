@@ -0,0 +1,437 @@
+/*
+ * Mipmap chains as guLoadTextureBlockMipMap() builds them, used by
+ * tools/mipmap.py.
+ *
+ * guLoadTextureBlockMipMap() (ultralib/src/gu/loadtextureblockmipmap.c) copies
+ * a texture into a TMEM image in RDRAM, then makes every smaller level by
+ * reading the one above it back out of that image, 3x3 texels at a time, and
+ * running them through a 1 2 1 / 2 4 2 / 1 2 1 kernel in float. Last it emits
+ * a LoadBlock of the whole image and a tile per level. All of that depends
+ * only on the texel data and a few flags, so it can be done once when the
+ * texture is built:
+ *
+ *   mipmap_generate()      the runtime algorithm, quirks included, on a
+ *                          zeroed buffer
+ *   mipmap_display_list()  the commands stuffDisplayList() emits
+ *   mipmap_load()          the baked alternative: copy a stored image (the
+ *                          DMA) and emit the same commands from its stored
+ *                          tiles
+ *
+ * The quirks kept, so a baked chain loads into TMEM byte for byte as the
+ * runtime one does:
+ *   - a level is filtered from rows and columns 0, 2, 4, ... of the level
+ *     above, so odd sizes write one texel or row past the level, into the
+ *     padding or the next level's space (4-bit texels are ORed in, which is
+ *     why the buffer has to start zeroed)
+ *   - when TMEM runs out (error 1) the level that didn't fit still gets a tile
+ *   - the LoadBlock asks for length rather than length - 1 texels, so one
+ *     more texel than the chain is loaded, and at most 2048 either way
+ *
+ * Every kernel sum is a small integer, which float holds exactly, so
+ * (int)(sum / 16.0 + 0.5) is (sum + 8) >> 4. The numpy port in mipmap.py uses
+ * the latter; this file keeps the float math to cost what the runtime costs.
+ *
+ * Build: cc -O3 -shared -fPIC -o libmipmap.so mipmap.c (mipmap.py does this itself, into build/tools/)
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+enum { FMT_RGBA, FMT_YUV, FMT_CI, FMT_IA, FMT_I };
+enum { SIZ_4b, SIZ_8b, SIZ_16b, SIZ_32b };
+
+#define MIPMAP_EINVAL (-1)
+
+/* Return values of guLoadTextureBlockMipMap() */
+#define MIPMAP_ETMEM 1   /* not every level fits, the rest are left out */
+#define MIPMAP_EFORMAT 2 /* can't filter this format */
+
+#define TRAM_SIZE 4096
+#define TRAM_WSIZE 8
+#define TRAM_LSIZE 8
+#define MM_MAX_LEVEL 7
+#define MM_MIN_SIZE 1
+
+/* Generation can write a row past the last level that fits */
+#define MIPMAP_BUF_SIZE (2 * TRAM_SIZE)
+
+/* The LoadBlock's extra texel can be one past a full TMEM */
+#define MIPMAP_LOAD_SIZE (TRAM_SIZE + TRAM_LSIZE)
+
+#define LDBLK_MAX_TXL 2047
+
+/* Tiles are w (line width in texels, padded to a TMEM line), s, t, addr */
+#define TILE_W 0
+#define TILE_S 1
+#define TILE_T 2
+#define TILE_ADDR 3
+
+/* Stored chains: an 8-byte header, a tile per level, the image */
+#define BLOB_HEADER 8
+#define BLOB_TILE 8
+
+/* texel size in nibbles, and log2 of the TMEM line size in texels, less one */
+static const int txlsizes[4] = { 1, 2, 4, 8 };
+static const int shifts[4] = { 3, 2, 1, 0 };
+
+/* RDP commands, laid out as in gbi.h */
+#define G_SETTIMG 0xFD
+#define G_SETTILE 0xF5
+#define G_LOADBLOCK 0xF3
+#define G_SETTILESIZE 0xF2
+#define G_RDPLOADSYNC 0xE6
+#define G_TX_LOADTILE 7
+#define G_TEXTURE_IMAGE_FRAC 2
+
+#define SHIFTL(v, s, w) (((uint32_t) (v) & ((1u << (w)) - 1)) << (s))
+
+static uint32_t *set_tile(uint32_t *out, int fmt, int siz, int line, int tmem, int tile, int pal, int cmt, int maskt,
+                          int shiftt, int cms, int masks, int shifts) {
+    out[0] = SHIFTL(G_SETTILE, 24, 8) | SHIFTL(fmt, 21, 3) | SHIFTL(siz, 19, 2) | SHIFTL(line, 9, 9) | SHIFTL(tmem, 0, 9);
+    out[1] = SHIFTL(tile, 24, 3) | SHIFTL(pal, 20, 4) | SHIFTL(cmt, 18, 2) | SHIFTL(maskt, 14, 4) | SHIFTL(shiftt, 10, 4) |
+             SHIFTL(cms, 8, 2) | SHIFTL(masks, 4, 4) | SHIFTL(shifts, 0, 4);
+    return out + 2;
+}
+
+static uint32_t *load_tile_generic(uint32_t *out, int cmd, int tile, int uls, int ult, int lrs, int lrt) {
+    out[0] = SHIFTL(cmd, 24, 8) | SHIFTL(uls, 12, 12) | SHIFTL(ult, 0, 12);
+    out[1] = SHIFTL(tile, 24, 3) | SHIFTL(lrs, 12, 12) | SHIFTL(lrt, 0, 12);
+    return out + 2;
+}
+
+/* Texels (4-bit ones as 8-bit) the LoadBlock moves, in bytes */
+static uint32_t load_bytes(int siz, uint32_t length) {
+    if (siz == SIZ_4b) {
+        length /= 2;
+        return (length < LDBLK_MAX_TXL ? length : LDBLK_MAX_TXL) + 1;
+    }
+    return ((length < LDBLK_MAX_TXL ? length : LDBLK_MAX_TXL) + 1) * txlsizes[siz] / 2;
+}
+
+/* get3x3(): the texels at (s[i], t[i]) of a tile */
+static void get3x3(const uint8_t *tram, const int32_t *tile, const int *s, const int *t, int *texel, int shift, int siz) {
+    int txlsize = txlsizes[siz];
+    int i;
+
+    for (i = 0; i < 9; i++) {
+        unsigned int ss = s[i], tt = t[i];
+        int bank = (((ss & (0x3 << (shift - 1))) >> (shift - 1)) ^ ((tt & 0x1) << 1)) << 1;
+        int row = (((tt * tile[TILE_W] + ss) * txlsize) >> 1) / TRAM_LSIZE;
+        unsigned int addr = tile[TILE_ADDR] + row * TRAM_WSIZE + bank;
+
+        switch (siz) {
+            case SIZ_4b:
+                texel[i] = tram[addr + ((ss & 0x2) >> 1)] & (0xF0 >> ((ss & 0x1) << 2));
+                if (!(ss & 0x1)) {
+                    texel[i] >>= 4;
+                }
+                break;
+            case SIZ_8b:
+                texel[i] = tram[addr + (ss & 0x1)];
+                break;
+            default:
+                texel[i] = (tram[addr] << 8) | tram[addr + 1];
+                break;
+        }
+    }
+}
+
+/* kernel(): weight 4 for the centre, 2 for edges, 1 for corners */
+static void kernel(int i, int c0, int c1, int c2, int c3, float sum[4]) {
+    float w = (i == 8) ? 4 : (i % 2 == 0) ? 2 : 1;
+
+    sum[0] += c0 * w;
+    sum[1] += c1 * w;
+    sum[2] += c2 * w;
+    sum[3] += c3 * w;
+}
+
+/* One filtered texel, or -1 for a format guLoadTextureBlockMipMap() can't filter */
+static int filter(int fmt, int siz, const int *tex) {
+    float sum[4] = { 0, 0, 0, 0 };
+    int out[4];
+    int i, j;
+
+    for (i = 0; i < 9; i++) {
+        int c = tex[i];
+
+        if (fmt == FMT_RGBA && siz == SIZ_16b) {
+            kernel(i, (c & 0xF800) >> 11, (c & 0x07C0) >> 6, (c & 0x003E) >> 1, c & 0x1, sum);
+        } else if ((fmt == FMT_CI || fmt == FMT_I) && siz == SIZ_4b) {
+            kernel(i, c & 0xF, 0, 0, 0, sum);
+        } else if ((fmt == FMT_CI || fmt == FMT_I) && siz == SIZ_8b) {
+            kernel(i, c & 0xFF, 0, 0, 0, sum);
+        } else if (fmt == FMT_IA && siz == SIZ_4b) {
+            kernel(i, (c & 0xE) >> 1, c & 0x1, 0, 0, sum);
+        } else if (fmt == FMT_IA && siz == SIZ_8b) {
+            kernel(i, (c & 0xF0) >> 4, c & 0xF, 0, 0, sum);
+        } else if (fmt == FMT_IA && siz == SIZ_16b) {
+            kernel(i, (c & 0xFF00) >> 8, c & 0xFF, 0, 0, sum);
+        } else {
+            return -1;
+        }
+    }
+    for (j = 0; j < 4; j++) {
+        out[j] = (int) (sum[j] / 16.0 + 0.5);
+    }
+
+    if (fmt == FMT_RGBA) {
+        return ((out[0] & 0x1F) << 11) | (out[1] & 0x1F) << 6 | ((out[2] & 0x1F) << 1) | out[3];
+    }
+    if (fmt == FMT_IA) {
+        switch (siz) {
+            case SIZ_4b:
+                return ((out[0] & 0x7) << 1) | (out[1] & 0x1);
+            case SIZ_8b:
+                return (out[1] & 0xF) | ((out[0] & 0xF) << 4);
+            default:
+                return (out[0] << 8) | out[1];
+        }
+    }
+    return out[0];
+}
+
+/*
+ * guLoadTextureBlockMipMap() for a whole width x height texture whose rows
+ * are lsize bytes apart, with cfs/cft set to clamp rather than wrap when
+ * filtering. tbuf is MIPMAP_BUF_SIZE bytes, and is zeroed first. tiles gets
+ * 4 ints for each level 0 to MM_MAX_LEVEL, info the last level with a tile,
+ * the chain length in texels and the bytes the LoadBlock moves.
+ *
+ * Returns what guLoadTextureBlockMipMap() does (0, MIPMAP_ETMEM or
+ * MIPMAP_EFORMAT), or MIPMAP_EINVAL for textures the runtime would overrun
+ * its buffers on: wider than TMEM, or more than MM_MAX_LEVEL levels.
+ */
+int mipmap_generate(int fmt, int siz, const uint8_t *img, int lsize, int width, int height, int cfs, int cft,
+                    uint8_t *tbuf, int32_t *tiles, int32_t info[3]) {
+    int txlsize, shift, ntexels;
+    int im_bytes, tr_bytes;
+    int h, b, level;
+    uint32_t length;
+
+    if (fmt < FMT_RGBA || fmt > FMT_I || siz < SIZ_4b || siz > SIZ_32b || width <= 0 || height <= 0) {
+        return MIPMAP_EINVAL;
+    }
+    txlsize = txlsizes[siz];
+    shift = shifts[siz];
+    ntexels = (TRAM_LSIZE / txlsize) << 1;
+    im_bytes = (width * txlsize + 1) >> 1;
+    tr_bytes = (im_bytes + TRAM_LSIZE - 1) / TRAM_LSIZE * TRAM_LSIZE;
+    if (lsize < im_bytes || tr_bytes * height > TRAM_SIZE) {
+        return MIPMAP_EINVAL;
+    }
+
+    /* Level 0, odd rows swizzled, 4-bit rows of odd width with the last nibble cleared */
+    memset(tbuf, 0, MIPMAP_BUF_SIZE);
+    for (h = 0; h < height; h++) {
+        int flip = (h & 1) << 2;
+        uint8_t *taddr = tbuf + h * tr_bytes;
+
+        for (b = 0; b < im_bytes; b++) {
+            taddr[b ^ flip] = img[h * lsize + b];
+        }
+        if ((width & 1) && siz == SIZ_4b) {
+            taddr[(b - 1) ^ flip] &= 0xF0;
+        }
+    }
+
+    tiles[TILE_S] = width;
+    tiles[TILE_T] = height;
+    tiles[TILE_W] = (tr_bytes / txlsize) << 1;
+    tiles[TILE_ADDR] = 0;
+    length = tiles[TILE_W] * tiles[TILE_T];
+
+    level = 0;
+    while (tiles[level * 4 + TILE_S] > 1 || tiles[level * 4 + TILE_T] > 1) {
+        const int32_t *src;
+        int32_t *dst;
+        uint8_t *taddr;
+        int s, t;
+
+        if (level == MM_MAX_LEVEL) {
+            return MIPMAP_EINVAL;
+        }
+        level++;
+        src = tiles + (level - 1) * 4;
+        dst = tiles + level * 4;
+        dst[TILE_ADDR] = src[TILE_ADDR] + (src[TILE_W] * txlsize * src[TILE_T] >> 1);
+        dst[TILE_S] = tiles[TILE_S] >> level;
+        dst[TILE_T] = tiles[TILE_T] >> level;
+        if (dst[TILE_S] == 0) {
+            dst[TILE_S] = 1;
+        }
+        if (dst[TILE_T] == 0) {
+            dst[TILE_T] = 1;
+        }
+        dst[TILE_W] = (dst[TILE_S] + (ntexels - 1)) >> (shift + 1) << (shift + 1);
+
+        length += dst[TILE_W] * dst[TILE_T];
+        if ((length * txlsize >> 1) >= TRAM_SIZE) {
+            length -= dst[TILE_W] * dst[TILE_T];
+            info[0] = level;
+            info[1] = length;
+            info[2] = load_bytes(siz, length);
+            return MIPMAP_ETMEM;
+        }
+
+        taddr = tbuf + dst[TILE_ADDR];
+        for (t = 0; t < src[TILE_T]; t += 2) {
+            int trip = (t & 2) << 1;
+            int ti = t + 1, tii = t - 1;
+            unsigned int tempaddr = 0;
+
+            if (cft) {
+                if (ti >= src[TILE_T]) ti = t;
+                if (tii < 0) tii = t;
+            } else {
+                if (ti >= src[TILE_T]) ti = 0;
+                if (tii < 0) tii = src[TILE_T] - 1;
+            }
+
+            for (s = 0; s < src[TILE_S]; s += 2) {
+                int si = s + 1, sii = s - 1;
+                int s4[9], t4[9], tex4[9];
+                uint8_t *saddr;
+                int texel;
+
+                if (cfs) {
+                    if (si >= src[TILE_S]) si = s;
+                    if (sii < 0) sii = s;
+                } else {
+                    if (si >= src[TILE_S]) si = 0;
+                    if (sii < 0) sii = src[TILE_S] - 1;
+                }
+
+                s4[0] = s;   t4[0] = tii;
+                s4[1] = si;  t4[1] = tii;
+                s4[2] = si;  t4[2] = t;
+                s4[3] = si;  t4[3] = ti;
+                s4[4] = s;   t4[4] = ti;
+                s4[5] = sii; t4[5] = ti;
+                s4[6] = sii; t4[6] = t;
+                s4[7] = sii; t4[7] = tii;
+                s4[8] = s;   t4[8] = t;
+
+                /* 32-bit texels fail before get3x3() would shift by -1 */
+                if (siz == SIZ_32b) {
+                    return MIPMAP_EFORMAT;
+                }
+                get3x3(tbuf, src, s4, t4, tex4, shift, siz);
+                texel = filter(fmt, siz, tex4);
+                if (texel < 0) {
+                    return MIPMAP_EFORMAT;
+                }
+
+                saddr = taddr + ((tempaddr >> 1) ^ trip);
+                switch (siz) {
+                    case SIZ_4b:
+                        *saddr |= (s & 0x2) ? texel : (texel << 4);
+                        break;
+                    case SIZ_8b:
+                        *saddr = texel;
+                        break;
+                    default:
+                        saddr[0] = texel >> 8;
+                        saddr[1] = texel;
+                        break;
+                }
+                tempaddr += txlsize;
+            }
+            taddr += (dst[TILE_W] * txlsize) >> 1;
+        }
+
+        if (dst[TILE_S] <= MM_MIN_SIZE && dst[TILE_T] <= MM_MIN_SIZE) {
+            break;
+        }
+    }
+
+    info[0] = level;
+    info[1] = length;
+    info[2] = load_bytes(siz, length);
+    return 0;
+}
+
+/*
+ * stuffDisplayList(): load the chain at timg, set tiles start_tile to
+ * start_tile + level. Writes two words per command to out (12 + 4 * level
+ * words at most), returns the number of commands.
+ */
+int mipmap_display_list(int fmt, int siz, const int32_t *tiles, int level, uint32_t length, uint32_t timg, int start_tile,
+                        int pal, int cms, int cmt, int masks, int maskt, uint32_t *out) {
+    uint32_t *p = out;
+    int txlsize = txlsizes[siz];
+    int load_siz = (siz == SIZ_4b) ? SIZ_8b : siz;
+    uint32_t lrs = (siz == SIZ_4b) ? length / 2 : length;
+    int tile, smask, tmask, sshift = 0, tshift = 0;
+
+    p[0] = SHIFTL(G_SETTIMG, 24, 8) | SHIFTL(fmt, 21, 3) | SHIFTL(load_siz, 19, 2) | SHIFTL(1 - 1, 0, 12);
+    p[1] = timg;
+    p += 2;
+    p = set_tile(p, fmt, load_siz, 0, 0, G_TX_LOADTILE, 0, 0, 0, 0, 0, 0, 0);
+    p[0] = SHIFTL(G_RDPLOADSYNC, 24, 8);
+    p[1] = 0;
+    p += 2;
+    p = load_tile_generic(p, G_LOADBLOCK, G_TX_LOADTILE, 0, 0, lrs < LDBLK_MAX_TXL ? lrs : LDBLK_MAX_TXL, 0);
+
+    for (tile = 0; tile <= level; tile++) {
+        const int32_t *m = tiles + tile * 4;
+
+        /* The shift stays at the last level that still had a mask */
+        tmask = maskt - tile;
+        if (tmask < 0) {
+            tmask = 0;
+        } else {
+            tshift = tile;
+        }
+        smask = masks - tile;
+        if (smask < 0) {
+            smask = 0;
+        } else {
+            sshift = tile;
+        }
+        p = set_tile(p, fmt, siz, m[TILE_W] * txlsize >> 4, m[TILE_ADDR] >> 3, tile + start_tile, pal, cmt, tmask,
+                     tshift, cms, smask, sshift);
+        p = load_tile_generic(p, G_SETTILESIZE, tile + start_tile, 0, 0, (m[TILE_S] - 1) << G_TEXTURE_IMAGE_FRAC,
+                              (m[TILE_T] - 1) << G_TEXTURE_IMAGE_FRAC);
+    }
+    return (int) (p - out) / 2;
+}
+
+static unsigned int get16(const uint8_t *p) {
+    return (p[0] << 8) | p[1];
+}
+
+/*
+ * The baked path: copy the image of a stored chain (see mipmap.py) to tbuf,
+ * MIPMAP_LOAD_SIZE bytes, and emit the commands mipmap_display_list() would. Returns the number of
+ * commands, or MIPMAP_EINVAL for a bad blob.
+ */
+int mipmap_load(const uint8_t *blob, int size, uint32_t timg, int start_tile, int pal, int cms, int cmt, int masks,
+                int maskt, uint8_t *tbuf, uint32_t *out) {
+    int32_t tiles[(MM_MAX_LEVEL + 1) * 4];
+    int fmt, siz, level, image, i;
+    uint32_t length, nbytes;
+
+    if (size < BLOB_HEADER) {
+        return MIPMAP_EINVAL;
+    }
+    fmt = blob[0];
+    siz = blob[1];
+    level = blob[2];
+    length = get16(blob + 4);
+    nbytes = get16(blob + 6);
+    image = BLOB_HEADER + (level + 1) * BLOB_TILE;
+    if (siz > SIZ_32b || level > MM_MAX_LEVEL || nbytes > MIPMAP_LOAD_SIZE || image + (int) nbytes > size) {
+        return MIPMAP_EINVAL;
+    }
+    for (i = 0; i <= level; i++) {
+        const uint8_t *t = blob + BLOB_HEADER + i * BLOB_TILE;
+
+        tiles[i * 4 + TILE_W] = get16(t);
+        tiles[i * 4 + TILE_S] = get16(t + 2);
+        tiles[i * 4 + TILE_T] = get16(t + 4);
+        tiles[i * 4 + TILE_ADDR] = get16(t + 6);
+    }
+    memcpy(tbuf, blob + image, nbytes);
+    return mipmap_display_list(fmt, siz, tiles, level, length, timg, start_tile, pal, cms, cmt, masks, maskt, out);
+}
@@ -0,0 +1,503 @@
+#!/usr/bin/env python3
+# Mipmap chains baked ahead of time instead of filtered at load time.
+#
+# guLoadTextureBlockMipMap() builds every level of a mipmap on the CPU each
+# time a texture is loaded. generate() does the same work, with the same
+# results byte for byte, once. bake() stores the result, the TMEM image and a
+# tile per level, and load() is all that's left to do at run time: copy the
+# image (on the N64, one DMA) and emit the load and tile commands. See
+# mipmap.c for the runtime's quirks this keeps. The work is done by mipmap.c,
+# compiled on first use by native_lib.py (set CC to pick the compiler). If
+# that isn't possible, a numpy port gives identical results, just slower.
+#
+# This is a standalone tool: the game never calls guLoadTextureBlockMipMap(),
+# so there are no textures for the build to bake and no ninja rule runs it.
+#
+#   mipmap.py bake FORMAT WIDTH HEIGHT IN OUT [--wrap-s] [--wrap-t]   texel data to a baked chain
+#   mipmap.py check                                                   native against numpy, baked against generated
+#   mipmap.py bench                                                   generating against loading baked chains
+#
+# Baked chains are big-endian, like the rest of the game's data:
+#
+#   0x0  u8   fmt, siz (gbi.h G_IM_FMT_*, G_IM_SIZ_*)
+#   0x2  u8   last level with a tile
+#   0x3  u8   flags: 1 TMEM ran out (the last tile has no texels), 2 clamp s, 4 clamp t
+#   0x4  u16  chain length in texels
+#   0x6  u16  image size in bytes
+#   0x8       per level: u16 line width in texels, width, height, TMEM address
+#   ...       the image, as the LoadBlock moves it
+
+import ctypes
+import struct
+from pathlib import Path
+from typing import List, NamedTuple, Optional, Tuple
+
+import numpy as np
+
+import native_lib
+from texcodec import FMT_CI, FMT_I, FMT_IA, FMT_RGBA, FMT_YUV, FORMAT_NAMES, SIZ_4b, SIZ_8b, SIZ_16b, SIZ_32b
+
+SOURCE_PATH = Path(__file__).with_suffix(".c")
+
+# As in mipmap.c
+TRAM_SIZE = 4096
+TRAM_LSIZE = 8
+MM_MAX_LEVEL = 7
+BUF_SIZE = 2 * TRAM_SIZE
+LOAD_SIZE = TRAM_SIZE + TRAM_LSIZE
+LDBLK_MAX_TXL = 2047
+ETMEM, EFORMAT = 1, 2
+TXLSIZE = {SIZ_4b: 1, SIZ_8b: 2, SIZ_16b: 4, SIZ_32b: 8}
+SHIFT = {SIZ_4b: 3, SIZ_8b: 2, SIZ_16b: 1, SIZ_32b: 0}
+
+HEADER = struct.Struct(">BBBBHH")
+TILE = struct.Struct(">HHHH")
+FLAG_TRUNCATED, FLAG_CLAMP_S, FLAG_CLAMP_T = 1, 2, 4
+
+# kernel() weights of the nine neighbours, in get3x3() order
+WEIGHTS = np.array([2, 1, 2, 1, 2, 1, 2, 1, 4], dtype=np.int32)
+
+
+class MipmapError(ValueError):
+    pass
+
+
+class Chain(NamedTuple):
+    fmt: int
+    siz: int
+    error: int  # 0 or ETMEM, as guLoadTextureBlockMipMap() returns
+    tiles: List[Tuple[int, int, int, int]]  # (line width, s, t, addr) of each level
+    length: int  # texels
+    image: bytes  # what the LoadBlock moves
+    clamp: Tuple[bool, bool]
+
+
+_i, _p, _u32 = ctypes.c_int, ctypes.c_void_p, ctypes.c_uint32
+SIGNATURES: native_lib.Signatures = {
+    "mipmap_generate": (_i, [_i, _i, _p, _i, _i, _i, _i, _i, _p, _p, _p]),
+    "mipmap_display_list": (_i, [_i, _i, _p, _i, _u32, _u32, _i, _i, _i, _i, _i, _i, _p]),
+    "mipmap_load": (_i, [_p, _i, _u32, _i, _i, _i, _i, _i, _i, _p, _p]),
+}
+
+
+def native() -> Optional[ctypes.CDLL]:
+    """The compiled library, or None if it can't be built or loaded (or
+    MIPMAP_NATIVE=0 is set)."""
+    return native_lib.load(SOURCE_PATH, "mipmap", ["-O3"], "MIPMAP_NATIVE", SIGNATURES)
+
+
+def _ptr(buf) -> Optional[int]:
+    return ctypes.addressof(ctypes.c_char.from_buffer(buf)) if len(buf) else None
+
+
+def _load_bytes(siz: int, length: int) -> int:
+    if siz == SIZ_4b:
+        return min(length // 2, LDBLK_MAX_TXL) + 1
+    return (min(length, LDBLK_MAX_TXL) + 1) * TXLSIZE[siz] // 2
+
+
+# numpy port of mipmap.c
+
+
+def _get3x3(tram: np.ndarray, tile: Tuple[int, int, int, int], ss: np.ndarray, tt: np.ndarray, siz: int) -> np.ndarray:
+    w, _, _, addr = tile
+    shift = SHIFT[siz]
+    bank = ((((ss & (3 << (shift - 1))) >> (shift - 1)) ^ ((tt & 1) << 1)) << 1).astype(np.int64)
+    row = (((tt * w + ss) * TXLSIZE[siz]) >> 1) // TRAM_LSIZE
+    a = addr + row * 8 + bank
+    if siz == SIZ_4b:
+        byte = tram[a + ((ss & 2) >> 1)].astype(np.int32)
+        return np.where(ss & 1, byte & 0xF, byte >> 4)
+    if siz == SIZ_8b:
+        return tram[a + (ss & 1)].astype(np.int32)
+    return (tram[a].astype(np.int32) << 8) | tram[a + 1]
+
+
+def _filter_np(fmt: int, siz: int, tex: np.ndarray) -> np.ndarray:
+    """tex is (9, n) texels. The sums are exact in float, so rounding them
+    the runtime's way is (sum + 8) >> 4."""
+    if fmt == FMT_RGBA:
+        planes = [(tex >> 11) & 0x1F, (tex >> 6) & 0x1F, (tex >> 1) & 0x1F, tex & 1]
+    elif fmt == FMT_IA and siz == SIZ_4b:
+        planes = [(tex >> 1) & 7, tex & 1]
+    elif fmt == FMT_IA and siz == SIZ_8b:
+        planes = [tex >> 4, tex & 0xF]
+    elif fmt == FMT_IA:
+        planes = [tex >> 8, tex & 0xFF]
+    else:
+        planes = [tex]
+    r = [(WEIGHTS @ p + 8) >> 4 for p in planes]
+    if fmt == FMT_RGBA:
+        return ((r[0] & 0x1F) << 11) | ((r[1] & 0x1F) << 6) | ((r[2] & 0x1F) << 1) | r[3]
+    if fmt == FMT_IA and siz == SIZ_4b:
+        return ((r[0] & 7) << 1) | (r[1] & 1)
+    if fmt == FMT_IA and siz == SIZ_8b:
+        return (r[1] & 0xF) | ((r[0] & 0xF) << 4)
+    if fmt == FMT_IA:
+        return (r[0] << 8) | r[1]
+    return r[0]
+
+
+def _filterable(fmt: int, siz: int) -> bool:
+    return (fmt, siz) in (
+        (FMT_RGBA, SIZ_16b),
+        (FMT_CI, SIZ_4b),
+        (FMT_CI, SIZ_8b),
+        (FMT_IA, SIZ_4b),
+        (FMT_IA, SIZ_8b),
+        (FMT_IA, SIZ_16b),
+        (FMT_I, SIZ_4b),
+        (FMT_I, SIZ_8b),
+    )
+
+
+def _neighbours(i: np.ndarray, n: int, clamp: bool) -> Tuple[np.ndarray, np.ndarray]:
+    after, before = i + 1, i - 1
+    if clamp:
+        after = np.where(after >= n, i, after)
+        before = np.where(before < 0, i, before)
+    else:
+        after = np.where(after >= n, 0, after)
+        before = np.where(before < 0, n - 1, before)
+    return after, before
+
+
+def _generate_np(fmt: int, siz: int, rows: np.ndarray, width: int, height: int, cfs: bool, cft: bool):
+    txlsize = TXLSIZE[siz]
+    shift = SHIFT[siz]
+    ntexels = (TRAM_LSIZE // txlsize) << 1
+    im_bytes = (width * txlsize + 1) >> 1
+    tr_bytes = -(-im_bytes // TRAM_LSIZE) * TRAM_LSIZE
+
+    tram = np.zeros(BUF_SIZE, dtype=np.uint8)
+    level0 = np.zeros((height, tr_bytes), dtype=np.uint8)
+    level0[:, :im_bytes] = rows[:, :im_bytes]
+    if width & 1 and siz == SIZ_4b:
+        level0[:, im_bytes - 1] &= 0xF0
+    odd = level0[1::2].reshape(-1, tr_bytes // 8, 2, 4)
+    level0[1::2] = odd[:, :, ::-1].reshape(-1, tr_bytes)
+    tram[: height * tr_bytes] = level0.reshape(-1)
+
+    tiles = [((tr_bytes // txlsize) << 1, width, height, 0)]
+    length = tiles[0][0] * height
+    level = 0
+    while tiles[level][1] > 1 or tiles[level][2] > 1:
+        if level == MM_MAX_LEVEL:
+            return -1, tram, tiles, length
+        level += 1
+        src = tiles[level - 1]
+        s = max(width >> level, 1)
+        t = max(height >> level, 1)
+        w = (s + ntexels - 1) >> (shift + 1) << (shift + 1)
+        tiles.append((w, s, t, src[3] + (src[0] * txlsize * src[2] >> 1)))
+        length += w * t
+        if (length * txlsize >> 1) >= TRAM_SIZE:
+            return ETMEM, tram, tiles, length - w * t
+        if not _filterable(fmt, siz):
+            return EFORMAT, tram, tiles, length
+
+        sx = np.arange(0, src[1], 2)
+        si, sii = _neighbours(sx, src[1], cfs)
+        ss = np.stack([sx, si, si, si, sx, sii, sii, sii, sx])
+        addr = tiles[level][3]
+        for ty in range(0, src[2], 2):
+            ti, tii = _neighbours(np.array(ty), src[2], cft)
+            tt = np.broadcast_to(np.array([tii, tii, ty, ti, ti, ti, ty, tii, ty])[:, None], ss.shape)
+            texel = _filter_np(fmt, siz, _get3x3(tram, src, ss, tt, siz))
+            offsets = ((np.arange(len(sx)) * txlsize) >> 1) ^ ((ty & 2) << 1)
+            if siz == SIZ_4b:
+                np.bitwise_or.at(tram, addr + offsets, np.where(sx & 2, texel, texel << 4).astype(np.uint8))
+            elif siz == SIZ_8b:
+                tram[addr + offsets] = texel
+            else:
+                tram[addr + offsets] = texel >> 8
+                tram[addr + offsets + 1] = texel & 0xFF
+            addr += (w * txlsize) >> 1
+        if s <= 1 and t <= 1:
+            break
+    return 0, tram, tiles, length
+
+
+def _display_list_py(fmt: int, siz: int, tiles, length: int, timg: int, start_tile: int, pal: int, cms: int, cmt: int, masks: int, maskt: int) -> List[int]:
+    def settile(fmt, siz, line, tmem, tile, pal, cmt, maskt, shiftt, cms, masks, shifts):
+        return [
+            0xF5 << 24 | (fmt & 7) << 21 | (siz & 3) << 19 | (line & 0x1FF) << 9 | (tmem & 0x1FF),
+            (tile & 7) << 24 | (pal & 0xF) << 20 | (cmt & 3) << 18 | (maskt & 0xF) << 14 | (shiftt & 0xF) << 10 | (cms & 3) << 8 | (masks & 0xF) << 4 | (shifts & 0xF),
+        ]
+
+    def loadtile(cmd, tile, lrs, lrt):
+        return [cmd << 24, (tile & 7) << 24 | (lrs & 0xFFF) << 12 | (lrt & 0xFFF)]
+
+    load_siz = SIZ_8b if siz == SIZ_4b else siz
+    lrs = length // 2 if siz == SIZ_4b else length
+    out = [0xFD << 24 | fmt << 21 | load_siz << 19, timg & 0xFFFFFFFF]
+    out += settile(fmt, load_siz, 0, 0, 7, 0, 0, 0, 0, 0, 0, 0)
+    out += [0xE6 << 24, 0]
+    out += loadtile(0xF3, 7, min(lrs, LDBLK_MAX_TXL), 0)
+    sshift = tshift = 0
+    for tile, (w, s, t, addr) in enumerate(tiles):
+        tmask = maskt - tile
+        if tmask < 0:
+            tmask = 0
+        else:
+            tshift = tile
+        smask = masks - tile
+        if smask < 0:
+            smask = 0
+        else:
+            sshift = tile
+        out += settile(fmt, siz, w * TXLSIZE[siz] >> 4, addr >> 3, tile + start_tile, pal, cmt, tmask, tshift, cms, smask, sshift)
+        out += loadtile(0xF2, tile + start_tile, (s - 1) << 2, (t - 1) << 2)
+    return out
+
+
+# Public interface
+
+
+def generate(fmt: int, siz: int, data: bytes, width: int, height: int, clamp_s: bool = True, clamp_t: bool = True, use_native: bool = True) -> Chain:
+    """What guLoadTextureBlockMipMap() leaves in its buffer for a texture,
+    given a zeroed buffer. data is unswizzled texel rows, (width << siz) / 2
+    bytes each rounded up, and clamp_s/clamp_t are its cfs/cft."""
+    if (fmt, siz) not in FORMAT_NAMES or width <= 0 or height <= 0:
+        raise MipmapError(f"no such texture: fmt {fmt}, siz {siz}, {width}x{height}")
+    name = f"{FORMAT_NAMES[(fmt, siz)]} {width}x{height}"
+    lsize = (width * TXLSIZE[siz] + 1) >> 1
+    if len(data) < lsize * height:
+        raise MipmapError(f"{name} needs 0x{lsize * height:X} bytes, got 0x{len(data):X}")
+    tr_bytes = -(-lsize // TRAM_LSIZE) * TRAM_LSIZE
+    if tr_bytes * height > TRAM_SIZE:
+        raise MipmapError(f"{name} doesn't fit in TMEM")
+
+    lib = native() if use_native else None
+    if lib is not None:
+        src = bytearray(data[: lsize * height])
+        tbuf = bytearray(BUF_SIZE)
+        tile_buf = (ctypes.c_int32 * ((MM_MAX_LEVEL + 1) * 4))()
+        info = (ctypes.c_int32 * 3)()
+        err = lib.mipmap_generate(fmt, siz, _ptr(src), lsize, width, height, int(clamp_s), int(clamp_t), _ptr(tbuf), tile_buf, info)
+        level, length = info[0], info[1]
+        tiles = [tuple(tile_buf[i * 4 : i * 4 + 4]) for i in range(level + 1)]
+        tram = np.frombuffer(tbuf, dtype=np.uint8)
+    else:
+        rows = np.frombuffer(bytes(data[: lsize * height]), dtype=np.uint8).reshape(height, lsize)
+        err, tram, tiles, length = _generate_np(fmt, siz, rows, width, height, clamp_s, clamp_t)
+    if err < 0:
+        raise MipmapError(f"{name} needs more than {MM_MAX_LEVEL} levels")
+    if err == EFORMAT:
+        raise MipmapError(f"guLoadTextureBlockMipMap() can't filter {name}")
+    image = tram[: _load_bytes(siz, length)].tobytes()
+    return Chain(fmt, siz, err, [tuple(int(v) for v in t) for t in tiles], length, image, (bool(clamp_s), bool(clamp_t)))
+
+
+def display_list(chain: Chain, timg: int, start_tile: int = 0, pal: int = 0, cms: int = 0, cmt: int = 0, masks: int = 0, maskt: int = 0, use_native: bool = True) -> List[int]:
+    """The commands guLoadTextureBlockMipMap() emits for a chain whose image
+    is at physical address timg, as (w0, w1) word pairs."""
+    lib = native() if use_native else None
+    if lib is not None:
+        tiles = (ctypes.c_int32 * (len(chain.tiles) * 4))(*[v for t in chain.tiles for v in t])
+        out = (ctypes.c_uint32 * (8 + 4 * len(chain.tiles)))()
+        n = lib.mipmap_display_list(chain.fmt, chain.siz, tiles, len(chain.tiles) - 1, chain.length, timg, start_tile, pal, cms, cmt, masks, maskt, out)
+        return list(out[: n * 2])
+    return _display_list_py(chain.fmt, chain.siz, chain.tiles, chain.length, timg, start_tile, pal, cms, cmt, masks, maskt)
+
+
+def bake(chain: Chain) -> bytes:
+    """A chain as stored with the textures (see the top of this file)."""
+    flags = (FLAG_TRUNCATED if chain.error == ETMEM else 0) | (FLAG_CLAMP_S if chain.clamp[0] else 0) | (FLAG_CLAMP_T if chain.clamp[1] else 0)
+    out = HEADER.pack(chain.fmt, chain.siz, len(chain.tiles) - 1, flags, chain.length, len(chain.image))
+    out += b"".join(TILE.pack(*t) for t in chain.tiles)
+    return out + chain.image + bytes(-len(chain.image) % 8)
+
+
+def unbake(blob: bytes) -> Chain:
+    if len(blob) < HEADER.size:
+        raise MipmapError("baked chain is truncated")
+    fmt, siz, level, flags, length, nbytes = HEADER.unpack_from(blob)
+    image = HEADER.size + (level + 1) * TILE.size
+    if (fmt, siz) not in FORMAT_NAMES or level > MM_MAX_LEVEL or image + nbytes > len(blob):
+        raise MipmapError("not a baked chain")
+    tiles = [TILE.unpack_from(blob, HEADER.size + i * TILE.size) for i in range(level + 1)]
+    error = ETMEM if flags & FLAG_TRUNCATED else 0
+    return Chain(fmt, siz, error, tiles, length, bytes(blob[image : image + nbytes]), (bool(flags & FLAG_CLAMP_S), bool(flags & FLAG_CLAMP_T)))
+
+
+def load(blob: bytes, timg: int, start_tile: int = 0, pal: int = 0, cms: int = 0, cmt: int = 0, masks: int = 0, maskt: int = 0, use_native: bool = True) -> Tuple[bytes, List[int]]:
+    """The run-time side of a baked chain: its image, as copied to the
+    buffer at timg, and the commands that load it."""
+    lib = native() if use_native else None
+    if lib is not None:
+        src = bytearray(blob)
+        tbuf = bytearray(LOAD_SIZE)
+        out = (ctypes.c_uint32 * (8 + 4 * (MM_MAX_LEVEL + 1)))()
+        n = lib.mipmap_load(_ptr(src), len(src), timg, start_tile, pal, cms, cmt, masks, maskt, _ptr(tbuf), out)
+        if n < 0:
+            raise MipmapError("not a baked chain")
+        return bytes(tbuf[: HEADER.unpack_from(blob)[5]]), list(out[: n * 2])
+    chain = unbake(blob)
+    return chain.image, display_list(chain, timg, start_tile, pal, cms, cmt, masks, maskt, use_native=False)
+
+
+# Checks and benchmark
+
+
+def _formats() -> List[Tuple[int, int]]:
+    return [(fmt, siz) for fmt, siz in FORMAT_NAMES if fmt != FMT_YUV]
+
+
+def check() -> bool:
+    from texcodec import size
+
+    ok = True
+    rng = np.random.default_rng(0)
+    backends = [False] + ([True] if native() is not None else [])
+    sizes = [(1, 1), (2, 2), (8, 8), (32, 32), (64, 32), (16, 64), (6, 10), (13, 7), (256, 1), (1, 128), (64, 64)]
+    cases = 0
+    for fmt, siz in _formats():
+        for width, height in sizes:
+            if siz == SIZ_4b and width % 2:
+                continue
+            data = rng.integers(0, 256, size(fmt, siz, width, height), dtype=np.uint8).tobytes()
+            for clamp in [(True, True), (False, False), (True, False)]:
+                name = f"{FORMAT_NAMES[(fmt, siz)]} {width}x{height} clamp {clamp}"
+                results = []
+                for use_native in backends:
+                    try:
+                        results.append(generate(fmt, siz, data, width, height, *clamp, use_native=use_native))
+                    except MipmapError as e:
+                        results.append(str(e))
+                cases += 1
+                if any(r != results[0] for r in results):
+                    print(f"{name}: native and numpy differ")
+                    ok = False
+                chain = results[-1]
+                if isinstance(chain, str):
+                    continue
+
+                # Loading the baked chain ends with the same buffer and commands
+                expected = display_list(chain, 0x123450, 1, 2, 1, 2, 5, 4)
+                for use_native in backends:
+                    image, dl = load(bake(chain), 0x123450, 1, 2, 1, 2, 5, 4, use_native=use_native)
+                    if image != chain.image or dl != expected:
+                        print(f"{name}: baked chain loads differently ({'native' if use_native else 'numpy'})")
+                        ok = False
+                if len(backends) > 1 and display_list(chain, 0x123450, 1, 2, 1, 2, 5, 4, use_native=False) != expected:
+                    print(f"{name}: display lists differ")
+                    ok = False
+
+    # A flat texture stays flat at every level: filtering by hand
+    for fmt, siz, byte in [(FMT_RGBA, SIZ_16b, 0x8C), (FMT_I, SIZ_8b, 0x5A), (FMT_IA, SIZ_4b, 0xBB)]:
+        chain = generate(fmt, siz, bytes([byte]) * size(fmt, siz, 32, 32), 32, 32)
+        for w, s, t, addr in chain.tiles:
+            line = (w * TXLSIZE[siz]) >> 1
+            for row in range(t):
+                start = addr + row * line
+                texels = [chain.image[start + (b ^ ((row & 1) << 2))] for b in range((s * TXLSIZE[siz]) >> 1)]
+                if siz == SIZ_4b and s & 1:
+                    texels.append(chain.image[start + (len(texels) ^ ((row & 1) << 2))] | (byte & 0xF))
+                if set(texels) != {byte}:
+                    print(f"{FORMAT_NAMES[(fmt, siz)]}: a flat texture isn't flat at {s}x{t}")
+                    ok = False
+                    break
+
+    print(f"{cases} textures: " + ("ok" if ok else "FAILED"))
+    return ok
+
+
+def bench(count: int, repeat: int):
+    import time
+
+    from texcodec import size
+
+    lib = native()
+    rng = np.random.default_rng(0)
+    textures = [
+        (FMT_RGBA, SIZ_16b, 32, 32),
+        (FMT_CI, SIZ_8b, 32, 32),
+        (FMT_CI, SIZ_4b, 64, 32),
+        (FMT_IA, SIZ_8b, 32, 64),
+        (FMT_I, SIZ_4b, 64, 64),
+    ]
+    timg = 0x200000
+
+    print(f"{count} loads of each texture, best of {repeat}, us per load")
+    print(f"{'texture':16}{'levels':>7}{'bytes':>7}{'generate':>10}{'numpy':>10}{'baked':>10}{'speedup':>9}")
+    for fmt, siz, width, height in textures:
+        data = rng.integers(0, 256, size(fmt, siz, width, height), dtype=np.uint8).tobytes()
+        chain = generate(fmt, siz, data, width, height)
+        blob = bake(chain)
+
+        def best(fn, n):
+            result = None
+            for _ in range(repeat):
+                start = time.perf_counter()
+                for _ in range(n):
+                    fn()
+                elapsed = (time.perf_counter() - start) / n
+                result = elapsed if result is None else min(result, elapsed)
+            return result
+
+        if lib is not None:
+            # What a load costs either way, without the ctypes and Python around it
+            src = bytearray(data)
+            tbuf = bytearray(BUF_SIZE)
+            tiles = (ctypes.c_int32 * ((MM_MAX_LEVEL + 1) * 4))()
+            info = (ctypes.c_int32 * 3)()
+            dl = (ctypes.c_uint32 * (8 + 4 * (MM_MAX_LEVEL + 1)))()
+            src_p, tbuf_p, blob_buf = _ptr(src), _ptr(tbuf), bytearray(blob)
+            blob_p = _ptr(blob_buf)
+            lsize = len(data) // height
+
+            def runtime():
+                lib.mipmap_generate(fmt, siz, src_p, lsize, width, height, 1, 1, tbuf_p, tiles, info)
+                lib.mipmap_display_list(fmt, siz, tiles, info[0], info[1], timg, 0, 0, 0, 0, 0, 0, dl)
+
+            def baked():
+                lib.mipmap_load(blob_p, len(blob_buf), timg, 0, 0, 0, 0, 0, 0, tbuf_p, dl)
+
+            generate_t = best(runtime, count)
+            baked_t = best(baked, count)
+        else:
+            generate_t = baked_t = float("nan")
+        numpy_t = best(lambda: generate(fmt, siz, data, width, height, use_native=False), max(1, count // 100))
+        name = f"{FORMAT_NAMES[(fmt, siz)]} {width}x{height}"
+        print(f"{name:16}{len(chain.tiles):7}{len(blob):7}{generate_t * 1e6:10.2f}{numpy_t * 1e6:10.0f}{baked_t * 1e6:10.2f}{generate_t / baked_t:8.1f}x")
+
+
+def main():
+    import argparse
+    import sys
+
+    formats = {name: key for key, name in FORMAT_NAMES.items()}
+    parser = argparse.ArgumentParser(description="Mipmap chains baked at build time")
+    sub = parser.add_subparsers(dest="command", required=True)
+    p = sub.add_parser("bake", help="texel data to a baked chain")
+    p.add_argument("format", choices=sorted(formats))
+    p.add_argument("width", type=int)
+    p.add_argument("height", type=int)
+    p.add_argument("input", type=Path, help="unswizzled texel rows")
+    p.add_argument("output", type=Path)
+    p.add_argument("--wrap-s", action="store_true", help="filter as if s wraps (cfs = 0)")
+    p.add_argument("--wrap-t", action="store_true", help="filter as if t wraps (cft = 0)")
+    sub.add_parser("check", help="native against numpy, baked against generated")
+    p = sub.add_parser("bench", help="time generating against loading baked chains")
+    p.add_argument("--count", type=int, default=2000)
+    p.add_argument("--repeat", type=int, default=3)
+    args = parser.parse_args()
+
+    if args.command == "bake":
+        fmt, siz = formats[args.format]
+        try:
+            chain = generate(fmt, siz, args.input.read_bytes(), args.width, args.height, not args.wrap_s, not args.wrap_t)
+        except MipmapError as e:
+            sys.exit(f"{args.input}: {e}")
+        if chain.error == ETMEM:
+            print(f"{args.input}: only the first {len(chain.tiles) - 1} level(s) fit in TMEM", file=sys.stderr)
+        args.output.write_bytes(bake(chain))
+    elif args.command == "check":
+        sys.exit(0 if check() else 1)
+    elif args.command == "bench":
+        bench(args.count, args.repeat)
+
+
+if __name__ == "__main__":
+    main()
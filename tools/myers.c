@@ -0,0 +1,153 @@
+/*
+ * Linear-space Myers diff (E. Myers, "An O(ND) Difference Algorithm and Its
+ * Variations", 1986, section 4b), used by tools/myers.py.
+ *
+ * Sequences are arrays of interned tokens. The result is the list of matched
+ * (a index, b index) pairs of a shortest edit script, in order. myers.py has a
+ * line-by-line Python port of this file that must give identical results, so
+ * keep the two in sync.
+ *
+ * Build: cc -O2 -shared -fPIC -o libmyers.so myers.c (myers.py does this itself, into build/tools/)
+ */
+
+#include <stdlib.h>
+
+typedef struct {
+    const int *a;
+    const int *b;
+    int *vf;
+    int *vb;
+    int voff;
+    int *out_a;
+    int *out_b;
+    int count;
+} Ctx;
+
+static void emit(Ctx *c, int i, int j) {
+    c->out_a[c->count] = i;
+    c->out_b[c->count] = j;
+    c->count++;
+}
+
+/* Find the middle snake of a[a0:a1] vs b[b0:b1]. Both ranges are non-empty. */
+static void middle_snake(Ctx *c, int a0, int a1, int b0, int b1, int *sx, int *sy, int *ex, int *ey) {
+    const int *a = c->a;
+    const int *b = c->b;
+    int *vf = c->vf + c->voff;
+    int *vb = c->vb + c->voff;
+    int n = a1 - a0;
+    int m = b1 - b0;
+    int delta = n - m;
+    int odd = delta & 1;
+    int max_d = (n + m + 1) / 2;
+    int d, k, x, y, xs, ys;
+
+    vf[1] = 0;
+    vb[1] = 0;
+    for (d = 0; d <= max_d; d++) {
+        for (k = -d; k <= d; k += 2) {
+            if (k == -d || (k != d && vf[k - 1] < vf[k + 1])) {
+                x = vf[k + 1];
+            } else {
+                x = vf[k - 1] + 1;
+            }
+            y = x - k;
+            xs = x;
+            ys = y;
+            while (x < n && y < m && a[a0 + x] == b[b0 + y]) {
+                x++;
+                y++;
+            }
+            vf[k] = x;
+            if (odd && k >= delta - (d - 1) && k <= delta + (d - 1) && vf[k] + vb[delta - k] >= n) {
+                *sx = a0 + xs;
+                *sy = b0 + ys;
+                *ex = a0 + x;
+                *ey = b0 + y;
+                return;
+            }
+        }
+        for (k = -d; k <= d; k += 2) {
+            if (k == -d || (k != d && vb[k - 1] < vb[k + 1])) {
+                x = vb[k + 1];
+            } else {
+                x = vb[k - 1] + 1;
+            }
+            y = x - k;
+            xs = x;
+            ys = y;
+            while (x < n && y < m && a[a1 - x - 1] == b[b1 - y - 1]) {
+                x++;
+                y++;
+            }
+            vb[k] = x;
+            if (!odd && delta - k >= -d && delta - k <= d && vb[k] + vf[delta - k] >= n) {
+                *sx = a1 - x;
+                *sy = b1 - y;
+                *ex = a1 - xs;
+                *ey = b1 - ys;
+                return;
+            }
+        }
+    }
+    /* Not reached: some d <= max_d always meets in the middle (myers.py
+     * asserts this). Should it ever not, split with no matches. */
+    *sx = *ex = a1;
+    *sy = *ey = b0;
+}
+
+static void lcs(Ctx *c, int a0, int a1, int b0, int b1) {
+    int sx, sy, ex, ey, i, suffix;
+
+    while (a0 < a1 && b0 < b1 && c->a[a0] == c->b[b0]) {
+        emit(c, a0, b0);
+        a0++;
+        b0++;
+    }
+    suffix = 0;
+    while (a0 < a1 && b0 < b1 && c->a[a1 - 1] == c->b[b1 - 1]) {
+        a1--;
+        b1--;
+        suffix++;
+    }
+    /* After trimming, an edit distance of 0 or 1 leaves one side empty, so
+     * the middle snake always splits into strictly smaller problems. */
+    if (a0 < a1 && b0 < b1) {
+        middle_snake(c, a0, a1, b0, b1, &sx, &sy, &ex, &ey);
+        lcs(c, a0, sx, b0, sy);
+        for (i = 0; i < ex - sx; i++) {
+            emit(c, sx + i, sy + i);
+        }
+        lcs(c, ex, a1, ey, b1);
+    }
+    for (i = 0; i < suffix; i++) {
+        emit(c, a1 + i, b1 + i);
+    }
+}
+
+/*
+ * Writes the matched pairs to out_a/out_b, which must hold min(n, m) entries.
+ * Returns the number of pairs, or -1 if out of memory.
+ */
+int myers_match(const int *a, int n, const int *b, int m, int *out_a, int *out_b) {
+    Ctx c;
+    int size = n + m + 3;
+
+    c.a = a;
+    c.b = b;
+    c.vf = malloc(sizeof(int) * (2 * size + 1));
+    c.vb = malloc(sizeof(int) * (2 * size + 1));
+    if (c.vf == NULL || c.vb == NULL) {
+        free(c.vf);
+        free(c.vb);
+        return -1;
+    }
+    c.voff = size;
+    c.out_a = out_a;
+    c.out_b = out_b;
+    c.count = 0;
+    lcs(&c, 0, n, 0, m);
+    free(c.vf);
+    free(c.vb);
+    return c.count;
+}
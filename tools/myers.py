@@ -0,0 +1,244 @@
+#!/usr/bin/env python3
+# Myers sequence alignment for diff.py (--algorithm myers).
+#
+# Computes a shortest edit script in linear space and returns it as
+# difflib-style opcodes. The work is done by myers.c, compiled on first use by
+# native_lib.py (set CC to pick the compiler). If that isn't possible, a
+# pure-Python port of the same algorithm gives identical results, just slower.
+#
+#   myers.py bench [--size N]   compare against difflib/Levenshtein
+
+import ctypes
+from array import array
+from pathlib import Path
+from typing import Dict, Hashable, List, Optional, Sequence, Tuple
+
+import native_lib
+
+Opcode = Tuple[str, int, int, int, int]
+
+SOURCE_PATH = Path(__file__).with_suffix(".c")
+
+SIGNATURES: native_lib.Signatures = {
+    "myers_match": (ctypes.c_int, [ctypes.c_void_p, ctypes.c_int, ctypes.c_void_p, ctypes.c_int, ctypes.c_void_p, ctypes.c_void_p]),
+}
+
+
+def native() -> Optional[ctypes.CDLL]:
+    """The compiled library, or None if it can't be built or loaded (or
+    MYERS_NATIVE=0 is set)."""
+    return native_lib.load(SOURCE_PATH, "myers", ["-O2"], "MYERS_NATIVE", SIGNATURES)
+
+
+def _middle_snake(a: Sequence[int], b: Sequence[int], a0: int, a1: int, b0: int, b1: int, vf: List[int], vb: List[int], off: int) -> Tuple[int, int, int, int]:
+    n = a1 - a0
+    m = b1 - b0
+    delta = n - m
+    odd = delta & 1
+    max_d = (n + m + 1) // 2
+
+    vf[off + 1] = 0
+    vb[off + 1] = 0
+    for d in range(max_d + 1):
+        for k in range(-d, d + 1, 2):
+            if k == -d or (k != d and vf[off + k - 1] < vf[off + k + 1]):
+                x = vf[off + k + 1]
+            else:
+                x = vf[off + k - 1] + 1
+            y = x - k
+            xs, ys = x, y
+            while x < n and y < m and a[a0 + x] == b[b0 + y]:
+                x += 1
+                y += 1
+            vf[off + k] = x
+            if odd and delta - (d - 1) <= k <= delta + (d - 1) and x + vb[off + delta - k] >= n:
+                return a0 + xs, b0 + ys, a0 + x, b0 + y
+        for k in range(-d, d + 1, 2):
+            if k == -d or (k != d and vb[off + k - 1] < vb[off + k + 1]):
+                x = vb[off + k + 1]
+            else:
+                x = vb[off + k - 1] + 1
+            y = x - k
+            xs, ys = x, y
+            while x < n and y < m and a[a1 - x - 1] == b[b1 - y - 1]:
+                x += 1
+                y += 1
+            vb[off + k] = x
+            if not odd and -d <= delta - k <= d and x + vf[off + delta - k] >= n:
+                return a1 - x, b1 - y, a1 - xs, b1 - ys
+    raise AssertionError("no middle snake found")
+
+
+def _match_python(a: Sequence[int], b: Sequence[int]) -> List[Tuple[int, int]]:
+    """Port of myers.c's lcs(), with the recursion turned into a work stack."""
+    size = len(a) + len(b) + 3
+    vf = [0] * (2 * size + 1)
+    vb = [0] * (2 * size + 1)
+    out: List[Tuple[int, int]] = []
+
+    # Items are either ranges to solve or runs of already known matches, in
+    # the order their pairs should be emitted.
+    stack: List[Tuple[bool, int, int, int, int]] = [(True, 0, len(a), 0, len(b))]
+    while stack:
+        is_range, a0, a1, b0, b1 = stack.pop()
+        if not is_range:
+            out.extend((a0 + i, b0 + i) for i in range(a1))
+            continue
+        while a0 < a1 and b0 < b1 and a[a0] == b[b0]:
+            out.append((a0, b0))
+            a0 += 1
+            b0 += 1
+        suffix = 0
+        while a0 < a1 and b0 < b1 and a[a1 - 1] == b[b1 - 1]:
+            a1 -= 1
+            b1 -= 1
+            suffix += 1
+        stack.append((False, a1, suffix, b1, 0))
+        if a0 < a1 and b0 < b1:
+            sx, sy, ex, ey = _middle_snake(a, b, a0, a1, b0, b1, vf, vb, size)
+            stack.append((True, ex, a1, ey, b1))
+            stack.append((False, sx, ex - sx, sy, 0))
+            stack.append((True, a0, sx, b0, sy))
+    return out
+
+
+def _match_native(lib: ctypes.CDLL, a: Sequence[int], b: Sequence[int]) -> List[Tuple[int, int]]:
+    arr_a = array("i", a)
+    arr_b = array("i", b)
+    count = min(len(a), len(b))
+    out_a = array("i", bytes(4 * count))
+    out_b = array("i", bytes(4 * count))
+    n = lib.myers_match(
+        arr_a.buffer_info()[0] if a else None,
+        len(a),
+        arr_b.buffer_info()[0] if b else None,
+        len(b),
+        out_a.buffer_info()[0] if count else None,
+        out_b.buffer_info()[0] if count else None,
+    )
+    if n < 0:
+        raise MemoryError
+    return list(zip(out_a[:n], out_b[:n]))
+
+
+def intern(seq1: Sequence[Hashable], seq2: Sequence[Hashable]) -> Tuple[List[int], List[int]]:
+    ids: Dict[Hashable, int] = {}
+    a = [ids.setdefault(x, len(ids)) for x in seq1]
+    b = [ids.setdefault(x, len(ids)) for x in seq2]
+    return a, b
+
+
+def match(seq1: Sequence[Hashable], seq2: Sequence[Hashable], use_native: bool = True) -> List[Tuple[int, int]]:
+    """The (i, j) pairs with seq1[i] == seq2[j] kept by a shortest edit script."""
+    a, b = intern(seq1, seq2)
+    lib = native() if use_native else None
+    if lib is not None:
+        return _match_native(lib, a, b)
+    return _match_python(a, b)
+
+
+def opcodes(seq1: Sequence[Hashable], seq2: Sequence[Hashable], use_native: bool = True) -> List[Opcode]:
+    """Like difflib.SequenceMatcher.get_opcodes(), for a shortest edit script.
+    A deletion directly next to an insertion is reported as "replace"."""
+    ret: List[Opcode] = []
+    i = j = 0
+    pairs = match(seq1, seq2, use_native)
+    for mi, mj in pairs + [(len(seq1), len(seq2))]:
+        if mi > i and mj > j:
+            ret.append(("replace", i, mi, j, mj))
+        elif mi > i:
+            ret.append(("delete", i, mi, j, j))
+        elif mj > j:
+            ret.append(("insert", i, i, j, mj))
+        if mi < len(seq1):
+            if ret and ret[-1][0] == "equal" and ret[-1][2] == mi:
+                ret[-1] = ("equal", ret[-1][1], mi + 1, ret[-1][3], mj + 1)
+            else:
+                ret.append(("equal", mi, mi + 1, mj, mj + 1))
+        i, j = mi + 1, mj + 1
+    return ret
+
+
+def _synthetic_function(rng, size: int) -> List[str]:
+    mnemonics = ["addiu", "lw", "sw", "jal", "nop", "lui", "or", "beqz", "b", "jr", "mtc1", "lwc1", "add.s", "mul.s", "sll", "andi"]
+    return [rng.choice(mnemonics) for _ in range(size)]
+
+
+def _mutate(rng, seq: List[str], edits: int) -> List[str]:
+    seq = seq[:]
+    for _ in range(edits):
+        pos = rng.randrange(len(seq))
+        op = rng.randrange(3)
+        if op == 0:
+            del seq[pos]
+        elif op == 1:
+            seq.insert(pos, rng.choice(seq))
+        else:
+            seq[pos] = rng.choice(seq)
+    return seq
+
+
+def bench(size: int, repeat: int):
+    import difflib
+    import random
+    import time
+
+    rng = random.Random(0)
+    base = _synthetic_function(rng, size)
+    cases = [
+        ("identical", base),
+        ("10 edits", _mutate(rng, base, 10)),
+        ("1% edited", _mutate(rng, base, size // 100)),
+        ("10% edited", _mutate(rng, base, size // 10)),
+        ("unrelated", _synthetic_function(rng, size)),
+    ]
+
+    backends = []
+    if native() is not None:
+        backends.append(("myers (native)", lambda x, y: opcodes(x, y, True)))
+    backends.append(("myers (python)", lambda x, y: opcodes(x, y, False)))
+    backends.append(("difflib", lambda x, y: difflib.SequenceMatcher(a=x, b=y, autojunk=False).get_opcodes()))
+    try:
+        import Levenshtein
+
+        def levenshtein(x, y):
+            a, b = intern(x, y)
+            return Levenshtein.opcodes("".join(map(chr, a)), "".join(map(chr, b)))
+
+        backends.append(("levenshtein", levenshtein))
+    except ModuleNotFoundError:
+        pass
+
+    print(f"{size} instructions, best of {repeat}")
+    print(f"{'case':12}" + "".join(f"{name:>18}" for name, _ in backends))
+    for case, other in cases:
+        if native() is not None:
+            assert opcodes(base, other, True) == opcodes(base, other, False), case
+        row = f"{case:12}"
+        for name, fn in backends:
+            best = None
+            for _ in range(repeat):
+                start = time.perf_counter()
+                fn(base, other)
+                elapsed = time.perf_counter() - start
+                best = elapsed if best is None else min(best, elapsed)
+            row += f"{best * 1000:16.2f}ms"
+        print(row)
+
+
+def main():
+    import argparse
+
+    parser = argparse.ArgumentParser(description="Myers alignment backend for diff.py")
+    sub = parser.add_subparsers(dest="command", required=True)
+    p = sub.add_parser("bench", help="time the backends on synthetic functions")
+    p.add_argument("--size", type=int, default=5000, help="instructions per function (default: %(default)s)")
+    p.add_argument("--repeat", type=int, default=3)
+    args = parser.parse_args()
+
+    if args.command == "bench":
+        bench(args.size, args.repeat)
+
+
+if __name__ == "__main__":
+    main()
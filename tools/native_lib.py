@@ -0,0 +1,78 @@
+# Building and loading the C helpers in tools/ (myers.c, texcodec.c, ...).
+#
+# load() compiles a helper into build/tools/lib<name>.so the first time it's
+# needed, and again whenever its source or one of its dependencies is newer,
+# then loads it with ctypes and sets up the signatures of its functions. Set
+# CC to pick the compiler. The compiler's warnings and errors are shown; if the
+# build or the load fails, load() returns None and the caller uses its Python
+# port instead.
+
+import ctypes
+import os
+import subprocess
+import sys
+import tempfile
+from pathlib import Path
+from typing import Any, Dict, List, Optional, Sequence, Tuple
+
+BUILD_DIR = Path(__file__).parent.parent / "build" / "tools"
+
+# function name -> (restype, argtypes)
+Signatures = Dict[str, Tuple[Any, List[Any]]]
+
+_loaded: Dict[str, Optional[ctypes.CDLL]] = {}
+
+
+def library_path(lib_name: str) -> Path:
+    return BUILD_DIR / f"lib{lib_name}.so"
+
+
+def _build(source: Path, lib_path: Path, flags: Sequence[str], deps: Sequence[Path], libs: Sequence[str]) -> bool:
+    try:
+        newest = max(p.stat().st_mtime for p in (source, *deps))
+        if lib_path.stat().st_mtime >= newest:
+            return True
+    except OSError:
+        pass
+    lib_path.parent.mkdir(parents=True, exist_ok=True)
+    fd, tmp_name = tempfile.mkstemp(dir=lib_path.parent, suffix=".so.tmp")
+    os.close(fd)
+    cmd = [os.environ.get("CC", "cc"), *flags, "-shared", "-fPIC", "-o", tmp_name, str(source), *libs]
+    try:
+        subprocess.run(cmd, check=True, stdout=subprocess.DEVNULL)
+    except (OSError, subprocess.CalledProcessError) as e:
+        print(f"native_lib: couldn't build {lib_path.name} ({e}), using the Python port", file=sys.stderr)
+        os.unlink(tmp_name)
+        return False
+    os.replace(tmp_name, lib_path)
+    return True
+
+
+def load(
+    source: Path,
+    lib_name: str,
+    flags: Sequence[str],
+    env_var: str,
+    signatures: Signatures,
+    deps: Sequence[Path] = (),
+    libs: Sequence[str] = (),
+) -> Optional[ctypes.CDLL]:
+    """lib<lib_name>.so built from source, or None if it can't be built or
+    loaded, or env_var is set to 0. The result is remembered, so this is
+    cheap to call every time the library is wanted."""
+    if lib_name in _loaded:
+        return _loaded[lib_name]
+    lib = None
+    if os.environ.get(env_var, "1") != "0":
+        lib_path = library_path(lib_name)
+        try:
+            if _build(source, lib_path, flags, deps, libs):
+                lib = ctypes.CDLL(str(lib_path))
+                for name, (restype, argtypes) in signatures.items():
+                    getattr(lib, name).restype = restype
+                    getattr(lib, name).argtypes = argtypes
+        except OSError as e:
+            print(f"native_lib: couldn't load {lib_path.name} ({e}), using the Python port", file=sys.stderr)
+            lib = None
+    _loaded[lib_name] = lib
+    return lib
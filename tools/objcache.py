@@ -0,0 +1,260 @@
+#!/usr/bin/env python3
+# ccache-style object cache for IDO compiles.
+#
+# Objects are keyed on the fully preprocessed source (as produced by the
+# compiler's own -E), a hash of the compiler binaries, and the exact flag set.
+# Include paths are left out of the key, since everything they affect is
+# already in the preprocessed source; that keeps the cache shareable between
+# checkouts on the same machine.
+#
+# Used directly by tools/asm_processor/build.py for game code, and as a
+# command wrapper for everything else:
+#
+#   objcache.py [--cache-dir DIR] [--depfile DEPFILE] -- <cc> <flags...> -c -o <out> <in>
+#
+# Since the wrapper preprocesses anyway, it can also write a depfile listing
+# every header the source pulled in. Without --cache-dir there is nothing to
+# preprocess for, so the compiler writes the depfile itself with -MDupdate.
+# build.ninja only goes through the wrapper when the cache is on.
+
+import argparse
+import hashlib
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+from pathlib import Path
+from typing import List, Optional
+
+try:
+    import fcntl
+except ImportError:
+    # No locking on Windows; the size total is then only approximate
+    fcntl = None
+
+from depfile import headers_from_preprocessed, write_depfile
+
+DEFAULT_MAX_SIZE = 2 * 2**30
+
+
+def default_cache_dir() -> Path:
+    if "POKEMONSNAP_OBJCACHE_DIR" in os.environ:
+        return Path(os.environ["POKEMONSNAP_OBJCACHE_DIR"])
+    xdg = os.environ.get("XDG_CACHE_HOME")
+    base = Path(xdg) if xdg else Path.home() / ".cache"
+    return base / "pokemonsnap" / "objcache"
+
+
+def key_flags(flags: List[str]) -> List[str]:
+    # Drop include paths (they differ between checkouts and only matter to
+    # the preprocessor) but keep everything else, -D included.
+    ret = []
+    skip = False
+    for flag in flags:
+        if skip:
+            skip = False
+        elif flag == "-I":
+            skip = True
+        elif not flag.startswith("-I"):
+            ret.append(flag)
+    return ret
+
+
+class ObjectCache:
+    """Objects are stored under objects/<2 hex digits>/. A running total of
+    their size is kept in the size file, so the shards are only scanned once
+    it passes max_size, which then evicts the least recently used objects
+    down to TRIM_RATIO of it (as ccache does)."""
+
+    TRIM_RATIO = 0.8
+
+    def __init__(self, path: Path, max_size: int = DEFAULT_MAX_SIZE):
+        self.path = Path(path)
+        self.objects_path = self.path / "objects"
+        self.compilers_path = self.path / "compilers"
+        self.size_path = self.path / "size"
+        self.max_size = max_size
+
+    def compiler_id(self, compiler: str) -> str:
+        """Hash of every file next to the compiler driver, since cc runs cfe,
+        uopt, ugen, as1 etc. from its own directory. The result is memoized by
+        path and mtimes so the binaries are only hashed once per install."""
+        compiler_dir = Path(compiler).resolve().parent
+        files = sorted(p for p in compiler_dir.iterdir() if p.is_file())
+        stamp = hashlib.sha256()
+        for p in files:
+            st = p.stat()
+            stamp.update(f"{p}:{st.st_size}:{st.st_mtime_ns}\n".encode())
+        stamp_path = self.compilers_path / stamp.hexdigest()
+        try:
+            return stamp_path.read_text()
+        except OSError:
+            pass
+
+        h = hashlib.sha256()
+        for p in files:
+            h.update(p.name.encode() + b"\0")
+            h.update(p.read_bytes())
+        digest = h.hexdigest()
+        self.compilers_path.mkdir(parents=True, exist_ok=True)
+        self._write_atomic(stamp_path, digest.encode())
+        return digest
+
+    def key(self, compiler_id: str, flags: List[str], preprocessed: bytes, extra: bytes = b"") -> str:
+        h = hashlib.sha256()
+        h.update(compiler_id.encode() + b"\0")
+        h.update(json.dumps(key_flags(flags)).encode() + b"\0")
+        h.update(len(extra).to_bytes(8, "little") + extra)
+        h.update(preprocessed)
+        return h.hexdigest()
+
+    def _entry(self, key: str) -> Path:
+        return self.objects_path / key[:2] / (key[2:] + ".o")
+
+    def get(self, key: str, out_file: Path) -> bool:
+        entry = self._entry(key)
+        try:
+            shutil.copyfile(entry, out_file)
+        except OSError:
+            return False
+        try:
+            os.utime(entry)
+        except OSError:
+            pass
+        return True
+
+    def put(self, key: str, obj_file: Path):
+        entry = self._entry(key)
+        entry.parent.mkdir(parents=True, exist_ok=True)
+        data = Path(obj_file).read_bytes()
+        self._write_atomic(entry, data)
+        size = self._update_size(added=len(data))
+        if size is None or size > self.max_size:
+            self.trim()
+
+    def trim(self):
+        entries = []
+        total = 0
+        for p in self.objects_path.glob("*/*.o"):
+            try:
+                st = p.stat()
+            except OSError:
+                continue
+            entries.append((st.st_mtime, st.st_size, p))
+            total += st.st_size
+        if total > self.max_size:
+            target = self.max_size * self.TRIM_RATIO
+            entries.sort()
+            for _, size, p in entries:
+                if total <= target:
+                    break
+                try:
+                    p.unlink()
+                except OSError:
+                    continue
+                total -= size
+        self._update_size(size=total)
+
+    def _update_size(self, added: int = 0, size: Optional[int] = None) -> Optional[int]:
+        """Add to the running total in the size file, or set it, and return
+        it (None if it isn't known yet). Compiles sharing the cache update it
+        under a lock."""
+        self.path.mkdir(parents=True, exist_ok=True)
+        fd = os.open(self.size_path, os.O_RDWR | os.O_CREAT, 0o644)
+        try:
+            if fcntl is not None:
+                fcntl.lockf(fd, fcntl.LOCK_EX)
+            if size is None:
+                try:
+                    size = int(os.read(fd, 64)) + added
+                except ValueError:
+                    return None
+            os.lseek(fd, 0, os.SEEK_SET)
+            os.ftruncate(fd, 0)
+            os.write(fd, f"{size}\n".encode())
+        finally:
+            os.close(fd)
+        return size
+
+    @staticmethod
+    def _write_atomic(path: Path, data: bytes):
+        fd, tmp_name = tempfile.mkstemp(dir=path.parent, suffix=".tmp")
+        with os.fdopen(fd, "wb") as f:
+            f.write(data)
+        os.replace(tmp_name, path)
+
+
+def preprocess(compiler: List[str], flags: List[str], in_file: Path) -> bytes:
+    # Errors are left for the real compile to report, rather than shown twice
+    cmd = compiler + [f for f in flags if f != "-c"] + ["-E", str(in_file)]
+    return subprocess.check_output(cmd, stderr=subprocess.DEVNULL)
+
+
+def split_output(args: List[str]):
+    """Split `<flags...> -o <out> <in>` into (flags, out, in)."""
+    args = list(args)
+    in_file = Path(args.pop())
+    out_ind = args.index("-o")
+    out_file = Path(args[out_ind + 1])
+    del args[out_ind : out_ind + 2]
+    return args, out_file, in_file
+
+
+def cached_compile(
+    cache: Optional[ObjectCache],
+    compiler: List[str],
+    args: List[str],
+    depfile: Optional[Path] = None,
+) -> int:
+    flags, out_file, in_file = split_output(args)
+    mdupdate = ["-MDupdate", str(depfile)] if depfile is not None else []
+    if cache is None:
+        return subprocess.call(compiler + mdupdate + args)
+    try:
+        preprocessed = preprocess(compiler, flags, in_file)
+    except subprocess.CalledProcessError:
+        # Let the real compile report the error
+        return subprocess.call(compiler + mdupdate + args)
+
+    if depfile is not None:
+        write_depfile(depfile, out_file, headers_from_preprocessed(preprocessed))
+
+    key = cache.key(cache.compiler_id(compiler[0]), flags, preprocessed)
+    if cache.get(key, out_file):
+        return 0
+
+    ret = subprocess.call(compiler + args)
+    if ret == 0:
+        cache.put(key, out_file)
+    return ret
+
+
+def main(argv: Optional[List[str]] = None) -> int:
+    argv = sys.argv[1:] if argv is None else argv
+    sep = argv.index("--") if "--" in argv else len(argv)
+
+    parser = argparse.ArgumentParser(description="Cache IDO compiler output")
+    parser.add_argument("--cache-dir", type=Path, help=f"cache location, e.g. {default_cache_dir()} (no caching if omitted)")
+    parser.add_argument("--max-size", type=int, default=DEFAULT_MAX_SIZE // 2**20, help="cache size limit in MiB (default: %(default)s)")
+    parser.add_argument("--depfile", type=Path, help="write a depfile listing every header the source includes")
+    parser.add_argument("--clear", action="store_true", help="remove every cached object")
+    args = parser.parse_args(argv[:sep])
+
+    if args.clear:
+        shutil.rmtree(args.cache_dir or default_cache_dir(), ignore_errors=True)
+        return 0
+
+    cache = None
+    if args.cache_dir is not None:
+        cache = ObjectCache(args.cache_dir, args.max_size * 2**20)
+
+    command = argv[sep + 1 :]
+    if not command:
+        parser.error("missing compiler command after --")
+    return cached_compile(cache, command[:1], command[1:], args.depfile)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,238 @@
+# In-process relocation and disassembly of single functions, for diff.py's
+# incremental watch mode (-W).
+#
+# Instead of relinking the ROM and running objdump on it after every edit, the
+# function is taken straight from its freshly compiled object file and
+# relocated against the addresses in the last full link's map. Since only that
+# object changed, everything it refers to outside of itself is still where the
+# map says, and its own sections still start at the same addresses. The result
+# is disassembled with ultralib's MIPS decoder into the same text format that
+# `objdump -D -b binary` produces, so diff.py's process() works unchanged.
+
+import struct
+import sys
+from pathlib import Path
+from typing import List, Optional, Tuple
+
+sys.path.insert(0, str(Path(__file__).parent.parent / "ultralib" / "tools"))
+from libelf import (  # noqa: E402
+    ElfFile,
+    R_MIPS_26,
+    R_MIPS_32,
+    R_MIPS_HI16,
+    R_MIPS_LO16,
+    SB_LOCAL,
+    SHN_ABS,
+    SHN_COMMON,
+    SHN_LORESERVE,
+    SHN_UND,
+    SHT_RELA,
+    ST_FUNC,
+    ST_NOTYPE,
+    ST_SECTION,
+)
+from mips_isa import ABI_VR4300, MipsAbi, MipsInsn, fetch_insn, mips_get_field, mips_insns  # noqa: E402
+
+import mapfile  # noqa: E402
+from symdb import SymbolDB  # noqa: E402
+
+# objdump spells registers without the `$`, and diff.py's regexes expect that
+OBJDUMP_ABI = MipsAbi(
+    "VR4300",
+    tuple(name.lstrip("$") for name in ABI_VR4300.gpr_names),
+    ABI_VR4300.cop0_names,
+    tuple(name.lstrip("$") for name in ABI_VR4300.cop1_names),
+    None,
+)
+
+
+class RelocationError(Exception):
+    pass
+
+
+def disassemble(data: bytes, address: int) -> str:
+    """Disassemble big-endian MIPS code the way `objdump -Dz -b binary` lays
+    it out: `<address>:\\t<raw> \\t<mnemonic>\\t<operands>`."""
+    lines = []
+    for offset in range(0, len(data) - 3, 4):
+        (raw,) = struct.unpack_from(">I", data, offset)
+        vaddr = address + offset
+        insn = MipsInsn(OBJDUMP_ABI, raw, vaddr, fetch_insn(raw, vaddr, mips_insns, mips_get_field))
+        row = f"{vaddr:8x}:\t{raw:08x} \t{insn.mnemonic}"
+        if insn.op_str:
+            row += f"\t{insn.op_str}"
+        lines.append(row)
+    return "\n".join(lines)
+
+
+class LinkedLayout:
+    """Symbol and section addresses from the last link, looked up in the map's
+    symbol database, which is rebuilt whenever the map file changes."""
+
+    def __init__(self, map_path: str):
+        self.map_path = map_path
+        self.db: Optional[SymbolDB] = None
+
+    def refresh(self):
+        if self.db is None:
+            self.db = SymbolDB(Path(self.map_path))
+        else:
+            self.db.refresh()
+
+    def symbol(self, name: str) -> Optional[int]:
+        # Symbols defined by objects win over ones assigned in linker scripts
+        syms = self.db.lookup(name, ("map",)) or self.db.lookup(name, ("script",))
+        return syms[-1].vram if syms else None
+
+    def input(self, objfile: str, section: str) -> mapfile.MapInput:
+        inp = self.db.input(objfile, section)
+        if inp is None:
+            raise RelocationError(f"{section} of {objfile} isn't in the map, run a full build")
+        return inp
+
+
+def function_ranges(objfile: str, section: str) -> List[Tuple[str, int, int]]:
+    """(name, start, end) of every function in an object's section, as
+    offsets into it, from the object's own symbol table. Unlike the map, that
+    includes static functions. Code before the first function gets a range of
+    its own, named after the section."""
+    with ElfFile.open(objfile) as elf:
+        sect = elf.find_section_by_name(section)
+        if sect is None or elf.symtab is None:
+            raise RelocationError(f"{objfile} has no {section} or symbol table")
+        starts = {}
+        for sym in elf.symtab.symbol_entries:
+            if sym.st_shndx != sect.index or sym.st_value >= sect.sh_size:
+                continue
+            # Functions, and globals in hand-written assembly (NOTYPE), but not
+            # local labels
+            if sym.type == ST_FUNC or (sym.type == ST_NOTYPE and sym.bind != SB_LOCAL):
+                starts.setdefault(sym.st_value, sym.name)
+        size = sect.sh_size
+    if size and 0 not in starts:
+        starts[0] = f"{section}+0x0"
+    bounds = sorted(starts) + [size]
+    return [(starts[start], start, end) for start, end in zip(bounds, bounds[1:])]
+
+
+def _next_global(addresses: List[int], start: int, end: int) -> int:
+    return min((a for a in addresses if a > start), default=end)
+
+
+class FunctionTarget:
+    """One function, diffed between the base ROM and its object file."""
+
+    def __init__(self, map_path: str, objfile: str, name: str, baseimg: str):
+        self.layout = LinkedLayout(map_path)
+        self.objfile = objfile
+        self.name = name
+        self.baseimg = baseimg
+        self._base_dump: Optional[str] = None
+
+    def base_dump(self) -> str:
+        """The function as it is in the base ROM. The ROM range comes from the
+        map, and is decoded only once per session."""
+        if self._base_dump is None:
+            self.layout.refresh()
+            text = self.layout.input(self.objfile, ".text")
+            sym = next((s for s in text.symbols if s.name == self.name), None)
+            if sym is None or text.rom is None:
+                raise RelocationError(f"{self.name} isn't in {self.objfile}'s .text in the map")
+            end = _next_global([s.vram for s in text.symbols], sym.vram, text.vram + text.size)
+            rom = text.rom + (sym.vram - text.vram)
+            with open(self.baseimg, "rb") as f:
+                f.seek(rom)
+                data = f.read(end - sym.vram)
+            self._base_dump = disassemble(data, rom)
+        return self._base_dump
+
+    def my_dump(self) -> str:
+        """The function from the current object file, relocated against the
+        last link."""
+        self.layout.refresh()
+        with ElfFile.open(self.objfile) as elf:
+            return self._my_dump(elf)
+
+    def _my_dump(self, elf: ElfFile) -> str:
+        text = elf.find_section_by_name(".text")
+        if text is None or elf.symtab is None:
+            raise RelocationError(f"{self.objfile} has no .text or symbol table")
+        func = next(
+            (
+                s
+                for s in elf.symtab.symbol_entries
+                if s.name == self.name and s.st_shndx == text.index and s.type != ST_SECTION
+            ),
+            None,
+        )
+        if func is None:
+            raise RelocationError(f"{self.name} isn't defined in {self.objfile}")
+
+        # End at the next global symbol, the same way the base ROM range is cut
+        # from the map (which only lists globals).
+        globals_in_text = [s.st_value for s in elf.symtab.global_symbols() if s.st_shndx == text.index]
+        start = func.st_value
+        end = _next_global(globals_in_text, start, text.sh_size)
+
+        map_text = self.layout.input(self.objfile, ".text")
+        assert map_text.rom is not None
+        data = self._relocate(elf, text, start, end, map_text.vram)
+        return disassemble(bytes(data[start:end]), map_text.rom + start)
+
+    def _symbol_value(self, elf: ElfFile, sym) -> int:
+        if sym.st_shndx == SHN_ABS:
+            return sym.st_value
+        if sym.st_shndx in (SHN_UND, SHN_COMMON) or sym.st_shndx >= SHN_LORESERVE:
+            value = self.layout.symbol(sym.name)
+            if value is None:
+                raise RelocationError(f"{sym.name} isn't in the map, run a full build")
+            return value
+        section = elf.sections[sym.st_shndx]
+        return self.layout.input(self.objfile, section.name).vram + sym.st_value
+
+    def _relocate(self, elf: ElfFile, text, start: int, end: int, text_vram: int) -> bytearray:
+        orig = bytes(text.data)
+        data = bytearray(orig)
+        relocs = sorted(
+            (r for rel in text.relocated_by for r in rel.relocations),
+            key=lambda r: r.r_offset,
+        )
+
+        def read(offset: int) -> int:
+            return struct.unpack_from(">I", orig, offset)[0]
+
+        def sext16(v: int) -> int:
+            return (v & 0x7FFF) - (v & 0x8000)
+
+        for i, r in enumerate(relocs):
+            if not start <= r.r_offset < end:
+                continue
+            insn = read(r.r_offset)
+            rela = r.sh_type == SHT_RELA
+            s = self._symbol_value(elf, r.relocated_symbol)
+
+            if r.rel_type == R_MIPS_32:
+                value = s + (r.r_addend if rela else insn)
+            elif r.rel_type == R_MIPS_26:
+                addend = r.r_addend if rela else (insn & 0x3FFFFFF) << 2
+                value = (insn & ~0x3FFFFFF) | (((s + addend) >> 2) & 0x3FFFFFF)
+            elif r.rel_type == R_MIPS_HI16:
+                if rela:
+                    addend = r.r_addend
+                else:
+                    # The low half of the addend is in the paired LO16
+                    lo = next(
+                        (x for x in relocs[i + 1 :] if x.rel_type == R_MIPS_LO16 and x.sym_index == r.sym_index),
+                        None,
+                    )
+                    if lo is None:
+                        raise RelocationError(f"unpaired R_MIPS_HI16 at {self.name}+0x{r.r_offset - start:X}")
+                    addend = ((insn & 0xFFFF) << 16) + sext16(read(lo.r_offset))
+                value = (insn & 0xFFFF0000) | (((s + addend + 0x8000) >> 16) & 0xFFFF)
+            elif r.rel_type == R_MIPS_LO16:
+                addend = r.r_addend if rela else sext16(insn)
+                value = (insn & 0xFFFF0000) | ((s + addend) & 0xFFFF)
+            else:
+                raise RelocationError(f"unsupported relocation type {r.rel_type} at {self.name}+0x{r.r_offset - start:X}")
+            struct.pack_into(">I", data, r.r_offset, value & 0xFFFFFFFF)
+        return data
@@ -0,0 +1,176 @@
+/*
+ * Random numbers for replaying and simulating animals, used by tools/prng.py.
+ *
+ * The game has one generator, guRandom() (ultralib/src/gu/random.c), a
+ * quadratic congruential one whose 32-bit seed every caller shares, so what
+ * one animal draws depends on everything drawn before it.
+ * prng_gurandom_fill() reproduces that sequence exactly.
+ *
+ * Everything else is Philox4x32-10 (Salmon et al., "Parallel random numbers:
+ * as easy as 1, 2, 3", 2011), a counter-based generator: block n of a stream
+ * is a keyed bijection of n, so any stream can be started anywhere and
+ * streams don't interact. The 64-bit key is (spawn id, level seed), the
+ * 128-bit counter is the block number in its low 64 bits. Each block is four
+ * 32-bit words.
+ *
+ * prng_fill() produces consecutive blocks of one stream, prng_streams() one
+ * block each of many streams. Both run four blocks at a time with SSE2; the
+ * 32x32->64 bit multiplies Philox needs are what _mm_mul_epu32 does.
+ *
+ * Build: cc -O3 -shared -fPIC -o libprng.so prng.c (prng.py does this itself, into build/tools/)
+ * Define PRNG_NO_SIMD to build without the SSE2 paths.
+ */
+
+#include <stdint.h>
+
+#if defined(__SSE2__) && !defined(PRNG_NO_SIMD)
+#define PRNG_SSE2
+#include <emmintrin.h>
+#endif
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+/* guRandom(), n times */
+uint32_t prng_gurandom_fill(uint32_t seed, uint32_t *out, int n) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        uint32_t x = (seed << 2) + 2;
+
+        x *= x + 1;
+        x = x >> 2;
+        seed = x;
+        out[i] = x;
+    }
+    return seed;
+}
+
+void prng_block(const uint32_t ctr[4], const uint32_t key[2], uint32_t out[4]) {
+    uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+    uint32_t k0 = key[0], k1 = key[1];
+    int r;
+
+    for (r = 0; r < PHILOX_ROUNDS; r++) {
+        uint64_t p0 = (uint64_t) PHILOX_M0 * c0;
+        uint64_t p1 = (uint64_t) PHILOX_M1 * c2;
+
+        c0 = (uint32_t) (p1 >> 32) ^ c1 ^ k0;
+        c1 = (uint32_t) p1;
+        c2 = (uint32_t) (p0 >> 32) ^ c3 ^ k1;
+        c3 = (uint32_t) p0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+#if defined(PRNG_SSE2)
+/* hi and lo halves of a * m for each 32-bit lane */
+static inline void mul_hilo(__m128i a, __m128i m, __m128i *hi, __m128i *lo) {
+    const __m128i lo_mask = _mm_set_epi32(0, -1, 0, -1);
+    __m128i even = _mm_mul_epu32(a, m);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), m);
+
+    *lo = _mm_or_si128(_mm_and_si128(even, lo_mask), _mm_slli_epi64(odd, 32));
+    *hi = _mm_or_si128(_mm_srli_epi64(even, 32), _mm_andnot_si128(lo_mask, odd));
+}
+
+/* Four blocks at once: lane i of c[j] is word j of block i */
+static inline void block4(__m128i c[4], __m128i k0, __m128i k1) {
+    const __m128i m0 = _mm_set1_epi32((int) PHILOX_M0);
+    const __m128i m1 = _mm_set1_epi32((int) PHILOX_M1);
+    const __m128i w0 = _mm_set1_epi32((int) PHILOX_W0);
+    const __m128i w1 = _mm_set1_epi32((int) PHILOX_W1);
+    int r;
+
+    for (r = 0; r < PHILOX_ROUNDS; r++) {
+        __m128i hi0, lo0, hi1, lo1;
+
+        mul_hilo(c[0], m0, &hi0, &lo0);
+        mul_hilo(c[2], m1, &hi1, &lo1);
+        c[0] = _mm_xor_si128(_mm_xor_si128(hi1, c[1]), k0);
+        c[1] = lo1;
+        c[2] = _mm_xor_si128(_mm_xor_si128(hi0, c[3]), k1);
+        c[3] = lo0;
+        k0 = _mm_add_epi32(k0, w0);
+        k1 = _mm_add_epi32(k1, w1);
+    }
+}
+
+/* Back to four blocks of four consecutive words */
+static inline void store4(uint32_t *out, __m128i c[4]) {
+    __m128i t0 = _mm_unpacklo_epi32(c[0], c[1]);
+    __m128i t1 = _mm_unpacklo_epi32(c[2], c[3]);
+    __m128i t2 = _mm_unpackhi_epi32(c[0], c[1]);
+    __m128i t3 = _mm_unpackhi_epi32(c[2], c[3]);
+
+    _mm_storeu_si128((__m128i *) (out + 0), _mm_unpacklo_epi64(t0, t1));
+    _mm_storeu_si128((__m128i *) (out + 4), _mm_unpackhi_epi64(t0, t1));
+    _mm_storeu_si128((__m128i *) (out + 8), _mm_unpacklo_epi64(t2, t3));
+    _mm_storeu_si128((__m128i *) (out + 12), _mm_unpackhi_epi64(t2, t3));
+}
+#endif
+
+/* n words of stream (key0, key1), from the start of block `counter` */
+void prng_fill(uint32_t key0, uint32_t key1, uint64_t counter, uint32_t *out, int n) {
+    uint32_t key[2] = { key0, key1 };
+    int i = 0;
+
+#if defined(PRNG_SSE2)
+    for (; i + 16 <= n; i += 16, counter += 4) {
+        __m128i c[4];
+
+        c[0] = _mm_set_epi32((int) (uint32_t) (counter + 3), (int) (uint32_t) (counter + 2),
+                             (int) (uint32_t) (counter + 1), (int) (uint32_t) counter);
+        c[1] = _mm_set_epi32((int) (uint32_t) ((counter + 3) >> 32), (int) (uint32_t) ((counter + 2) >> 32),
+                             (int) (uint32_t) ((counter + 1) >> 32), (int) (uint32_t) (counter >> 32));
+        c[2] = _mm_setzero_si128();
+        c[3] = _mm_setzero_si128();
+        block4(c, _mm_set1_epi32((int) key0), _mm_set1_epi32((int) key1));
+        store4(out + i, c);
+    }
+#endif
+    for (; i < n; i += 4, counter++) {
+        uint32_t ctr[4] = { (uint32_t) counter, (uint32_t) (counter >> 32), 0, 0 };
+        uint32_t block[4];
+        int j;
+
+        prng_block(ctr, key, block);
+        for (j = 0; j < 4 && i + j < n; j++) {
+            out[i + j] = block[j];
+        }
+    }
+}
+
+/* Block counter[i] of stream (key0[i], key1[i]) into out[4 * i], for each i */
+void prng_streams(const uint32_t *key0, const uint32_t *key1, const uint64_t *counter, int n, uint32_t *out) {
+    int i = 0;
+
+#if defined(PRNG_SSE2)
+    for (; i + 4 <= n; i += 4) {
+        __m128i c[4];
+
+        c[0] = _mm_set_epi32((int) (uint32_t) counter[i + 3], (int) (uint32_t) counter[i + 2],
+                             (int) (uint32_t) counter[i + 1], (int) (uint32_t) counter[i]);
+        c[1] = _mm_set_epi32((int) (uint32_t) (counter[i + 3] >> 32), (int) (uint32_t) (counter[i + 2] >> 32),
+                             (int) (uint32_t) (counter[i + 1] >> 32), (int) (uint32_t) (counter[i] >> 32));
+        c[2] = _mm_setzero_si128();
+        c[3] = _mm_setzero_si128();
+        block4(c, _mm_loadu_si128((const __m128i *) (key0 + i)), _mm_loadu_si128((const __m128i *) (key1 + i)));
+        store4(out + i * 4, c);
+    }
+#endif
+    for (; i < n; i++) {
+        uint32_t ctr[4] = { (uint32_t) counter[i], (uint32_t) (counter[i] >> 32), 0, 0 };
+        uint32_t key[2] = { key0[i], key1[i] };
+
+        prng_block(ctr, key, out + i * 4);
+    }
+}
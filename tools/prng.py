@@ -0,0 +1,338 @@
+#!/usr/bin/env python3
+# Random number streams for replaying and simulating animals.
+#
+# The game draws every random number from guRandom(), one generator shared by
+# everything, so an animal's choices depend on what every other object drew
+# first. Here each animal gets its own Stream instead, keyed by its spawn id
+# and the level seed: a counter-based generator (Philox4x32-10, see prng.c)
+# where any position of any stream can be computed directly, so one animal can
+# be replayed on its own and many can be stepped at once. StreamSet hands
+# them out, or in compat mode hands everyone the same GuRandom, which gives
+# exactly the game's sequence.
+#
+# The work is done by prng.c, compiled on first use by native_lib.py (set CC
+# to pick the compiler). If that isn't possible, a numpy port gives identical
+# results, just slower.
+#
+#   prng.py check    known answers, and native against numpy
+#   prng.py bench    words per second of each generator
+
+import ctypes
+from pathlib import Path
+from typing import Dict, Optional, Sequence, Union
+
+import numpy as np
+
+import native_lib
+
+SOURCE_PATH = Path(__file__).with_suffix(".c")
+
+# The initial xseed in ultralib/src/gu/random.c
+GURANDOM_SEED = 174823885
+
+PHILOX_M0 = 0xD2511F53
+PHILOX_M1 = 0xCD9E8D57
+PHILOX_W0 = 0x9E3779B9
+PHILOX_W1 = 0xBB67AE85
+PHILOX_ROUNDS = 10
+
+# (counter, key, block) from the Random123 known-answer tests
+PHILOX_KAT = [
+    ((0, 0, 0, 0), (0, 0), (0x6627E8D5, 0xE169C58D, 0xBC57AC4C, 0x9B00DBD8)),
+    ((0xFFFFFFFF,) * 4, (0xFFFFFFFF,) * 2, (0x408F276D, 0x41C83B0E, 0xA20BC7C6, 0x6D5451FD)),
+    (
+        (0x243F6A88, 0x85A308D3, 0x13198A2E, 0x03707344),
+        (0xA4093822, 0x299F31D0),
+        (0xD16CFE09, 0x94FDCCEB, 0x5001E420, 0x24126EA1),
+    ),
+]
+
+
+_i, _p, _u32, _u64 = ctypes.c_int, ctypes.c_void_p, ctypes.c_uint32, ctypes.c_uint64
+SIGNATURES: native_lib.Signatures = {
+    "prng_gurandom_fill": (_u32, [_u32, _p, _i]),
+    "prng_block": (None, [_p, _p, _p]),
+    "prng_fill": (None, [_u32, _u32, _u64, _p, _i]),
+    "prng_streams": (None, [_p, _p, _p, _i, _p]),
+}
+
+
+def native() -> Optional[ctypes.CDLL]:
+    """The compiled library, or None if it can't be built or loaded (or
+    PRNG_NATIVE=0 is set)."""
+    return native_lib.load(SOURCE_PATH, "prng", ["-O3"], "PRNG_NATIVE", SIGNATURES)
+
+
+# numpy port of prng.c
+
+
+def _gurandom_py(seed: int, n: int):
+    out = np.empty(n, dtype=np.uint32)
+    for i in range(n):
+        x = ((seed << 2) + 2) & 0xFFFFFFFF
+        x = (x * (x + 1)) & 0xFFFFFFFF
+        seed = x >> 2
+        out[i] = seed
+    return out, seed
+
+
+def _philox_np(c: np.ndarray, k0: np.ndarray, k1: np.ndarray) -> np.ndarray:
+    """c is (n, 4) uint32 counters, k0 and k1 n keys each. Returns (n, 4)."""
+    c0, c1, c2, c3 = (c[:, j].astype(np.uint64) for j in range(4))
+    k0 = k0.astype(np.uint64)
+    k1 = k1.astype(np.uint64)
+    mask = np.uint64(0xFFFFFFFF)
+    for _ in range(PHILOX_ROUNDS):
+        p0 = np.uint64(PHILOX_M0) * c0
+        p1 = np.uint64(PHILOX_M1) * c2
+        c0, c1, c2, c3 = (p1 >> np.uint64(32)) ^ c1 ^ k0, p1 & mask, (p0 >> np.uint64(32)) ^ c3 ^ k1, p0 & mask
+        k0 = (k0 + np.uint64(PHILOX_W0)) & mask
+        k1 = (k1 + np.uint64(PHILOX_W1)) & mask
+    return np.stack([c0, c1, c2, c3], axis=1).astype(np.uint32)
+
+
+def _counters(counter: np.ndarray) -> np.ndarray:
+    counter = counter.astype(np.uint64)
+    c = np.zeros((len(counter), 4), dtype=np.uint32)
+    c[:, 0] = counter & np.uint64(0xFFFFFFFF)
+    c[:, 1] = counter >> np.uint64(32)
+    return c
+
+
+def _ptr(a: np.ndarray) -> int:
+    return a.ctypes.data
+
+
+def gurandom(seed: int, n: int, use_native: bool = True):
+    """The next n values of guRandom() from xseed `seed`, and the new xseed."""
+    lib = native() if use_native else None
+    if lib is not None:
+        out = np.empty(n, dtype=np.uint32)
+        seed = lib.prng_gurandom_fill(seed, _ptr(out), n)
+        return out, seed
+    return _gurandom_py(seed, n)
+
+
+def block(counter: Sequence[int], key: Sequence[int], use_native: bool = True) -> np.ndarray:
+    """One Philox4x32-10 block."""
+    ctr = np.array(counter, dtype=np.uint32)
+    k = np.array(key, dtype=np.uint32)
+    lib = native() if use_native else None
+    if lib is not None:
+        out = np.empty(4, dtype=np.uint32)
+        lib.prng_block(_ptr(ctr), _ptr(k), _ptr(out))
+        return out
+    return _philox_np(ctr.reshape(1, 4), k[:1], k[1:])[0]
+
+
+def fill(key0: int, key1: int, counter: int, n: int, use_native: bool = True) -> np.ndarray:
+    """n words of stream (key0, key1) from the start of block `counter`."""
+    lib = native() if use_native else None
+    if lib is not None:
+        out = np.empty(n, dtype=np.uint32)
+        lib.prng_fill(key0, key1, counter, _ptr(out), n)
+        return out
+    blocks = -(-n // 4)
+    counters = _counters(np.arange(counter, counter + blocks, dtype=np.uint64))
+    k0 = np.full(blocks, key0, dtype=np.uint32)
+    k1 = np.full(blocks, key1, dtype=np.uint32)
+    return _philox_np(counters, k0, k1).reshape(-1)[:n]
+
+
+def streams(key0: np.ndarray, key1: np.ndarray, counter: np.ndarray, use_native: bool = True) -> np.ndarray:
+    """Block counter[i] of stream (key0[i], key1[i]) for every i, as (n, 4)."""
+    key0 = np.ascontiguousarray(key0, dtype=np.uint32)
+    key1 = np.ascontiguousarray(key1, dtype=np.uint32)
+    counter = np.ascontiguousarray(counter, dtype=np.uint64)
+    lib = native() if use_native else None
+    if lib is not None:
+        out = np.empty((len(counter), 4), dtype=np.uint32)
+        lib.prng_streams(_ptr(key0), _ptr(key1), _ptr(counter), len(counter), _ptr(out))
+        return out
+    return _philox_np(_counters(counter), key0, key1)
+
+
+def to_float(words: Union[int, np.ndarray]):
+    """32-bit words to floats in [0, 1), from their top 24 bits."""
+    return (np.asarray(words, dtype=np.uint32) >> 8).astype(np.float32) * np.float32(2.0**-24)
+
+
+class GuRandom:
+    """guRandom() itself: one shared seed, the game's exact sequence."""
+
+    def __init__(self, seed: int = GURANDOM_SEED):
+        self.seed = seed
+
+    def next_u32(self) -> int:
+        out, self.seed = gurandom(self.seed, 1)
+        return int(out[0])
+
+    def fill(self, n: int) -> np.ndarray:
+        out, self.seed = gurandom(self.seed, n)
+        return out
+
+
+class Stream:
+    """One animal's random numbers: word `position` onwards of the stream
+    keyed by (spawn id, level seed). Recreating a Stream with the same
+    arguments replays it."""
+
+    def __init__(self, level_seed: int, spawn_id: int, position: int = 0):
+        self.key0 = spawn_id & 0xFFFFFFFF
+        self.key1 = level_seed & 0xFFFFFFFF
+        self.position = position
+
+    def fill(self, n: int) -> np.ndarray:
+        block_index, skip = divmod(self.position, 4)
+        words = fill(self.key0, self.key1, block_index, n + skip)[skip:]
+        self.position += n
+        return words
+
+    def next_u32(self) -> int:
+        return int(self.fill(1)[0])
+
+
+class StreamSet:
+    """The random numbers of every animal in a level. In compat mode every
+    spawn id shares one GuRandom, like the game."""
+
+    def __init__(self, level_seed: int, compat: bool = False, gurandom_seed: int = GURANDOM_SEED):
+        self.level_seed = level_seed & 0xFFFFFFFF
+        self.compat = compat
+        self.shared = GuRandom(gurandom_seed) if compat else None
+        self._streams: Dict[int, Stream] = {}
+
+    def stream(self, spawn_id: int) -> Union[Stream, GuRandom]:
+        if self.shared is not None:
+            return self.shared
+        if spawn_id not in self._streams:
+            self._streams[spawn_id] = Stream(self.level_seed, spawn_id)
+        return self._streams[spawn_id]
+
+    def step(self, spawn_ids: Sequence[int]) -> np.ndarray:
+        """The next word of each animal's stream, all at once. Each spawn id
+        may appear once."""
+        if self.shared is not None:
+            return self.shared.fill(len(spawn_ids))
+        owned = [self.stream(i) for i in spawn_ids]
+        positions = np.array([s.position for s in owned], dtype=np.uint64)
+        blocks = streams(
+            np.array([s.key0 for s in owned], dtype=np.uint32),
+            np.full(len(owned), self.level_seed, dtype=np.uint32),
+            positions >> np.uint64(2),
+        )
+        for s in owned:
+            s.position += 1
+        return blocks[np.arange(len(owned)), (positions & np.uint64(3)).astype(np.intp)]
+
+
+def check() -> bool:
+    ok = True
+    backends = [("numpy", False)] + ([("native", True)] if native() is not None else [])
+    for name, use_native in backends:
+        for ctr, key, expected in PHILOX_KAT:
+            got = tuple(int(v) for v in block(ctr, key, use_native))
+            if got != expected:
+                print(f"{name}: Philox4x32-10 {ctr} {key} gives {got}, not {expected}")
+                ok = False
+
+    # guRandom against the C in random.c, by hand for the first value
+    x = ((GURANDOM_SEED << 2) + 2) & 0xFFFFFFFF
+    first = ((x * (x + 1)) & 0xFFFFFFFF) >> 2
+    for name, use_native in backends:
+        out, seed = gurandom(GURANDOM_SEED, 1000, use_native)
+        if int(out[0]) != first or int(out[-1]) != seed:
+            print(f"{name}: guRandom sequence is wrong")
+            ok = False
+    if len(backends) > 1:
+        a, sa = gurandom(GURANDOM_SEED, 10000, True)
+        b, sb = gurandom(GURANDOM_SEED, 10000, False)
+        if not np.array_equal(a, b) or sa != sb:
+            print("guRandom: native and numpy differ")
+            ok = False
+
+        rng = np.random.default_rng(0)
+        for n in (1, 3, 15, 16, 17, 1000):
+            key0, key1, counter = (int(v) for v in rng.integers(0, 2**32, 3))
+            counter = (counter << 31) | counter
+            if not np.array_equal(fill(key0, key1, counter, n), fill(key0, key1, counter, n, use_native=False)):
+                print(f"fill of {n}: native and numpy differ")
+                ok = False
+        k0 = rng.integers(0, 2**32, 1001).astype(np.uint32)
+        k1 = rng.integers(0, 2**32, 1001).astype(np.uint32)
+        ctr = rng.integers(0, 2**63, 1001).astype(np.uint64)
+        if not np.array_equal(streams(k0, k1, ctr), streams(k0, k1, ctr, use_native=False)):
+            print("streams: native and numpy differ")
+            ok = False
+
+    # A stream gives the same words however it's consumed
+    a = Stream(1, 2).fill(37)
+    s = Stream(1, 2)
+    b = np.concatenate([s.fill(5), s.fill(1), [s.next_u32()], s.fill(30)])
+    sset = StreamSet(1)
+    c = np.array([sset.step([2, 3])[0] for _ in range(37)], dtype=np.uint32)
+    if not (np.array_equal(a, b) and np.array_equal(a, c)):
+        print("Stream: words depend on how they're drawn")
+        ok = False
+
+    compat = StreamSet(1, compat=True)
+    d = np.concatenate([compat.step([5, 6, 7]), [compat.stream(9).next_u32()]])
+    if not np.array_equal(d, gurandom(GURANDOM_SEED, 4)[0]):
+        print("StreamSet: compat mode doesn't follow guRandom")
+        ok = False
+
+    print("ok" if ok else "FAILED")
+    return ok
+
+
+def bench(count: int, repeat: int):
+    import time
+
+    rng = np.random.default_rng(0)
+    nstreams = count // 4
+    k0 = rng.integers(0, 2**32, nstreams).astype(np.uint32)
+    k1 = np.full(nstreams, 1, dtype=np.uint32)
+    ctr = np.zeros(nstreams, dtype=np.uint64)
+
+    cases = []
+    for name, use_native in [("native", True), ("numpy", False)]:
+        if use_native and native() is None:
+            continue
+        n = count if use_native else count // 16
+        cases += [
+            (f"guRandom ({name})", n, lambda n=n, u=use_native: gurandom(GURANDOM_SEED, n, u)),
+            (f"fill ({name})", n, lambda n=n, u=use_native: fill(1, 2, 0, n, u)),
+            (f"streams ({name})", nstreams * 4, lambda u=use_native: streams(k0, k1, ctr, u)),
+        ]
+
+    print(f"best of {repeat}")
+    for name, n, fn in cases:
+        best = None
+        for _ in range(repeat):
+            start = time.perf_counter()
+            fn()
+            elapsed = time.perf_counter() - start
+            best = elapsed if best is None else min(best, elapsed)
+        print(f"  {name:20}{n:10} words {best * 1e3:9.1f} ms  {n / best / 1e6:9.1f} M words/s")
+
+
+def main():
+    import argparse
+    import sys
+
+    parser = argparse.ArgumentParser(description="Random number streams for animals")
+    sub = parser.add_subparsers(dest="command", required=True)
+    sub.add_parser("check", help="known answers, and native against numpy")
+    p = sub.add_parser("bench", help="time each generator")
+    p.add_argument("--count", type=int, default=1 << 22)
+    p.add_argument("--repeat", type=int, default=3)
+    args = parser.parse_args()
+
+    if args.command == "check":
+        sys.exit(0 if check() else 1)
+    elif args.command == "bench":
+        bench(args.count, args.repeat)
+
+
+if __name__ == "__main__":
+    main()
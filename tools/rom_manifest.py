@@ -0,0 +1,262 @@
+#!/usr/bin/env python3
+# Per-segment and per-object ROM hash manifests.
+#
+#   rom_manifest.py build <map> <rom> <manifest.json>
+#       Write sha1s of every segment and every object's ROM ranges, and say
+#       which segments changed since the manifest that was there before.
+#   rom_manifest.py verify <map> <rom> <baserom> [--manifest manifest.json]
+#       Compare the built ROM's manifest against the base ROM range by range,
+#       and report exactly which segments and objects differ.
+#
+# The sha1sum check already hashes the ROM once per link, so the manifest is
+# only part of the default build with --segment-link, for the changed segment
+# report; otherwise `ninja build/pokemonsnap.manifest.json` asks for it. verify
+# only runs when that check fails. It reuses the manifest if it is newer than
+# the ROM and the map, and otherwise hashes the ROM itself. It doesn't write
+# the manifest, so the next build's report still compares against the last one.
+#
+# ROMs are read through mmap and hashed on a thread pool (hashlib releases the
+# GIL on large buffers), and the base ROM's hashes are cached between runs.
+
+import argparse
+import hashlib
+import json
+import mmap
+import os
+import sys
+from concurrent.futures import ThreadPoolExecutor
+from dataclasses import dataclass
+from pathlib import Path
+from typing import Dict, Iterable, List, Optional, Tuple
+
+import mapfile
+
+CHUNK_SIZE = 0x1000
+
+
+@dataclass(frozen=True)
+class RomRange:
+    segment: str
+    object: Optional[str]
+    section: Optional[str]
+    rom: int
+    size: int
+
+
+def rom_ranges(map_path: Path) -> List[RomRange]:
+    """Every non-empty ROM range from the map: one per segment, plus one per
+    object input section."""
+    ranges: List[RomRange] = []
+    segments: Dict[str, List[int]] = {}
+    for section in mapfile.parse(map_path):
+        if section.rom is None:
+            continue
+        for inp in section.inputs:
+            if inp.rom is None or inp.size == 0:
+                continue
+            ranges.append(RomRange(section.segment, inp.object, inp.section, inp.rom, inp.size))
+        if section.size == 0:
+            continue
+        bounds = segments.setdefault(section.segment, [section.rom, section.rom + section.size])
+        bounds[0] = min(bounds[0], section.rom)
+        bounds[1] = max(bounds[1], section.rom + section.size)
+    for name, (start, end) in segments.items():
+        ranges.append(RomRange(name, None, None, start, end - start))
+    ranges.sort(key=lambda r: (r.rom, r.object is not None))
+    return ranges
+
+
+class Rom:
+    def __init__(self, path: Path):
+        self.path = path
+        self.file = open(path, "rb")
+        self.size = os.fstat(self.file.fileno()).st_size
+        self.map = mmap.mmap(self.file.fileno(), 0, access=mmap.ACCESS_READ) if self.size else None
+        self.view = memoryview(self.map) if self.map is not None else memoryview(b"")
+
+    def close(self):
+        self.view.release()
+        if self.map is not None:
+            self.map.close()
+        self.file.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def sha1(self, start: int, size: int) -> str:
+        return hashlib.sha1(self.view[start : start + size]).hexdigest()
+
+
+def hash_ranges(rom: Rom, spans: Iterable[Tuple[int, int]], jobs: Optional[int] = None) -> Dict[Tuple[int, int], str]:
+    spans = sorted(set(spans))
+    with ThreadPoolExecutor(jobs) as pool:
+        digests = pool.map(lambda span: rom.sha1(*span), spans)
+        return dict(zip(spans, digests))
+
+
+def build_manifest(map_path: Path, rom_path: Path, jobs: Optional[int] = None) -> dict:
+    ranges = rom_ranges(map_path)
+    with Rom(rom_path) as rom:
+        digests = hash_ranges(rom, ((r.rom, r.size) for r in ranges), jobs)
+        manifest = {
+            "rom": {"size": rom.size, "sha1": rom.sha1(0, rom.size)},
+            "segments": {},
+            "objects": {},
+        }
+    for r in ranges:
+        entry = {"rom": r.rom, "size": r.size, "sha1": digests[(r.rom, r.size)]}
+        if r.object is None:
+            manifest["segments"][r.segment] = entry
+        else:
+            obj = manifest["objects"].setdefault(r.object, {"segment": r.segment, "sections": []})
+            obj["sections"].append({"section": r.section, **entry})
+    return manifest
+
+
+def load_base_hashes(cache_path: Path, base: Rom) -> Dict[Tuple[int, int], str]:
+    st = os.stat(base.path)
+    stamp = f"{st.st_size}:{st.st_mtime_ns}"
+    try:
+        cached = json.loads(cache_path.read_text())
+    except (OSError, ValueError):
+        return {}
+    if cached.get("stamp") != stamp:
+        return {}
+    return {tuple(map(int, k.split(":"))): v for k, v in cached["hashes"].items()}
+
+
+def save_base_hashes(cache_path: Path, base: Rom, hashes: Dict[Tuple[int, int], str]):
+    st = os.stat(base.path)
+    cache_path.parent.mkdir(parents=True, exist_ok=True)
+    cache_path.write_text(
+        json.dumps(
+            {
+                "stamp": f"{st.st_size}:{st.st_mtime_ns}",
+                "hashes": {f"{k[0]}:{k[1]}": v for k, v in hashes.items()},
+            }
+        )
+    )
+
+
+def first_difference(a: Rom, b: Rom, start: int, size: int) -> Optional[int]:
+    end = min(start + size, a.size, b.size)
+    for chunk in range(start, end, CHUNK_SIZE):
+        chunk_end = min(chunk + CHUNK_SIZE, end)
+        if a.view[chunk:chunk_end] != b.view[chunk:chunk_end]:
+            for i in range(chunk, chunk_end):
+                if a.view[i] != b.view[i]:
+                    return i
+    if start + size > min(a.size, b.size):
+        return min(a.size, b.size)
+    return None
+
+
+def manifest_ranges(manifest: dict) -> List[Tuple[RomRange, str]]:
+    """The ranges of a manifest with their sha1s, in rom_ranges() order."""
+    ranges = [(RomRange(name, None, None, e["rom"], e["size"]), e["sha1"]) for name, e in manifest["segments"].items()]
+    for obj, o in manifest["objects"].items():
+        ranges.extend((RomRange(o["segment"], obj, e["section"], e["rom"], e["size"]), e["sha1"]) for e in o["sections"])
+    ranges.sort(key=lambda x: (x[0].rom, x[0].object is not None))
+    return ranges
+
+
+def current_manifest(map_path: Path, rom_path: Path, manifest_path: Optional[Path], jobs: Optional[int] = None) -> dict:
+    """The manifest at manifest_path if it is newer than the map and the ROM,
+    or else a new one."""
+    if manifest_path is not None:
+        try:
+            if manifest_path.stat().st_mtime >= max(map_path.stat().st_mtime, rom_path.stat().st_mtime):
+                return json.loads(manifest_path.read_text())
+        except (OSError, ValueError):
+            pass
+    return build_manifest(map_path, rom_path, jobs)
+
+
+def report_changes(old: dict, new: dict):
+    changed = [name for name, e in new["segments"].items() if old["segments"].get(name, {}).get("sha1") != e["sha1"]]
+    if changed:
+        print("Changed segments: " + ", ".join(changed))
+    else:
+        print("No segment bytes changed")
+
+
+def write_manifest(path: Path, manifest: dict):
+    path.write_text(json.dumps(manifest, indent=1) + "\n")
+
+
+def verify(map_path: Path, rom_path: Path, base_path: Path, cache_path: Optional[Path], manifest_path: Optional[Path], jobs: Optional[int] = None) -> bool:
+    manifest = current_manifest(map_path, rom_path, manifest_path, jobs)
+    ranges = manifest_ranges(manifest)
+    rom_size = manifest["rom"]["size"]
+
+    with Rom(base_path) as base:
+        base_hashes = load_base_hashes(cache_path, base) if cache_path else {}
+        missing = {(0, base.size)} | {(r.rom, r.size) for r, _ in ranges}
+        missing -= base_hashes.keys()
+        if missing:
+            base_hashes.update(hash_ranges(base, missing, jobs))
+            if cache_path:
+                save_base_hashes(cache_path, base, base_hashes)
+
+        if rom_size == base.size and manifest["rom"]["sha1"] == base_hashes[(0, base.size)]:
+            print("OK")
+            return True
+        if rom_size != base.size:
+            print(f"ROM size differs: 0x{rom_size:X} vs 0x{base.size:X}")
+
+        bad_segments = [r for r, sha1 in ranges if r.object is None and sha1 != base_hashes[(r.rom, r.size)]]
+        bad_objects = [r for r, sha1 in ranges if r.object is not None and sha1 != base_hashes[(r.rom, r.size)]]
+
+        if not bad_segments and not bad_objects:
+            print("ROM differs, but only outside of the ranges in the map")
+            return False
+
+        print(f"{len(bad_segments)} segment(s) differ: " + ", ".join(r.segment for r in bad_segments))
+        with Rom(rom_path) as rom:
+            for r in bad_segments:
+                if not any(o.segment == r.segment for o in bad_objects):
+                    diff = first_difference(rom, base, r.rom, r.size)
+                    at = f" at ROM 0x{diff:X}" if diff is not None else ""
+                    print(f"  {r.segment}: only padding between objects differs{at}")
+            for r in bad_objects:
+                diff = first_difference(rom, base, r.rom, r.size)
+                at = f", first at ROM 0x{diff:X} (+0x{diff - r.rom:X})" if diff is not None else ""
+                print(f"  {r.object} ({r.section}, ROM 0x{r.rom:X}-0x{r.rom + r.size:X}){at}")
+    return False
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Per-segment and per-object ROM hashes")
+    parser.add_argument("-j", "--jobs", type=int, help="number of hashing threads")
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    p = sub.add_parser("build", help="write a hash manifest for a ROM")
+    p.add_argument("map", type=Path)
+    p.add_argument("rom", type=Path)
+    p.add_argument("out", type=Path)
+
+    p = sub.add_parser("verify", help="report which segments and objects differ from the base ROM")
+    p.add_argument("map", type=Path)
+    p.add_argument("rom", type=Path)
+    p.add_argument("baserom", type=Path)
+    p.add_argument("--cache", type=Path, default=Path("build/baserom.hashes.json"), help="where to cache the base ROM's hashes (default: %(default)s)")
+    p.add_argument("--manifest", type=Path, help="the built ROM's manifest, reused if it is up to date")
+
+    args = parser.parse_args()
+    if args.command == "build":
+        manifest = build_manifest(args.map, args.rom, args.jobs)
+        try:
+            report_changes(json.loads(args.out.read_text()), manifest)
+        except (OSError, ValueError, KeyError):
+            pass
+        write_manifest(args.out, manifest)
+    elif args.command == "verify":
+        if not verify(args.map, args.rom, args.baserom, args.cache, args.manifest, args.jobs):
+            sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
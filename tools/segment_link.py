@@ -0,0 +1,152 @@
+# Per-segment partial linking.
+#
+# Rewrites the splat-generated linker script so that each segment's objects are
+# first combined with `ld -r` into build/segments/<segment>.o, and the final
+# link only places those blobs. Each partial link gets its own small linker
+# script that reproduces the original per-object layout (input order and
+# SUBALIGN), so the final ROM is byte-identical to a regular link.
+#
+# Which segments' ROM bytes changed since the last build is reported by
+# rom_manifest.py, whose manifest --segment-link adds to the default build.
+
+import re
+from dataclasses import dataclass, field
+from pathlib import Path
+from typing import Dict, List, Optional
+
+OBJECT_LINE_RE = re.compile(r"^\s*(\S+\.o)\(([.\w]+)\);?\s*$")
+BLOCK_START_RE = re.compile(r"^\s*(\.[\w.]+)\s+[^:]*:")
+SUBALIGN_RE = re.compile(r"SUBALIGN\((\w+)\)")
+
+SEGMENT_SUFFIXES = (".bss", ".noload")
+
+
+@dataclass
+class Group:
+    """All `<obj>(<section>)` lines for one input section name inside one
+    output section block of the linker script."""
+
+    block: str
+    section: str
+    subalign: Optional[str]
+    objects: List[str] = field(default_factory=list)
+    lines: List[int] = field(default_factory=list)
+
+    @property
+    def partial_section(self) -> str:
+        return f".sl.{self.block.lstrip('.')}.{self.section.lstrip('.')}"
+
+
+def segment_name(block: str) -> str:
+    name = block.lstrip(".")
+    for suffix in SEGMENT_SUFFIXES:
+        if name.endswith(suffix):
+            name = name[: -len(suffix)]
+    return name
+
+
+def parse_groups(lines: List[str]) -> Dict[str, List[Group]]:
+    segments: Dict[str, List[Group]] = {}
+    block = None
+    subalign = None
+    groups: Dict[str, Group] = {}
+    # Output section blocks live at depth 1, inside `SECTIONS { ... }`
+    depth = 0
+    for i, line in enumerate(lines):
+        if depth == 1:
+            m = BLOCK_START_RE.match(line)
+            if m:
+                block = m.group(1)
+                m2 = SUBALIGN_RE.search(line)
+                subalign = m2.group(1) if m2 else None
+                groups = {}
+                segments.setdefault(segment_name(block), [])
+        depth += line.count("{") - line.count("}")
+        if depth < 2:
+            if "}" in line:
+                block = None
+            continue
+        if block is None:
+            continue
+        m = OBJECT_LINE_RE.match(line)
+        if m is None:
+            continue
+        obj, section = m.groups()
+        group = groups.get(section)
+        if group is None:
+            group = Group(block, section, subalign)
+            groups[section] = group
+            segments[segment_name(block)].append(group)
+        group.objects.append(obj)
+        group.lines.append(i)
+    return segments
+
+
+def groupable(lines: List[str], groups: List[Group]) -> bool:
+    objects = set()
+    for group in groups:
+        # Only lines with nothing but other lines of the same group (or blank
+        # lines) in between can be merged without moving any symbol
+        # assignments around.
+        for a, b in zip(group.lines, group.lines[1:]):
+            if any(lines[j].strip() for j in range(a + 1, b)):
+                return False
+        objects.update(group.objects)
+    return len(objects) > 1
+
+
+@dataclass
+class SegmentPlan:
+    objects: List[str]
+    # The segment places COMMON symbols itself, so the partial link has to
+    # allocate them (ld -r -d) for the script to see them.
+    allocate_common: bool
+
+
+def plan(ld_path: Path, out_script: Path, partial_dir: Path) -> Dict[str, SegmentPlan]:
+    """Write the rewritten linker script and one partial-link script per
+    segment. Returns the objects each segment blob is made of, in link order."""
+    lines = ld_path.read_text().splitlines()
+    segments = parse_groups(lines)
+
+    partial_dir.mkdir(parents=True, exist_ok=True)
+    replace: Dict[int, Optional[str]] = {}
+    ret: Dict[str, SegmentPlan] = {}
+    for name, groups in segments.items():
+        if not groups or not groupable(lines, groups):
+            continue
+        blob = partial_dir / f"{name}.o"
+        objects: List[str] = []
+        script = ["SECTIONS", "{"]
+        for group in groups:
+            subalign = f" SUBALIGN({group.subalign})" if group.subalign else ""
+            script.append(f"    {group.partial_section} 0 :{subalign}")
+            script.append("    {")
+            for obj in group.objects:
+                script.append(f"        {obj}({group.section});")
+                if obj not in objects:
+                    objects.append(obj)
+            script.append("    }")
+            indent = lines[group.lines[0]][: len(lines[group.lines[0]]) - len(lines[group.lines[0]].lstrip())]
+            replace[group.lines[0]] = f"{indent}{blob}({group.partial_section});"
+            for i in group.lines[1:]:
+                replace[i] = None
+        script.append("}")
+        write_if_changed(partial_dir / f"{name}.ld", "\n".join(script) + "\n")
+        ret[name] = SegmentPlan(objects, any(g.section == "COMMON" for g in groups))
+
+    out = []
+    for i, line in enumerate(lines):
+        if i in replace:
+            if replace[i] is not None:
+                out.append(replace[i])
+        else:
+            out.append(line)
+    write_if_changed(out_script, "\n".join(out) + "\n")
+    return ret
+
+
+def write_if_changed(path: Path, text: str):
+    if path.exists() and path.read_text() == text:
+        return
+    path.write_text(text)
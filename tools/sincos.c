@@ -0,0 +1,435 @@
+/*
+ * sin and cos the way the game computes them, used by tools/sincos.py.
+ *
+ * libultra's __sinf and __cosf (ultralib/src/gu/sinf.c, cosf.c) reduce the
+ * angle to +/- pi/2 the Cody and Waite way, sin around n*pi and cos around
+ * (n - 1/2)*pi, then evaluate the same degree 9 odd polynomial in double
+ * precision. sincos_ref_sinf() and sincos_ref_cosf() are straight ports.
+ *
+ * sincos_one() gets both for one angle, classifying the argument once, and
+ * sincos_batch() does the same for an array, two angles at a time with SSE2.
+ * Neither changes an operation or its order, so both agree bit for bit with
+ * the ports, as long as nothing gets fused into an FMA (hence
+ * -ffp-contract=off). sincos_check() confirms that exhaustively.
+ *
+ * sincos_table_batch() approximates both from the 1024-entry quarter wave
+ * libultra's sins() and coss() read (ultralib/src/gu/sintable.h),
+ * interpolated linearly. Over every float it's within 3.1e-5 of __sinf and
+ * __cosf, nearly all of it the table's own rounding to 1/32767. On the host
+ * it's no faster than sincos_batch(), whose polynomial vectorises where the
+ * table lookups don't; it's there for code that wants the table's values.
+ *
+ * sincos_rotate_rpy() builds guRotateRPYF() matrices (ultralib/src/gu/
+ * rotaterpy.c), the euler angles in degrees rotation the geo transforms use,
+ * for many nodes at once on top of sincos_batch().
+ *
+ * Build: cc -O3 -ffp-contract=off -shared -fPIC -o libsincos.so sincos.c (sincos.py does this itself, into build/tools/)
+ * Define SINCOS_NO_SIMD to build without the SSE2 paths.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) && !defined(SINCOS_NO_SIMD)
+#define SINCOS_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "../ultralib/src/gu/sintable.h"
+
+#define SINCOS_EINVAL (-1)
+#define SINCOS_ENOMEM (-2)
+
+/* Bit patterns of the constants in sinf.c and cosf.c */
+typedef union {
+    uint64_t i;
+    double d;
+} du;
+
+typedef union {
+    uint32_t i;
+    float f;
+} fu;
+
+static const du P[] = {
+    { 0x3ff0000000000000 }, { 0xbfc55554bc83656d }, { 0x3f8110ed3804c2a0 },
+    { 0xbf29f6ffeea56814 }, { 0x3ec5dbdf0e314bfe },
+};
+static const du rpi = { 0x3fd45f306dc9c883 };
+static const du pihi = { 0x400921fb50000000 };
+static const du pilo = { 0x3e6110b4611a6263 };
+static const fu qnan = { 0x7f810000 }; /* __libm_qnan_f, libm_vals.s */
+
+#define ROUND(d) (int) (((d) >= 0.0) ? ((d) + 0.5) : ((d) - 0.5))
+
+/* xpt is the exponent and the top bit of the mantissa */
+static inline int exponent_bits(float x) {
+    fu u;
+
+    u.f = x;
+    return (u.i >> 22) & 0x1ff;
+}
+
+static inline double poly(double dx) {
+    double xsq = dx * dx;
+    double p = ((P[4].d * xsq + P[3].d) * xsq + P[2].d) * xsq + P[1].d;
+
+    return dx + (dx * xsq) * p;
+}
+
+float sincos_ref_sinf(float x) {
+    int xpt = exponent_bits(x);
+    double dx, dn;
+    int n;
+
+    if (xpt < 0xff) {
+        /* |x| < 1.5 */
+        if (xpt >= 0xe6) {
+            return (float) poly(x);
+        }
+        return x;
+    }
+    if (xpt < 0x136) {
+        /* |x| < 2^28 */
+        dx = x;
+        dn = dx * rpi.d;
+        n = ROUND(dn);
+        dn = n;
+        dx = dx - dn * pihi.d;
+        dx = dx - dn * pilo.d;
+        if ((n & 1) == 0) {
+            return (float) poly(dx);
+        }
+        return -(float) poly(dx);
+    }
+    if (x != x) {
+        return qnan.f;
+    }
+    return 0.0f;
+}
+
+float sincos_ref_cosf(float x) {
+    int xpt = exponent_bits(x);
+    double dx, dn;
+    int n;
+
+    if (xpt < 0x136) {
+        dx = fabsf(x);
+        dn = dx * rpi.d + 0.5;
+        n = ROUND(dn);
+        dn = n;
+        dn -= 0.5;
+        dx = dx - dn * pihi.d;
+        dx = dx - dn * pilo.d;
+        if ((n & 1) == 0) {
+            return (float) poly(dx);
+        }
+        return -(float) poly(dx);
+    }
+    if (x != x) {
+        return qnan.f;
+    }
+    return 0.0f;
+}
+
+void sincos_one(float x, float *s, float *c) {
+    int xpt = exponent_bits(x);
+    double dx, p, dn, ds, dc;
+    int ns, nc;
+    float fs, fc;
+
+    if (xpt >= 0x136) {
+        *s = sincos_ref_sinf(x);
+        *c = sincos_ref_cosf(x);
+        return;
+    }
+
+    /*
+     * For |x| < 1.5 sin skips the reduction, but n is 0 then and taking
+     * away 0 * pi leaves dx as it was, so the general case gives the same
+     * result. Below 2^-12 sin returns x itself, which the polynomial would
+     * round to anyway except for the sign of -0.
+     */
+    dx = x;
+    p = dx * rpi.d;
+    ns = ROUND(p);
+    dn = ns;
+    ds = dx - dn * pihi.d;
+    ds = ds - dn * pilo.d;
+
+    /* |x| * rpi is |x * rpi| */
+    dx = fabs(dx);
+    nc = ROUND(fabs(p) + 0.5);
+    dn = nc;
+    dn -= 0.5;
+    dc = dx - dn * pihi.d;
+    dc = dc - dn * pilo.d;
+
+    fs = (float) poly(ds);
+    fc = (float) poly(dc);
+    *s = xpt < 0xe6 ? x : (ns & 1) ? -fs : fs;
+    *c = (nc & 1) ? -fc : fc;
+}
+
+#if defined(SINCOS_SSE2)
+/* Two angles at once; both must have xpt < 0x136 */
+static inline void sincos_pair(const float *x, float *s, float *c) {
+    const __m128d half = _mm_set1_pd(0.5);
+    const __m128d sign = _mm_set1_pd(-0.0);
+    const __m128d vrpi = _mm_set1_pd(rpi.d);
+    const __m128d vpihi = _mm_set1_pd(pihi.d);
+    const __m128d vpilo = _mm_set1_pd(pilo.d);
+    __m128i bits = _mm_loadl_epi64((const __m128i *) x);
+    __m128d dx = _mm_cvtps_pd(_mm_castsi128_ps(bits));
+    __m128d p = _mm_mul_pd(dx, vrpi);
+    __m128d ax, dn, ds, dc, r[2];
+    __m128i ns, nc, small;
+    __m128 fs, fc;
+    int k;
+
+    /* ROUND(p) is p plus 0.5 with the sign of p, truncated */
+    ns = _mm_cvttpd_epi32(_mm_add_pd(p, _mm_or_pd(_mm_and_pd(p, sign), half)));
+    dn = _mm_cvtepi32_pd(ns);
+    ds = _mm_sub_pd(dx, _mm_mul_pd(dn, vpihi));
+    ds = _mm_sub_pd(ds, _mm_mul_pd(dn, vpilo));
+
+    ax = _mm_andnot_pd(sign, dx);
+    nc = _mm_cvttpd_epi32(_mm_add_pd(_mm_add_pd(_mm_andnot_pd(sign, p), half), half));
+    dn = _mm_sub_pd(_mm_cvtepi32_pd(nc), half);
+    dc = _mm_sub_pd(ax, _mm_mul_pd(dn, vpihi));
+    dc = _mm_sub_pd(dc, _mm_mul_pd(dn, vpilo));
+
+    r[0] = ds;
+    r[1] = dc;
+    for (k = 0; k < 2; k++) {
+        __m128d d = r[k];
+        __m128d xsq = _mm_mul_pd(d, d);
+        __m128d q = _mm_add_pd(_mm_mul_pd(_mm_set1_pd(P[4].d), xsq), _mm_set1_pd(P[3].d));
+
+        q = _mm_add_pd(_mm_mul_pd(q, xsq), _mm_set1_pd(P[2].d));
+        q = _mm_add_pd(_mm_mul_pd(q, xsq), _mm_set1_pd(P[1].d));
+        r[k] = _mm_add_pd(d, _mm_mul_pd(_mm_mul_pd(d, xsq), q));
+    }
+
+    /* Negate the odd ones, and let sin of |x| < 2^-12 be x */
+    fs = _mm_xor_ps(_mm_cvtpd_ps(r[0]), _mm_castsi128_ps(_mm_slli_epi32(ns, 31)));
+    fc = _mm_xor_ps(_mm_cvtpd_ps(r[1]), _mm_castsi128_ps(_mm_slli_epi32(nc, 31)));
+    small = _mm_cmplt_epi32(_mm_and_si128(bits, _mm_set1_epi32(0x7fffffff)), _mm_set1_epi32(0xe6 << 22));
+    fs = _mm_or_ps(_mm_and_ps(_mm_castsi128_ps(small), _mm_castsi128_ps(bits)), _mm_andnot_ps(_mm_castsi128_ps(small), fs));
+
+    _mm_storel_epi64((__m128i *) s, _mm_castps_si128(fs));
+    _mm_storel_epi64((__m128i *) c, _mm_castps_si128(fc));
+}
+#endif
+
+void sincos_batch(const float *x, int n, float *s, float *c) {
+    int i = 0;
+
+#if defined(SINCOS_SSE2)
+    for (; i + 2 <= n; i += 2) {
+        if (exponent_bits(x[i]) < 0x136 && exponent_bits(x[i + 1]) < 0x136) {
+            sincos_pair(x + i, s + i, c + i);
+        } else {
+            sincos_one(x[i], s + i, c + i);
+            sincos_one(x[i + 1], s + i + 1, c + i + 1);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        sincos_one(x[i], s + i, c + i);
+    }
+}
+
+void sincos_ref_batch(const float *x, int n, float *s, float *c) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        s[i] = sincos_ref_sinf(x[i]);
+        c[i] = sincos_ref_cosf(x[i]);
+    }
+}
+
+/* sin of quadrant q (mod 4) plus f quarter turns, 0 <= f < 1, from the table */
+static inline float table_sin(int64_t q, double f) {
+    double u;
+    int i;
+    float v;
+
+    if (q & 1) {
+        f = 1.0 - f;
+    }
+    u = f * 1023.0;
+    i = (int) u;
+    if (i >= 1023) {
+        v = sintable[1023];
+    } else {
+        v = sintable[i] + (float) (u - i) * (float) (sintable[i + 1] - sintable[i]);
+    }
+    v *= 1.0f / 32767.0f;
+    return (q & 2) ? -v : v;
+}
+
+void sincos_table_batch(const float *x, int n, float *s, float *c) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        double t;
+        double q;
+
+        if (exponent_bits(x[i]) >= 0x136) {
+            s[i] = sincos_ref_sinf(x[i]);
+            c[i] = sincos_ref_cosf(x[i]);
+            continue;
+        }
+        /* In quarter turns */
+        t = x[i] * (2.0 / M_PI);
+        q = floor(t);
+        s[i] = table_sin((int64_t) q, t - q);
+        c[i] = table_sin((int64_t) q + 1, t - q);
+    }
+}
+
+/*
+ * rph holds n (roll, pitch, heading) triples in degrees, mtx gets n 4x4
+ * matrices the way guRotateRPYF() lays them out.
+ */
+int sincos_rotate_rpy(const float *rph, int n, float *mtx) {
+    static const float dtor = 3.1415926 / 180.0;
+    float *angles, *sn, *cs;
+    int i;
+
+    if (n < 0) {
+        return SINCOS_EINVAL;
+    }
+    if (n == 0) {
+        return 0;
+    }
+    angles = malloc(sizeof(float) * 3 * n);
+    sn = malloc(sizeof(float) * 3 * n);
+    cs = malloc(sizeof(float) * 3 * n);
+    if (angles == NULL || sn == NULL || cs == NULL) {
+        free(angles);
+        free(sn);
+        free(cs);
+        return SINCOS_ENOMEM;
+    }
+    for (i = 0; i < 3 * n; i++) {
+        angles[i] = rph[i] * dtor;
+    }
+    sincos_batch(angles, 3 * n, sn, cs);
+
+    for (i = 0; i < n; i++) {
+        float sinr = sn[i * 3 + 0], cosr = cs[i * 3 + 0];
+        float sinp = sn[i * 3 + 1], cosp = cs[i * 3 + 1];
+        float sinh = sn[i * 3 + 2], cosh = cs[i * 3 + 2];
+        float *mf = mtx + i * 16;
+
+        memset(mf, 0, sizeof(float) * 16);
+        mf[15] = 1.0f;
+
+        mf[0] = cosp * cosh;
+        mf[1] = cosp * sinh;
+        mf[2] = -sinp;
+
+        mf[4] = sinr * sinp * cosh - cosr * sinh;
+        mf[5] = sinr * sinp * sinh + cosr * cosh;
+        mf[6] = sinr * cosp;
+
+        mf[8] = cosr * sinp * cosh + sinr * sinh;
+        mf[9] = cosr * sinp * sinh - sinr * cosh;
+        mf[10] = cosr * cosp;
+    }
+
+    free(angles);
+    free(sn);
+    free(cs);
+    return 0;
+}
+
+/*
+ * Compare everything against the ports for every float whose bits, sign
+ * aside, are in [lo, hi), both positive and negative. stats gets:
+ *
+ *   0  floats checked
+ *   1  sincos_batch() results that differ from the ports
+ *   2  sincos_one() results that differ
+ *   3  largest |sin| error of sincos_table_batch()
+ *   4  largest |cos| error
+ *   5  where the largest sin error is
+ *   6  where the largest cos error is
+ *   7  the first angle sincos_batch() or sincos_one() got wrong, or NaN
+ */
+#define CHECK_CHUNK 4096
+
+int sincos_check(uint32_t lo, uint32_t hi, double *stats) {
+    float *x, *s, *c, *ts, *tc;
+    uint64_t b = lo;
+    int sign, i;
+
+    if (lo > hi || hi > 0x80000000u) {
+        return SINCOS_EINVAL;
+    }
+    x = malloc(sizeof(float) * 5 * CHECK_CHUNK);
+    if (x == NULL) {
+        return SINCOS_ENOMEM;
+    }
+    s = x + CHECK_CHUNK;
+    c = s + CHECK_CHUNK;
+    ts = c + CHECK_CHUNK;
+    tc = ts + CHECK_CHUNK;
+    memset(stats, 0, sizeof(double) * 8);
+    stats[7] = NAN;
+
+    while (b < hi) {
+        int n = (hi - b) < CHECK_CHUNK / 2 ? (int) (hi - b) : CHECK_CHUNK / 2;
+
+        for (sign = 0; sign < 2; sign++) {
+            for (i = 0; i < n; i++) {
+                fu u;
+
+                u.i = (uint32_t) (b + i) | (sign ? 0x80000000u : 0);
+                x[sign * n + i] = u.f;
+            }
+        }
+        b += n;
+        n *= 2;
+
+        sincos_batch(x, n, s, c);
+        sincos_table_batch(x, n, ts, tc);
+        for (i = 0; i < n; i++) {
+            float rs = sincos_ref_sinf(x[i]);
+            float rc = sincos_ref_cosf(x[i]);
+            float os, oc;
+            double e;
+
+            sincos_one(x[i], &os, &oc);
+            if (memcmp(&s[i], &rs, 4) != 0 || memcmp(&c[i], &rc, 4) != 0) {
+                stats[1]++;
+                if (isnan(stats[7])) {
+                    stats[7] = x[i];
+                }
+            }
+            if (memcmp(&os, &rs, 4) != 0 || memcmp(&oc, &rc, 4) != 0) {
+                stats[2]++;
+                if (isnan(stats[7])) {
+                    stats[7] = x[i];
+                }
+            }
+            e = fabs((double) ts[i] - rs);
+            if (e > stats[3]) {
+                stats[3] = e;
+                stats[5] = x[i];
+            }
+            e = fabs((double) tc[i] - rc);
+            if (e > stats[4]) {
+                stats[4] = e;
+                stats[6] = x[i];
+            }
+        }
+        stats[0] += n;
+    }
+    free(x);
+    return 0;
+}
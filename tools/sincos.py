@@ -0,0 +1,323 @@
+#!/usr/bin/env python3
+# sin and cos exactly as the game computes them, for many angles at once.
+#
+# sincos() gives the same float32 results as libultra's __sinf and __cosf, bit
+# for bit, and rotate_rpy() the same matrices as guRotateRPYF(), for arrays of
+# angles. sincos_table() approximates them from the sins()/coss() table,
+# within 3.1e-5. See sincos.c for how. The work is done by sincos.c, compiled
+# on first use by native_lib.py (set CC to pick the compiler). If that isn't
+# possible, a numpy port gives identical results, just slower.
+#
+#   sincos.py check [--max RADIANS] [-j N]   compare against __sinf/__cosf for every float in range
+#   sincos.py bench                          time each implementation
+
+import ctypes
+import os
+import re
+import struct
+from pathlib import Path
+from typing import Optional, Tuple
+
+import numpy as np
+
+import native_lib
+
+SOURCE_PATH = Path(__file__).with_suffix(".c")
+SINTABLE_PATH = Path(__file__).parent.parent / "ultralib" / "src" / "gu" / "sintable.h"
+
+# The constants of sinf.c and cosf.c
+P = np.array([0x3FF0000000000000, 0xBFC55554BC83656D, 0x3F8110ED3804C2A0, 0xBF29F6FFEEA56814, 0x3EC5DBDF0E314BFE], dtype=np.uint64).view(np.float64)
+RPI, PIHI, PILO = np.array([0x3FD45F306DC9C883, 0x400921FB50000000, 0x3E6110B4611A6263], dtype=np.uint64).view(np.float64)
+QNAN = np.uint32(0x7F810000).view(np.float32)
+
+# Every angle the game's transforms see: a full turn either way
+DEFAULT_MAX = 2 * np.pi
+
+
+class SinCosError(ValueError):
+    pass
+
+
+_i, _p, _u32 = ctypes.c_int, ctypes.c_void_p, ctypes.c_uint32
+SIGNATURES: native_lib.Signatures = {
+    "sincos_batch": (None, [_p, _i, _p, _p]),
+    "sincos_ref_batch": (None, [_p, _i, _p, _p]),
+    "sincos_table_batch": (None, [_p, _i, _p, _p]),
+    "sincos_rotate_rpy": (_i, [_p, _i, _p]),
+    "sincos_check": (_i, [_u32, _u32, _p]),
+}
+
+
+def native() -> Optional[ctypes.CDLL]:
+    """The compiled library, or None if it can't be built or loaded (or
+    SINCOS_NATIVE=0 is set)."""
+    return native_lib.load(SOURCE_PATH, "sincos", ["-O3", "-ffp-contract=off"], "SINCOS_NATIVE", SIGNATURES, deps=[SINTABLE_PATH], libs=["-lm"])
+
+
+def _angles(x) -> np.ndarray:
+    return np.ascontiguousarray(x, dtype=np.float32)
+
+
+# numpy port of sincos.c
+
+
+def _poly(dx: np.ndarray) -> np.ndarray:
+    xsq = dx * dx
+    p = ((P[4] * xsq + P[3]) * xsq + P[2]) * xsq + P[1]
+    return dx + (dx * xsq) * p
+
+
+def _sincos_np(x: np.ndarray) -> Tuple[np.ndarray, np.ndarray]:
+    bits = x.view(np.uint32)
+    xpt = (bits >> 22) & 0x1FF
+    in_range = xpt < 0x136
+    dx = np.where(in_range, x, 0).astype(np.float64)
+
+    p = dx * RPI
+    # + 0.0 turns the -0.0 np.trunc() gives for small negative p into the 0 of C's int
+    ns = np.trunc(p + np.copysign(0.5, p)) + 0.0
+    ds = dx - ns * PIHI
+    ds = ds - ns * PILO
+
+    nc = np.trunc(np.abs(p) + 0.5 + 0.5)
+    dn = nc - 0.5
+    dc = np.abs(dx) - dn * PIHI
+    dc = dc - dn * PILO
+
+    s = _poly(ds).astype(np.float32)
+    c = _poly(dc).astype(np.float32)
+    s = np.where(ns.astype(np.int64) & 1, -s, s)
+    c = np.where(nc.astype(np.int64) & 1, -c, c)
+    s = np.where(xpt < 0xE6, x, s)
+
+    # Past 2^28 both give up: 0, or a NaN for a NaN
+    out = np.where(np.isnan(x), QNAN, np.float32(0))
+    return np.where(in_range, s, out), np.where(in_range, c, out)
+
+
+_sintable: Optional[np.ndarray] = None
+
+
+def sintable() -> np.ndarray:
+    """libultra's quarter wave, sintable.h: 32767 * sin(i / 1023 * pi / 2)"""
+    global _sintable
+    if _sintable is None:
+        text = SINTABLE_PATH.read_text()
+        body = text[text.index("{") :]
+        _sintable = np.array([int(v, 16) for v in re.findall(r"0x[0-9a-fA-F]+", body)], dtype=np.float32)
+    return _sintable
+
+
+def _table_sin(q: np.ndarray, f: np.ndarray) -> np.ndarray:
+    table = sintable()
+    f = np.where(q & 1, 1.0 - f, f)
+    u = f * 1023.0
+    i = np.minimum(u.astype(np.int64), 1023)
+    nxt = np.minimum(i + 1, 1023)
+    v = table[i] + (u - i).astype(np.float32) * (table[nxt] - table[i])
+    v = np.where(i >= 1023, table[1023], v)
+    v = v * (np.float32(1) / np.float32(32767))
+    return np.where(q & 2, -v, v)
+
+
+def _sincos_table_np(x: np.ndarray) -> Tuple[np.ndarray, np.ndarray]:
+    in_range = ((x.view(np.uint32) >> 22) & 0x1FF) < 0x136
+    t = np.where(in_range, x, 0).astype(np.float64) * (2.0 / np.pi)
+    q = np.floor(t)
+    f = t - q
+    q = q.astype(np.int64)
+    s, c = _sincos_np(x)
+    return np.where(in_range, _table_sin(q, f), s), np.where(in_range, _table_sin(q + 1, f), c)
+
+
+def _rotate_rpy_np(rph: np.ndarray) -> np.ndarray:
+    dtor = np.float32(3.1415926 / 180.0)
+    s, c = _sincos_np((rph * dtor).reshape(-1))
+    s = s.reshape(-1, 3)
+    c = c.reshape(-1, 3)
+    sinr, sinp, sinh = s[:, 0], s[:, 1], s[:, 2]
+    cosr, cosp, cosh = c[:, 0], c[:, 1], c[:, 2]
+
+    mf = np.zeros((len(rph), 4, 4), dtype=np.float32)
+    mf[:, 3, 3] = 1
+    mf[:, 0, 0] = cosp * cosh
+    mf[:, 0, 1] = cosp * sinh
+    mf[:, 0, 2] = -sinp
+    mf[:, 1, 0] = sinr * sinp * cosh - cosr * sinh
+    mf[:, 1, 1] = sinr * sinp * sinh + cosr * cosh
+    mf[:, 1, 2] = sinr * cosp
+    mf[:, 2, 0] = cosr * sinp * cosh + sinr * sinh
+    mf[:, 2, 1] = cosr * sinp * sinh - sinr * cosh
+    mf[:, 2, 2] = cosr * cosp
+    return mf
+
+
+def _call(name: str, x: np.ndarray) -> Tuple[np.ndarray, np.ndarray]:
+    lib = native()
+    s = np.empty_like(x)
+    c = np.empty_like(x)
+    getattr(lib, name)(x.ctypes.data, x.size, s.ctypes.data, c.ctypes.data)
+    return s, c
+
+
+def sincos(x, use_native: bool = True) -> Tuple[np.ndarray, np.ndarray]:
+    """(__sinf(x), __cosf(x)) for every angle in x, in radians."""
+    x = _angles(x)
+    if use_native and native() is not None:
+        s, c = _call("sincos_batch", x.reshape(-1))
+        return s.reshape(x.shape), c.reshape(x.shape)
+    return _sincos_np(x)
+
+
+def sincos_table(x, use_native: bool = True) -> Tuple[np.ndarray, np.ndarray]:
+    """sin and cos of every angle in x from the sins() table, within 3.1e-5."""
+    x = _angles(x)
+    if use_native and native() is not None:
+        s, c = _call("sincos_table_batch", x.reshape(-1))
+        return s.reshape(x.shape), c.reshape(x.shape)
+    return _sincos_table_np(x)
+
+
+def rotate_rpy(rph, use_native: bool = True) -> np.ndarray:
+    """guRotateRPYF() of every (roll, pitch, heading) in degrees in an (n, 3)
+    array, as an (n, 4, 4) array."""
+    rph = _angles(rph).reshape(-1, 3)
+    lib = native() if use_native else None
+    if lib is not None:
+        mf = np.empty((len(rph), 4, 4), dtype=np.float32)
+        if lib.sincos_rotate_rpy(rph.ctypes.data, len(rph), mf.ctypes.data) < 0:
+            raise SinCosError(f"can't build {len(rph)} matrices")
+        return mf
+    return _rotate_rpy_np(rph)
+
+
+def _float_bits(x: float) -> int:
+    return struct.unpack("<I", struct.pack("<f", x))[0]
+
+
+def check(max_angle: float, jobs: int) -> dict:
+    """Compare sincos() and sincos_table() against ports of __sinf and __cosf
+    for every float32 within +/- max_angle, and the numpy port against
+    sincos.c on a sample of them."""
+    from concurrent.futures import ThreadPoolExecutor
+
+    lib = native()
+    if lib is None:
+        raise SinCosError("checking every angle needs libsincos.so")
+
+    hi = _float_bits(np.nextafter(np.float32(max_angle), np.float32(np.inf))) if max_angle < np.inf else 0x80000000
+    step = -(-hi // (jobs * 16))
+    ranges = [(lo, min(lo + step, hi)) for lo in range(0, hi, step)]
+
+    def run(r):
+        stats = (ctypes.c_double * 8)()
+        if lib.sincos_check(r[0], r[1], stats) < 0:
+            raise SinCosError(f"can't check 0x{r[0]:08X}-0x{r[1]:08X}")
+        return list(stats)
+
+    # The library doesn't hold the GIL, so threads are enough
+    with ThreadPoolExecutor(jobs) as pool:
+        results = list(pool.map(run, ranges))
+
+    summary = {
+        "max": float(np.float32(max_angle)),
+        "checked": int(sum(r[0] for r in results)),
+        "batch_mismatches": int(sum(r[1] for r in results)),
+        "scalar_mismatches": int(sum(r[2] for r in results)),
+        "first_mismatch": next((r[7] for r in results if not np.isnan(r[7])), None),
+    }
+    worst_sin = max(results, key=lambda r: r[3])
+    worst_cos = max(results, key=lambda r: r[4])
+    summary["table_sin_error"] = worst_sin[3]
+    summary["table_sin_worst"] = worst_sin[5]
+    summary["table_cos_error"] = worst_cos[4]
+    summary["table_cos_worst"] = worst_cos[6]
+
+    rng = np.random.default_rng(0)
+    sample = np.concatenate(
+        [
+            rng.uniform(-max_angle, max_angle, 1 << 20).astype(np.float32) if max_angle < np.inf else np.zeros(0, np.float32),
+            rng.integers(0, 1 << 32, 1 << 16, dtype=np.uint64).astype(np.uint32).view(np.float32),
+            np.array([0.0, -0.0, np.inf, -np.inf, np.nan, 2.0**-12, 1.5, 2.0**28], dtype=np.float32),
+        ]
+    )
+    same = True
+    for fn in (sincos, sincos_table):
+        for a, b in zip(fn(sample), fn(sample, use_native=False)):
+            same &= a.tobytes() == b.tobytes()
+    rph = rng.uniform(-360, 360, (1 << 14, 3)).astype(np.float32)
+    same &= rotate_rpy(rph).tobytes() == rotate_rpy(rph, use_native=False).tobytes()
+    summary["numpy_port_matches"] = bool(same)
+    return summary
+
+
+def bench(count: int, repeat: int):
+    import time
+
+    lib = native()
+    rng = np.random.default_rng(0)
+    x = rng.uniform(-DEFAULT_MAX, DEFAULT_MAX, count).astype(np.float32)
+    rph = rng.uniform(-360, 360, (count // 3, 3)).astype(np.float32)
+
+    cases = []
+    if lib is not None:
+        cases += [
+            ("__sinf + __cosf", lambda: _call("sincos_ref_batch", x)),
+            ("sincos", lambda: sincos(x)),
+            ("sincos_table", lambda: sincos_table(x)),
+            ("rotate_rpy", lambda: rotate_rpy(rph)),
+        ]
+    cases += [
+        ("sincos (numpy)", lambda: sincos(x, use_native=False)),
+        ("sincos_table (numpy)", lambda: sincos_table(x, use_native=False)),
+        ("rotate_rpy (numpy)", lambda: rotate_rpy(rph, use_native=False)),
+    ]
+
+    print(f"{count} angles, best of {repeat}")
+    for name, fn in cases:
+        best = None
+        for _ in range(repeat):
+            start = time.perf_counter()
+            fn()
+            elapsed = time.perf_counter() - start
+            best = elapsed if best is None else min(best, elapsed)
+        per = best / (len(rph) if name.startswith("rotate") else count)
+        unit = "matrix" if name.startswith("rotate") else "angle"
+        print(f"  {name:24}{best * 1e3:9.1f} ms  {per * 1e9:7.1f} ns/{unit}")
+
+
+def main():
+    import argparse
+    import sys
+
+    parser = argparse.ArgumentParser(description="sin and cos as libultra computes them")
+    sub = parser.add_subparsers(dest="command", required=True)
+    p = sub.add_parser("check", help="compare against __sinf/__cosf for every float in range")
+    p.add_argument("--max", type=float, default=DEFAULT_MAX, help="largest |angle| in radians, inf for every float (default: 2 pi)")
+    p.add_argument("-j", "--jobs", type=int, default=os.cpu_count() or 1)
+    p = sub.add_parser("bench", help="time each implementation")
+    p.add_argument("--count", type=int, default=1 << 20)
+    p.add_argument("--repeat", type=int, default=3)
+    args = parser.parse_args()
+
+    if args.command == "check":
+        try:
+            r = check(args.max, max(1, args.jobs))
+        except SinCosError as e:
+            sys.exit(str(e))
+        print(f"{r['checked']} floats with |x| <= {r['max']:.7g}")
+        print(f"  sincos_batch differs from __sinf/__cosf: {r['batch_mismatches']}")
+        print(f"  sincos_one differs from __sinf/__cosf:   {r['scalar_mismatches']}")
+        print(f"  sincos_table sin error: {r['table_sin_error']:.3g} (at {r['table_sin_worst']:.9g})")
+        print(f"  sincos_table cos error: {r['table_cos_error']:.3g} (at {r['table_cos_worst']:.9g})")
+        print(f"  numpy port matches sincos.c: {'yes' if r['numpy_port_matches'] else 'no'}")
+        if r["batch_mismatches"] or r["scalar_mismatches"] or not r["numpy_port_matches"]:
+            if r["first_mismatch"] is not None:
+                print(f"  first mismatch at {r['first_mismatch']:.9g}")
+            sys.exit(1)
+    elif args.command == "bench":
+        bench(args.count, args.repeat)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,68 @@
+import hashlib
+import json
+import sys
+from pathlib import Path
+from typing import List, Tuple
+
+from splat.segtypes.common.bin import CommonSegBin
+
+TOOLS_DIR = Path(__file__).parent.parent
+sys.path.insert(0, str(TOOLS_DIR))
+import audio_format  # noqa: E402
+from audio_format import AudioFormatError, BytesReader, SampleCache  # noqa: E402
+
+
+class N64SegSnap_bank(CommonSegBin):
+    """An audio bank file (.ctl). It's still written out and linked as a bin,
+    but splitting also writes a JSON descriptor of its banks, instruments and
+    wavetables, and decodes every wavetable to a WAV file in a directory of
+    the same name. The YAML entry gives the ROM range of the wave table file
+    (.tbl) the bank's samples are in:
+
+      - { start: 0xAFEEE0, type: snap_bank, name: audio/bank1, table: [0xB04430, 0xBA6C20] }
+    """
+
+    # Hashed into the fingerprint by split_incremental, with the class itself
+    FINGERPRINT_SOURCES = SampleCache.SOURCES
+
+    def table_range(self) -> Tuple[int, int]:
+        table = self.yaml.get("table") if isinstance(self.yaml, dict) else None
+        if not (isinstance(table, list) and len(table) == 2 and all(isinstance(x, int) for x in table)):
+            raise AudioFormatError(f"{self.name}: snap_bank segments need the ROM range of their wave table in `table`, as [start, end]")
+        return table[0], table[1]
+
+    def readers(self, rom_bytes: bytes):
+        ctl = BytesReader(rom_bytes, self.rom_start, self.rom_end - self.rom_start)
+        start, end = self.table_range()
+        return ctl, BytesReader(rom_bytes, start, end - start)
+
+    def fingerprint_extra(self, rom_bytes: bytes) -> bytes:
+        """What the outputs depend on besides the segment's own bytes, for
+        split_incremental: the wave table the samples are in."""
+        start, end = self.table_range()
+        return hashlib.sha1(rom_bytes[start:end]).digest()
+
+    def output_paths(self) -> List[Path]:
+        """The bin, the descriptor and the WAVs it lists, for split_incremental."""
+        bin_path = self.out_path()
+        json_path = bin_path.with_suffix(".json")
+        try:
+            waves = json.loads(json_path.read_text())["wavetables"]
+        except (OSError, ValueError, KeyError):
+            return [bin_path, json_path]
+        return [bin_path, json_path] + [json_path.parent / w["wav"] for w in waves if "wav" in w]
+
+    def split(self, rom_bytes: bytes):
+        super().split(rom_bytes)
+
+        # AudioFormatError is left to propagate, so split_incremental retries
+        # the segment next time
+        bin_path = self.out_path()
+        ctl, tbl = self.readers(rom_bytes)
+        audio_format.extract_bank(
+            ctl,
+            tbl,
+            bin_path.with_suffix(".json"),
+            bin_path.with_suffix(""),
+            SampleCache(audio_format.SAMPLE_CACHE_DIR),
+        )
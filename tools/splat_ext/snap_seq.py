@@ -0,0 +1,42 @@
+import json
+import sys
+from pathlib import Path
+from typing import List
+
+from splat.segtypes.common.bin import CommonSegBin
+
+TOOLS_DIR = Path(__file__).parent.parent
+sys.path.insert(0, str(TOOLS_DIR))
+import audio_format  # noqa: E402
+
+
+class N64SegSnap_seq(CommonSegBin):
+    """A sequence. It's still written out and linked as a bin, but splitting
+    also writes a JSON descriptor (tracks, tempo map, loops, length) and, for
+    compressed sequences, a standard MIDI file next to it."""
+
+    # Hashed into the fingerprint by split_incremental, with the class itself
+    FINGERPRINT_SOURCES = [Path(audio_format.__file__)]
+
+    def output_paths(self) -> List[Path]:
+        """The bin, the descriptor and the MIDI file it names, for
+        split_incremental."""
+        bin_path = self.out_path()
+        json_path = bin_path.with_suffix(".json")
+        try:
+            midi_name = json.loads(json_path.read_text()).get("midi")
+        except (OSError, ValueError, AttributeError):
+            return [bin_path, json_path]
+        return [bin_path, json_path] + ([json_path.with_name(midi_name)] if midi_name else [])
+
+    def split(self, rom_bytes: bytes):
+        super().split(rom_bytes)
+
+        # AudioFormatError is left to propagate, so split_incremental retries
+        # the segment next time
+        bin_path = self.out_path()
+        audio_format.extract_seq(
+            rom_bytes[self.rom_start : self.rom_end],
+            bin_path.with_suffix(".json"),
+            bin_path.with_suffix(".mid"),
+        )
@@ -0,0 +1,165 @@
+# Incremental, parallel asset extraction on top of splat.
+#
+# splat's own cache works per top-level segment and only looks at the YAML, so
+# a one-line edit inside a code segment (app_level, say) re-extracts every bin
+# and snap_sprite subsegment in it. This module hooks Segment.should_split so
+# that asset segments are fingerprinted by their ROM bytes, their YAML entry and
+# the source of the class that extracts them. Segments whose fingerprint
+# matches the manifest from the previous run (and whose outputs all still
+# exist) are skipped; the rest are deferred and extracted afterwards in a
+# process pool, since asset segments don't depend on each other or on splat's
+# symbol state. Segments that write more than their out_path() (PNGs, JSON
+# descriptors, WAVs, MIDI files) list everything in output_paths(). A segment
+# that fails to extract is left out of the manifest, so it's retried next time.
+#
+# Usage (see configure.py):
+#   split_incremental.install(manifest_path)
+#   split.main(...)
+#   split_incremental.finish(jobs)
+
+import hashlib
+import inspect
+import json
+import multiprocessing
+import os
+from pathlib import Path
+from typing import Dict, List, Optional
+
+from splat.segtypes.segment import Segment
+from splat.util import options
+
+# Segment types that are self-contained given the ROM bytes
+INCREMENTAL_TYPES = {"bin", "snap_sprite", "snap_bank", "snap_seq"}
+
+_manifest_path: Optional[Path] = None
+_old_manifest: Dict[str, str] = {}
+_new_manifest: Dict[str, str] = {}
+_deferred: List[Segment] = []
+_rom_bytes: Optional[bytes] = None
+_class_hashes: Dict[type, str] = {}
+_orig_should_split = Segment.should_split
+
+
+def _rom() -> bytes:
+    global _rom_bytes
+    if _rom_bytes is None:
+        _rom_bytes = options.opts.target_path.read_bytes()
+    return _rom_bytes
+
+
+def _class_hash(cls: type) -> str:
+    """Hash of the source of the class and its bases, plus any other files it
+    lists in FINGERPRINT_SOURCES (code it extracts with)."""
+    if cls not in _class_hashes:
+        h = hashlib.sha1()
+        for klass in cls.__mro__:
+            try:
+                h.update(Path(inspect.getfile(klass)).read_bytes())
+            except (TypeError, OSError):
+                pass
+        for path in getattr(cls, "FINGERPRINT_SOURCES", ()):
+            h.update(Path(path).read_bytes())
+        _class_hashes[cls] = h.hexdigest()
+    return _class_hashes[cls]
+
+
+def _segment_id(seg: Segment) -> str:
+    return f"{seg.type}:{seg.rom_start:X}:{seg.name}"
+
+
+def _fingerprint(seg: Segment) -> str:
+    h = hashlib.sha1()
+    h.update(repr(seg.yaml).encode())
+    h.update(f"{seg.rom_start}:{seg.rom_end}:{seg.vram_start}".encode())
+    h.update(_class_hash(type(seg)).encode())
+    h.update(_rom()[seg.rom_start : seg.rom_end])
+    # Segments whose outputs depend on more than their own bytes (a bank's
+    # samples live in its wave table) say so
+    extra = getattr(seg, "fingerprint_extra", None)
+    if extra is not None:
+        h.update(extra(_rom()))
+    return h.hexdigest()
+
+
+def _outputs_exist(seg: Segment) -> bool:
+    output_paths = getattr(seg, "output_paths", None)
+    outputs = output_paths() if output_paths is not None else [seg.out_path()]
+    return all(out is None or out.exists() for out in outputs)
+
+
+def _should_split(seg: Segment) -> bool:
+    if not _orig_should_split(seg):
+        return False
+    if (
+        seg.type not in INCREMENTAL_TYPES
+        or seg.file_path
+        or seg.rom_start is None
+        or seg.rom_end is None
+    ):
+        return True
+
+    seg_id = _segment_id(seg)
+    fingerprint = _fingerprint(seg)
+    _new_manifest[seg_id] = fingerprint
+    if _old_manifest.get(seg_id) != fingerprint or not _outputs_exist(seg):
+        _deferred.append(seg)
+    return False
+
+
+def install(manifest_path: Path):
+    global _manifest_path, _old_manifest
+
+    _manifest_path = manifest_path
+    try:
+        with open(manifest_path) as f:
+            _old_manifest = json.load(f)
+    except (OSError, ValueError):
+        _old_manifest = {}
+    Segment.should_split = _should_split
+
+
+def _split_one(index: int) -> Optional[str]:
+    """Extract a deferred segment, returning why it failed, if it did. The
+    error goes back as a string, since not every exception pickles."""
+    try:
+        _deferred[index].split(_rom())
+    except Exception as e:
+        return f"{type(e).__name__}: {e}"
+    return None
+
+
+def finish(jobs: Optional[int] = None):
+    """Extract the segments deferred during split.main, then save the manifest."""
+    Segment.should_split = _orig_should_split
+
+    failed = set()
+    if _deferred:
+        print(f"Extracting {len(_deferred)} changed asset segment(s)")
+        _rom()
+        jobs = jobs or os.cpu_count() or 1
+        indices = range(len(_deferred))
+        if jobs > 1 and "fork" in multiprocessing.get_all_start_methods():
+            # Forked workers inherit _deferred and the ROM, so only indices
+            # need to cross the process boundary.
+            ctx = multiprocessing.get_context("fork")
+            with ctx.Pool(jobs) as pool:
+                errors = pool.map(_split_one, indices)
+        else:
+            errors = [_split_one(i) for i in indices]
+        for seg, error in zip(_deferred, errors):
+            if error is not None:
+                print(f"Failed to extract {seg.name}: {error}")
+                failed.add(_segment_id(seg))
+
+    manifest = {k: v for k, v in _new_manifest.items() if k not in failed}
+    # Keep entries for segments splat's own cache skipped this time, but not
+    # the old entries of segments that just failed
+    for k, v in _old_manifest.items():
+        if k not in failed:
+            manifest.setdefault(k, v)
+    if _manifest_path is not None:
+        with open(_manifest_path, "w") as f:
+            json.dump(manifest, f, indent=0, sort_keys=True)
+
+    if failed:
+        raise RuntimeError(f"{len(failed)} segment(s) failed to extract")
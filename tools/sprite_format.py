@@ -0,0 +1,341 @@
+# Layout of libultra Sprite segments, shared by the snap_sprite splat
+# extension (which splits them to PNG) and sprite_pack.py (which turns the
+# PNG back into the segment's bytes).
+#
+# A sprite segment holds the texture tiles, an array of Bitmap structs, the
+# TLUT for CI sprites and, in its last 0x40 bytes, the Sprite struct. Besides
+# the PNG, splitting writes a layout file next to it with the structs and any
+# bytes that the PNG can't reproduce (tile columns past the sprite's width,
+# padding), so that packing an unmodified PNG gives back the exact bytes. It
+# also writes the segment's ROM bytes, which the build links unless configure
+# was run with --sprite-pack.
+
+import json
+import struct
+from dataclasses import dataclass, fields
+from enum import IntEnum, IntFlag
+from io import BytesIO
+from pathlib import Path
+from struct import unpack
+from typing import Dict, List, Optional, Tuple
+
+import numpy as np
+
+import texcodec
+
+# Everything that decides how a sprite's PNG maps to its bytes
+CODEC_SOURCES = [Path(__file__), Path(texcodec.__file__), texcodec.SOURCE_PATH]
+
+SPRITE_SIZE = 0x40
+BITMAP_SIZE = 0x10
+
+
+class IM_FMT(IntEnum):
+    G_IM_FMT_RGBA = 0
+    G_IM_FMT_YUV = 1
+    G_IM_FMT_CI = 2
+    G_IM_FMT_IA = 3
+    G_IM_FMT_I = 4
+
+
+class IM_SIZ(IntEnum):
+    G_IM_SIZ_4b = 0
+    G_IM_SIZ_8b = 1
+    G_IM_SIZ_16b = 2
+    G_IM_SIZ_32b = 3
+    G_IM_SIZ_DD = 5
+
+
+class SpriteAttributes(IntFlag):
+    SP_TRANSPARENT = 0x00000001
+    SP_CUTOUT = 0x00000002
+    SP_HIDDEN = 0x00000004
+    SP_Z = 0x00000008
+    SP_SCALE = 0x00000010
+    SP_FASTCOPY = 0x00000020
+    SP_OVERLAP = 0x00000040
+    SP_TEXSHIFT = 0x00000080
+    SP_FRACPOS = 0x00000100
+    SP_TEXSHUF = 0x00000200
+    SP_EXTERN = 0x00000400
+
+
+@dataclass(init=False)
+class Bitmap:
+    width: int
+    width_img: int
+    s: int
+    t: int
+    buf: int
+    actual_height: int
+    lut_offset: int
+
+    STRUCT = ">hhhhIhh"
+
+    def unpack(self, io: BytesIO):
+        (
+            self.width,
+            self.width_img,
+            self.s,
+            self.t,
+            self.buf,
+            self.actual_height,
+            self.lut_offset,
+        ) = unpack(self.STRUCT, io.read(BITMAP_SIZE))
+
+    def pack(self) -> bytes:
+        return struct.pack(self.STRUCT, *(getattr(self, f.name) for f in fields(self)))
+
+
+@dataclass(init=False)
+class Sprite:
+    x: int
+    y: int
+    width: int
+    height: int
+    scalex: float
+    scaley: float
+    expx: int
+    expy: int
+    attr: SpriteAttributes
+    zdepth: int
+    red: int
+    green: int
+    blue: int
+    alpha: int
+    startTLUT: int
+    nTLUT: int
+    LUT: int  # list[int]
+    istart: int
+    istep: int
+    nbitmaps: int
+    ndisplist: int
+    bmheight: int
+    bmHreal: int
+    bmfmt: IM_FMT
+    bmsiz: IM_SIZ
+    pad: int
+    bitmap: int  # bitmap
+    rsp_dl: int  # gfx
+    rsp_dl_next: int  # gfx
+
+    STRUCT = ">hhhhffhhHhBBBBhhIhhHHhhBBHIII"
+
+    def unpack(self, io: BytesIO):
+        (self.x, self.y) = unpack(">hh", io.read(4))
+        (self.width, self.height) = unpack(">hh", io.read(4))
+        (self.scalex, self.scaley) = unpack(">ff", io.read(8))
+        (self.expx, self.expy) = unpack(">hh", io.read(4))
+        (attr,) = unpack(">H", io.read(2))
+        (self.zdepth,) = unpack(">h", io.read(2))
+        (self.red, self.green, self.blue, self.alpha) = unpack(">BBBB", io.read(4))
+        (self.startTLUT, self.nTLUT, self.LUT) = unpack(">hhI", io.read(8))
+        (self.istart, self.istep) = unpack(">hh", io.read(4))
+        (self.nbitmaps,) = unpack(">H", io.read(2))
+        (self.ndisplist,) = unpack(">H", io.read(2))
+        (self.bmheight, self.bmHreal) = unpack(">hh", io.read(4))
+        (bmfmt,) = unpack(">B", io.read(1))
+        (bmsiz,) = unpack(">B", io.read(1))
+        (self.pad,) = unpack(">H", io.read(2))
+        (self.bitmap,) = unpack(">I", io.read(4))
+        (self.rsp_dl,) = unpack(">I", io.read(4))
+        (self.rsp_dl_next,) = unpack(">I", io.read(4))
+
+        self.attr = SpriteAttributes(attr)
+        self.bmfmt = IM_FMT(bmfmt)
+        self.bmsiz = IM_SIZ(bmsiz)
+
+    def pack(self) -> bytes:
+        return struct.pack(self.STRUCT, *(getattr(self, f.name) for f in fields(self)))
+
+
+@dataclass(frozen=True)
+class SpriteFormat:
+    fmt: int
+    siz: int
+
+    @property
+    def name(self) -> str:
+        return texcodec.FORMAT_NAMES[(self.fmt, self.siz)]
+
+    @property
+    def planes(self) -> int:
+        return texcodec.PLANES[self.fmt]
+
+    @property
+    def bits(self) -> int:
+        return 4 << self.siz
+
+    @property
+    def swizzle_group(self) -> int:
+        return 4 if self.bits == 32 else 64 // self.bits
+
+    def tile_size(self, bitmap: "Bitmap") -> int:
+        return texcodec.size(self.fmt, self.siz, bitmap.width_img, bitmap.actual_height)
+
+
+# Everything texcodec handles, except YUV16: its conversion to RGB is lossy,
+# so those sprites are kept as raw bytes.
+FORMATS: Dict[Tuple[IM_FMT, IM_SIZ], SpriteFormat] = {
+    (IM_FMT(fmt), IM_SIZ(siz)): SpriteFormat(fmt, siz)
+    for fmt, siz in texcodec.FORMAT_NAMES
+    if fmt != texcodec.FMT_YUV
+}
+
+
+def sprite_format(sprite: Sprite) -> Optional[SpriteFormat]:
+    return FORMATS.get((sprite.bmfmt, sprite.bmsiz))
+
+
+def decodable(sprite: Sprite, bitmaps: List[Bitmap]) -> Optional[SpriteFormat]:
+    """The sprite's format, if it can be split to PNG and packed back."""
+    fmt = sprite_format(sprite)
+    if fmt is None:
+        return None
+    try:
+        for bitmap in bitmaps:
+            fmt.tile_size(bitmap)
+    except texcodec.TexCodecError:
+        return None
+    return fmt
+
+
+def unswizzle_odd_rows(pixels: np.ndarray, group: int):
+    """Swap the two halves of every `group` texels on odd rows, in place.
+
+    TMEM stores odd rows with their 32-bit words swapped, so this both undoes
+    and applies the swizzle. Done as one reshape over the whole tile rather
+    than per texel group."""
+    width = pixels.shape[1]
+    full = width - width % group
+    odd = pixels[1::2, :full]
+    halves = odd.reshape(odd.shape[0], full // group, 2, group // 2, pixels.shape[2])
+    pixels[1::2, :full] = halves[:, :, ::-1].reshape(odd.shape)
+
+
+def place_tiles(sprite: Sprite, bitmaps: List[Bitmap]) -> List[Tuple[int, int]]:
+    """Where each bitmap goes on the sprite's canvas: left to right, wrapping
+    to a new row of tiles once the sprite's width is reached."""
+    positions = []
+    x = y = 0
+    for bitmap in bitmaps:
+        positions.append((x, y))
+        x += bitmap.width
+        if x >= sprite.width:
+            x = 0
+            y += bitmap.actual_height
+    return positions
+
+
+def visible_texels(sprite: Sprite, bitmaps: List[Bitmap], fmt: SpriteFormat, swizzled: bool = True) -> List[np.ndarray]:
+    """For each bitmap, which of its texels end up on the canvas, in TMEM
+    order (swizzled) or in display order. Columns past the bitmap's width, and
+    anything a later tile draws over, only exist in the ROM."""
+    positions = place_tiles(sprite, bitmaps)
+    owner = np.full((sprite.height, sprite.width), -1)
+    for i, (bitmap, (x, y)) in enumerate(zip(bitmaps, positions)):
+        owner[y : y + bitmap.actual_height, x : x + bitmap.width] = i
+
+    masks = []
+    for i, (bitmap, (x, y)) in enumerate(zip(bitmaps, positions)):
+        mask = np.zeros((bitmap.actual_height, bitmap.width_img, 1), dtype=bool)
+        mask[:, : bitmap.width, 0] = owner[y : y + bitmap.actual_height, x : x + bitmap.width] == i
+        if swizzled:
+            unswizzle_odd_rows(mask, fmt.swizzle_group)
+        masks.append(mask[:, :, 0])
+    return masks
+
+
+def layout_path(png_path: Path) -> Path:
+    return png_path.with_suffix(".json")
+
+
+def raw_path(png_path: Path) -> Path:
+    """Where the split puts the segment's bytes as they are in the ROM."""
+    return png_path.with_suffix(".bin")
+
+
+def tlut_entries(sprite: Sprite, fmt: Optional[SpriteFormat]) -> int:
+    """How many TLUT entries come from the PNG's palette (sprites use RGBA16
+    TLUTs)."""
+    if fmt is None or fmt.fmt != texcodec.FMT_CI or not sprite.LUT:
+        return 0
+    return max(sprite.nTLUT, 0)
+
+
+def make_layout(data: bytes, vram: int, png_name: Optional[str]) -> dict:
+    """Describe a sprite segment well enough for sprite_pack.py to rebuild it
+    from its PNG. Bytes the PNG and the structs don't account for are kept
+    verbatim."""
+    size = len(data)
+    sprite = Sprite()
+    sprite.unpack(BytesIO(data[-SPRITE_SIZE:]))
+    covered = np.zeros(size, dtype=bool)
+    covered[size - SPRITE_SIZE :] = True
+
+    bitmaps = []
+    for i in range(sprite.nbitmaps):
+        offset = sprite.bitmap - vram + i * BITMAP_SIZE
+        assert 0 <= offset and offset + BITMAP_SIZE <= size
+        bitmap = Bitmap()
+        bitmap.unpack(BytesIO(data[offset : offset + BITMAP_SIZE]))
+        bitmaps.append(bitmap)
+        covered[offset : offset + BITMAP_SIZE] = True
+
+    fmt = decodable(sprite, bitmaps)
+    if fmt is not None and png_name is not None:
+        for bitmap, mask in zip(bitmaps, visible_texels(sprite, bitmaps, fmt)):
+            offset = bitmap.buf - vram
+            tile_size = fmt.tile_size(bitmap)
+            assert 0 <= offset and offset + tile_size <= size
+            # A byte only comes from the PNG if all of its texels do
+            texels = mask.reshape(-1)
+            if fmt.bits == 4:
+                covered[offset : offset + tile_size] |= texels[0::2] & texels[1::2]
+            else:
+                covered[offset : offset + tile_size] |= np.repeat(texels, fmt.bits // 8)
+
+        entries = tlut_entries(sprite, fmt)
+        if entries:
+            offset = sprite.LUT - vram
+            assert 0 <= offset and offset + entries * 2 <= size
+            covered[offset : offset + entries * 2] = True
+    else:
+        png_name = None
+
+    # Runs of uncovered bytes
+    raw = []
+    edges = np.flatnonzero(np.diff(np.concatenate(([True], covered, [True])).astype(np.int8)))
+    for start, end in zip(edges[::2], edges[1::2]):
+        raw.append([int(start), data[start:end].hex()])
+
+    return {
+        "vram": vram,
+        "size": size,
+        "png": png_name,
+        "sprite": {f.name: _jsonable(getattr(sprite, f.name)) for f in fields(sprite)},
+        "bitmaps": [{f.name: getattr(b, f.name) for f in fields(b)} for b in bitmaps],
+        "raw": raw,
+    }
+
+
+def _jsonable(value):
+    return int(value) if isinstance(value, int) else value
+
+
+def load_layout(path: Path) -> Tuple[dict, Sprite, List[Bitmap]]:
+    with open(path) as f:
+        layout = json.load(f)
+    sprite = Sprite()
+    for name, value in layout["sprite"].items():
+        setattr(sprite, name, value)
+    sprite.attr = SpriteAttributes(sprite.attr)
+    sprite.bmfmt = IM_FMT(sprite.bmfmt)
+    sprite.bmsiz = IM_SIZ(sprite.bmsiz)
+    bitmaps = []
+    for entry in layout["bitmaps"]:
+        bitmap = Bitmap()
+        for name, value in entry.items():
+            setattr(bitmap, name, value)
+        bitmaps.append(bitmap)
+    return layout, sprite, bitmaps
@@ -0,0 +1,188 @@
+#!/usr/bin/env python3
+# Pack a sprite PNG split by the snap_sprite extension back into the bytes of
+# its segment, for the `bin` rule to link.
+#
+#   sprite_pack.py <layout.json> <out.bin>
+#   sprite_pack.py --check [assets]
+#       Pack every split sprite and compare it against the ROM bytes the split
+#       wrote next to it (<name>.bin), reporting any that differ.
+#
+# The layout file written next to the PNG during the split fixes the tiling:
+# the PNG is cut into the same Bitmap strips, each strip is converted to the
+# sprite's texel format and swizzled for TMEM by texcodec, and the TLUT (for
+# CI sprites), the Bitmap array and the Sprite struct are written back around
+# them. An unmodified PNG gives back the original bytes exactly. Changing a
+# sprite's size or format isn't supported, since that would move everything
+# after it.
+#
+# With --sprite-pack, configure.py adds one ninja edge per sprite, so packing is
+# incremental and runs in parallel with the rest of the build. Without it, the
+# build links the ROM bytes, until --check has confirmed the round trip for
+# every sprite in the ROM.
+
+import argparse
+import json
+import os
+import sys
+import tempfile
+from pathlib import Path
+from typing import Optional
+
+import numpy as np
+import png
+
+import texcodec
+from sprite_format import (
+    BITMAP_SIZE,
+    SPRITE_SIZE,
+    SpriteFormat,
+    decodable,
+    load_layout,
+    place_tiles,
+    raw_path,
+    tlut_entries,
+    visible_texels,
+)
+
+
+class PackError(Exception):
+    pass
+
+
+def read_png(path: Path, fmt: SpriteFormat, paletted: bool):
+    """The PNG as a (height, width, planes) array, plus its palette for CI
+    sprites with a TLUT."""
+    reader = png.Reader(filename=str(path))
+    palette = None
+    if paletted:
+        width, height, rows, info = reader.read()
+        if "palette" not in info or info["bitdepth"] != 8:
+            raise PackError(f"{path}: {fmt.name} sprites need an 8-bit paletted PNG")
+        palette = info["palette"]
+    elif fmt.planes == 4:
+        width, height, rows, info = reader.asRGBA8()
+    else:
+        width, height, rows, info = reader.asDirect()
+        if not info["greyscale"] or info["bitdepth"] != 8 or info["alpha"] != (fmt.planes == 2):
+            kind = "greyscale+alpha" if fmt.planes == 2 else "greyscale"
+            raise PackError(f"{path}: {fmt.name} sprites need an 8-bit {kind} PNG")
+    pixels = np.array([np.asarray(row, dtype=np.uint8) for row in rows], dtype=np.uint8)
+    return pixels.reshape(height, width, fmt.planes), palette
+
+
+def encode_tlut(palette, entries: int) -> bytes:
+    if len(palette) < entries:
+        raise PackError(f"the PNG's palette has {len(palette)} colors, the sprite's TLUT needs {entries}")
+    colors = np.array([tuple(c) + (0xFF,) * (4 - len(c)) for c in palette[:entries]], dtype=np.uint8)
+    return texcodec.encode_tlut(colors)
+
+
+def pack(layout_file: Path) -> bytes:
+    layout, sprite, bitmaps = load_layout(layout_file)
+    vram = layout["vram"]
+    out = bytearray(layout["size"])
+    for offset, data in layout["raw"]:
+        chunk = bytes.fromhex(data)
+        out[offset : offset + len(chunk)] = chunk
+
+    if layout["png"] is not None:
+        fmt = decodable(sprite, bitmaps)
+        assert fmt is not None
+        entries = tlut_entries(sprite, fmt)
+        png_path = layout_file.parent / layout["png"]
+        canvas, palette = read_png(png_path, fmt, entries > 0)
+        if canvas.shape[:2] != (sprite.height, sprite.width):
+            raise PackError(
+                f"{png_path}: is {canvas.shape[1]}x{canvas.shape[0]}, but the sprite is {sprite.width}x{sprite.height}"
+            )
+
+        # Decode each tile as it stands (only the texels the PNG doesn't show
+        # are filled in from "raw" so far), draw the PNG's part over it and
+        # encode it again
+        masks = visible_texels(sprite, bitmaps, fmt, swizzled=False)
+        for bitmap, mask, (x, y) in zip(bitmaps, masks, place_tiles(sprite, bitmaps)):
+            offset = bitmap.buf - vram
+            tile_size = fmt.tile_size(bitmap)
+            width, height = bitmap.width_img, bitmap.actual_height
+            pixels = np.array(texcodec.decode(fmt.fmt, fmt.siz, out[offset : offset + tile_size], width, height, swizzled=True))
+            region = canvas[y : y + height, x : x + bitmap.width]
+            visible = mask[:, : bitmap.width]
+            pixels[:, : bitmap.width][visible] = region[visible]
+            out[offset : offset + tile_size] = texcodec.encode(fmt.fmt, fmt.siz, pixels, swizzled=True)
+
+        if entries:
+            offset = sprite.LUT - vram
+            out[offset : offset + entries * 2] = encode_tlut(palette, entries)
+
+    for i, bitmap in enumerate(bitmaps):
+        offset = sprite.bitmap - vram + i * BITMAP_SIZE
+        out[offset : offset + BITMAP_SIZE] = bitmap.pack()
+    out[-SPRITE_SIZE:] = sprite.pack()
+    return bytes(out)
+
+
+def write_if_changed(path: Path, data: bytes):
+    """Leave the output untouched if it's already up to date, so the rule can
+    use restat to skip relinking."""
+    try:
+        if path.read_bytes() == data:
+            return
+    except OSError:
+        pass
+    path.parent.mkdir(parents=True, exist_ok=True)
+    fd, tmp_name = tempfile.mkstemp(dir=path.parent, suffix=".tmp")
+    with os.fdopen(fd, "wb") as f:
+        f.write(data)
+    os.replace(tmp_name, path)
+
+
+def check(assets: Path) -> bool:
+    """Pack every sprite layout under assets and compare the result with the
+    ROM bytes the split wrote next to it."""
+    matching = 0
+    bad = []
+    for layout_file in sorted(assets.rglob("*.json")):
+        try:
+            with open(layout_file) as f:
+                layout = json.load(f)
+        except (OSError, ValueError):
+            continue
+        if not isinstance(layout, dict) or "sprite" not in layout or "raw" not in layout:
+            continue
+        try:
+            expected = raw_path(layout_file).read_bytes()
+            data = pack(layout_file)
+        except (OSError, PackError) as e:
+            bad.append(f"{layout_file}: {e}")
+            continue
+        if data == expected:
+            matching += 1
+            continue
+        diff = next((i for i, (a, b) in enumerate(zip(data, expected)) if a != b), min(len(data), len(expected)))
+        bad.append(f"{layout_file}: differs from the ROM at +0x{diff:X}")
+    for line in bad:
+        print(line)
+    print(f"{matching} sprite(s) match the ROM, {len(bad)} don't")
+    return not bad
+
+
+def main(argv: Optional[list] = None):
+    parser = argparse.ArgumentParser(description="Pack a split sprite PNG back into its segment")
+    parser.add_argument("layout", type=Path, nargs="?", help="layout file written next to the PNG by the split")
+    parser.add_argument("out", type=Path, nargs="?", help="where to write the segment's bytes")
+    parser.add_argument("--check", type=Path, nargs="?", const=Path("assets"), metavar="DIR", help="check that every sprite under DIR packs back to its ROM bytes (default: %(const)s)")
+    args = parser.parse_args(argv)
+
+    if args.check is not None:
+        sys.exit(0 if check(args.check) else 1)
+    if args.layout is None or args.out is None:
+        parser.error("needs a layout file and an output file, or --check")
+    try:
+        data = pack(args.layout)
+    except PackError as e:
+        sys.exit(f"sprite_pack: {e}")
+    write_if_changed(args.out, data)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,320 @@
+#!/usr/bin/env python3
+# The map file and symbol_addrs.txt, compiled into one indexed SQLite
+# database next to the map (build/pokemonsnap.map -> build/pokemonsnap.symdb).
+#
+# Tools look symbols up by name, RAM or ROM address, and object sections up by
+# object and section name, each with one indexed query instead of parsing the
+# map again. The build writes the database after every link, and opening it
+# rebuilds it first if the map or symbol_addrs.txt changed since, so it's never
+# stale even when the map came from somewhere else.
+#
+#   symdb.py build <map> [-o out.symdb]
+#   symdb.py lookup <name | 0xRAM> [--rom]
+
+import argparse
+import os
+import re
+import sqlite3
+import sys
+import tempfile
+from dataclasses import dataclass
+from pathlib import Path
+from typing import Iterator, List, Optional, Tuple
+
+import mapfile
+
+script_dir = os.path.dirname(os.path.realpath(__file__))
+root_dir = os.path.abspath(os.path.join(script_dir, ".."))
+
+MAP_PATH = Path(root_dir) / "build" / "pokemonsnap.map"
+SYMBOL_ADDRS_PATH = Path(root_dir) / "tools" / "symbol_addrs.txt"
+
+# Bump when the schema or what goes into it changes
+VERSION = 1
+
+SCHEMA = """
+CREATE TABLE meta (key TEXT PRIMARY KEY, value TEXT);
+CREATE TABLE inputs (
+    id INTEGER PRIMARY KEY,
+    object TEXT NOT NULL,
+    section TEXT NOT NULL,
+    vram INTEGER NOT NULL,
+    size INTEGER NOT NULL,
+    rom INTEGER
+);
+-- source is 'map' for symbols defined by objects, 'script' for ones assigned
+-- in linker scripts, and 'addrs' for symbol_addrs.txt. Rows are in map order.
+CREATE TABLE symbols (
+    id INTEGER PRIMARY KEY,
+    name TEXT NOT NULL,
+    vram INTEGER NOT NULL,
+    rom INTEGER,
+    input INTEGER REFERENCES inputs(id),
+    source TEXT NOT NULL,
+    type TEXT,
+    size INTEGER,
+    segment TEXT
+);
+CREATE INDEX inputs_object ON inputs (object, section);
+CREATE INDEX symbols_name ON symbols (name);
+CREATE INDEX symbols_vram ON symbols (vram);
+CREATE INDEX symbols_rom ON symbols (rom) WHERE rom IS NOT NULL;
+CREATE INDEX symbols_input ON symbols (input);
+"""
+
+# symbol_addrs.txt: `name = 0x80001234; // type:func rom:0x1234 size:0x10`
+ADDRS_RE = re.compile(r"^\s*([\w.$]+)\s*=\s*(0x[0-9a-fA-F]+|\d+)\s*;\s*(?://(.*))?$")
+
+
+@dataclass
+class Symbol:
+    name: str
+    vram: int
+    rom: Optional[int]
+    object: Optional[str]
+    section: Optional[str]
+    source: str
+
+
+def db_path_for(map_path: Path) -> Path:
+    return Path(map_path).with_suffix(".symdb")
+
+
+def file_stamp(path: Optional[Path]) -> str:
+    if path is None:
+        return ""
+    try:
+        st = os.stat(path)
+    except OSError:
+        return "missing"
+    return f"{st.st_size}:{st.st_mtime_ns}"
+
+
+def parse_symbol_addrs(path: Path) -> Iterator[Tuple[str, int, Optional[int], Optional[str], Optional[int], Optional[str]]]:
+    """(name, vram, rom, type, size, segment) of every entry"""
+    with open(path) as f:
+        for line in f:
+            m = ADDRS_RE.match(line)
+            if not m:
+                continue
+            attrs = {}
+            for attr in (m.group(3) or "").split():
+                key, _, value = attr.partition(":")
+                attrs[key] = value
+            rom = int(attrs["rom"], 0) if "rom" in attrs else None
+            size = int(attrs["size"], 0) if "size" in attrs else None
+            yield m.group(1), int(m.group(2), 0), rom, attrs.get("type"), size, attrs.get("segment")
+
+
+def build(map_path: Path, db_path: Path, symbol_addrs: Optional[Path] = SYMBOL_ADDRS_PATH):
+    """Write the database for map_path, atomically replacing db_path."""
+    # Stamp the inputs before reading them, so a change during the build
+    # makes the database stale rather than wrong
+    stamps = {"version": str(VERSION), "map": file_stamp(map_path), "symbol_addrs": file_stamp(symbol_addrs)}
+
+    db_path.parent.mkdir(parents=True, exist_ok=True)
+    fd, tmp_name = tempfile.mkstemp(dir=db_path.parent, suffix=".tmp")
+    os.close(fd)
+    try:
+        con = sqlite3.connect(tmp_name)
+        # Nothing to roll back or recover: a half-written file never replaces
+        # the database, so skip the journal and the syncs
+        con.execute("PRAGMA journal_mode = OFF")
+        con.execute("PRAGMA synchronous = OFF")
+        with con:
+            con.executescript("BEGIN;" + SCHEMA)
+            has_load_addresses = False
+            for section in mapfile.parse(map_path):
+                has_load_addresses |= section.rom is not None
+                for inp in section.inputs:
+                    cur = con.execute(
+                        "INSERT INTO inputs (object, section, vram, size, rom) VALUES (?, ?, ?, ?, ?)",
+                        (inp.object, inp.section, inp.vram, inp.size, inp.rom),
+                    )
+                    con.executemany(
+                        "INSERT INTO symbols (name, vram, rom, input, source) VALUES (?, ?, ?, ?, 'map')",
+                        [(sym.name, sym.vram, sym.rom, cur.lastrowid) for sym in inp.symbols],
+                    )
+            con.executemany(
+                "INSERT INTO symbols (name, vram, source) VALUES (?, ?, 'script')",
+                mapfile.parse_assignments(map_path).items(),
+            )
+            if symbol_addrs is not None and symbol_addrs.exists():
+                con.executemany(
+                    "INSERT INTO symbols (name, vram, rom, type, size, segment, source) VALUES (?, ?, ?, ?, ?, ?, 'addrs')",
+                    parse_symbol_addrs(symbol_addrs),
+                )
+            stamps["has_load_addresses"] = str(int(has_load_addresses))
+            con.executemany("INSERT INTO meta VALUES (?, ?)", stamps.items())
+        con.close()
+        os.replace(tmp_name, db_path)
+    except BaseException:
+        os.unlink(tmp_name)
+        raise
+
+
+SYMBOL_COLUMNS = "s.name, s.vram, s.rom, i.object, i.section, s.source"
+SYMBOL_FROM = "symbols s LEFT JOIN inputs i ON s.input = i.id"
+
+
+class SymbolDB:
+    """Read access to a map's database, rebuilt first whenever it's stale."""
+
+    def __init__(self, map_path: Path = MAP_PATH, symbol_addrs: Optional[Path] = SYMBOL_ADDRS_PATH, db_path: Optional[Path] = None):
+        self.map_path = Path(map_path)
+        self.symbol_addrs = symbol_addrs
+        self.db_path = db_path or db_path_for(self.map_path)
+        self.con: Optional[sqlite3.Connection] = None
+        self.refresh()
+
+    def _is_current(self) -> bool:
+        try:
+            con = sqlite3.connect(f"file:{self.db_path}?mode=ro", uri=True)
+            try:
+                meta = dict(con.execute("SELECT key, value FROM meta"))
+            finally:
+                con.close()
+        except sqlite3.Error:
+            return False
+        return (
+            meta.get("version") == str(VERSION)
+            and meta.get("map") == file_stamp(self.map_path)
+            and meta.get("symbol_addrs") == file_stamp(self.symbol_addrs)
+        )
+
+    def refresh(self):
+        """Reopen the database, rebuilding it if the map changed."""
+        if self.con is not None and self._is_current():
+            return
+        if self.con is not None:
+            self.con.close()
+            self.con = None
+        if not self._is_current():
+            build(self.map_path, self.db_path, self.symbol_addrs)
+        self.con = sqlite3.connect(f"file:{self.db_path}?mode=ro", uri=True)
+
+    def close(self):
+        if self.con is not None:
+            self.con.close()
+            self.con = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def meta(self, key: str) -> Optional[str]:
+        row = self.con.execute("SELECT value FROM meta WHERE key = ?", (key,)).fetchone()
+        return row[0] if row else None
+
+    def _symbols(self, where: str, params: tuple, tail: str = "") -> List[Symbol]:
+        rows = self.con.execute(f"SELECT {SYMBOL_COLUMNS} FROM {SYMBOL_FROM} WHERE {where} {tail}", params)
+        return [Symbol(*row) for row in rows]
+
+    def lookup(self, name: str, sources: Tuple[str, ...] = ("map", "script")) -> List[Symbol]:
+        """Every definition of name, in map order"""
+        marks = ", ".join("?" * len(sources))
+        return self._symbols(f"s.name = ? AND s.source IN ({marks})", (name, *sources), "ORDER BY s.id")
+
+    def address(self, name: str) -> Optional[int]:
+        """RAM address of name from the map, or failing that symbol_addrs.txt"""
+        syms = self.lookup(name) or self.lookup(name, ("addrs",))
+        return syms[-1].vram if syms else None
+
+    def at_vram(self, vram: int) -> Optional[Symbol]:
+        """The last object symbol at or before vram"""
+        syms = self._symbols("s.vram <= ? AND s.source = 'map'", (vram,), "ORDER BY s.vram DESC, s.id DESC LIMIT 1")
+        return syms[0] if syms else None
+
+    def at_rom(self, rom: int) -> Optional[Symbol]:
+        """The last symbol at or before ROM address rom"""
+        syms = self._symbols("s.rom <= ? AND s.source = 'map'", (rom,), "ORDER BY s.rom DESC, s.id DESC LIMIT 1")
+        return syms[0] if syms else None
+
+    def rom_end(self) -> Optional[int]:
+        """ROM address of the last symbol in ROM"""
+        return self.con.execute("SELECT MAX(rom) FROM symbols WHERE source = 'map'").fetchone()[0]
+
+    def input(self, objfile: str, section: str) -> Optional[mapfile.MapInput]:
+        """The first input section named section from objfile, with its symbols"""
+        row = self.con.execute(
+            "SELECT id, object, section, vram, size, rom FROM inputs WHERE object = ? AND section = ? ORDER BY id LIMIT 1",
+            (objfile, section),
+        ).fetchone()
+        if row is None:
+            return None
+        inp = mapfile.MapInput(*row[1:])
+        for name, vram, rom in self.con.execute("SELECT name, vram, rom FROM symbols WHERE input = ? ORDER BY id", (row[0],)):
+            inp.symbols.append(mapfile.MapSymbol(name, vram, rom, inp.object, inp.section))
+        return inp
+
+    def inputs(self, section: str) -> List[mapfile.MapInput]:
+        """Every input section named section, in map order, without symbols"""
+        rows = self.con.execute(
+            "SELECT object, section, vram, size, rom FROM inputs WHERE section = ? ORDER BY id",
+            (section,),
+        )
+        return [mapfile.MapInput(*row) for row in rows]
+
+    def first_moved(self, other: "SymbolDB") -> Optional[Tuple[Symbol, Optional[str]]]:
+        """The symbol with the lowest ROM address that's in other's map, but
+        at a different ROM address, and the name of the symbol before it."""
+        self.con.execute("ATTACH DATABASE ? AS other", (f"file:{other.db_path}?mode=ro",))
+        try:
+            row = self.con.execute(
+                f"SELECT s.id, {SYMBOL_COLUMNS} FROM {SYMBOL_FROM} "
+                "WHERE s.source = 'map' AND s.rom IS NOT NULL "
+                "AND EXISTS (SELECT 1 FROM other.symbols o WHERE o.name = s.name AND o.source = 'map' AND o.rom IS NOT NULL) "
+                "AND NOT EXISTS (SELECT 1 FROM other.symbols o WHERE o.name = s.name AND o.source = 'map' AND o.rom = s.rom) "
+                "ORDER BY s.rom, s.id LIMIT 1"
+            ).fetchone()
+        finally:
+            self.con.execute("DETACH DATABASE other")
+        if row is None:
+            return None
+        prev = self.con.execute(
+            "SELECT name FROM symbols WHERE source = 'map' AND rom IS NOT NULL AND id < ? ORDER BY id DESC LIMIT 1",
+            (row[0],),
+        ).fetchone()
+        return Symbol(*row[1:]), prev[0] if prev else None
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Indexed database of the map file and symbol_addrs.txt")
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    p = sub.add_parser("build", help="compile a map file's database")
+    p.add_argument("map", type=Path)
+    p.add_argument("-o", "--output", type=Path, help="database to write (default: next to the map)")
+    p.add_argument("--symbol-addrs", type=Path, default=SYMBOL_ADDRS_PATH)
+
+    p = sub.add_parser("lookup", help="look up a symbol by name or address")
+    p.add_argument("query", help="symbol name, or an address in hex")
+    p.add_argument("--rom", action="store_true", help="the address is a ROM address")
+    p.add_argument("--map", type=Path, default=MAP_PATH)
+
+    args = parser.parse_args()
+
+    if args.command == "build":
+        build(args.map, args.output or db_path_for(args.map), args.symbol_addrs)
+        return
+
+    if not args.map.exists():
+        sys.exit(f"{args.map} doesn't exist, build the ROM first")
+    with SymbolDB(args.map) as db:
+        if re.fullmatch(r"(0x)?[0-9a-fA-F]+", args.query) and not db.lookup(args.query):
+            addr = int(args.query, 16)
+            sym = db.at_rom(addr) if args.rom else db.at_vram(addr)
+            syms = [sym] if sym is not None else []
+        else:
+            syms = db.lookup(args.query) or db.lookup(args.query, ("addrs",))
+        if not syms:
+            sys.exit(f"{args.query} not found")
+        for sym in syms:
+            rom = f"0x{sym.rom:X}" if sym.rom is not None else "-"
+            print(f"{sym.name} RAM 0x{sym.vram:08X} ROM {rom} {sym.object or sym.source} {sym.section or ''}".rstrip())
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,407 @@
+/*
+ * N64 texture codec, used by tools/texcodec.py.
+ *
+ * Converts texel data in any format the RDP can sample (RGBA16/32, YUV16,
+ * CI4/8, IA4/8/16, I4/8) to and from 8 bits per channel pixels, the way they
+ * go into PNGs:
+ *
+ *   RGBA, YUV  4 channels (R, G, B, A)
+ *   IA         2 channels (I, A)
+ *   I          1 channel
+ *   CI         1 channel, the palette index
+ *
+ * Narrow channels are widened by bit replication and narrowed by keeping the
+ * top bits, so decode then encode gives back the same texels, except for
+ * YUV16, whose RGB conversion is lossy. Texel data is optionally swizzled the
+ * way TMEM stores it: odd rows have the 32-bit halves of every 64-bit word
+ * swapped (for 32-bit texels, the 64-bit halves of every 128 bits).
+ *
+ * texcodec.py has a numpy port of this file that must give identical results,
+ * so keep the two in sync.
+ *
+ * Build: cc -O3 -shared -fPIC -o libtexcodec.so texcodec.c (texcodec.py does this itself, into build/tools/)
+ * Define TEXCODEC_NO_SIMD to build without the SSE2 paths.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) && !defined(TEXCODEC_NO_SIMD)
+#define TEXCODEC_SSE2
+#include <emmintrin.h>
+#endif
+
+enum { FMT_RGBA, FMT_YUV, FMT_CI, FMT_IA, FMT_I };
+enum { SIZ_4b, SIZ_8b, SIZ_16b, SIZ_32b };
+
+#define TEXCODEC_EINVAL (-1)
+#define TEXCODEC_ENOMEM (-2)
+
+/* Channels per decoded pixel, or -1 if the RDP has no such format */
+int texcodec_planes(int fmt, int siz) {
+    switch (fmt) {
+        case FMT_RGBA:
+            return (siz == SIZ_16b || siz == SIZ_32b) ? 4 : -1;
+        case FMT_YUV:
+            return siz == SIZ_16b ? 4 : -1;
+        case FMT_CI:
+            return (siz == SIZ_4b || siz == SIZ_8b) ? 1 : -1;
+        case FMT_IA:
+            return (siz >= SIZ_4b && siz <= SIZ_16b) ? 2 : -1;
+        case FMT_I:
+            return (siz == SIZ_4b || siz == SIZ_8b) ? 1 : -1;
+    }
+    return -1;
+}
+
+static int row_bytes(int siz, int width) {
+    return (width << siz) / 2;
+}
+
+/* Bytes of texel data for a width x height texture, or -1 */
+int texcodec_size(int fmt, int siz, int width, int height) {
+    if (texcodec_planes(fmt, siz) < 0 || width < 0 || height < 0) {
+        return TEXCODEC_EINVAL;
+    }
+    if ((siz == SIZ_4b && (width & 1)) || (fmt == FMT_YUV && (width & 1))) {
+        return TEXCODEC_EINVAL;
+    }
+    return row_bytes(siz, width) * height;
+}
+
+static void swap_row(int siz, uint8_t *row, int nbytes) {
+    int unit = siz == SIZ_32b ? 16 : 8;
+    int half = unit / 2;
+    uint8_t tmp[8];
+    int x;
+
+    for (x = 0; x + unit <= nbytes; x += unit) {
+        memcpy(tmp, row + x, half);
+        memmove(row + x, row + x + half, half);
+        memcpy(row + x + half, tmp, half);
+    }
+}
+
+/* Apply (or undo, it's its own inverse) the TMEM odd row swizzle in place */
+int texcodec_swizzle(int siz, uint8_t *data, int width, int height) {
+    int stride = row_bytes(siz, width);
+    int y;
+
+    if (siz < SIZ_4b || siz > SIZ_32b || (siz == SIZ_4b && (width & 1))) {
+        return TEXCODEC_EINVAL;
+    }
+    for (y = 1; y < height; y += 2) {
+        swap_row(siz, data + y * stride, stride);
+    }
+    return 0;
+}
+
+static inline uint8_t widen5(unsigned v) {
+    return (v << 3) | (v >> 2);
+}
+
+static inline uint8_t widen3(unsigned v) {
+    return (v << 5) | (v << 2) | (v >> 1);
+}
+
+static inline uint8_t clamp8(int v) {
+    return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+/* Fixed point BT.601, with biases that keep every shifted value positive */
+static inline void yuv_to_rgb(int y, int u, int v, uint8_t *out) {
+    out[0] = clamp8(y + ((359 * (v - 128) + 65536 + 128) >> 8) - 256);
+    out[1] = clamp8(y + ((-88 * (u - 128) - 183 * (v - 128) + 65536 + 128) >> 8) - 256);
+    out[2] = clamp8(y + ((454 * (u - 128) + 65536 + 128) >> 8) - 256);
+    out[3] = 0xFF;
+}
+
+static void decode_rgba16(const uint8_t *src, int n, uint8_t *dst) {
+    int i = 0;
+
+#if defined(TEXCODEC_SSE2)
+    const __m128i m5 = _mm_set1_epi16(0x1F);
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i lo8 = _mm_set1_epi16(0xFF);
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i * 2));
+        __m128i r, g, b, a, rg, ba;
+
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        r = _mm_and_si128(_mm_srli_epi16(v, 11), m5);
+        g = _mm_and_si128(_mm_srli_epi16(v, 6), m5);
+        b = _mm_and_si128(_mm_srli_epi16(v, 1), m5);
+        a = _mm_and_si128(_mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(v, one)), lo8);
+        r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+        g = _mm_or_si128(_mm_slli_epi16(g, 3), _mm_srli_epi16(g, 2));
+        b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+        rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+        ba = _mm_or_si128(b, _mm_slli_epi16(a, 8));
+        _mm_storeu_si128((__m128i *)(dst + i * 4), _mm_unpacklo_epi16(rg, ba));
+        _mm_storeu_si128((__m128i *)(dst + i * 4 + 16), _mm_unpackhi_epi16(rg, ba));
+    }
+#endif
+    for (; i < n; i++) {
+        unsigned v = (src[i * 2] << 8) | src[i * 2 + 1];
+        dst[i * 4 + 0] = widen5((v >> 11) & 0x1F);
+        dst[i * 4 + 1] = widen5((v >> 6) & 0x1F);
+        dst[i * 4 + 2] = widen5((v >> 1) & 0x1F);
+        dst[i * 4 + 3] = (v & 1) ? 0xFF : 0;
+    }
+}
+
+static void encode_rgba16(const uint8_t *src, int n, uint8_t *dst) {
+    int i = 0;
+
+#if defined(TEXCODEC_SSE2)
+    const __m128i lo8 = _mm_set1_epi32(0xFF);
+    const __m128i bias = _mm_set1_epi32(0x8000);
+    const __m128i bias16 = _mm_set1_epi16((short)0x8000);
+    for (; i + 8 <= n; i += 8) {
+        __m128i t[2];
+        __m128i v;
+        int k;
+
+        for (k = 0; k < 2; k++) {
+            __m128i p = _mm_loadu_si128((const __m128i *)(src + i * 4 + k * 16));
+            __m128i r = _mm_and_si128(p, lo8);
+            __m128i g = _mm_and_si128(_mm_srli_epi32(p, 8), lo8);
+            __m128i b = _mm_and_si128(_mm_srli_epi32(p, 16), lo8);
+            __m128i a = _mm_srli_epi32(p, 24);
+
+            t[k] = _mm_or_si128(
+                _mm_or_si128(_mm_slli_epi32(_mm_srli_epi32(r, 3), 11), _mm_slli_epi32(_mm_srli_epi32(g, 3), 6)),
+                _mm_or_si128(_mm_slli_epi32(_mm_srli_epi32(b, 3), 1), _mm_srli_epi32(a, 7)));
+            /* packs saturates signed values, so pack around 0 */
+            t[k] = _mm_sub_epi32(t[k], bias);
+        }
+        v = _mm_xor_si128(_mm_packs_epi32(t[0], t[1]), bias16);
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128((__m128i *)(dst + i * 2), v);
+    }
+#endif
+    for (; i < n; i++) {
+        const uint8_t *p = src + i * 4;
+        unsigned v = ((p[0] >> 3) << 11) | ((p[1] >> 3) << 6) | ((p[2] >> 3) << 1) | (p[3] >> 7);
+        dst[i * 2] = v >> 8;
+        dst[i * 2 + 1] = v;
+    }
+}
+
+/* 4-bit texels, high nibble first, each nibble widened to 8 bits */
+static void decode_nibbles(const uint8_t *src, int n, uint8_t *dst, int widen) {
+    int i = 0;
+
+#if defined(TEXCODEC_SSE2)
+    const __m128i m4 = _mm_set1_epi8(0x0F);
+    for (; i + 32 <= n; i += 32) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i / 2));
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), m4);
+        __m128i lo = _mm_and_si128(v, m4);
+        if (widen) {
+            hi = _mm_or_si128(hi, _mm_slli_epi16(hi, 4));
+            lo = _mm_or_si128(lo, _mm_slli_epi16(lo, 4));
+        }
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *)(dst + i + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+#endif
+    for (; i < n; i++) {
+        unsigned v = (src[i / 2] >> ((i & 1) ? 0 : 4)) & 0xF;
+        dst[i] = widen ? v * 0x11 : v;
+    }
+}
+
+static void encode_nibbles(const uint8_t *src, int n, uint8_t *dst, int narrow) {
+    int i;
+
+    for (i = 0; i + 1 < n; i += 2) {
+        unsigned hi = narrow ? src[i] >> 4 : src[i] & 0xF;
+        unsigned lo = narrow ? src[i + 1] >> 4 : src[i + 1] & 0xF;
+        dst[i / 2] = (hi << 4) | lo;
+    }
+}
+
+static void decode_row(int fmt, int siz, const uint8_t *src, int width, uint8_t *dst) {
+    int x;
+
+    switch ((fmt << 2) | siz) {
+        case (FMT_RGBA << 2) | SIZ_16b:
+            decode_rgba16(src, width, dst);
+            break;
+        case (FMT_RGBA << 2) | SIZ_32b:
+            memcpy(dst, src, width * 4);
+            break;
+        case (FMT_YUV << 2) | SIZ_16b:
+            /* U Y0 V Y1 for each pair of texels */
+            for (x = 0; x + 1 < width; x += 2) {
+                const uint8_t *p = src + x * 2;
+                yuv_to_rgb(p[1], p[0], p[2], dst + x * 4);
+                yuv_to_rgb(p[3], p[0], p[2], dst + x * 4 + 4);
+            }
+            break;
+        case (FMT_CI << 2) | SIZ_4b:
+            decode_nibbles(src, width, dst, 0);
+            break;
+        case (FMT_I << 2) | SIZ_4b:
+            decode_nibbles(src, width, dst, 1);
+            break;
+        case (FMT_CI << 2) | SIZ_8b:
+        case (FMT_I << 2) | SIZ_8b:
+            memcpy(dst, src, width);
+            break;
+        case (FMT_IA << 2) | SIZ_4b:
+            for (x = 0; x < width; x++) {
+                unsigned v = (src[x / 2] >> ((x & 1) ? 0 : 4)) & 0xF;
+                dst[x * 2] = widen3(v >> 1);
+                dst[x * 2 + 1] = (v & 1) ? 0xFF : 0;
+            }
+            break;
+        case (FMT_IA << 2) | SIZ_8b:
+            for (x = 0; x < width; x++) {
+                dst[x * 2] = (src[x] >> 4) * 0x11;
+                dst[x * 2 + 1] = (src[x] & 0xF) * 0x11;
+            }
+            break;
+        case (FMT_IA << 2) | SIZ_16b:
+            memcpy(dst, src, width * 2);
+            break;
+    }
+}
+
+static void encode_row(int fmt, int siz, const uint8_t *src, int width, uint8_t *dst) {
+    int x;
+
+    switch ((fmt << 2) | siz) {
+        case (FMT_RGBA << 2) | SIZ_16b:
+            encode_rgba16(src, width, dst);
+            break;
+        case (FMT_RGBA << 2) | SIZ_32b:
+            memcpy(dst, src, width * 4);
+            break;
+        case (FMT_YUV << 2) | SIZ_16b:
+            for (x = 0; x + 1 < width; x += 2) {
+                const uint8_t *p = src + x * 4;
+                int r = p[0] + p[4], g = p[1] + p[5], b = p[2] + p[6];
+                int su = -43 * r - 85 * g + 128 * b;
+                int sv = 128 * r - 107 * g - 21 * b;
+
+                dst[x * 2 + 0] = clamp8(((su + 131072 + 256) >> 9) - 256 + 128);
+                dst[x * 2 + 1] = (77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8;
+                dst[x * 2 + 2] = clamp8(((sv + 131072 + 256) >> 9) - 256 + 128);
+                dst[x * 2 + 3] = (77 * p[4] + 150 * p[5] + 29 * p[6] + 128) >> 8;
+            }
+            break;
+        case (FMT_CI << 2) | SIZ_4b:
+            encode_nibbles(src, width, dst, 0);
+            break;
+        case (FMT_I << 2) | SIZ_4b:
+            encode_nibbles(src, width, dst, 1);
+            break;
+        case (FMT_CI << 2) | SIZ_8b:
+        case (FMT_I << 2) | SIZ_8b:
+            memcpy(dst, src, width);
+            break;
+        case (FMT_IA << 2) | SIZ_4b:
+            for (x = 0; x + 1 < width; x += 2) {
+                unsigned hi = ((src[x * 2] >> 5) << 1) | (src[x * 2 + 1] >> 7);
+                unsigned lo = ((src[x * 2 + 2] >> 5) << 1) | (src[x * 2 + 3] >> 7);
+                dst[x / 2] = (hi << 4) | lo;
+            }
+            break;
+        case (FMT_IA << 2) | SIZ_8b:
+            for (x = 0; x < width; x++) {
+                dst[x] = (src[x * 2] & 0xF0) | (src[x * 2 + 1] >> 4);
+            }
+            break;
+        case (FMT_IA << 2) | SIZ_16b:
+            memcpy(dst, src, width * 2);
+            break;
+    }
+}
+
+/*
+ * Decode width x height texels from src into dst, which must hold
+ * width * height * planes bytes. If swizzled, src is in TMEM order.
+ * Returns 0, or a negative error.
+ */
+int texcodec_decode(int fmt, int siz, const uint8_t *src, int width, int height, int swizzled, uint8_t *dst) {
+    int planes = texcodec_planes(fmt, siz);
+    int stride = row_bytes(siz, width);
+    uint8_t *row = NULL;
+    int y;
+
+    if (texcodec_size(fmt, siz, width, height) < 0) {
+        return TEXCODEC_EINVAL;
+    }
+    if (swizzled && height > 1) {
+        row = malloc(stride > 0 ? stride : 1);
+        if (row == NULL) {
+            return TEXCODEC_ENOMEM;
+        }
+    }
+    for (y = 0; y < height; y++) {
+        const uint8_t *in = src + y * stride;
+        if (swizzled && (y & 1)) {
+            memcpy(row, in, stride);
+            swap_row(siz, row, stride);
+            in = row;
+        }
+        decode_row(fmt, siz, in, width, dst + y * width * planes);
+    }
+    free(row);
+    return 0;
+}
+
+/* The inverse of texcodec_decode. dst must hold texcodec_size() bytes. */
+int texcodec_encode(int fmt, int siz, const uint8_t *src, int width, int height, int swizzled, uint8_t *dst) {
+    int planes = texcodec_planes(fmt, siz);
+    int stride = row_bytes(siz, width);
+    int y;
+
+    if (texcodec_size(fmt, siz, width, height) < 0) {
+        return TEXCODEC_EINVAL;
+    }
+    for (y = 0; y < height; y++) {
+        encode_row(fmt, siz, src + y * width * planes, width, dst + y * stride);
+        if (swizzled && (y & 1)) {
+            swap_row(siz, dst + y * stride, stride);
+        }
+    }
+    return 0;
+}
+
+/* TLUT entries (RGBA16 or IA16) to n RGBA pixels */
+int texcodec_decode_tlut(int fmt, const uint8_t *src, int n, uint8_t *dst) {
+    int i;
+
+    if (fmt == FMT_RGBA) {
+        decode_rgba16(src, n, dst);
+    } else if (fmt == FMT_IA) {
+        for (i = 0; i < n; i++) {
+            dst[i * 4 + 0] = dst[i * 4 + 1] = dst[i * 4 + 2] = src[i * 2];
+            dst[i * 4 + 3] = src[i * 2 + 1];
+        }
+    } else {
+        return TEXCODEC_EINVAL;
+    }
+    return 0;
+}
+
+/* n RGBA pixels to TLUT entries. IA16 TLUTs take their intensity from red. */
+int texcodec_encode_tlut(int fmt, const uint8_t *src, int n, uint8_t *dst) {
+    int i;
+
+    if (fmt == FMT_RGBA) {
+        encode_rgba16(src, n, dst);
+    } else if (fmt == FMT_IA) {
+        for (i = 0; i < n; i++) {
+            dst[i * 2] = src[i * 4];
+            dst[i * 2 + 1] = src[i * 4 + 3];
+        }
+    } else {
+        return TEXCODEC_EINVAL;
+    }
+    return 0;
+}
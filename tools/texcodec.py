@@ -0,0 +1,410 @@
+#!/usr/bin/env python3
+# Encoding and decoding of N64 texture formats.
+#
+# Every format the RDP can sample (RGBA16/32, YUV16, CI4/8, IA4/8/16, I4/8)
+# converts to and from numpy arrays of 8-bit channels, optionally undoing or
+# applying the TMEM odd row swizzle, plus RGBA16/IA16 TLUTs. See texcodec.c
+# for the pixel layouts. The work is done by texcodec.c, compiled on first use
+# by native_lib.py (set CC to pick the compiler). If that isn't possible, a
+# numpy port gives identical results, just slower.
+#
+#   texcodec.py bench [--rom pokemonsnap.z64]   decode/encode throughput
+
+import ctypes
+from pathlib import Path
+from typing import Dict, List, Optional, Tuple
+
+import numpy as np
+
+import native_lib
+
+SOURCE_PATH = Path(__file__).with_suffix(".c")
+
+# IM_FMT and IM_SIZ, as in gbi.h
+FMT_RGBA, FMT_YUV, FMT_CI, FMT_IA, FMT_I = range(5)
+SIZ_4b, SIZ_8b, SIZ_16b, SIZ_32b = range(4)
+
+FORMAT_NAMES: Dict[Tuple[int, int], str] = {
+    (FMT_RGBA, SIZ_16b): "RGBA16",
+    (FMT_RGBA, SIZ_32b): "RGBA32",
+    (FMT_YUV, SIZ_16b): "YUV16",
+    (FMT_CI, SIZ_4b): "CI4",
+    (FMT_CI, SIZ_8b): "CI8",
+    (FMT_IA, SIZ_4b): "IA4",
+    (FMT_IA, SIZ_8b): "IA8",
+    (FMT_IA, SIZ_16b): "IA16",
+    (FMT_I, SIZ_4b): "I4",
+    (FMT_I, SIZ_8b): "I8",
+}
+
+PLANES = {FMT_RGBA: 4, FMT_YUV: 4, FMT_CI: 1, FMT_IA: 2, FMT_I: 1}
+
+
+class TexCodecError(ValueError):
+    pass
+
+
+_i, _p = ctypes.c_int, ctypes.c_void_p
+SIGNATURES: native_lib.Signatures = {
+    "texcodec_planes": (_i, [_i, _i]),
+    "texcodec_size": (_i, [_i, _i, _i, _i]),
+    "texcodec_swizzle": (_i, [_i, _p, _i, _i]),
+    "texcodec_decode": (_i, [_i, _i, _p, _i, _i, _i, _p]),
+    "texcodec_encode": (_i, [_i, _i, _p, _i, _i, _i, _p]),
+    "texcodec_decode_tlut": (_i, [_i, _p, _i, _p]),
+    "texcodec_encode_tlut": (_i, [_i, _p, _i, _p]),
+}
+
+
+def native() -> Optional[ctypes.CDLL]:
+    """The compiled library, or None if it can't be built or loaded (or
+    TEXCODEC_NATIVE=0 is set)."""
+    return native_lib.load(SOURCE_PATH, "texcodec", ["-O3"], "TEXCODEC_NATIVE", SIGNATURES)
+
+
+def planes(fmt: int, siz: int) -> int:
+    if (fmt, siz) not in FORMAT_NAMES:
+        raise TexCodecError(f"no such texture format: fmt {fmt}, siz {siz}")
+    return PLANES[fmt]
+
+
+def size(fmt: int, siz: int, width: int, height: int) -> int:
+    """Bytes of texel data for a width x height texture."""
+    planes(fmt, siz)
+    if width % 2 and (siz == SIZ_4b or fmt == FMT_YUV):
+        raise TexCodecError(f"{FORMAT_NAMES[(fmt, siz)]} textures need an even width, not {width}")
+    return (width << siz) // 2 * height
+
+
+def _ptr(buf) -> Optional[int]:
+    return ctypes.addressof(ctypes.c_char.from_buffer(buf)) if len(buf) else None
+
+
+# numpy port of texcodec.c
+
+
+def _swizzle_np(siz: int, rows: np.ndarray) -> np.ndarray:
+    """rows is (height, row bytes). Returns a swizzled copy."""
+    rows = rows.copy()
+    unit = 16 if siz == SIZ_32b else 8
+    full = rows.shape[1] - rows.shape[1] % unit
+    odd = rows[1::2, :full]
+    halves = odd.reshape(odd.shape[0], full // unit, 2, unit // 2)
+    rows[1::2, :full] = halves[:, :, ::-1].reshape(odd.shape)
+    return rows
+
+
+def _widen5(v):
+    return (v << 3) | (v >> 2)
+
+
+def _widen3(v):
+    return (v << 5) | (v << 2) | (v >> 1)
+
+
+def _nibbles(rows: np.ndarray) -> np.ndarray:
+    out = np.empty((rows.shape[0], rows.shape[1] * 2), dtype=np.uint8)
+    out[:, 0::2] = rows >> 4
+    out[:, 1::2] = rows & 0xF
+    return out
+
+
+def _yuv_to_rgb(y, u, v) -> np.ndarray:
+    y, u, v = (c.astype(np.int32) for c in (y, u, v))
+    out = np.empty(y.shape + (4,), dtype=np.uint8)
+    out[..., 0] = np.clip(y + ((359 * (v - 128) + 65536 + 128) >> 8) - 256, 0, 255)
+    out[..., 1] = np.clip(y + ((-88 * (u - 128) - 183 * (v - 128) + 65536 + 128) >> 8) - 256, 0, 255)
+    out[..., 2] = np.clip(y + ((454 * (u - 128) + 65536 + 128) >> 8) - 256, 0, 255)
+    out[..., 3] = 0xFF
+    return out
+
+
+def _rgba16_to_rgba(v: np.ndarray) -> np.ndarray:
+    v = v.astype(np.uint16)
+    out = np.empty(v.shape + (4,), dtype=np.uint8)
+    out[..., 0] = _widen5((v >> 11) & 0x1F)
+    out[..., 1] = _widen5((v >> 6) & 0x1F)
+    out[..., 2] = _widen5((v >> 1) & 0x1F)
+    out[..., 3] = (v & 1) * 0xFF
+    return out
+
+
+def _rgba_to_rgba16(p: np.ndarray) -> np.ndarray:
+    p = p.astype(np.uint16)
+    return (p[..., 0] >> 3) << 11 | (p[..., 1] >> 3) << 6 | (p[..., 2] >> 3) << 1 | p[..., 3] >> 7
+
+
+def _decode_np(fmt: int, siz: int, rows: np.ndarray, width: int) -> np.ndarray:
+    height = rows.shape[0]
+    name = FORMAT_NAMES[(fmt, siz)]
+    if name == "RGBA16":
+        return _rgba16_to_rgba(rows.view(">u2"))
+    if name in ("RGBA32", "IA16", "CI8", "I8"):
+        return rows.reshape(height, width, PLANES[fmt])
+    if name == "YUV16":
+        q = rows.reshape(height, width // 2, 4)
+        out = np.empty((height, width, 4), dtype=np.uint8)
+        out[:, 0::2] = _yuv_to_rgb(q[..., 1], q[..., 0], q[..., 2])
+        out[:, 1::2] = _yuv_to_rgb(q[..., 3], q[..., 0], q[..., 2])
+        return out
+    if name == "CI4":
+        return _nibbles(rows)[..., None]
+    if name == "I4":
+        return (_nibbles(rows) * 0x11)[..., None]
+    if name == "IA4":
+        n = _nibbles(rows)
+        return np.stack((_widen3(n >> 1), (n & 1) * 0xFF), axis=-1).astype(np.uint8)
+    if name == "IA8":
+        return np.stack(((rows >> 4) * 0x11, (rows & 0xF) * 0x11), axis=-1).astype(np.uint8)
+    raise AssertionError(name)
+
+
+def _encode_np(fmt: int, siz: int, pixels: np.ndarray) -> np.ndarray:
+    height, width = pixels.shape[:2]
+    name = FORMAT_NAMES[(fmt, siz)]
+    if name == "RGBA16":
+        return _rgba_to_rgba16(pixels).astype(">u2").view(np.uint8).reshape(height, width * 2)
+    if name in ("RGBA32", "IA16", "CI8", "I8"):
+        return pixels.reshape(height, width * PLANES[fmt])
+    if name == "YUV16":
+        p = pixels.astype(np.int32)
+        r = p[:, 0::2, 0] + p[:, 1::2, 0]
+        g = p[:, 0::2, 1] + p[:, 1::2, 1]
+        b = p[:, 0::2, 2] + p[:, 1::2, 2]
+        out = np.empty((height, width // 2, 4), dtype=np.uint8)
+        out[..., 0] = np.clip(((-43 * r - 85 * g + 128 * b + 131072 + 256) >> 9) - 256 + 128, 0, 255)
+        out[..., 1] = (77 * p[:, 0::2, 0] + 150 * p[:, 0::2, 1] + 29 * p[:, 0::2, 2] + 128) >> 8
+        out[..., 2] = np.clip(((128 * r - 107 * g - 21 * b + 131072 + 256) >> 9) - 256 + 128, 0, 255)
+        out[..., 3] = (77 * p[:, 1::2, 0] + 150 * p[:, 1::2, 1] + 29 * p[:, 1::2, 2] + 128) >> 8
+        return out.reshape(height, width * 2)
+    if name in ("CI4", "I4"):
+        n = pixels[..., 0] if name == "CI4" else pixels[..., 0] >> 4
+        n = n & 0xF
+        return ((n[:, 0::2] << 4) | n[:, 1::2]).astype(np.uint8)
+    if name == "IA4":
+        n = ((pixels[..., 0] >> 5) << 1) | (pixels[..., 1] >> 7)
+        return ((n[:, 0::2] << 4) | n[:, 1::2]).astype(np.uint8)
+    if name == "IA8":
+        return ((pixels[..., 0] & 0xF0) | (pixels[..., 1] >> 4)).astype(np.uint8)
+    raise AssertionError(name)
+
+
+# Public interface
+
+
+def swizzle(siz: int, data: bytes, width: int, height: int) -> bytes:
+    """Apply (or undo, it's its own inverse) the TMEM odd row swizzle."""
+    if siz == SIZ_4b and width % 2:
+        raise TexCodecError(f"4-bit textures need an even width, not {width}")
+    stride = (width << siz) // 2
+    buf = bytearray(data[: stride * height])
+    lib = native()
+    if lib is not None:
+        lib.texcodec_swizzle(siz, _ptr(buf), width, height)
+        return bytes(buf)
+    rows = np.frombuffer(bytes(buf), dtype=np.uint8).reshape(height, stride)
+    return _swizzle_np(siz, rows).tobytes()
+
+
+def decode(fmt: int, siz: int, data: bytes, width: int, height: int, swizzled: bool = False, use_native: bool = True) -> np.ndarray:
+    """Texel data to a (height, width, planes) uint8 array."""
+    nbytes = size(fmt, siz, width, height)
+    if len(data) < nbytes:
+        raise TexCodecError(f"{FORMAT_NAMES[(fmt, siz)]} {width}x{height} needs 0x{nbytes:X} bytes, got 0x{len(data):X}")
+    nplanes = PLANES[fmt]
+    lib = native() if use_native else None
+    if lib is not None:
+        src = bytearray(data[:nbytes])
+        out = bytearray(width * height * nplanes)
+        if lib.texcodec_decode(fmt, siz, _ptr(src), width, height, int(swizzled), _ptr(out)) < 0:
+            raise TexCodecError(f"can't decode {FORMAT_NAMES[(fmt, siz)]} {width}x{height}")
+        return np.frombuffer(out, dtype=np.uint8).reshape(height, width, nplanes)
+    rows = np.frombuffer(bytes(data[:nbytes]), dtype=np.uint8).reshape(height, (width << siz) // 2)
+    if swizzled:
+        rows = _swizzle_np(siz, rows)
+    return _decode_np(fmt, siz, rows, width).reshape(height, width, nplanes)
+
+
+def encode(fmt: int, siz: int, pixels: np.ndarray, swizzled: bool = False, use_native: bool = True) -> bytes:
+    """A (height, width, planes) uint8 array to texel data."""
+    height, width = pixels.shape[:2]
+    nbytes = size(fmt, siz, width, height)
+    if pixels.shape[2:] != (PLANES[fmt],):
+        raise TexCodecError(f"{FORMAT_NAMES[(fmt, siz)]} needs {PLANES[fmt]} channel(s), got an array of shape {pixels.shape}")
+    pixels = np.ascontiguousarray(pixels, dtype=np.uint8)
+    lib = native() if use_native else None
+    if lib is not None:
+        src = bytearray(pixels.tobytes())
+        out = bytearray(nbytes)
+        if lib.texcodec_encode(fmt, siz, _ptr(src), width, height, int(swizzled), _ptr(out)) < 0:
+            raise TexCodecError(f"can't encode {FORMAT_NAMES[(fmt, siz)]} {width}x{height}")
+        return bytes(out)
+    rows = _encode_np(fmt, siz, pixels)
+    if swizzled:
+        rows = _swizzle_np(siz, rows)
+    return rows.tobytes()
+
+
+def decode_tlut(data: bytes, count: int, fmt: int = FMT_RGBA, use_native: bool = True) -> np.ndarray:
+    """RGBA16 or IA16 TLUT entries to a (count, 4) RGBA array."""
+    if fmt not in (FMT_RGBA, FMT_IA):
+        raise TexCodecError(f"TLUTs are RGBA16 or IA16, not fmt {fmt}")
+    if len(data) < count * 2:
+        raise TexCodecError(f"a TLUT of {count} entries needs 0x{count * 2:X} bytes, got 0x{len(data):X}")
+    lib = native() if use_native else None
+    if lib is not None:
+        src = bytearray(data[: count * 2])
+        out = bytearray(count * 4)
+        lib.texcodec_decode_tlut(fmt, _ptr(src), count, _ptr(out))
+        return np.frombuffer(out, dtype=np.uint8).reshape(count, 4)
+    raw = np.frombuffer(bytes(data[: count * 2]), dtype=np.uint8).reshape(count, 2)
+    if fmt == FMT_RGBA:
+        return _rgba16_to_rgba(raw.view(">u2")[:, 0])
+    return np.stack((raw[:, 0], raw[:, 0], raw[:, 0], raw[:, 1]), axis=-1)
+
+
+def encode_tlut(colors: np.ndarray, fmt: int = FMT_RGBA, use_native: bool = True) -> bytes:
+    """A (count, 4) RGBA array to RGBA16 or IA16 TLUT entries. IA16 takes its
+    intensity from red."""
+    if fmt not in (FMT_RGBA, FMT_IA):
+        raise TexCodecError(f"TLUTs are RGBA16 or IA16, not fmt {fmt}")
+    colors = np.ascontiguousarray(colors, dtype=np.uint8).reshape(-1, 4)
+    lib = native() if use_native else None
+    if lib is not None:
+        src = bytearray(colors.tobytes())
+        out = bytearray(len(colors) * 2)
+        lib.texcodec_encode_tlut(fmt, _ptr(src), len(colors), _ptr(out))
+        return bytes(out)
+    if fmt == FMT_RGBA:
+        return _rgba_to_rgba16(colors).astype(">u2").tobytes()
+    return np.stack((colors[:, 0], colors[:, 3]), axis=-1).tobytes()
+
+
+# Benchmark
+
+
+def rom_textures(rom_path: Path, yaml_path: Path) -> List[Tuple[int, int, bytes, int, int]]:
+    """(fmt, siz, data, width, height) of every sprite bitmap in the ROM,
+    found through the snap_sprite segments in splat.yaml."""
+    import re
+
+    from sprite_format import BITMAP_SIZE, SPRITE_SIZE, Bitmap, Sprite
+
+    rom = rom_path.read_bytes()
+    # Top-level segments give the VRAM of the subsegments under them
+    entry_re = re.compile(r"^\s+- \[(0x[0-9A-Fa-f]+),\s*(\w+)")
+    top_re = re.compile(r"^  - ")
+    starts: List[Tuple[int, str, int]] = []
+    base_rom = base_vram = None
+    with open(yaml_path) as f:
+        for line in f:
+            if top_re.match(line):
+                base_rom = base_vram = None
+            m = re.match(r"^    (start|vram): (0x[0-9A-Fa-f]+)", line)
+            if m:
+                if m.group(1) == "start":
+                    base_rom = int(m.group(2), 16)
+                else:
+                    base_vram = int(m.group(2), 16)
+            m = entry_re.match(line)
+            if m:
+                rom_start = int(m.group(1), 16)
+                vram = base_vram + rom_start - base_rom if base_rom is not None and base_vram is not None else -1
+                starts.append((rom_start, m.group(2), vram))
+
+    from io import BytesIO
+
+    textures = []
+    for (start, kind, vram), (end, _, _) in zip(starts, starts[1:]):
+        if kind != "snap_sprite" or vram < 0:
+            continue
+        data = rom[start:end]
+        sprite = Sprite()
+        sprite.unpack(BytesIO(data[-SPRITE_SIZE:]))
+        if (int(sprite.bmfmt), int(sprite.bmsiz)) not in FORMAT_NAMES:
+            continue
+        for i in range(sprite.nbitmaps):
+            offset = sprite.bitmap - vram + i * BITMAP_SIZE
+            bitmap = Bitmap()
+            bitmap.unpack(BytesIO(data[offset : offset + BITMAP_SIZE]))
+            try:
+                nbytes = size(sprite.bmfmt, sprite.bmsiz, bitmap.width_img, bitmap.actual_height)
+            except TexCodecError:
+                continue
+            buf = bitmap.buf - vram
+            if 0 <= buf and buf + nbytes <= len(data):
+                textures.append((int(sprite.bmfmt), int(sprite.bmsiz), data[buf : buf + nbytes], bitmap.width_img, bitmap.actual_height))
+    return textures
+
+
+def synthetic_textures(width: int = 256, height: int = 256) -> List[Tuple[int, int, bytes, int, int]]:
+    rng = np.random.default_rng(0)
+    return [
+        (fmt, siz, rng.integers(0, 256, size(fmt, siz, width, height), dtype=np.uint8).tobytes(), width, height)
+        for fmt, siz in FORMAT_NAMES
+    ]
+
+
+def bench(textures: List[Tuple[int, int, bytes, int, int]], repeat: int):
+    import time
+
+    backends = []
+    if native() is not None:
+        backends.append(("native", True))
+    backends.append(("numpy", False))
+
+    by_format: Dict[str, List[Tuple[int, int, bytes, int, int]]] = {}
+    for tex in textures:
+        by_format.setdefault(FORMAT_NAMES[(tex[0], tex[1])], []).append(tex)
+
+    print(f"{len(textures)} textures, best of {repeat}, MB of texel data per second")
+    print(f"{'format':8}{'count':>7}" + "".join(f"{name + ' dec':>14}{name + ' enc':>14}" for name, _ in backends))
+    for name, texs in sorted(by_format.items()):
+        total = sum(len(t[2]) for t in texs)
+        row = f"{name:8}{len(texs):7}"
+        decoded = {}
+        for backend, use_native in backends:
+            for op in ("dec", "enc"):
+                best = None
+                for _ in range(repeat):
+                    start = time.perf_counter()
+                    if op == "dec":
+                        out = [decode(f, s, d, w, h, True, use_native) for f, s, d, w, h in texs]
+                    else:
+                        for (f, s, d, w, h), px in zip(texs, decoded[backend]):
+                            encode(f, s, px, True, use_native)
+                    elapsed = time.perf_counter() - start
+                    best = elapsed if best is None else min(best, elapsed)
+                if op == "dec":
+                    decoded[backend] = out
+                row += f"{total / best / 1e6:14.1f}"
+        if len(backends) > 1:
+            for a, b in zip(decoded["native"], decoded["numpy"]):
+                assert np.array_equal(a, b), name
+        print(row)
+
+
+def main():
+    import argparse
+
+    parser = argparse.ArgumentParser(description="N64 texture codec")
+    sub = parser.add_subparsers(dest="command", required=True)
+    p = sub.add_parser("bench", help="time decoding and encoding")
+    p.add_argument("--rom", type=Path, default=Path("pokemonsnap.z64"), help="ROM to take sprite textures from (default: %(default)s)")
+    p.add_argument("--yaml", type=Path, default=Path("splat.yaml"))
+    p.add_argument("--synthetic", action="store_true", help="use random 256x256 textures of every format instead")
+    p.add_argument("--repeat", type=int, default=3)
+    args = parser.parse_args()
+
+    if args.command == "bench":
+        if args.synthetic or not args.rom.exists():
+            if not args.synthetic:
+                print(f"{args.rom} not found, using synthetic textures")
+            textures = synthetic_textures()
+        else:
+            textures = rom_textures(args.rom, args.yaml)
+        bench(textures, args.repeat)
+
+
+if __name__ == "__main__":
+    main()
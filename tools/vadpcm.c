@@ -0,0 +1,147 @@
+/*
+ * VADPCM decoder, used by tools/vadpcm.py.
+ *
+ * VADPCM is the ADPCM flavour of the N64 audio library's AL_ADPCM_WAVE
+ * wavetables. Samples come in frames of 9 bytes: a header byte holding a
+ * scale exponent (high nibble) and a predictor index (low nibble), then 16
+ * signed 4-bit residuals. Each predictor in the wavetable's ALADPCMBook is an
+ * order x 8 block of s16 coefficients (fixed point, 11 fractional bits) that
+ * predicts 8 samples at a time from the previous `order` samples. Expanding
+ * every predictor into an 8 x (order + 8) matrix the way the SDK's tools do
+ * makes each group of 8 outputs one matrix-vector product, rounded down.
+ *
+ * Decoded samples are clamped to 16 bits, as the RSP microcode does.
+ *
+ * vadpcm.py has a Python port of this file that must give identical results,
+ * so keep the two in sync.
+ *
+ * Build: cc -O3 -shared -fPIC -o libvadpcm.so vadpcm.c (vadpcm.py does this itself, into build/tools/)
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define VADPCM_FRAME_BYTES 9
+#define VADPCM_FRAME_SAMPLES 16
+#define VADPCM_MAX_ORDER 8
+#define VADPCM_MAX_PREDICTORS 16
+
+#define VADPCM_EINVAL (-1)
+#define VADPCM_ENOMEM (-2)
+
+static int16_t clamp16(int64_t v) {
+    if (v > INT16_MAX) {
+        return INT16_MAX;
+    }
+    if (v < INT16_MIN) {
+        return INT16_MIN;
+    }
+    return (int16_t) v;
+}
+
+/*
+ * book holds npredictors * order * 8 coefficients, predictor by predictor and
+ * within one, order rows of 8. table gets npredictors * 8 * (order + 8).
+ */
+static void expand_book(const int16_t* book, int order, int npredictors, int32_t* table) {
+    int width = order + 8;
+
+    for (int p = 0; p < npredictors; p++) {
+        int32_t* t = table + p * 8 * width;
+
+        for (int j = 0; j < order; j++) {
+            for (int k = 0; k < 8; k++) {
+                t[k * width + j] = book[(p * order + j) * 8 + k];
+            }
+        }
+        t[0 * width + order] = 2048;
+        for (int k = 1; k < 8; k++) {
+            t[k * width + order] = t[(k - 1) * width + order - 1];
+        }
+        for (int k = 1; k < 8; k++) {
+            for (int j = 0; j < k; j++) {
+                t[j * width + k + order] = 0;
+            }
+            for (int j = k; j < 8; j++) {
+                t[j * width + k + order] = t[(j - k) * width + order];
+            }
+        }
+    }
+}
+
+/* sum(row * in) / 2048, rounded down */
+static int64_t inner_product(const int32_t* row, const int32_t* in, int n) {
+    int64_t acc = 0;
+
+    for (int i = 0; i < n; i++) {
+        acc += (int64_t) row[i] * in[i];
+    }
+    return acc >= 0 ? acc / 2048 : -((-acc + 2047) / 2048);
+}
+
+/*
+ * Decode the whole frames in src[0..len) into dst, which must have room for
+ * len / 9 * 16 samples. Decoding starts from silence (the wavetable's loop
+ * state only matters when playback jumps back to the loop start). Returns the
+ * number of samples written, or a negative error.
+ */
+int vadpcm_decode(const uint8_t* src, int len, const int16_t* book, int order, int npredictors, int16_t* dst) {
+    int32_t* table;
+    int32_t in[VADPCM_MAX_ORDER + 8];
+    int width = order + 8;
+    int nframes = len / VADPCM_FRAME_BYTES;
+    int16_t* prev = NULL;
+
+    if (len < 0 || order < 1 || order > VADPCM_MAX_ORDER || npredictors < 1 ||
+        npredictors > VADPCM_MAX_PREDICTORS) {
+        return VADPCM_EINVAL;
+    }
+    table = malloc(sizeof(int32_t) * npredictors * 8 * width);
+    if (table == NULL) {
+        return VADPCM_ENOMEM;
+    }
+    expand_book(book, order, npredictors, table);
+
+    for (int f = 0; f < nframes; f++) {
+        const uint8_t* frame = src + f * VADPCM_FRAME_BYTES;
+        int scale = 1 << (frame[0] >> 4);
+        int predictor = frame[0] & 0xF;
+        int16_t* out = dst + f * VADPCM_FRAME_SAMPLES;
+        int32_t residuals[VADPCM_FRAME_SAMPLES];
+
+        if (predictor >= npredictors) {
+            free(table);
+            return VADPCM_EINVAL;
+        }
+        for (int i = 0; i < 8; i++) {
+            int hi = frame[1 + i] >> 4;
+            int lo = frame[1 + i] & 0xF;
+
+            residuals[i * 2] = (hi >= 8 ? hi - 16 : hi) * scale;
+            residuals[i * 2 + 1] = (lo >= 8 ? lo - 16 : lo) * scale;
+        }
+
+        for (int group = 0; group < 2; group++) {
+            const int32_t* t = table + predictor * 8 * width;
+
+            /* The last `order` samples before this group */
+            for (int i = 0; i < order; i++) {
+                if (group == 1) {
+                    in[i] = out[8 - order + i];
+                } else {
+                    in[i] = prev != NULL ? prev[VADPCM_FRAME_SAMPLES - order + i] : 0;
+                }
+            }
+            for (int i = 0; i < 8; i++) {
+                in[order + i] = residuals[group * 8 + i];
+            }
+            for (int i = 0; i < 8; i++) {
+                out[group * 8 + i] = clamp16(inner_product(t + i * width, in, width));
+            }
+        }
+        prev = out;
+    }
+
+    free(table);
+    return nframes * VADPCM_FRAME_SAMPLES;
+}
@@ -0,0 +1,129 @@
+# Decoding of VADPCM, the ADPCM format of AL_ADPCM_WAVE wavetables.
+#
+# decode() turns a wavetable's frames into 16-bit PCM, given its ALADPCMBook.
+# See vadpcm.c for the format. The work is done by vadpcm.c, compiled on first
+# use by native_lib.py (set CC to pick the compiler). If that isn't possible,
+# a Python port gives identical results, just slower.
+
+import ctypes
+from pathlib import Path
+from typing import List, Optional
+
+import numpy as np
+
+import native_lib
+
+SOURCE_PATH = Path(__file__).with_suffix(".c")
+
+FRAME_BYTES = 9
+FRAME_SAMPLES = 16
+MAX_ORDER = 8
+MAX_PREDICTORS = 16
+
+
+class VadpcmError(ValueError):
+    pass
+
+
+SIGNATURES: native_lib.Signatures = {
+    "vadpcm_decode": (ctypes.c_int, [ctypes.c_void_p, ctypes.c_int, ctypes.c_void_p, ctypes.c_int, ctypes.c_int, ctypes.c_void_p]),
+}
+
+
+def native() -> Optional[ctypes.CDLL]:
+    """The compiled library, or None if it can't be built or loaded (or
+    VADPCM_NATIVE=0 is set)."""
+    return native_lib.load(SOURCE_PATH, "vadpcm", ["-O3"], "VADPCM_NATIVE", SIGNATURES)
+
+
+def _check_book(book: np.ndarray, order: int, npredictors: int):
+    if not 1 <= order <= MAX_ORDER or not 1 <= npredictors <= MAX_PREDICTORS:
+        raise VadpcmError(f"unsupported codebook: order {order}, {npredictors} predictors")
+    if book.size != order * npredictors * 8:
+        raise VadpcmError(f"a codebook of order {order} with {npredictors} predictors has {order * npredictors * 8} coefficients, got {book.size}")
+
+
+def _expand_book(book: np.ndarray, order: int, npredictors: int) -> np.ndarray:
+    """The (npredictors, 8, order + 8) matrices of vadpcm.c's expand_book."""
+    width = order + 8
+    table = np.zeros((npredictors, 8, width), dtype=np.int64)
+    coefs = book.astype(np.int64).reshape(npredictors, order, 8)
+    for p in range(npredictors):
+        t = table[p]
+        t[:, :order] = coefs[p].T
+        t[0, order] = 2048
+        for k in range(1, 8):
+            t[k, order] = t[k - 1, order - 1]
+        for k in range(1, 8):
+            t[k:, k + order] = t[: 8 - k, order]
+    return table
+
+
+def _decode_py(data: bytes, book: np.ndarray, order: int, npredictors: int) -> np.ndarray:
+    table = _expand_book(book, order, npredictors)
+    nframes = len(data) // FRAME_BYTES
+    frames = np.frombuffer(bytes(data[: nframes * FRAME_BYTES]), dtype=np.uint8).reshape(nframes, FRAME_BYTES)
+    scales = (1 << (frames[:, 0] >> 4).astype(np.int64))[:, None]
+    predictors = frames[:, 0] & 0xF
+    if nframes and predictors.max() >= npredictors:
+        raise VadpcmError(f"frame uses predictor {predictors.max()}, the codebook has {npredictors}")
+    nibbles = np.empty((nframes, FRAME_SAMPLES), dtype=np.int64)
+    nibbles[:, 0::2] = frames[:, 1:] >> 4
+    nibbles[:, 1::2] = frames[:, 1:] & 0xF
+    residuals = np.where(nibbles >= 8, nibbles - 16, nibbles) * scales
+
+    out = np.zeros((nframes, FRAME_SAMPLES), dtype=np.int64)
+    history = np.zeros(order, dtype=np.int64)
+    vec = np.empty(order + 8, dtype=np.int64)
+    for f in range(nframes):
+        t = table[predictors[f]]
+        for group in range(2):
+            vec[:order] = history
+            vec[order:] = residuals[f, group * 8 : group * 8 + 8]
+            # Floor division rounds down like vadpcm.c's inner_product
+            samples = np.clip((t @ vec) // 2048, -0x8000, 0x7FFF)
+            out[f, group * 8 : group * 8 + 8] = samples
+            history = samples[8 - order :]
+    return out.reshape(-1).astype(np.int16)
+
+
+def decode(data: bytes, book, order: int, npredictors: int, use_native: bool = True) -> np.ndarray:
+    """The int16 samples of the whole VADPCM frames in data. book is the
+    ALADPCMBook's coefficients, npredictors * order * 8 of them."""
+    book = np.ascontiguousarray(book, dtype=np.int16).reshape(-1)
+    _check_book(book, order, npredictors)
+    lib = native() if use_native else None
+    if lib is None:
+        return _decode_py(data, book, order, npredictors)
+
+    src = bytearray(data)
+    coefs = bytearray(book.tobytes())
+    out = np.empty(len(src) // FRAME_BYTES * FRAME_SAMPLES, dtype=np.int16)
+    n = lib.vadpcm_decode(
+        ctypes.addressof(ctypes.c_char.from_buffer(src)) if src else None,
+        len(src),
+        ctypes.addressof(ctypes.c_char.from_buffer(coefs)),
+        order,
+        npredictors,
+        out.ctypes.data if out.size else None,
+    )
+    if n < 0:
+        raise VadpcmError(f"frame uses a predictor past the codebook's {npredictors}")
+    return out
+
+
+def pcm_wav(samples: np.ndarray, sample_rate: int, loop: Optional[List[int]] = None) -> bytes:
+    """A mono 16-bit WAV file of samples. loop is [start, end] in samples,
+    written as a `smpl` chunk so that editors show the loop."""
+    import struct
+
+    data = samples.astype("<i2").tobytes()
+    chunks = [b"fmt " + struct.pack("<IHHIIHH", 16, 1, 1, sample_rate, sample_rate * 2, 2, 16)]
+    chunks.append(b"data" + struct.pack("<I", len(data)) + data + b"\0" * (len(data) & 1))
+    if loop is not None:
+        start, end = loop
+        smpl = struct.pack("<9I", 0, 0, 1_000_000_000 // max(sample_rate, 1), 60, 0, 0, 0, 1, 0)
+        smpl += struct.pack("<6I", 0, 0, start, end - 1, 0, 0)
+        chunks.append(b"smpl" + struct.pack("<I", len(smpl)) + smpl)
+    body = b"WAVE" + b"".join(chunks)
+    return b"RIFF" + struct.pack("<I", len(body)) + body
@@ -384,6 +384,23 @@ extern	void	guS2DInitBg(uObjBg *);
   extern void	guS2DEmuBgRect1Cyc(Gfx **, uObjBg *);
 #endif
 
+#ifdef	S2D_BGCACHE
+/* Background command cache counters (see guS2DEmuGetBgStats()) */
+typedef	struct	{
+  u32	draws;		/* guS2DEmuBgRect1Cyc() calls */
+  u32	hits;		/* calls that copied out cached commands */
+  u32	cmds;		/* commands emitted by all calls */
+  u32	cmdsMax;	/* most commands emitted by one call */
+} uObjBgStats;
+
+# ifdef	F3DEX_GBI_2
+#  define guS2DEmuGetBgStats	guS2D2EmuGetBgStats	/*Wrapper*/
+  extern void	guS2D2EmuGetBgStats(uObjBgStats *);
+# else
+  extern void	guS2DEmuGetBgStats(uObjBgStats *);
+# endif
+#endif
+
 #ifdef _LANGUAGE_C_PLUS_PLUS
 }
 #endif
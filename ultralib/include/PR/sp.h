@@ -154,6 +154,18 @@ typedef struct sprite Sprite;
 #define SP_FRACPOS		0x00000100
 #define SP_TEXSHUF		0x00000200
 #define SP_EXTERN		0x00000400
+#ifdef SP_DLCACHE
+#define SP_CACHED		0x00000800	/* reuse the last display list */
+
+/*
+ * Display list cache counters (see spCacheStats())
+ */
+typedef struct {
+	u32	hits;		/* spDraw() calls that reused a display list */
+	u32	misses;		/* cached sprites that had to be built */
+	u32	bytes_saved;	/* display list bytes not built again */
+} SpCacheStats;
+#endif
 
 /*
  * Function wrapper
@@ -165,6 +177,8 @@ typedef struct sprite Sprite;
 #define	spDraw			spX2Draw
 #define	spInit			spX2Init
 #define	spFinish		spX2Finish
+#define	spInvalidate		spX2Invalidate
+#define	spCacheStats		spX2CacheStats
 #elif	defined(F3DEX_GBI)
 #define	spMove			spXMove
 #define	spSetZ			spXSetZ
@@ -172,6 +186,8 @@ typedef struct sprite Sprite;
 #define	spDraw			spXDraw
 #define	spInit			spXInit
 #define	spFinish		spXFinish
+#define	spInvalidate		spXInvalidate
+#define	spCacheStats		spXCacheStats
 #endif
 
 /*
@@ -188,6 +204,10 @@ Gfx *spDraw (Sprite *sp);
 void spInit( Gfx **glistp );
 void spScissor( s32 xmin, s32 xmax, s32 ymin, s32 ymax );
 void spFinish( Gfx **glistp );
+#ifdef SP_DLCACHE
+void spInvalidate (Sprite *sp);
+void spCacheStats (SpCacheStats *stats);
+#endif
 
 #ifdef _LANGUAGE_C_PLUS_PLUS
 }
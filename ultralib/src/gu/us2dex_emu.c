@@ -9,6 +9,9 @@
 #define		F3DEX_GBI
 #include	<ultra64.h>
 #include	<PR/gs2dex.h>
+#ifdef	S2D_BGCACHE
+#include	<PR/os_libc.h>
+#endif
 
 #define	RSP_DEBUG
 
@@ -171,6 +174,108 @@ static	void	tmemLoad(Gfx **pkt, u32 *imagePtr,
   }
 }
 
+#ifdef	S2D_BGCACHE
+/*---------------------------------------------------------------------------*
+ * Background command cache
+ *
+ *	The commands for a background depend only on its uObjBg, the
+ *	scissor box and the bilerp flag; the texels are not read. So a
+ *	background drawn again with nothing changed gets the commands it got
+ *	last time copied out of the cache instead of being sliced again.
+ *	Entries live in one command pool; when the pool or the entry table
+ *	is full, the whole cache is dropped and refilled.
+ *---------------------------------------------------------------------------*/
+#ifndef	S2D_BGCACHE_SIZE
+#define	S2D_BGCACHE_SIZE	8	/* backgrounds */
+#endif
+#ifndef	S2D_BGCACHE_GFX
+#define	S2D_BGCACHE_GFX		1024	/* commands for all of them */
+#endif
+
+typedef	struct	{
+  uObjScaleBg_t	bg;		/* bg->s as drawn */
+  u16		scissor[4];	/* scissorX0, Y0, X1, Y1 */
+  u8		flagBilerp;
+  u16		len;		/* number of commands */
+  Gfx		*cmds;		/* in bgCacheGfx */
+} BgCacheEntry;
+
+static	BgCacheEntry	bgCache[S2D_BGCACHE_SIZE];
+static	Gfx		bgCacheGfx[S2D_BGCACHE_GFX];
+static	s16		bgCacheEntries;
+static	u16		bgCacheUsed;
+static	uObjBgStats	bgStats;
+
+static	void	bgRect1Cyc(Gfx **pkt, uObjBg *bg);
+
+void	guS2DEmuBgRect1Cyc(Gfx **pkt, uObjBg *bg)
+{
+  BgCacheEntry	*e;
+  Gfx	*start = *pkt;
+  u32	len;
+  s16	i;
+
+  bgStats.draws ++;
+  for (i = 0; i < bgCacheEntries; i ++){
+    e = &bgCache[i];
+    if (e->scissor[0] == scissorX0 && e->scissor[1] == scissorY0 &&
+	e->scissor[2] == scissorX1 && e->scissor[3] == scissorY1 &&
+	e->flagBilerp == flagBilerp &&
+	bcmp(&e->bg, &bg->s, sizeof(uObjScaleBg_t)) == 0){
+      bcopy(e->cmds, start, e->len * sizeof(Gfx));
+      *pkt = start + e->len;
+      len  = e->len;
+      bgStats.hits ++;
+      goto done;
+    }
+  }
+
+  bgRect1Cyc(pkt, bg);
+  len = *pkt - start;
+
+  /* Too big to keep at all */
+  if (len > S2D_BGCACHE_GFX) goto done;
+
+  if (bgCacheEntries == S2D_BGCACHE_SIZE ||
+      bgCacheUsed + len > S2D_BGCACHE_GFX){
+    bgCacheEntries = 0;
+    bgCacheUsed    = 0;
+  }
+  e = &bgCache[bgCacheEntries ++];
+  bcopy(&bg->s, &e->bg, sizeof(uObjScaleBg_t));
+  e->scissor[0] = scissorX0;
+  e->scissor[1] = scissorY0;
+  e->scissor[2] = scissorX1;
+  e->scissor[3] = scissorY1;
+  e->flagBilerp = flagBilerp;
+  e->len  = len;
+  e->cmds = &bgCacheGfx[bgCacheUsed];
+  bcopy(start, e->cmds, len * sizeof(Gfx));
+  bgCacheUsed += len;
+
+ done:
+  bgStats.cmds += len;
+  if (len > bgStats.cmdsMax) bgStats.cmdsMax = len;
+}
+
+/*---------------------------------------------------------------------------*
+ * Get background counters since the last call and clear them
+ *	(call once a frame for per-frame counts; cmds/draws is the average
+ *	number of commands per background)
+ *---------------------------------------------------------------------------*/
+void	guS2DEmuGetBgStats(uObjBgStats *stats)
+{
+  *stats = bgStats;
+  bgStats.draws   = 0;
+  bgStats.hits    = 0;
+  bgStats.cmds    = 0;
+  bgStats.cmdsMax = 0;
+}
+
+#undef	guS2DEmuBgRect1Cyc
+#define	guS2DEmuBgRect1Cyc	bgRect1Cyc
+#endif	/* S2D_BGCACHE */
+
 /*---------------------------------------------------------------------------*
  * Scalable BG serface draw process
  *---------------------------------------------------------------------------*/
@@ -21,6 +21,9 @@
 #include <assert.h>
 #include <sp.h>
 #include <PR/os_version.h>
+#ifdef SP_DLCACHE
+#include <PR/os_libc.h>
+#endif
 // TODO: this comes from a header
 #ident "$Revision: 1.17 $"
 
@@ -400,6 +403,81 @@ spInit( Gfx **glistp )
 }
 
 
+#ifdef SP_DLCACHE
+/*
+ * Display list cache
+ *
+ *   A sprite with SP_CACHED set keeps the display list spDraw() last built
+ *   for it, and spDraw() hands that back instead of building it again for
+ *   as long as nothing it was built from changes: the Sprite itself
+ *   (position, scale, colour, attributes, where in rsp_dl it goes, ...),
+ *   the attributes of the sprite drawn before it and the scissor box. The
+ *   fields are compared rather than marked dirty, so spMove(), spScale(),
+ *   spColor(), spSetAttribute(), spShow() and spHide() need no changes, and
+ *   writing the fields directly works as well.
+ *
+ *   What isn't compared is what the Sprite points to: after changing its
+ *   Bitmaps, texels or TLUT in place, call spInvalidate(). And a cached
+ *   sprite's rsp_dl must be its own, written by nothing but spDraw().
+ */
+#ifndef SP_DLCACHE_SIZE
+#define SP_DLCACHE_SIZE	32
+#endif
+
+typedef struct {
+    Sprite	*sp;		/* NULL if unused */
+    Sprite	key;		/* *sp as drawn, rsp_dl_next where it went */
+    u16		prev_attr;	/* sp_attr when it was drawn */
+    s32		scissor[4];	/* xmin, ymin, xmax, ymax */
+    Gfx		*dl_end;	/* rsp_dl_next after it was drawn */
+} SpCacheEntry;
+
+static SpCacheEntry sp_cache[SP_DLCACHE_SIZE];
+static int sp_cache_victim = 0;
+static SpCacheStats sp_cache_stats;
+
+static SpCacheEntry *
+cache_find (Sprite *s)
+{
+    int i;
+
+    for (i = 0; i < SP_DLCACHE_SIZE; i++) {
+	if (sp_cache[i].sp == s)
+	    return &sp_cache[i];
+    }
+    return NULL;
+}
+
+/*
+ * spInvalidate()
+ *
+ *   Makes the next spDraw() of a cached sprite build its display list.
+ */
+void
+spInvalidate (Sprite *sp)
+{
+    SpCacheEntry *e = cache_find(sp);
+
+    if (e != NULL)
+	e->sp = NULL;
+}
+
+/*
+ * spCacheStats()
+ *
+ *   Returns the cache counters since the last call and clears them, so
+ *   calling it once a frame gives them per frame.
+ */
+void
+spCacheStats (SpCacheStats *stats)
+{
+    *stats = sp_cache_stats;
+    sp_cache_stats.hits = 0;
+    sp_cache_stats.misses = 0;
+    sp_cache_stats.bytes_saved = 0;
+}
+#endif /* SP_DLCACHE */
+
 /*
  * spDraw()
  *
@@ -427,6 +505,9 @@ spDraw ( Sprite   *s )
     float	ftx, fty;
     s32		fs, ft;
     s32		ex, ey;
+#ifdef SP_DLCACHE
+    SpCacheEntry *e;
+#endif
 
 #ifdef rmDEBUG
     rmonPrintf("spDraw (Sprite 0x%08x )\n", s );
@@ -446,6 +527,42 @@ spDraw ( Sprite   *s )
     ogl = gl;
 #endif
 
+#ifdef SP_DLCACHE
+    e = cache_find(s);
+    if (s->attr & SP_CACHED) {
+	Sprite key;
+
+	key = *s;
+	key.rsp_dl_next = dl_start;
+	if (e != NULL && e->prev_attr == sp_attr &&
+	    e->scissor[0] == scissor_xmin && e->scissor[1] == scissor_ymin &&
+	    e->scissor[2] == scissor_xmax && e->scissor[3] == scissor_ymax &&
+	    bcmp(&e->key, &key, sizeof(Sprite)) == 0) {
+	    sp_cache_stats.hits++;
+	    sp_cache_stats.bytes_saved += (char *)e->dl_end - (char *)dl_start;
+	    sp_attr = s->attr;
+	    s->rsp_dl_next = e->dl_end;
+	    return( dl_start );
+	}
+
+	if (e == NULL) {
+	    e = &sp_cache[sp_cache_victim];
+	    sp_cache_victim = (sp_cache_victim + 1) % SP_DLCACHE_SIZE;
+	}
+	e->sp = NULL;		/* until it's built */
+	e->key = key;
+	e->prev_attr = sp_attr;
+	e->scissor[0] = scissor_xmin;
+	e->scissor[1] = scissor_ymin;
+	e->scissor[2] = scissor_xmax;
+	e->scissor[3] = scissor_ymax;
+	sp_cache_stats.misses++;
+    } else if (e != NULL) {
+	e->sp = NULL;		/* drawn uncached, so the old list may be gone */
+	e = NULL;
+    }
+#endif
+
     b  = s->bitmap;
     ex = 0;
     ey = 0;
@@ -730,6 +847,12 @@ spDraw ( Sprite   *s )
 #line 714
 #endif
     assert((gl - ogl) < s->ndisplist);
+#ifdef SP_DLCACHE
+    if (e != NULL) {
+	e->sp = s;
+	e->dl_end = gl;
+    }
+#endif
     s->rsp_dl_next   = gl;
     return(  dl_start );
 }
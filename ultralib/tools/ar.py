@@ -184,16 +184,18 @@ class Archive:
 
         i = 8
         while i < len(ar_data):
-            file_name =     ar_data[i:][ 0:][:16].decode("ASCII").strip()
-            file_time = int(ar_data[i:][16:][:12].decode("ASCII").strip())
-            file_uid  = int(ar_data[i:][28:][: 6].decode("ASCII").strip())
-            file_gid  = int(ar_data[i:][34:][: 6].decode("ASCII").strip())
-            file_mode = int(ar_data[i:][40:][: 8].decode("ASCII").strip(), 8)
-            file_size = int(ar_data[i:][48:][:10].decode("ASCII").strip())
-            end = ar_data[i:][58:][:2].decode("ASCII")
+            # Slice the header alone, not the whole rest of the archive
+            header = ar_data[i:i + 60]
+            file_name =     header[ 0:][:16].decode("ASCII").strip()
+            file_time = int(header[16:][:12].decode("ASCII").strip())
+            file_uid  = int(header[28:][: 6].decode("ASCII").strip())
+            file_gid  = int(header[34:][: 6].decode("ASCII").strip())
+            file_mode = int(header[40:][: 8].decode("ASCII").strip(), 8)
+            file_size = int(header[48:][:10].decode("ASCII").strip())
+            end = header[58:][:2].decode("ASCII")
             assert end == "`\n"
 
-            data = ar_data[i:][60:][:file_size]
+            data = ar_data[i + 60:i + 60 + file_size]
             assert len(data) == file_size
 
             if file_name == '/':
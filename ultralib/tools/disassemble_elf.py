@@ -301,12 +301,9 @@ def main():
     parser.add_argument("--strenc",     help="string encoding, default is EUC-JP for IDO and SJIS for GCC")
     args = parser.parse_args()
 
-    elf_file = None
-    with open(args.filepath, "rb") as elf:
-        elf_file = ElfFile(bytearray(elf.read()))
-
-    disassembler = MipsDisasm(elf_file)
-    disassembler.disassemble_all_sections()
+    with ElfFile.open(args.filepath) as elf_file:
+        disassembler = MipsDisasm(elf_file)
+        disassembler.disassemble_all_sections()
 
 if __name__ == '__main__':
     main()
@@ -48,18 +48,16 @@ def main():
     parser.add_argument("--fix-section-flags", help="", action="store_true")
     args = parser.parse_args()
 
-    elf = None
-    with open(args.compiled, "rb") as elf_file:
-        elf = ElfFile(bytearray(elf_file.read()))
-
     original = None
     with open(args.original, "rb") as original_file:
         original = bytearray(original_file.read())
 
-    if args.fix_section_flags:
-        fix_section_flags(elf)
+    # The compiled file is overwritten below, so it must be unmapped by then
+    with ElfFile.open(args.compiled) as elf:
+        if args.fix_section_flags:
+            fix_section_flags(elf)
 
-    result_data = fix_garbage(elf, original)
+        result_data = fix_garbage(elf, original)
 
     with open(args.compiled, "wb") as elf_file:
         elf_file.write(result_data)
@@ -1,17 +1,35 @@
 #!/usr/bin/env python3
-from typing import Any, Dict, Optional
+#
+#   Diff two objects with asm-differ, or every member of two archives:
+#
+#   libdiff.py target.o compiled.o [function]
+#   libdiff.py --archive base/L/libgultra_rom.a build/L/libgultra_rom/libgultra_rom.a [-j N] [--json summary.json]
+#
+#   Archive members are compared on a process pool. Identical members aren't disassembled at all, and the
+#   disassembly of every other member is cached by the hash of its contents, so the reference archive is only
+#   ever disassembled once.
+#
+from typing import Any, Dict, List, Optional, Tuple
+import argparse
+import hashlib
 import json
 import logging
+import multiprocessing
+import os
 import subprocess
 import tempfile
 import pathlib
 import sys
 import queue
+import time
 
 import asm_differ.diff as asm_differ
+from ar import Archive
 
 MAX_FUNC_SIZE_LINES = 5000
 
+DUMP_CACHE_DIR = pathlib.Path("build") / "libdiff_cache"
+
 class AsmDifferWrapper:
     @staticmethod
     def create_config(arch: asm_differ.ArchSettings) -> asm_differ.Config:
@@ -135,16 +153,164 @@ class AsmDifferWrapper:
         # Print the output
         display.run_sync()
 
-if __name__ == "__main__":
-    if len(sys.argv) != 3 and len(sys.argv) != 4:
-        print(f"Usage: {sys.argv[0]} [path/to/target.o] [path/to/compiled.o] [function name (optional)]")
-        sys.exit(0)
-    target = pathlib.Path(sys.argv[1])
-    compiled = pathlib.Path(sys.argv[2])
-    if len(sys.argv) == 4:
-        label = sys.argv[3]
+    @staticmethod
+    def score(basedump: str, mydump: str, config: asm_differ.Config) -> Tuple[int, int]:
+        """
+        The asm-differ score of mydump against basedump, 0 meaning they match, and the worst possible score
+        """
+        diff = asm_differ.do_diff(asm_differ.process(basedump, config), asm_differ.process(mydump, config), config)
+        return diff.score, diff.max_score
+
+class DumpCache:
+    """
+    Preprocessed objdump output of objects, by the hash of their contents and of the objdump that disassembled them
+    """
+    def __init__(self, path: Optional[pathlib.Path], objdump_id: str):
+        self.path = path
+        self.objdump_id = objdump_id
+
+    @staticmethod
+    def objdump_version() -> str:
+        try:
+            return subprocess.run(["mips-linux-gnu-objdump", "--version"], capture_output=True, universal_newlines=True).stdout.split("\n")[0]
+        except OSError:
+            return ""
+
+    def dump(self, data: bytes, config: asm_differ.Config) -> Optional[str]:
+        key = hashlib.sha1(self.objdump_id.encode() + b"\0" + data).hexdigest()
+        cached = self.path / key[:2] / f"{key}.s" if self.path is not None else None
+        if cached is not None and cached.exists():
+            return cached.read_text()
+
+        dump = AsmDifferWrapper.run_objdump(data, config, None)
+        if not dump:
+            return None
+        dump = asm_differ.preprocess_objdump_out(None, data, dump, config)
+
+        if cached is not None:
+            cached.parent.mkdir(parents=True, exist_ok=True)
+            fd, tmp_name = tempfile.mkstemp(dir=cached.parent, suffix=".tmp")
+            with os.fdopen(fd, "w") as f:
+                f.write(dump)
+            os.replace(tmp_name, cached)
+        return dump
+
+def archive_members(path: pathlib.Path) -> Dict[str, bytes]:
+    """
+    Archive members by name. Repeated names get a #n suffix from their second occurrence on.
+    """
+    members = {}
+    for file in Archive.from_image(path.read_bytes()).files:
+        name = file.name
+        n = 1
+        while name in members:
+            n += 1
+            name = f"{file.name}#{n}"
+        members[name] = bytes(file.data)
+    return members
+
+def compare_member(name: str, target: Optional[bytes], compiled: Optional[bytes], cache: DumpCache) -> Dict[str, Any]:
+    result = {"name": name}
+    if target is None:
+        result["status"] = "extra"
+    elif compiled is None:
+        result["status"] = "missing"
+    elif target == compiled:
+        result["status"] = "match"
     else:
-        label = None
-    target_bytes = target.read_bytes()
-    compiled_bytes = compiled.read_bytes()
-    AsmDifferWrapper.diff(target_bytes, compiled_bytes, label)
+        config = AsmDifferWrapper.create_config(asm_differ.get_arch("mips"))
+        basedump = cache.dump(target, config)
+        mydump = cache.dump(compiled, config)
+        if basedump is None or mydump is None:
+            result["status"] = "error"
+        else:
+            score, max_score = AsmDifferWrapper.score(basedump, mydump, config)
+            # Same code, but the bytes differ elsewhere (data, relocations, debug info, ...)
+            result["status"] = "asm_match" if score == 0 else "nonmatching"
+            result["score"] = score
+            result["max_score"] = max_score
+    return result
+
+def diff_archives(target: pathlib.Path, compiled: pathlib.Path, jobs: int, cache_dir: Optional[pathlib.Path]) -> Dict[str, Any]:
+    start = time.perf_counter()
+    target_members = archive_members(target)
+    compiled_members = archive_members(compiled)
+    cache = DumpCache(cache_dir, DumpCache.objdump_version())
+
+    names = list(target_members) + [name for name in compiled_members if name not in target_members]
+    work = [(name, target_members.get(name), compiled_members.get(name), cache) for name in names]
+
+    # Identical members need no disassembly, so only the rest go to the pool
+    results = {}
+    todo = []
+    for args in work:
+        if args[1] is not None and args[1] == args[2]:
+            results[args[0]] = compare_member(*args)
+        else:
+            todo.append(args)
+    if jobs > 1 and len(todo) > 1:
+        with multiprocessing.Pool(min(jobs, len(todo))) as pool:
+            for result in pool.starmap(compare_member, todo, chunksize=1):
+                results[result["name"]] = result
+    else:
+        for args in todo:
+            result = compare_member(*args)
+            results[result["name"]] = result
+
+    members = [results[name] for name in names]
+    counts = {}
+    for member in members:
+        counts[member["status"]] = counts.get(member["status"], 0) + 1
+    return {
+        "target": str(target),
+        "compiled": str(compiled),
+        "members": members,
+        "counts": counts,
+        "matched": counts.get("match", 0),
+        "code_matched": counts.get("match", 0) + counts.get("asm_match", 0),
+        "total": len(target_members),
+        "seconds": round(time.perf_counter() - start, 3),
+    }
+
+def print_summary(summary: Dict[str, Any]):
+    for member in summary["members"]:
+        if member["status"] in ("match", "asm_match"):
+            continue
+        score = f" {member['score']}/{member['max_score']}" if "score" in member else ""
+        print(f"{member['name']:24} {member['status']}{score}")
+    counts = ", ".join(f"{n} {status}" for status, n in sorted(summary["counts"].items()))
+    print(f"Matched: {summary['matched']}/{summary['total']}, code matched: {summary['code_matched']}/{summary['total']} ({counts}) in {summary['seconds']:.2f}s")
+
+def main():
+    parser = argparse.ArgumentParser(description="Diff objects, or every member of two archives, with asm-differ")
+    parser.add_argument("target", type=pathlib.Path, help="path to the target object, or archive with --archive")
+    parser.add_argument("compiled", type=pathlib.Path, help="path to the compiled object, or archive with --archive")
+    parser.add_argument("label", nargs="?", help="function name (optional)")
+    parser.add_argument("--archive", action="store_true", help="compare every member of two archives")
+    parser.add_argument("-j", "--jobs", type=int, default=os.cpu_count() or 1, help="worker processes for --archive")
+    parser.add_argument("--json", help="write a summary of --archive as JSON here (- for stdout)")
+    parser.add_argument("--cache", type=pathlib.Path, default=DUMP_CACHE_DIR, help=f"disassembly cache (default: {DUMP_CACHE_DIR})")
+    parser.add_argument("--no-cache", action="store_true", help="don't cache disassembly")
+    args = parser.parse_args()
+
+    if not args.archive:
+        target_bytes = args.target.read_bytes()
+        compiled_bytes = args.compiled.read_bytes()
+        AsmDifferWrapper.diff(target_bytes, compiled_bytes, args.label)
+        return
+
+    summary = diff_archives(args.target, args.compiled, args.jobs, None if args.no_cache else args.cache)
+    if args.json == "-":
+        json.dump(summary, sys.stdout, indent=1)
+        print()
+    else:
+        print_summary(summary)
+        if args.json is not None:
+            with open(args.json, "w") as f:
+                json.dump(summary, f, indent=1)
+                f.write("\n")
+    if summary["code_matched"] != summary["total"]:
+        sys.exit(1)
+
+if __name__ == "__main__":
+    main()
@@ -2,7 +2,12 @@
 #
 #   MIPS ELF library
 #
+#   Section headers are parsed up front, everything else when first used: section data, symbols,
+#   relocations and .mdebug are only read when a tool asks for them. ElfFile.open() memory-maps the
+#   file, so a tool that only looks at a few sections of a large ELF never reads the rest of it.
+#
 
+import mmap
 import struct
 
 from mdebug import EcoffHDRR, EcoffFdr, EcoffPdr, EcoffLiner, EcoffSymr
@@ -790,14 +795,36 @@ x28 x40         END
         assert not self.sh_flags & SHF_LINK_ORDER
         if self.sh_entsize != 0:
             assert self.sh_size % self.sh_entsize == 0
-        if self.sh_type in [SHT_NULL, SHT_NOBITS]:
-            self.data = None
-        else:
-            self.data = elf_file.data[self.sh_offset:][:self.sh_size]
+        self._data = None
         self.index = index
         self.relocated_by = []
         self.elf_file = elf_file
 
+    @property
+    def data(self):
+        # Copied out of the file the first time it's needed
+        if self._data is None and self.has_data():
+            self._data = self.elf_file.data[self.sh_offset:self.sh_offset + self.sh_size]
+        return self._data
+
+    @data.setter
+    def data(self, data):
+        self._data = data
+
+    def has_data(self):
+        return self.sh_type not in [SHT_NULL, SHT_NOBITS]
+
+    def view(self):
+        """
+        The section's contents as a memoryview into the file, without copying them. Views of a
+        memory-mapped file must be released before the ElfFile is closed.
+        """
+        if self._data is not None:
+            return memoryview(self._data)
+        if not self.has_data():
+            return None
+        return memoryview(self.elf_file.data)[self.sh_offset:self.sh_offset + self.sh_size]
+
     def late_init(self):
         self.late_init_done = True
 
@@ -822,12 +849,7 @@ x28 x40         END
         return relocs
 
     def get_sym(self, addr):
-        symtab = self.elf_file.symtab
-        symbols = []
-        for symbol in symtab.symbol_entries:
-            if symbol.st_value == addr and symbol.st_shndx == self.index and symbol.type != ST_SECTION:
-                symbols.append(symbol)
-        return symbols
+        return [s for s in self.elf_file.symtab.symbols_at(addr) if s.st_shndx == self.index]
 
     def is_rel(self):
         return self.sh_type == SHT_REL or self.sh_type == SHT_RELA
@@ -875,58 +897,73 @@ class SymtabSection(Section):
     def __init__(self, header, elf_file, index):
         super().__init__(header, elf_file, index)
         assert self.sh_entsize == 16
+        self._symbol_entries = None
+        self._by_name = None
+        self._by_value = None
 
     def late_init(self):
         if self.late_init_done:
             return
         super().late_init()
         self.strtab = self.elf_file.sections[self.sh_link]
-        self.symbol_entries = []
-        for i in range(0, self.sh_size, self.sh_entsize):
-            self.symbol_entries.append(Symbol(self.data[i:i+self.sh_entsize], self.elf_file))
+
+    @property
+    def symbol_entries(self):
+        if self._symbol_entries is None:
+            data = self.data
+            self._symbol_entries = [Symbol(data[i:i+self.sh_entsize], self.elf_file) for i in range(0, self.sh_size, self.sh_entsize)]
+        return self._symbol_entries
+
+    @symbol_entries.setter
+    def symbol_entries(self, entries):
+        self._symbol_entries = entries
+        self._by_name = None
+        self._by_value = None
+
+    def symbols_at(self, vaddr):
+        """
+        The non-section symbols at vaddr, in symbol table order
+        """
+        if self._by_value is None:
+            self._by_value = {}
+            for s in self.symbol_entries:
+                if s.type != ST_SECTION:
+                    self._by_value.setdefault(s.st_value, []).append(s)
+        return self._by_value.get(vaddr, [])
 
     def to_bin(self):
-        header, _ = super().to_bin()
+        header, data = super().to_bin()
+        if self._symbol_entries is None:
+            # Never parsed, so it can't have changed
+            return header, data
         data = bytearray()
         for sym in self.symbol_entries:
             data.extend(sym.to_bin())
         return header, data
 
     def find_symbol(self, name):
-        for s in self.symbol_entries:
-            if s.name == name:
-                return (s.st_shndx, s.st_value)
-        return None
+        if self._by_name is None:
+            self._by_name = {}
+            for s in self.symbol_entries:
+                self._by_name.setdefault(s.name, (s.st_shndx, s.st_value))
+        return self._by_name.get(name)
 
     def lookup_symbol(self, vaddr):
-        found = []
-        for s in self.symbol_entries:
-            if s.st_value == vaddr and s.type != ST_SECTION:
-                found.append(s)
+        found = list(self.symbols_at(vaddr))
         if len(found) != 0:
             found.sort(reverse=True, key=(lambda s : s.type))
             return found[0]
         return None
 
     def lookup_symbol_for_section(self, vaddr, shndx):
-        found = []
-        for s in self.symbol_entries:
-            if s.st_value == vaddr and s.type != ST_SECTION and s.st_shndx == shndx:
-                found.append(s)
+        found = [s for s in self.symbols_at(vaddr) if s.st_shndx == shndx]
         if len(found) != 0:
             found.sort(reverse=True, key=(lambda s : s.type))
             return found[0]
         return None
 
     def lookup_symbol_in_section(self, vaddr, section):
-        found = []
-        for s in self.symbol_entries:
-            if s.st_value == vaddr and s.type != ST_SECTION and s.st_shndx == section.index:
-                found.append(s)
-        if len(found) != 0:
-            found.sort(reverse=True, key=(lambda s : s.type))
-            return found[0]
-        return None
+        return self.lookup_symbol_for_section(vaddr, section.index)
 
     def find_symbol_in_section(self, name, section):
         pos = self.find_symbol(name)
@@ -956,8 +993,12 @@ class RelocationSection(Section):
     """
     Relocation Section
     """
+
     def __init__(self, header, data, index):
         super().__init__(header, data, index)
+        self._relocations = None
+        self._by_offset = None
+        self._by_word = None
 
     def late_init(self):
         if self.late_init_done:
@@ -965,28 +1006,43 @@ class RelocationSection(Section):
         super().late_init()
         self.rel_target = self.elf_file.sections[self.sh_info]
         self.rel_target.relocated_by.append(self)
-        self.relocations = []
-        for i in range(0, self.sh_size, self.sh_entsize):
-            self.relocations.append(Relocation(self.data[i:][:self.sh_entsize], self.elf_file, self.rel_target, self.sh_type))
+
+    @property
+    def relocations(self):
+        if self._relocations is None:
+            data = self.data
+            self._relocations = [Relocation(data[i:i+self.sh_entsize], self.elf_file, self.rel_target, self.sh_type) for i in range(0, self.sh_size, self.sh_entsize)]
+        return self._relocations
+
+    @relocations.setter
+    def relocations(self, relocations):
+        self._relocations = relocations
+        self._by_offset = None
+        self._by_word = None
 
     def to_bin(self):
-        header, _ = super().to_bin()
+        header, data = super().to_bin()
+        if self._relocations is None:
+            # Never parsed, so it can't have changed
+            return header, data
         data = bytearray()
         for rel in self.relocations:
             data.extend(rel.to_bin())
         return header, data
 
     def lookup_reloc(self, vaddr):
-        for r in self.relocations:
-            if r.r_offset - r.r_offset % 4 == vaddr:
-                return r
-        return None
+        if self._by_word is None:
+            self._by_word = {}
+            for r in self.relocations:
+                self._by_word.setdefault(r.r_offset - r.r_offset % 4, r)
+        return self._by_word.get(vaddr)
 
     def find_reloc(self, vaddr):
-        for r in self.relocations:
-            if r.r_offset == vaddr:
-                return r
-        return None
+        if self._by_offset is None:
+            self._by_offset = {}
+            for r in self.relocations:
+                self._by_offset.setdefault(r.r_offset, r)
+        return self._by_offset.get(vaddr)
 
     def lookup_jtbl_reloc(self, vaddr, symtab):
         for r in self.relocations:
@@ -1002,19 +1058,23 @@ class MdebugSection(Section):
     def __init__(self, header, elf_file, index):
         super().__init__(header, elf_file, index)
         self.parent = self.elf_file
-        self.hdrr = EcoffHDRR(self.data)
- 
-        self.fdrs = []
-        for i in range(self.hdrr.ifdMax):
-            fdr = EcoffFdr.from_binary(self, i)
-            self.fdrs.append(fdr)
-
-    def late_init(self):
-        if self.late_init_done:
-            return
-        super().late_init()
-        for fdr in self.fdrs:
-            fdr.late_init()
+        self._hdrr = None
+        self._fdrs = None
+
+    @property
+    def hdrr(self):
+        if self._hdrr is None:
+            self._hdrr = EcoffHDRR(self.elf_file.data[self.sh_offset:self.sh_offset + EcoffHDRR.SIZE])
+        return self._hdrr
+
+    @property
+    def fdrs(self):
+        if self._fdrs is None:
+            # Symbols may refer to other files' symbols, so every fdr exists before any is linked
+            self._fdrs = [EcoffFdr.from_binary(self, i) for i in range(self.hdrr.ifdMax)]
+            for fdr in self._fdrs:
+                fdr.late_init()
+        return self._fdrs
 
     def fdr_forname(self, filename):
         for fdr in self.fdrs:
@@ -1053,11 +1113,15 @@ class ReginfoSection(Section):
 # =====================================================================================================
 
 class ElfFile:
+    """
+    An ELF file in a bytes-like object: bytes, a bytearray or an mmap. Use ElfFile.open() to map a
+    file from disk, and close it (or use it as a context manager) when done with it.
+    """
     def __init__(self, data):
         def init_section(i):
             offset = self.elf_header.e_shoff + i * self.elf_header.e_shentsize
-            section_type = struct.unpack(">I", data[offset + 4:][:4])[0]
-            header_data = data[offset:][:self.elf_header.e_shentsize]
+            section_type = struct.unpack_from(">I", data, offset + 4)[0]
+            header_data = data[offset:offset + self.elf_header.e_shentsize]
 
             if section_type == SHT_REL or section_type == SHT_RELA:
                 return RelocationSection(header_data, self, i)
@@ -1073,6 +1137,7 @@ class ElfFile:
                 return Section(header_data, self, i)
 
         self.data = data
+        self._mapping = None
         self.elf_header = ElfHeader(data[0:52])
 
         num_progheaders = self.elf_header.e_phnum
@@ -1082,7 +1147,7 @@ class ElfFile:
         self.progheaders = []
         for i in range(num_progheaders):
             offset = self.elf_header.e_phoff + i * self.elf_header.e_phentsize
-            self.progheaders.append(ProgramHeader(data[offset:][:self.elf_header.e_phentsize], self.elf_header.e_ident[EI_CLASS]))
+            self.progheaders.append(ProgramHeader(data[offset:offset + self.elf_header.e_phentsize], self.elf_header.e_ident[EI_CLASS]))
 
         # Init sections
         self.sections = []
@@ -1110,6 +1175,47 @@ class ElfFile:
         for s in self.sections:
             s.late_init()
 
+    @staticmethod
+    def open(path):
+        """
+        Memory-maps the file at path read-only
+        """
+        with open(path, "rb") as f:
+            try:
+                mapping = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+            except ValueError: # empty file, which can't be mapped
+                mapping = None
+            elf_file = ElfFile(mapping if mapping is not None else f.read())
+        elf_file._mapping = mapping
+        return elf_file
+
+    def close(self):
+        """
+        Unmaps a file opened with ElfFile.open(). Anything already parsed out of it stays valid.
+        """
+        if self._mapping is not None:
+            self._mapping.close()
+            self._mapping = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def parse_all(self):
+        """
+        Parses everything that would otherwise be parsed on first use
+        """
+        for s in self.sections:
+            s.data
+            if isinstance(s, SymtabSection):
+                s.symbol_entries
+            elif isinstance(s, RelocationSection):
+                s.relocations
+            elif isinstance(s, MdebugSection):
+                s.fdrs
+
     def find_section_by_name(self, name):
         for s in self.sections:
             if s.name == name:
@@ -1129,8 +1235,7 @@ if __name__ == "__main__":
 
     elf_file = None
 
-    with open(sys.argv[1], "rb") as elf:
-        elf_file = ElfFile(bytearray(elf.read()))
+    elf_file = ElfFile.open(sys.argv[1])
 
     # Header Info Test
     print(elf_file.elf_header)
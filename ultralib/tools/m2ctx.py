@@ -1,14 +1,31 @@
 #!/usr/bin/env python3
+# Create context files for mips_to_c: every macro and declaration a C file
+# sees, minus gcc's own predefined macros.
+#
+# Both the predefined macro set and each file's context are cached under
+# build/m2ctx_cache. A context is reused as long as none of the files it was
+# preprocessed from (the C file and its whole include closure) has changed
+# size or mtime, so regenerating the context of an unchanged file doesn't run
+# gcc at all. Several files are handled in parallel:
+#
+#   m2ctx.py src/io/foo.c               writes ctx.c
+#   m2ctx.py src/io/*.c [-j N]          writes build/ctx/src/io/*.c
 
 import argparse
+import hashlib
+import json
 import os
-import sys
+import shutil
 import subprocess
+import sys
 import tempfile
+from concurrent.futures import ThreadPoolExecutor
+from typing import Dict, List, Optional, Tuple
 
 script_dir = os.path.dirname(os.path.realpath(__file__))
 root_dir = os.path.abspath(os.path.join(script_dir, ".."))
 src_dir = root_dir + "src/"
+cache_dir = os.path.join(root_dir, "build", "m2ctx_cache")
 
 # Project-specific
 CPP_FLAGS = [
@@ -28,48 +45,167 @@ CPP_FLAGS = [
     "-DM2CTX",
 ]
 
-def import_c_file(in_file) -> str:
-    in_file = os.path.relpath(in_file, root_dir)
-    cpp_command = ["gcc", "-E", "-P", "-dM", *CPP_FLAGS, in_file]
-    cpp_command2 = ["gcc", "-E", "-P", *CPP_FLAGS, in_file]
 
+def compiler_id() -> str:
+    """Identifies the gcc in use, so that a different one invalidates the cache."""
+    path = shutil.which("gcc") or "gcc"
+    try:
+        st = os.stat(path)
+        return f"{os.path.realpath(path)}:{st.st_size}:{st.st_mtime_ns}"
+    except OSError:
+        return path
+
+
+def cache_path(kind: str, key: str) -> str:
+    return os.path.join(cache_dir, kind, hashlib.sha1(key.encode()).hexdigest() + ".json")
+
+
+def read_cache(path: str) -> Optional[dict]:
+    try:
+        with open(path, encoding="utf-8") as f:
+            return json.load(f)
+    except (OSError, ValueError):
+        return None
+
+
+def write_cache(path: str, entry: dict):
+    os.makedirs(os.path.dirname(path), exist_ok=True)
+    fd, tmp_name = tempfile.mkstemp(dir=os.path.dirname(path), suffix=".tmp")
+    with os.fdopen(fd, "w", encoding="utf-8") as f:
+        json.dump(entry, f)
+    os.replace(tmp_name, path)
+
+
+def stock_macros(use_cache: bool = True) -> List[str]:
+    """gcc's predefined macros, one #define per line."""
+    path = cache_path("stock", compiler_id())
+    if use_cache:
+        entry = read_cache(path)
+        if entry is not None:
+            return entry["macros"]
     with tempfile.NamedTemporaryFile(suffix=".c") as tmp:
-        stock_macros = subprocess.check_output(["gcc", "-E", "-P", "-dM", tmp.name], cwd=root_dir, encoding="utf-8")
+        output = subprocess.check_output(["gcc", "-E", "-P", "-dM", tmp.name], cwd=root_dir, encoding="utf-8")
+    macros = output.strip().splitlines()
+    if use_cache:
+        write_cache(path, {"macros": macros})
+    return macros
+
 
-    out_text = ""
+def file_stamp(path: str) -> Optional[Tuple[int, int]]:
     try:
-        out_text += subprocess.check_output(cpp_command, cwd=root_dir, encoding="utf-8")
-        out_text += subprocess.check_output(cpp_command2, cwd=root_dir, encoding="utf-8")
-    except subprocess.CalledProcessError:
-        print(
-            "Failed to preprocess input file, when running command:\n"
-            + cpp_command,
-            file=sys.stderr,
-            )
-        sys.exit(1)
+        st = os.stat(os.path.join(root_dir, path))
+    except OSError:
+        return None
+    return (st.st_size, st.st_mtime_ns)
 
+
+def parse_depfile(text: str) -> List[str]:
+    """The prerequisites in a Makefile-style depfile written by gcc -MD."""
+    text = text.replace("\\\n", " ")
+    _, _, deps = text.partition(": ")
+    names = []
+    for name in deps.replace("\\ ", "\0").split():
+        names.append(name.replace("\0", " "))
+    return names
+
+
+def preprocess(in_file: str) -> Tuple[str, List[str]]:
+    """The macros and then the body of in_file, and every file they came
+    from. The two gcc runs happen at the same time."""
+    with tempfile.TemporaryDirectory() as tmp_dir:
+        depfile = os.path.join(tmp_dir, "ctx.d")
+        cpp_command = ["gcc", "-E", "-P", "-dM", "-MD", "-MF", depfile, *CPP_FLAGS, in_file]
+        cpp_command2 = ["gcc", "-E", "-P", *CPP_FLAGS, in_file]
+        procs = [
+            subprocess.Popen(cmd, cwd=root_dir, stdout=subprocess.PIPE, encoding="utf-8")
+            for cmd in (cpp_command, cpp_command2)
+        ]
+        outputs = [proc.communicate()[0] for proc in procs]
+        for cmd, proc in zip((cpp_command, cpp_command2), procs):
+            if proc.returncode != 0:
+                raise RuntimeError("Failed to preprocess input file, when running command:\n" + " ".join(cmd))
+        with open(depfile, encoding="utf-8") as f:
+            deps = parse_depfile(f.read())
+    return "".join(outputs), deps
+
+
+def import_c_file(in_file, use_cache: bool = True) -> str:
+    in_file = os.path.relpath(in_file, root_dir)
+    path = cache_path("ctx", "\0".join([compiler_id(), in_file, *CPP_FLAGS]))
+
+    if use_cache:
+        entry = read_cache(path)
+        if entry is not None and all(file_stamp(dep) == tuple(stamp) for dep, stamp in entry["deps"].items()):
+            return entry["output"]
+
+    out_text, deps = preprocess(in_file)
     if not out_text:
-        print("Output is empty - aborting")
-        sys.exit(1)
+        raise RuntimeError("Output is empty - aborting")
+
+    # One pass over the output instead of a replace per stock macro
+    stock = set(stock_macros(use_cache))
+    out_text = "".join(line for line in out_text.splitlines(keepends=True) if line.rstrip("\n") not in stock)
 
-    for line in stock_macros.strip().splitlines():
-        out_text = out_text.replace(line + "\n", "")
+    if use_cache:
+        stamps: Dict[str, Tuple[int, int]] = {}
+        for dep in [in_file] + deps:
+            stamp = file_stamp(dep)
+            if stamp is not None:
+                stamps[dep] = stamp
+        write_cache(path, {"deps": stamps, "output": out_text})
     return out_text
 
+
+def write_text(path: str, text: str):
+    os.makedirs(os.path.dirname(path) or ".", exist_ok=True)
+    with open(path, "w", encoding="UTF-8") as f:
+        f.write(text)
+
+
 def main():
-    parser = argparse.ArgumentParser(
-        description="""Create a context file which can be used for mips_to_c"""
+    parser = argparse.ArgumentParser(description="""Create a context file which can be used for mips_to_c""")
+    parser.add_argument(
+        "c_files",
+        nargs="+",
+        help="""File(s) from which to create context""",
     )
     parser.add_argument(
-        "c_file",
-        help="""File from which to create context""",
+        "--out-dir",
+        default=os.path.join(root_dir, "build", "ctx"),
+        help="""Where contexts of several files go, by their path in the repo (default: build/ctx)""",
     )
+    parser.add_argument("-j", "--jobs", type=int, default=os.cpu_count() or 1, help="""Files to preprocess at once""")
+    parser.add_argument("--no-cache", action="store_true", help="""Always run the preprocessor""")
     args = parser.parse_args()
+    use_cache = not args.no_cache
 
-    output = import_c_file(args.c_file)
+    if len(args.c_files) == 1:
+        try:
+            output = import_c_file(args.c_files[0], use_cache)
+        except (RuntimeError, OSError) as e:
+            print(e, file=sys.stderr)
+            sys.exit(1)
+        write_text(os.path.join(root_dir, "ctx.c"), output)
+        return
 
-    with open(os.path.join(root_dir, "ctx.c"), "w", encoding="UTF-8") as f:
-        f.write(output)
+    # The stock macros are needed by every file, so get them once up front
+    stock_macros(use_cache)
+    failed = False
+    with ThreadPoolExecutor(max(1, args.jobs)) as pool:
+        futures = [(c_file, pool.submit(import_c_file, c_file, use_cache)) for c_file in args.c_files]
+        for c_file, future in futures:
+            try:
+                output = future.result()
+            except (RuntimeError, OSError) as e:
+                print(f"{c_file}: {e}", file=sys.stderr)
+                failed = True
+                continue
+            name = os.path.relpath(os.path.abspath(c_file), root_dir)
+            if name.startswith(".."):
+                name = os.path.basename(c_file)
+            write_text(os.path.join(args.out_dir, name), output)
+    if failed:
+        sys.exit(1)
 
 
 if __name__ == "__main__":
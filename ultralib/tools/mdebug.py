@@ -646,7 +646,7 @@ class EcoffPdr:
         while len(self.lines) < self.size//4:
             # assert line_data < line_end , "Overflow in line numbers table"
 
-            liner = EcoffLiner(elf_data[line_data:])
+            liner = EcoffLiner(elf_data[line_data:line_data + 3])
             line_no += liner.delta
             # if line_no < self.lnLow or line_no > self.lnHigh:
             #     break
@@ -762,7 +762,7 @@ class EcoffFdr:
         for i in range(self.caux):
             i += self.iauxBase
             assert i < hdrr.iauxMax , "Out of bounds in Auxiliary Symbol Table"
-            aux = EcoffAux(self, elf_data[hdrr.cbAuxOffset+i*EcoffAux.SIZE:][:EcoffAux.SIZE], self.fBigEndian)
+            aux = EcoffAux(self, elf_data[hdrr.cbAuxOffset+i*EcoffAux.SIZE:hdrr.cbAuxOffset+(i+1)*EcoffAux.SIZE], self.fBigEndian)
             self.auxs.append(aux)
 
         # Symbols
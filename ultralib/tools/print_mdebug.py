@@ -18,6 +18,8 @@ import struct
 import collections
 import sys
 
+from libelf import ElfFile, SHT_MIPS_DEBUG
+
 OFFSET = 0 # TODO why are the offsets in the symbolic header off by some amount?
 
 indent_level = 0
@@ -73,19 +75,6 @@ def read_uint16_be(file_data, offset):
 def read_uint8_be(file_data, offset):
     return struct.unpack('>B', file_data[offset:offset+1])[0]
 
-def read_elf_header(file_data, offset):
-    Header = collections.namedtuple('ElfHeader',
-                                    '''e_magic e_class e_data e_version e_osabi e_abiversion e_pad
-                                       e_type e_machine e_version2 e_entry e_phoff e_shoff e_flags
-                                       e_ehsize e_phentsize e_phnum e_shentsize e_shnum e_shstrndx''')
-    return Header._make(struct.unpack('>I5B7s2H5I6H', file_data[offset:offset+52]))
-
-def read_elf_section_header(file_data, offset):
-    Header = collections.namedtuple('SectionHeader',
-                                    '''sh_name sh_type sh_flags sh_addr sh_offset sh_size sh_link
-                                       sh_info sh_addralign sh_entsize''')
-    return Header._make(struct.unpack('>10I', file_data[offset:offset+40]))
-
 def read_symbolic_header(file_data, offset):
     Header = collections.namedtuple('SymbolicHeader',
                                     '''magic vstamp ilineMax cbLine cbLineOffset idnMax cbDnOffset
@@ -146,15 +135,9 @@ def read_auxiliary_symbol(file_data, offset):
     return read_auxiliary_symbol.cache[offset]
 
 def read_string(file_data, offset):
-    current_offset = 0
-    current_string = b''
-    while True:
-        char = struct.unpack('c', file_data[offset+current_offset:offset+current_offset+1])[0]
-        if char == b'\0':
-            return current_string.decode('ascii')
-        else:
-            current_string += char
-        current_offset += 1
+    end = file_data.find(b'\0', offset)
+    assert end != -1
+    return file_data[offset:end].decode('ascii')
 
 def map_relative_file_descriptor(file_data, fd, symbolic_header, rfd_num):
     if fd.crfd == 0:
@@ -493,28 +476,21 @@ def main():
     filename = sys.argv[1]
 
     try:
-        with open(filename, 'rb') as f:
-            file_data = f.read()
+        elf = ElfFile.open(filename)
     except IOError:
         print('failed to read file ' + filename)
         return
 
-    elf_header = read_elf_header(file_data, 0)
-    section_headers = []
-    debug_index = 0xFFFFFFFF
-    #print('%r' % (elf_header,))
-    for i in range(elf_header.e_shnum):
-        section_headers.append(read_elf_section_header(file_data, elf_header.e_shoff + i*40))
-        #print('%r' % (section_headers[i],))
-        if section_headers[i].sh_type == 0x70000005:
-            debug_index = i
-
-    if debug_index != 0xFFFFFFFF:
-        symbolic_header = read_symbolic_header(file_data, section_headers[debug_index].sh_offset)
+    # Only the section headers are parsed, everything else is read straight from the mapped file
+    file_data = elf.data
+    debug_section = elf.find_section_by_type(SHT_MIPS_DEBUG)
+
+    if debug_section is not None:
+        symbolic_header = read_symbolic_header(file_data, debug_section.sh_offset)
         file_descriptors = []
         print('%r' % (symbolic_header,))
         # Set offset by assuming that there are no optimization symbols so cbOptOffset points to the start of the symbolic header
-        #OFFSET = symbolic_header.cbOptOffset - section_headers[debug_index].sh_offset
+        #OFFSET = symbolic_header.cbOptOffset - debug_section.sh_offset
         #print('Using OFFSET of %d' % OFFSET)
         #for sym_num in range(symbolic_header.isymMax):
             #sym = read_symbol(file_data, symbolic_header.cbSymOffset - OFFSET + sym_num*12)
@@ -585,5 +561,7 @@ def main():
             print('    pretty print:')
             print_symbols(file_data, fd, symbolic_header)
 
+    elf.close()
+
 
 main()
\ No newline at end of file